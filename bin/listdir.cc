@@ -8,8 +8,11 @@
 
 namespace {
 static
-void PrintName(const char* name, void* arg) {
-  std::cout << name << std::endl;
+void PrintEntry(const char* name, const info_t* info, void* arg) {
+  std::cout << (info->is_dir ? "d " : "- ")
+            << std::oct << info->mode << std::dec << " "
+            << info->uid << " " << info->gid << " "
+            << info->size << " " << name << std::endl;
 }
 }
 
@@ -22,7 +25,7 @@ int main(int argc, char* argv[]) {
   }
   cli_t* cli = NULL;
   if (idxfs_create_client(NULL, &cli) == 0) {
-    if (idxfs_readdir(cli, argv[1], PrintName, NULL) == 0) {
+    if (idxfs_listdir(cli, argv[1], PrintEntry, NULL) == 0) {
     }
   }
   return idxfs_destroy_client(cli);
@@ -23,6 +23,7 @@ FS_OPT=""                    # (A) Build IndexFS upon POSIX
 
 # MORE_OPT1="-DIDXFS_EXTRA_SCALE -DIDXFS_VIRTUAL_SERVERS"
 # MORE_OPT2="-DIDXFS_RPC_NOBLOCKING"
+# MORE_OPT2="-DIDXFS_RPC_THREADED"
 # MORE_OPT3="-DIDXFS_RPC_DEBUG"
 # MORE_OPT4="-DLEVELDB_VERSION_EDIT_DEBUG"
 OPT="$OPT $MORE_OPT1 $MORE_OPT2 $MORE_OPT3 $MORE_OPT4 -DIDXFS_ENABLE_COMPRESSION"
@@ -18,6 +18,7 @@ using ::indexfs::Logger;
 using ::indexfs::StatInfo;
 using ::indexfs::Status;
 using ::indexfs::Client;
+using ::indexfs::DirIterator;
 using ::indexfs::ClientFactory;
 using ::indexfs::LoadClientConfig;
 using ::indexfs::ParseCommandLineFlags;
@@ -89,6 +90,19 @@ int idxfs_dir_exists(cli_t* cli, const char* path) {
   return CheckErrors(__func__, s);
 }
 
+namespace {
+static
+void CopyInfo(const StatInfo& info, info_t* _return) {
+  _return->mode = info.mode;
+  _return->size = info.size;
+  _return->uid = info.uid;
+  _return->gid = info.gid;
+  _return->mtime = info.mtime;
+  _return->ctime = info.ctime;
+  _return->is_dir = S_ISDIR(info.mode);
+}
+}
+
 int idxfs_getinfo(cli_t* cli, const char* path, info_t* _return) {
   Status s;
   std::string p = path;
@@ -96,13 +110,7 @@ int idxfs_getinfo(cli_t* cli, const char* path, info_t* _return) {
   StatInfo info;
   s = client->Getattr(p, &info);
   if (s.ok()) {
-    _return->mode = info.mode;
-    _return->size = info.size;
-    _return->uid = info.uid;
-    _return->gid = info.gid;
-    _return->mtime = info.mtime;
-    _return->ctime = info.ctime;
-    _return->is_dir = S_ISDIR(info.mode);
+    CopyInfo(info, _return);
   }
   return CheckErrors(__func__, s);
 }
@@ -130,14 +138,44 @@ int idxfs_readdir(cli_t* cli, const char* path,
   Status s;
   std::string p = path;
   Client* client = (Client*) cli->rep;
-  std::vector<std::string> names;
-  s = client->ReadDir(p, &names);
-  if (s.ok() && handler != NULL) {
-    std::vector<std::string>::iterator it = names.begin();
-    for (; it != names.end(); ++it) {
-      (*handler)(it->c_str(), arg);
+  DirIterator* iter = NULL;
+  s = client->ScanDir(p, &iter);
+  if (s.ok()) {
+    std::string name;
+    for (; iter->Valid(); iter->Next()) {
+      if (handler != NULL) {
+        iter->RetrieveEntryName(&name);
+        (*handler)(name.c_str(), arg);
+      }
+    }
+    s = iter->status();
+  }
+  delete iter;
+  return CheckErrors(__func__, s);
+}
+
+int idxfs_listdir(cli_t* cli, const char* path,
+                  listdir_handler_t handler, void* arg) {
+  Status s;
+  std::string p = path;
+  Client* client = (Client*) cli->rep;
+  DirIterator* iter = NULL;
+  s = client->ScanDirPlus(p, &iter);
+  if (s.ok()) {
+    std::string name;
+    StatInfo info;
+    info_t _info;
+    for (; iter->Valid(); iter->Next()) {
+      if (handler != NULL) {
+        iter->RetrieveEntryName(&name);
+        iter->RetrieveEntryStat(&info);
+        CopyInfo(info, &_info);
+        (*handler)(name.c_str(), &_info, arg);
+      }
     }
+    s = iter->status();
   }
+  delete iter;
   return CheckErrors(__func__, s);
 }
 
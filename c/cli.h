@@ -60,6 +60,11 @@ extern int idxfs_dir_exists(cli_t* cli, const char* path);
 extern int idxfs_readdir(cli_t* cli, const char* path,
                          readdir_handler_t handler, void* arg);
 
+// List entries in a directory along with their attributes.
+//
+extern int idxfs_listdir(cli_t* cli, const char* path,
+                         listdir_handler_t handler, void* arg);
+
 // Update the permission bits of the specified file or directory.
 //
 extern int idxfs_chmod(cli_t* cli, const char* path,
@@ -29,5 +29,8 @@ typedef struct {
 } cli_t;
 // User callback for readdir operation.
 typedef void (*readdir_handler_t)(const char* name, void* arg);
+// User callback for listdir operation.
+typedef void (*listdir_handler_t)(const char* name,
+                                  const info_t* info, void* arg);
 
 #endif /* _INDEXFS_C_CLI_TYPES_H_ */
@@ -0,0 +1,239 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <poll.h>
+#include <vector>
+#include <gflags/gflags.h>
+
+#include "client/client_impl.h"
+
+namespace indexfs {
+
+DEFINE_int32(async_window, 64, "Max number of outstanding asynchronous operations per server");
+
+namespace {
+// Max number of server redirection allowed per operation
+static const int kNumRedirect = 10;
+}
+
+// An asynchronous operation that has been sent to a server
+// but has not yet been completed. Each operation holds a reference
+// to the index of its parent directory until it completes.
+//
+struct ClientImpl::AsyncOp {
+  enum Type { kMknod, kGetattr };
+
+  Type type;
+  OID oid;
+  int16_t perm;
+  StatInfo* info;
+  AsyncCallback* callback;
+  DirIndexEntry* index_entry;
+  int num_redirects;
+  int srv_id;
+  uint64_t seq;
+  uint64_t revoke_seq;
+};
+
+// Resolves the parent directory of the given path and
+// prepares a new operation against the server in charge.
+//
+Status ClientImpl::NewAsyncOp(const std::string& path,
+        AsyncCallback* callback, AsyncOp** op) {
+  Status s;
+  OID oid;
+  int16_t zeroth_server;
+  DLOG_ASSERT(callback != NULL);
+  s = ResolvePath(path, &oid, &zeroth_server);
+  if (!s.ok()) {
+    return s;
+  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
+  if (!s.ok()) {
+    return s;
+  }
+  AsyncOp* result = new AsyncOp;
+  result->oid = oid;
+  result->perm = 0;
+  result->info = NULL;
+  result->callback = callback;
+  result->index_entry = entry;
+  result->num_redirects = 0;
+  result->srv_id = -1;
+  result->seq = 0;
+  result->revoke_seq = 0;
+  *op = result;
+  return s;
+}
+
+// Sends an operation to the server currently believed to be in charge
+// of it, first reaping replies from that server if its window is full.
+//
+void ClientImpl::SendAsync(AsyncOp* op) {
+  int srv_id = op->index_entry->index->SelectServer(op->oid.obj_name);
+  DLOG_ASSERT(srv_id >= 0);
+  DLOG_ASSERT(static_cast<size_t>(srv_id) < async_queues_.size());
+  const size_t window = FLAGS_async_window > 0 ? FLAGS_async_window : 1;
+  while (async_queues_[srv_id].size() >= window) {
+    RecvAsync(srv_id);
+  }
+  op->revoke_seq = RevokeSeq();
+  try {
+    if (op->type == AsyncOp::kMknod) {
+      rpc_->SendMknod(srv_id, op->oid, op->perm);
+    } else {
+      rpc_->SendGetattr(srv_id, op->oid);
+    }
+  } catch (apache::thrift::transport::TTransportException &tx) {
+    AbortAsync(srv_id);
+    FinishAsync(op, Status::IOError(tx.what()), 0);
+    return;
+  }
+  op->srv_id = srv_id;
+  op->seq = next_async_seq_++;
+  async_queues_[srv_id].push_back(op);
+  num_async_ops_++;
+}
+
+// Receives the reply to the oldest operation outstanding on
+// the given server. Redirected operations are sent again.
+//
+void ClientImpl::RecvAsync(int srv_id) {
+  DLOG_ASSERT(!async_queues_[srv_id].empty());
+  AsyncOp* op = async_queues_[srv_id].front();
+  async_queues_[srv_id].pop_front();
+  num_async_ops_--;
+  Status s;
+  int64_t neg_lease_due = 0;
+  try {
+    if (op->type == AsyncOp::kMknod) {
+      rpc_->RecvMknod(srv_id);
+    } else {
+      rpc_->RecvGetattr(srv_id, op->info);
+    }
+  } catch (ServerRedirectionException &sx) {
+    op->index_entry->index->Update(sx.dmap_data);
+    if (++op->num_redirects <= kNumRedirect) {
+      SendAsync(op);
+      return;
+    }
+    s = Status::BufferFull("Too many redirection");
+  } catch (FileAlreadyExistsException &ae) {
+    s = Status::AlreadyExists(Slice());
+  } catch (FileNotFoundException &nf) {
+    neg_lease_due = nf.lease_due;
+    s = Status::NotFound(Slice());
+  } catch (IOError &ioe) {
+    s = Status::IOError(ioe.message);
+  } catch (ServerInternalError &sie) {
+    s = Status::Corruption(sie.message);
+  } catch (UnrecognizedDirectoryError &ude) {
+    s = Status::Corruption("Unrecognized directory id");
+  } catch (apache::thrift::transport::TTransportException &tx) {
+    AbortAsync(srv_id);
+    s = Status::IOError(tx.what());
+  } catch (apache::thrift::TException &tx) {
+    LOG(FATAL) << "RPC exception: " << tx.what();
+    abort();
+  }
+  FinishAsync(op, s, neg_lease_due);
+}
+
+// Fails all operations outstanding on a server whose connection
+// has been lost, as none of their replies can be received anymore.
+//
+void ClientImpl::AbortAsync(int srv_id) {
+  AsyncQueue failed;
+  failed.swap(async_queues_[srv_id]);
+  num_async_ops_ -= failed.size();
+  for (size_t i = 0; i < failed.size(); ++i) {
+    FinishAsync(failed[i], Status::IOError("Connection lost"), 0);
+  }
+}
+
+void ClientImpl::FinishAsync(AsyncOp* op,
+        const Status& s, int64_t neg_lease_due) {
+  if (op->type == AsyncOp::kMknod && s.ok()) {
+    lookup_cache_->Evict(op->oid);
+  }
+  if (op->type == AsyncOp::kGetattr && s.IsNotFound()) {
+    SetKnownMissing(op->oid, neg_lease_due, op->revoke_seq);
+  }
+  op->index_entry->GetCache()->Release(op->index_entry);
+  AsyncCallback* callback = op->callback;
+  delete op;
+  callback->Done(s);
+}
+
+// Picks a server whose next reply can be received without blocking.
+// Falls back to the server holding the oldest outstanding operation.
+//
+int ClientImpl::NextAsyncServer() {
+  std::vector<pollfd> fds;
+  std::vector<int> srvs;
+  int oldest = -1;
+  for (int i = 0; i < static_cast<int>(async_queues_.size()); ++i) {
+    if (!async_queues_[i].empty()) {
+      int fd = rpc_->GetPendingFD(i);
+      if (fd >= 0) {
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        srvs.push_back(i);
+      }
+      if (oldest < 0 || async_queues_[i].front()->seq <
+              async_queues_[oldest].front()->seq) {
+        oldest = i;
+      }
+    }
+  }
+  if (!fds.empty() && poll(&fds[0], fds.size(), 0) > 0) {
+    for (size_t i = 0; i < fds.size(); ++i) {
+      if (fds[i].revents != 0) {
+        return srvs[i];
+      }
+    }
+  }
+  return oldest;
+}
+
+Status ClientImpl::MknodAsync(const std::string& path,
+        i16 perm, AsyncCallback* callback) {
+  AsyncOp* op = NULL;
+  Status s = NewAsyncOp(path, callback, &op);
+  if (s.ok()) {
+    op->type = AsyncOp::kMknod;
+    op->perm = perm;
+    SendAsync(op);
+  }
+  return s;
+}
+
+Status ClientImpl::GetattrAsync(const std::string& path,
+        StatInfo* info, AsyncCallback* callback) {
+  AsyncOp* op = NULL;
+  Status s = NewAsyncOp(path, callback, &op);
+  if (s.ok()) {
+    op->type = AsyncOp::kGetattr;
+    op->info = info;
+    if (IsKnownMissing(op->oid)) {
+      FinishAsync(op, Status::NotFound(Slice()), 0);
+    } else {
+      SendAsync(op);
+    }
+  }
+  return s;
+}
+
+Status ClientImpl::WaitAsync(int max_outstanding) {
+  while (num_async_ops_ > max_outstanding) {
+    RecvAsync(NextAsyncServer());
+  }
+  return Status::OK();
+}
+
+} // namespace indexfs
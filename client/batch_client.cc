@@ -147,7 +147,7 @@ static Status Remote_Getattr(RPC* rpc, const OID& oid, DirIndex* dir_idx,
   DLOG_ASSERT(dir_idx != NULL);
   Status s;
   int srv_id = dir_idx->SelectServer(oid.obj_name);
-  rpc->GetClient(srv_id)->Getattr(*info, oid);
+  RPC_Stub(rpc, srv_id)->Getattr(*info, oid);
   return s;
 }
 }
@@ -40,8 +40,16 @@ class BatchClient: virtual public Client {
   Status Getattr(const std::string& path, StatInfo* info);
   Status AccessDir(const std::string& path);
   Status ListDir(const std::string& path,
-     NameList* names, StatList stats);
+     NameList* names, StatList* stats);
   Status ReadDir(const std::string& path, NameList* names);
+  Status ScanDir(const std::string& path, DirIterator** iter);
+  Status ScanDirPlus(const std::string& path, DirIterator** iter);
+
+  Status MknodAsync(const std::string& path,
+      i16 perm, AsyncCallback* callback);
+  Status GetattrAsync(const std::string& path,
+      StatInfo* info, AsyncCallback* callback);
+  Status WaitAsync(int max_outstanding);
 
   Status Close(FileHandle* handle);
   Status Open(const std::string& path, int mode, FileHandle** handle);
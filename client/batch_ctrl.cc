@@ -53,7 +53,29 @@ Status BatchClient::ReadDir(const std::string& path, NameList* names) {
   return Status::Corruption("Not implemented");
 }
 
-Status BatchClient::ListDir(const std::string& path, NameList* names, StatList stats) {
+Status BatchClient::ScanDir(const std::string& path, DirIterator** iter) {
+  return Status::Corruption("Not implemented");
+}
+
+Status BatchClient::ScanDirPlus(const std::string& path, DirIterator** iter) {
+  return Status::Corruption("Not implemented");
+}
+
+Status BatchClient::MknodAsync(const std::string& path,
+        i16 perm, AsyncCallback* callback) {
+  return Status::Corruption("Not implemented");
+}
+
+Status BatchClient::GetattrAsync(const std::string& path,
+        StatInfo* info, AsyncCallback* callback) {
+  return Status::Corruption("Not implemented");
+}
+
+Status BatchClient::WaitAsync(int max_outstanding) {
+  return Status::Corruption("Not implemented");
+}
+
+Status BatchClient::ListDir(const std::string& path, NameList* names, StatList* stats) {
   return Status::Corruption("Not implemented");
 }
 
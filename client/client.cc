@@ -14,18 +14,28 @@ Client* ClientFactory::GetClient(Config* config) {
 }
 
 ClientImpl::~ClientImpl() {
+  delete callbacks_;
   delete rpc_;
+  delete path_cache_;
   delete lookup_cache_;
   delete index_cache_;
 }
 
 ClientImpl::ClientImpl(Config* config, Env* env) :
     env_(env),
-    config_(config) {
+    config_(config),
+    async_queues_(config->GetSrvNum()),
+    callbacks_(NULL),
+    client_id_(-1),
+    revoke_epoch_(0),
+    revoke_seq_(0),
+    num_async_ops_(0),
+    next_async_seq_(0) {
   rpc_ = RPC::CreateRPC(config_);
   index_policy_ = DirIndexPolicy::Default(config_);
   index_cache_ = new DirIndexCache(config_->GetDirMappingCacheSize());
   lookup_cache_ = new LookupCache(config_->GetDirEntryCacheSize());
+  path_cache_ = new PathCache(config_->GetDirEntryCacheSize());
 }
 
 } /* namespace indexfs */
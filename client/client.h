@@ -52,6 +52,54 @@ class FileHandle {
   FileHandle& operator=(const FileHandle&);
 };
 
+// An iterator over the entries of a directory. Entries are fetched
+// from the servers one page at a time, so memory usage stays bounded
+// regardless of the size of the directory.
+//
+class DirIterator {
+ public:
+
+  virtual ~DirIterator() { }
+
+  virtual void Next() = 0;
+  virtual bool Valid() = 0;
+
+  virtual void RetrieveEntryName(std::string* name) = 0;
+  // Only available to iterators opened by ScanDirPlus.
+  virtual void RetrieveEntryStat(StatInfo* info) = 0;
+
+  // Returns the error that stopped the iteration, if any.
+  virtual Status status() = 0;
+
+ protected:
+  DirIterator() { }
+
+ private:
+  // No copying allowed
+  DirIterator(const DirIterator&);
+  DirIterator& operator=(const DirIterator&);
+};
+
+// Completion callback of an asynchronous client operation.
+// Callbacks run on the thread driving the client, from within client
+// calls such as WaitAsync, and may themselves issue new operations.
+//
+class AsyncCallback {
+ public:
+
+  virtual ~AsyncCallback() { }
+
+  virtual void Done(const Status& status) = 0;
+
+ protected:
+  AsyncCallback() { }
+
+ private:
+  // No copying allowed
+  AsyncCallback(const AsyncCallback&);
+  AsyncCallback& operator=(const AsyncCallback&);
+};
+
 /* -----------------------------------------------------------------
  * Main Client Interface
  * -----------------------------------------------------------------
@@ -89,11 +137,31 @@ class Client {
 
   virtual Status AccessDir(const std::string& path) = 0;
   virtual Status ListDir(const std::string& path,
-      NameList* names, StatList stats) = 0;
+      NameList* names, StatList* stats) = 0;
   virtual Status ReadDir(const std::string& path, NameList* names) = 0;
+  // Open an iterator over the entries of a directory.
+  // Note that caller should delete *iter when it is no longer needed.
+  virtual Status ScanDir(const std::string& path, DirIterator** iter) = 0;
+  // Same as ScanDir, but the attributes of each entry are fetched
+  // along with its name.
+  virtual Status ScanDirPlus(const std::string& path, DirIterator** iter) = 0;
 
   virtual Status Close(FileHandle* handle) = 0;
   virtual Status Open(const std::string& path, int mode, FileHandle** handle) = 0;
+
+  // Asynchronous operations. Each operation is sent right away, and many
+  // operations may be outstanding on a server at the same time. Operations
+  // sent to different servers complete independently of each other.
+  // If OK is returned, the callback is invoked exactly once when the
+  // operation completes, otherwise the operation was never started.
+  virtual Status MknodAsync(const std::string& path,
+      i16 perm, AsyncCallback* callback) = 0;
+  // Note that *info must stay valid until the operation completes.
+  virtual Status GetattrAsync(const std::string& path,
+      StatInfo* info, AsyncCallback* callback) = 0;
+  // Waits until no more than the given number of asynchronous
+  // operations are outstanding.
+  virtual Status WaitAsync(int max_outstanding) = 0;
 };
 
 } /* namespace indexfs */
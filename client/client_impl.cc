@@ -10,7 +10,20 @@
 namespace indexfs {
 
 Status ClientImpl::Init() {
-  return rpc_->Init();
+  Status s = rpc_->Init();
+  if (s.ok() && FLAGS_lease_callbacks) {
+    callbacks_ = new CallbackListener(this);
+    Status cs = callbacks_->Start();
+    if (cs.ok()) {
+      client_id_ = callbacks_->GetClientId();
+    } else {
+      // Leases simply expire without callbacks
+      LOG(WARNING) << "Fail to listen for lease callbacks: " << cs.ToString();
+      delete callbacks_;
+      callbacks_ = NULL;
+    }
+  }
+  return s;
 }
 
 Status ClientImpl::FlushWriteBuffer() {
@@ -21,7 +34,7 @@ Status ClientImpl::FlushWriteBuffer() {
   } else {
     int srv_id = cli_id;
     for (; srv_id < config_->GetSrvNum(); srv_id += config_->GetNumClients()) {
-      rpc_->GetClient(srv_id)->FlushDB();
+      RPC_Stub(rpc_, srv_id)->FlushDB();
     }
   }
   return s;
@@ -33,9 +46,24 @@ Status ClientImpl::Dispose() {
     DLOG(WARNING) << "Client closed with un-flushed mknod_buffer";
   }
 # endif
+  WaitAsync(0);
+  if (callbacks_ != NULL) {
+    callbacks_->Stop();
+  }
   return rpc_->Shutdown();
 }
 
+// Invoked by the callback listener thread.
+//
+void ClientImpl::Revoke(const OID& oid, bool is_negative) {
+  MutexLock lock(&revoke_mu_);
+  lookup_cache_->Evict(oid);
+  if (!is_negative) {
+    __sync_add_and_fetch(&revoke_epoch_, 1);
+  }
+  revoke_seq_++;
+}
+
 // -------------------------------------------------------------
 // Ping
 // -------------------------------------------------------------
@@ -45,7 +73,7 @@ static
 Status RPC_Ping(RPC* rpc, int srv) {
   Status s;
   try {
-    rpc->GetClient(srv)->Ping();
+    RPC_Stub(rpc, srv)->Ping();
   } catch (ServerInternalError &ie) {
     s = Status::Corruption(ie.message);
   }
@@ -70,7 +98,7 @@ static
 Status RPC_Renew(RPC* rpc, int srv, const OID& oid, LookupInfo* info) {
   Status s;
   try {
-    rpc->GetClient(srv)->Renew(*info, oid);
+    RPC_Stub(rpc, srv)->Renew(*info, oid);
   } catch (FileNotFoundException &nf) {
     s = Status::NotFound(Slice());
   } catch (DirectoryExpectedError &de) {
@@ -92,7 +120,7 @@ static
 Status RPC_Access(RPC* rpc, int srv, const OID& oid, LookupInfo* info) {
   Status s;
   try {
-    rpc->GetClient(srv)->Access(*info, oid);
+    RPC_Stub(rpc, srv)->Access(*info, oid);
   } catch (FileNotFoundException &nf) {
     s = Status::NotFound(Slice());
   } catch (DirectoryExpectedError &de) {
@@ -109,6 +137,33 @@ Status RPCEngine::Access(const OID& oid, LookupInfo* info) {
   EXEC_WITH_RETRY_CATCH();
 }
 
+namespace {
+static
+Status RPC_ResolvePrefix(RPC* rpc, int srv, const OID& oid,
+        const NameList& names, std::vector<LookupInfo>* infos,
+        int64_t* neg_lease_due) {
+  Status s;
+  try {
+    RPC_Stub(rpc, srv)->ResolvePrefix(*infos, oid, names);
+  } catch (FileNotFoundException &nf) {
+    *neg_lease_due = nf.lease_due;
+    s = Status::NotFound(Slice());
+  } catch (DirectoryExpectedError &de) {
+    s = Status::InvalidArgument("Not a directory");
+  }
+  return s;
+}
+}
+
+Status RPCEngine::ResolvePrefix(const OID& oid, const NameList& names,
+        std::vector<LookupInfo>* infos, int64_t* neg_lease_due) {
+  EXEC_WITH_RETRY_TRY() {
+    return RPC_ResolvePrefix(rpc_, srv_id_,
+            oid, names, infos, neg_lease_due);
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
 // Retrieve path lookup info from a server. In order to correctly
 // route request to the right server, parent directory's index data
 // may need to be retrieved first when it is not currently cached at local.
@@ -116,10 +171,8 @@ Status RPCEngine::Access(const OID& oid, LookupInfo* info) {
 Status ClientImpl::Lookup(const OID& oid, int16_t zeroth_server,
         LookupInfo* info, bool is_renew) {
   Status s;
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::NotFound(Slice());
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     if (is_renew) {
@@ -131,6 +184,91 @@ Status ClientImpl::Lookup(const OID& oid, int16_t zeroth_server,
   return s;
 }
 
+// Resolve the given path component along with as many of the following
+// components as its server holds, and deposit all resulting path lookup
+// entries into the lookup cache. At least the given component is resolved
+// if this returns OK. If the given component is missing, that is also
+// remembered for as long as the server allows.
+//
+Status ClientImpl::LookupPrefix(const OID& oid, int16_t zeroth_server,
+        const NameList& names) {
+  Status s;
+  std::vector<LookupInfo> infos;
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
+  uint64_t revoke_seq = RevokeSeq();
+  if (s.ok()) {
+    int64_t neg_lease_due = 0;
+    DirIndexGuard idx_guard(entry);
+    s = RPCEngine(entry->index, rpc_).ResolvePrefix(oid,
+            names, &infos, &neg_lease_due);
+    if (s.IsNotFound()) {
+      SetKnownMissing(oid, neg_lease_due, revoke_seq);
+    }
+  }
+  if (s.ok() && infos.empty()) {
+    s = Status::Corruption("Empty lookup result");
+  }
+  MutexLock lock(&revoke_mu_);
+  if (s.ok() && revoke_seq_ != revoke_seq) {
+    // Use the result only once
+    for (size_t i = 0; i < infos.size(); ++i) {
+      infos[i].lease_due = 0;
+    }
+  }
+  OID next = oid;
+  for (size_t i = 0; s.ok() && i < infos.size(); ++i) {
+    if (i > 0) {
+      next.dir_id = infos[i - 1].id;
+      next.path_depth++;
+      next.obj_name = names[i - 1];
+    }
+    LookupEntry* cache_entry = lookup_cache_->Get(next);
+    if (cache_entry != NULL && cache_entry->IsNegative()) {
+      lookup_cache_->Release(cache_entry);
+      lookup_cache_->Evict(next);
+      cache_entry = NULL;
+    }
+    if (cache_entry == NULL) {
+      cache_entry = lookup_cache_->New(next, infos[i]);
+    } else {
+      cache_entry->uid = infos[i].uid;
+      cache_entry->gid = infos[i].gid;
+      cache_entry->perm = infos[i].perm;
+      cache_entry->lease_due = infos[i].lease_due;
+    }
+    DLOG_ASSERT(cache_entry->inode_no == infos[i].id);
+    DLOG_ASSERT(cache_entry->zeroth_server == infos[i].zeroth_server);
+    lookup_cache_->Release(cache_entry);
+  }
+  return s;
+}
+
+// Returns true if the given name is known to be missing under
+// a negative lookup entry that has not yet expired.
+//
+bool ClientImpl::IsKnownMissing(const OID& oid) {
+  bool missing = false;
+  LookupEntry* entry = lookup_cache_->Get(oid);
+  if (entry != NULL) {
+    missing = entry->IsNegative() && env_->NowMicros() <= entry->lease_due;
+    lookup_cache_->Release(entry);
+  }
+  return missing;
+}
+
+// Remembers a missing name until the given lease expires, unless
+// some lease has been revoked since the request was sent.
+// Servers not granting negative leases return a zero lease due.
+//
+void ClientImpl::SetKnownMissing(const OID& oid,
+        int64_t lease_due, uint64_t revoke_seq) {
+  MutexLock lock(&revoke_mu_);
+  if (lease_due > 0 && revoke_seq_ == revoke_seq) {
+    lookup_cache_->Release(lookup_cache_->NewNegative(oid, lease_due));
+  }
+}
+
 // -------------------------------------------------------------
 // Mknod
 // -------------------------------------------------------------
@@ -140,7 +278,7 @@ static
 Status RPC_Mknod(RPC* rpc, int srv, const OID& oid, i16 perm) {
   Status s;
   try {
-    rpc->GetClient(srv)->Mknod(oid, perm);
+    RPC_Stub(rpc, srv)->Mknod(oid, perm);
   } catch (FileAlreadyExistsException &ae) {
     s = Status::AlreadyExists(Slice());
   }
@@ -163,14 +301,15 @@ Status ClientImpl::Mknod(const std::string& path, i16 perm) {
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     s = RPCEngine(entry->index, rpc_).Mknod(oid, perm);
   }
+  if (s.ok()) {
+    lookup_cache_->Evict(oid);
+  }
   return s;
 }
 
@@ -183,7 +322,7 @@ static
 Status RPC_Mkdir(RPC* rpc, int srv, const OID& oid, i16 perm, i16 hint_srv) {
   Status s;
   try {
-    rpc->GetClient(srv)->Mkdir(oid, perm, hint_srv, hint_srv);
+    RPC_Stub(rpc, srv)->Mkdir(oid, perm, hint_srv, hint_srv);
   } catch (FileAlreadyExistsException &ae) {
     s = Status::AlreadyExists(Slice());
   }
@@ -206,14 +345,15 @@ Status ClientImpl::Mkdir(const std::string& path, i16 perm) {
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     s = RPCEngine(entry->index, rpc_).Mkdir(oid, perm, RandomServer(path));
   }
+  if (s.ok()) {
+    lookup_cache_->Evict(oid);
+  }
   return s;
 }
 
@@ -227,7 +367,7 @@ Status RPC_Chmod(RPC* rpc, int srv,
         const OID& oid, i16 perm, bool* is_dir) {
   Status s;
   try {
-    bool r = rpc->GetClient(srv)->Chmod(oid, perm);
+    bool r = RPC_Stub(rpc, srv)->Chmod(oid, perm);
     if (is_dir != NULL) {
       *is_dir = r;
     }
@@ -254,10 +394,8 @@ Status ClientImpl::Chmod(const std::string& path,
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     s = RPCEngine(entry->index, rpc_).Chmod(oid, perm, is_dir);
@@ -275,7 +413,7 @@ Status RPC_Chown(RPC* rpc, int srv,
         const OID& oid, i16 uid, i16 gid, bool* is_dir) {
   Status s;
   try {
-    bool r = rpc->GetClient(srv)->Chown(oid, uid, gid);
+    bool r = RPC_Stub(rpc, srv)->Chown(oid, uid, gid);
     if (is_dir != NULL) {
       *is_dir = r;
     }
@@ -302,10 +440,8 @@ Status ClientImpl::Chown(const std::string& path,
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     s = RPCEngine(entry->index, rpc_).Chown(oid, uid, gid, is_dir);
@@ -319,20 +455,23 @@ Status ClientImpl::Chown(const std::string& path,
 
 namespace {
 static
-Status RPC_Getattr(RPC* rpc, int srv, const OID& oid, StatInfo* info) {
+Status RPC_Getattr(RPC* rpc, int srv, const OID& oid,
+        StatInfo* info, int64_t* neg_lease_due) {
   Status s;
   try {
-    rpc->GetClient(srv)->Getattr(*info, oid);
+    RPC_Stub(rpc, srv)->Getattr(*info, oid);
   } catch (FileNotFoundException &nf) {
+    *neg_lease_due = nf.lease_due;
     s = Status::NotFound(Slice());
   }
   return s;
 }
 }
 
-Status RPCEngine::Getattr(const OID& oid, StatInfo* info) {
+Status RPCEngine::Getattr(const OID& oid,
+        StatInfo* info, int64_t* neg_lease_due) {
   EXEC_WITH_RETRY_TRY() {
-    return RPC_Getattr(rpc_, srv_id_, oid, info);
+    return RPC_Getattr(rpc_, srv_id_, oid, info, neg_lease_due);
   }
   EXEC_WITH_RETRY_CATCH();
 }
@@ -345,13 +484,19 @@ Status ClientImpl::Getattr(const std::string& path, StatInfo* info) {
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
+  if (IsKnownMissing(oid)) {
+    return Status::NotFound(Slice());
   }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
+    int64_t neg_lease_due = 0;
+    uint64_t revoke_seq = RevokeSeq();
     DirIndexGuard idx_guard(entry);
-    s = RPCEngine(entry->index, rpc_).Getattr(oid, info);
+    s = RPCEngine(entry->index, rpc_).Getattr(oid, info, &neg_lease_due);
+    if (s.IsNotFound()) {
+      SetKnownMissing(oid, neg_lease_due, revoke_seq);
+    }
   }
   return s;
 }
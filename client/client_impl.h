@@ -5,7 +5,11 @@
 #ifndef _INDEXFS_CLIENT_IMPL_H_
 #define _INDEXFS_CLIENT_IMPL_H_
 
+#include <deque>
+#include <vector>
+
 #include "ipc/rpc.h"
+#include "ipc/callback.h"
 #include "util/str_hash.h"
 #include "client/client.h"
 
@@ -13,6 +17,7 @@
 #include "common/dirlock.h"
 #include "common/dirguard.h"
 #include "common/lookupcache.h"
+#include "common/pathcache.h"
 
 namespace indexfs {
 
@@ -34,6 +39,8 @@ class RPCEngine {
 
   Status Access(const OID& oid, LookupInfo* info);
   Status Renew(const OID& oid, LookupInfo* info);
+  Status ResolvePrefix(const OID& oid, const NameList& names,
+      std::vector<LookupInfo>* infos, int64_t* neg_lease_due);
 
   Status Mknod(const OID& oid, i16 perm);
   Status Mknods(const OIDS& oids, int srv_id, i16 perm);
@@ -42,9 +49,8 @@ class RPCEngine {
   Status Chmod(const OID& oid, i16 perm, bool* is_dir);
   Status Chown(const OID& oid, i16 uid, i16 gid, bool* is_dir);
 
-  Status Getattr(const OID& oid, StatInfo* info);
+  Status Getattr(const OID& oid, StatInfo* info, int64_t* neg_lease_due);
   Status ReadDir(i64 dir_id, NameList* names);
-  Status ListDir(i64 dir_id, NameList* names, StatList* stats);
 
  private:
   int srv_id_;
@@ -59,7 +65,7 @@ class RPCEngine {
   RPCEngine& operator=(const RPCEngine&);
 };
 
-class ClientImpl: virtual public Client {
+class ClientImpl: virtual public Client, public RevocationHandler {
  public:
 
   ClientImpl(Config* config, Env* env);
@@ -84,12 +90,22 @@ class ClientImpl: virtual public Client {
   Status Getattr(const std::string& path, StatInfo* info);
   Status AccessDir(const std::string& path);
   Status ListDir(const std::string& path,
-      NameList* names, StatList stats);
+      NameList* names, StatList* stats);
   Status ReadDir(const std::string& path, NameList* names);
+  Status ScanDir(const std::string& path, DirIterator** iter);
+  Status ScanDirPlus(const std::string& path, DirIterator** iter);
 
   Status Close(FileHandle* handle);
   Status Open(const std::string& path, int mode, FileHandle** handle);
 
+  Status MknodAsync(const std::string& path,
+      i16 perm, AsyncCallback* callback);
+  Status GetattrAsync(const std::string& path,
+      StatInfo* info, AsyncCallback* callback);
+  Status WaitAsync(int max_outstanding);
+
+  void Revoke(const OID& oid, bool is_negative);
+
  private:
   RPC* rpc_;
   DirIndexCache* index_cache_;
@@ -98,6 +114,25 @@ class ClientImpl: virtual public Client {
   Env* env_;
   Config* config_;
   LookupCache* lookup_cache_;
+  PathCache* path_cache_;
+
+  // Revoked leases are evicted from the lookup cache right away. Cached
+  // paths are instead invalidated all at once by bumping the epoch they
+  // have to match, as the paths depending on a lease are unknown.
+  CallbackListener* callbacks_;
+  int64_t client_id_;
+  uint64_t revoke_epoch_;
+  // Number of leases revoked so far. Leases granted by replies received
+  // after a revocation may have been revoked before they were cached, so
+  // replies are only cached if no revocation has happened since they were
+  // requested, which is checked under revoke_mu_ along with the insertion.
+  Mutex revoke_mu_;
+  uint64_t revoke_seq_;
+
+  uint64_t RevokeSeq() {
+    MutexLock lock(&revoke_mu_);
+    return revoke_seq_;
+  }
 
   static int RandomServer(const std::string& path) {
     return GetStrHash(path.data(), path.size(), 0)
@@ -109,10 +144,31 @@ class ClientImpl: virtual public Client {
   typedef std::map<int64_t, MknodBuffer*>::iterator BufferIter;
 
   Status FlushBuffer(MknodBuffer* buffer);
+
+  struct AsyncOp;
+  typedef std::deque<AsyncOp*> AsyncQueue;
+  // Outstanding asynchronous operations, per server, in sending order
+  std::vector<AsyncQueue> async_queues_;
+  int num_async_ops_;
+  uint64_t next_async_seq_;
+
+  Status NewAsyncOp(const std::string& path, AsyncCallback* callback,
+      AsyncOp** op);
+  void SendAsync(AsyncOp* op);
+  void RecvAsync(int srv_id);
+  void AbortAsync(int srv_id);
+  void FinishAsync(AsyncOp* op, const Status& s, int64_t neg_lease_due);
+  int NextAsyncServer();
   Status Lookup(const OID& oid, int16_t zeroth_server,
       LookupInfo* info, bool is_renew);
-  DirIndexEntry* FetchIndex(int64_t dir_id, int16_t zeroth_server);
+  Status LookupPrefix(const OID& oid, int16_t zeroth_server,
+      const NameList& names);
+  bool IsKnownMissing(const OID& oid);
+  void SetKnownMissing(const OID& oid, int64_t lease_due, uint64_t revoke_seq);
+  Status FetchIndex(int64_t dir_id, int16_t zeroth_server,
+      DirIndexEntry** entry);
   Status ResolvePath(const std::string& path, OID* oid, int16_t* zeroth_server);
+  Status OpenDirIterator(const std::string& path, bool plus, DirIterator** iter);
 
   // No copy allowed
   ClientImpl(const ClientImpl&);
@@ -14,7 +14,7 @@ Status RPC_Msdir(RPC* rpc, int srv, const OID& oid,
   Status s;
   DLOG_ASSERT(rpc != NULL);
   try {
-    rpc->GetClient(srv)->Mkdir_Presplit(oid, perm, hint_srv, hint_srv);
+    RPC_Stub(rpc, srv)->Mkdir_Presplit(oid, perm, hint_srv, hint_srv);
   } catch (FileAlreadyExistsException &ae) {
     s = Status::AlreadyExists(Slice());
   }
@@ -37,14 +37,15 @@ Status ClientImpl::Mkdir_Presplit(const std::string& path, i16 perm) {
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     s = RPCEngine(entry->index, rpc_).Msdir(oid, perm, RandomServer(path));
   }
+  if (s.ok()) {
+    lookup_cache_->Evict(oid);
+  }
   return s;
 }
 
@@ -17,7 +17,8 @@ DEFINE_int32(mknod_bufsize, 128, "Max number of mknods buffered per server");
 
 // Buffered file creations under a particular directory
 // that is assumed to have been pre-split to all metadata servers.
-// We further assume that each file is created with a same permission.
+// All buffered files share the same permission, so buffered files
+// are flushed before creating one with a different permission.
 //
 class ClientImpl::MknodBuffer {
  public:
@@ -32,11 +33,13 @@ class ClientImpl::MknodBuffer {
 #   endif
   }
 
-  MknodBuffer(int64_t dir_id, int16_t dir_depth,
-          int16_t zeroth_server, int num_srvs)
+  MknodBuffer(int64_t dir_id, int16_t dir_depth, int16_t zeroth_server,
+          int num_srvs, int64_t client_id, int16_t perm)
     : dir_id_(dir_id),
       dir_depth_(dir_depth),
+      client_id_(client_id),
       zeroth_server_(zeroth_server),
+      perm_(perm),
       bufs_(num_srvs) {
   }
 
@@ -47,38 +50,61 @@ class ClientImpl::MknodBuffer {
       OIDS oids;
       oids.dir_id = dir_id_;
       oids.path_depth = dir_depth_;
+      oids.client_id = client_id_;
       oids.obj_names.insert(oids.obj_names.begin(),
               queue->begin(), queue->end());
-      s = RPCEngine(dir_idx, rpc).Mknods(oids, srv_id, 0);
-      if (s.ok()) {
+      s = RPCEngine(dir_idx, rpc).Mknods(oids, srv_id, perm_);
+      if (s.ok() || s.IsAlreadyExists()) {
         queue->clear();
       }
     }
     return s;
   }
 
+  // Flushes all queues. Names that already existed don't stop other
+  // queues from being flushed, but are reported once all are done.
   Status Flush(DirIndex* dir_idx, RPC* rpc) {
     Status s;
+    bool name_collision = false;
     for (int i = 0; s.ok() && i < bufs_.size(); ++i) {
       if (bufs_[i].size() > 0) {
         s = MaybeFlushQueue(&bufs_[i], i, dir_idx, rpc, true);
+        if (s.IsAlreadyExists()) {
+          name_collision = true;
+          s = Status::OK();
+        }
       }
     }
+    if (s.ok() && name_collision) {
+      s = Status::AlreadyExists(Slice());
+    }
     return s;
   }
 
-  Status Mknod(const std::string& name, DirIndex* dir_idx, RPC* rpc) {
+  Status Mknod(const std::string& name, int16_t perm,
+          DirIndex* dir_idx, RPC* rpc) {
+    Status s;
+    if (perm != perm_) {
+      s = Flush(dir_idx, rpc);
+      if (!s.ok() && !s.IsAlreadyExists()) {
+        return s;
+      }
+      perm_ = perm;
+    }
     int srv_id = dir_idx->SelectServer(name);
     DLOG_ASSERT(srv_id < bufs_.size());
     ReqQueue* queue = &bufs_[srv_id];
     queue->push_back(name);
-    return MaybeFlushQueue(queue, srv_id, dir_idx, rpc, false);
+    Status fs = MaybeFlushQueue(queue, srv_id, dir_idx, rpc, false);
+    return fs.ok() ? s : fs;
   }
 
  private:
   int64_t dir_id_;
   int16_t dir_depth_;
+  int64_t client_id_;
   int16_t zeroth_server_;
+  int16_t perm_;
   std::vector<ReqQueue> bufs_;
 
   friend class ClientImpl;
@@ -93,12 +119,8 @@ class ClientImpl::MknodBuffer {
 
 Status ClientImpl::FlushBuffer(MknodBuffer* buffer) {
   Status s;
-  DirIndexEntry* entry = FetchIndex(buffer->dir_id_, buffer->zeroth_server_);
-  if (entry == NULL) {
-    // Maybe the directory itself has been removed.
-    // To prevent this, we could use a directory lease.
-    s = Status::Corruption("No such directory or index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(buffer->dir_id_, buffer->zeroth_server_, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     s = buffer->Flush(entry->index, rpc_);
@@ -108,39 +130,90 @@ Status ClientImpl::FlushBuffer(MknodBuffer* buffer) {
 
 namespace {
 static
-Status RPC_Mknods(RPC* rpc, int srv, const OIDS& oids, i16 perm) {
-  Status s;
+Status RPC_Mknods(RPC* rpc, int srv, const OIDS& oids, i16 perm,
+        MknodBulkResult* result) {
   try {
-    rpc->GetClient(srv)->Mknod_Bulk(oids, perm);
-  } catch (FileAlreadyExistsException &ae) {
-    s = Status::AlreadyExists(Slice());
+    RPC_Stub(rpc, srv)->Mknod_Bulk(*result, oids, perm);
+  } catch (IOError &ioe) {
+    return Status::IOError(ioe.message);
+  } catch (ServerInternalError &sie) {
+    return Status::Corruption(sie.message);
+  } catch (UnrecognizedDirectoryError &ude) {
+    return Status::Corruption("Unrecognized directory id");
+  } catch (apache::thrift::TException &tx) {
+    LOG(FATAL) << "RPC exception: " << tx.what();
+    abort();
   }
-  return s;
+  return Status::OK();
 }
 }
 
+// Sends a batch of file creations to a given server. Names rejected
+// by that server due to a stale directory index are regrouped
+// according to the updated index and resent to their new owners.
+// The batch may have been grouped under an older index than the
+// current one, which the server handles the same way.
+// Returns AlreadyExists if at least one of the names already existed,
+// though all other names will still have been created.
+//
 Status RPCEngine::Mknods(const OIDS& oids, int srv_id, i16 perm) {
   Status s;
-  if (oids.obj_names.size() > 0) {
-#   ifndef NDEBUG
-    for (int i = 0; i < oids.obj_names.size(); ++i) {
-      DLOG_ASSERT(srv_id == dir_idx_->SelectServer(oids.obj_names[i]));
+  if (oids.obj_names.size() == 0) {
+    return s;
+  }
+  bool name_collision = false;
+  std::map<int, OIDS> pending;
+  pending[srv_id] = oids;
+  int num_redirects = 0;
+  while (s.ok() && !pending.empty()) {
+    if (num_redirects++ > kNumRedirect) {
+      return Status::BufferFull("Too many redirection");
     }
-#   endif
-    try {
-      return RPC_Mknods(rpc_, srv_id, oids, perm);
-    } catch (ServerRedirectionException &se) {
-      s = Status::Corruption("Stale directory index");
+    NameList redirected;
+    std::map<int, OIDS>::iterator it = pending.begin();
+    for (; s.ok() && it != pending.end(); ++it) {
+      const OIDS& req = it->second;
+      MknodBulkResult result;
+      s = RPC_Mknods(rpc_, it->first, req, perm, &result);
+      if (s.ok()) {
+        DLOG_ASSERT(result.status.size() == req.obj_names.size());
+        if (!result.dmap_data.empty()) {
+          dir_idx_->Update(result.dmap_data);
+        }
+        for (size_t i = 0; i < result.status.size(); ++i) {
+          if (result.status[i] == MknodStatus::ALREADY_EXISTS) {
+            name_collision = true;
+          } else if (result.status[i] == MknodStatus::REDIRECTED) {
+            redirected.push_back(req.obj_names[i]);
+          }
+        }
+      }
     }
+    pending.clear();
+    for (size_t i = 0; s.ok() && i < redirected.size(); ++i) {
+      OIDS& req = pending[dir_idx_->SelectServer(redirected[i])];
+      req.dir_id = oids.dir_id;
+      req.path_depth = oids.path_depth;
+      req.client_id = oids.client_id;
+      req.obj_names.push_back(redirected[i]);
+    }
+  }
+  if (s.ok() && name_collision) {
+    s = Status::AlreadyExists(Slice());
   }
   return s;
 }
 
 Status ClientImpl::Mknod_Flush() {
   Status s;
+  bool name_collision = false;
   BufferIter it = mknod_bufmap_.begin();
   while (s.ok() && it != mknod_bufmap_.end()) {
     s = FlushBuffer(it->second);
+    if (s.IsAlreadyExists()) {
+      name_collision = true;
+      s = Status::OK();
+    }
     if (s.ok()) {
       delete it->second;
       BufferIter it_ = it;
@@ -148,6 +221,9 @@ Status ClientImpl::Mknod_Flush() {
       mknod_bufmap_.erase(it_);
     }
   }
+  if (s.ok() && name_collision) {
+    s = Status::AlreadyExists(Slice());
+  }
   return s;
 }
 
@@ -159,22 +235,24 @@ Status ClientImpl::Mknod_Buffered(const std::string& path, i16 perm) {
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     MknodBuffer* buffer;
     if (mknod_bufmap_.count(oid.dir_id) > 0) {
       buffer = mknod_bufmap_[oid.dir_id];
     } else {
-      buffer = new MknodBuffer(oid.dir_id,
-              oid.path_depth, zeroth_server, index_policy_->NumServers());
+      buffer = new MknodBuffer(oid.dir_id, oid.path_depth, zeroth_server,
+              index_policy_->NumServers(), oid.client_id, perm);
       mknod_bufmap_.insert(std::make_pair(oid.dir_id, buffer));
     }
     DLOG_ASSERT(buffer != NULL);
-    s = buffer->Mknod(oid.obj_name, entry->index, rpc_);
+    s = buffer->Mknod(oid.obj_name, perm, entry->index, rpc_);
+  }
+  if (s.ok()) {
+    // The server skips our own negative lease on the name
+    lookup_cache_->Evict(oid);
   }
   return s;
 }
@@ -0,0 +1,224 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <gflags/gflags.h>
+
+#include "ipc/callback.h"
+#include "ipc/rpc_impl.h"
+#include "client/client_impl.h"
+#include "common/unit_test.h"
+
+namespace indexfs { namespace test {
+
+namespace {
+static const int kNumServers = 4;
+static const int kNumFiles = 64;
+
+static std::string FileName(int i) {
+  char name[32];
+  snprintf(name, sizeof(name), "f%d", i);
+  return name;
+}
+
+// Files of the root directory, which is split over all servers. Clients
+// are handed an older index that only knows of the first two partitions,
+// so some of their creations reach the wrong server and get redirected.
+//
+class FakeDir {
+ public:
+
+  FakeDir() : policy_(DirIndexPolicy::TEST_NewPolicy(kNumServers, kNumServers)) {
+    index_ = policy_->NewDirIndex(0, 0);
+    index_->SetBit(1);
+    stale_dmap_ = index_->ToSlice().ToString();
+    index_->SetBit(2);
+    index_->SetBit(3);
+  }
+
+  ~FakeDir() {
+    delete index_;
+    delete policy_;
+  }
+
+  int Owner(const std::string& name) {
+    MutexLock lock(&mu_);
+    return index_->SelectServer(name);
+  }
+
+  // Returns the server holding the given file, or -1 if none does.
+  int Lookup(const std::string& name, mode_t* mode) {
+    MutexLock lock(&mu_);
+    std::map<std::string, std::pair<int, mode_t> >::iterator it;
+    it = files_.find(name);
+    if (it == files_.end()) {
+      return -1;
+    }
+    *mode = it->second.second;
+    return it->second.first;
+  }
+
+  // Returns the number of times a name was sent to any server.
+  int NumRequests(const std::string& name) {
+    MutexLock lock(&mu_);
+    return num_requests_[name];
+  }
+
+  void ReadBitmap(std::string& _return) {
+    _return = stale_dmap_;
+  }
+
+  void Mknods(int srv, MknodBulkResult& _return,
+              const OIDS& obj_ids, int16_t perm) {
+    MutexLock lock(&mu_);
+    bool redirected = false;
+    for (size_t i = 0; i < obj_ids.obj_names.size(); ++i) {
+      const std::string& name = obj_ids.obj_names[i];
+      num_requests_[name]++;
+      if (index_->SelectServer(name) != srv) {
+        _return.status.push_back(MknodStatus::REDIRECTED);
+        redirected = true;
+      } else if (files_.count(name) != 0) {
+        _return.status.push_back(MknodStatus::ALREADY_EXISTS);
+      } else {
+        files_[name] = std::make_pair(srv, S_IFREG | perm);
+        _return.status.push_back(MknodStatus::CREATED);
+      }
+    }
+    if (redirected) {
+      _return.dmap_data = index_->ToSlice().ToString();
+    }
+  }
+
+ private:
+  Mutex mu_;
+  DirIndexPolicy* policy_;
+  DirIndex* index_;
+  std::string stale_dmap_;
+  std::map<std::string, std::pair<int, mode_t> > files_;
+  std::map<std::string, int> num_requests_;
+
+  // No copying allowed
+  FakeDir(const FakeDir&);
+  FakeDir& operator=(const FakeDir&);
+};
+
+// Serves one server's share of the fake directory.
+//
+class FakeService: public MetadataIndexServiceNull {
+ public:
+  FakeService(FakeDir* dir, int srv) : dir_(dir), srv_(srv) { }
+  void ReadBitmap(std::string& _return, const int64_t dir_id) {
+    dir_->ReadBitmap(_return);
+  }
+  void Mknod_Bulk(MknodBulkResult& _return,
+          const OIDS& obj_ids, const int16_t perm) {
+    dir_->Mknods(srv_, _return, obj_ids, perm);
+  }
+ private:
+  FakeDir* dir_;
+  int srv_;
+};
+
+static void* RunServer(void* arg) {
+  reinterpret_cast<SrvRep*>(arg)->Start();
+  return NULL;
+}
+}
+
+class MknodBufTest {
+ public:
+  Config* config_;
+  FakeDir dir_;
+  std::vector<SrvRep*> servers_;
+  std::vector<pthread_t> threads_;
+
+  MknodBufTest() : threads_(kNumServers) {
+    FLAGS_lease_callbacks = false;
+    config_ = Config::CreateServerTestingConfig();
+    std::vector<std::pair<std::string, int> > addrs;
+    for (int i = 0; i < kNumServers; ++i) {
+      int port = config_->GetDefaultSrvPort() + i;
+      addrs.push_back(std::make_pair("127.0.0.1", port));
+      // The service is disposed of by the server
+      servers_.push_back(new SrvRep(new FakeService(&dir_, i), port));
+      ASSERT_EQ(pthread_create(&threads_[i], NULL, RunServer, servers_[i]), 0);
+    }
+    ASSERT_TRUE(config_->SetServers(addrs).ok());
+    usleep(100 * 1000); // Wait for the servers to start listening
+  }
+
+  ~MknodBufTest() {
+    for (int i = 0; i < kNumServers; ++i) {
+      servers_[i]->Stop();
+      pthread_join(threads_[i], NULL);
+      delete servers_[i];
+    }
+    delete config_;
+  }
+};
+
+// Each buffered file is created once on the server owning it with the
+// permission it was created with. Only names redirected by a server are
+// resent, and only to the server owning them under the returned index.
+// Buffered files are flushed whenever the permission changes, after which
+// the index is up to date and no more names are redirected.
+//
+TEST(MknodBufTest, ResendRedirected) {
+  ClientImpl client(config_, Env::Default());
+  ASSERT_TRUE(client.Init().ok());
+  DirIndexPolicy* policy =
+      DirIndexPolicy::TEST_NewPolicy(kNumServers, kNumServers);
+  std::string stale_dmap;
+  dir_.ReadBitmap(stale_dmap);
+  DirIndex* stale_idx = policy->RecoverDirIndex(stale_dmap);
+  int num_redirected = 0;
+  for (int i = 0; i < kNumFiles; ++i) {
+    const mode_t perm = i < kNumFiles / 2 ? S_IRUSR | S_IWUSR : S_IRWXU;
+    ASSERT_TRUE(client.Mknod_Buffered("/" + FileName(i), perm).ok());
+    if (i < kNumFiles / 2 &&
+        stale_idx->SelectServer(FileName(i)) != dir_.Owner(FileName(i))) {
+      num_redirected++;
+    }
+  }
+  ASSERT_TRUE(num_redirected > 0);
+  // An existing name collides without holding back the other files
+  ASSERT_TRUE(client.Mknod_Buffered("/" + FileName(0), S_IRWXU).ok());
+  ASSERT_TRUE(client.Mknod_Buffered("/" + FileName(kNumFiles), S_IRWXU).ok());
+  ASSERT_TRUE(client.Mknod_Flush().IsAlreadyExists());
+  ASSERT_TRUE(client.Mknod_Flush().ok());
+  for (int i = 0; i <= kNumFiles; ++i) {
+    const std::string name = FileName(i);
+    mode_t mode;
+    ASSERT_EQ(dir_.Lookup(name, &mode), dir_.Owner(name));
+    if (i < kNumFiles / 2) {
+      ASSERT_EQ(mode, S_IFREG | S_IRUSR | S_IWUSR);
+    } else {
+      ASSERT_EQ(mode, S_IFREG | S_IRWXU);
+    }
+    int num_requests = 1;
+    if (i < kNumFiles / 2 &&
+        stale_idx->SelectServer(name) != dir_.Owner(name)) {
+      num_requests++;
+    }
+    if (i == 0) {
+      num_requests++; // Created again, this time colliding
+    }
+    ASSERT_EQ(dir_.NumRequests(name), num_requests);
+  }
+  ASSERT_TRUE(client.Dispose().ok());
+  delete stale_idx;
+  delete policy;
+}
+
+} /* namespace test */ } /* namespace indexfs */
+
+int main(int argc, char* argv[]) {
+  return indexfs::test::RunAllTests();
+}
@@ -2,43 +2,537 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <map>
+#include <algorithm>
+#include <set>
+#include <deque>
 #include <vector>
 
 #include "client/client_impl.h"
 
 namespace indexfs {
 
+DEFINE_int32(readdir_pagesize, 1024, "Max number of entries fetched per readdir page");
+DEFINE_int32(readdir_fanout, 16, "Max number of partitions read concurrently per readdir");
+
 namespace {
 static
-Status RPC_Readdir(RPC* rpc, int srv,
-        i64 dir_id, i16 index, EntryList* list) {
+Status RPC_SendReaddir(RPC* rpc, int srv, i64 dir_id, i16 index) {
   Status s;
   try {
-    rpc->GetClient(srv)->Readdir(*list, dir_id, index);
+    s = rpc->SendReaddir(srv, dir_id, index);
+  } catch (apache::thrift::transport::TTransportException &tx) {
+    s = Status::IOError(tx.what());
+  }
+  return s;
+}
+
+static
+Status RPC_RecvReaddir(RPC* rpc, int srv, EntryList* list) {
+  Status s;
+  try {
+    s = rpc->RecvReaddir(srv, list);
   } catch (IOError &io) {
     s = Status::IOError(io.message);
   } catch (ServerInternalError &ie) {
     s = Status::Corruption(ie.message);
+  } catch (apache::thrift::transport::TTransportException &tx) {
+    s = Status::IOError(tx.what());
   }
   return s;
 }
+
+static
+Status RPC_SendReaddirScan(RPC* rpc, int srv, i64 dir_id, i16 index,
+        const std::string& start_hash, i32 max_entries, bool plus) {
+  Status s;
+  try {
+    if (plus) {
+      s = rpc->SendReaddirPlus(srv, dir_id, index, start_hash, max_entries);
+    } else {
+      s = rpc->SendReaddirScan(srv, dir_id, index, start_hash, max_entries);
+    }
+  } catch (apache::thrift::transport::TTransportException &tx) {
+    s = Status::IOError(tx.what());
+  }
+  return s;
 }
 
-Status RPCEngine::ReadDir(i64 dir_id, NameList* names) {
-  for (int16_t idx = 0;
-       idx < (1 << dir_idx_->FetchBitmapRadix());
+static
+Status RPC_RecvReaddirScan(RPC* rpc, int srv, ScanResult* result) {
+  Status s;
+  try {
+    s = rpc->RecvReaddirScan(srv, result);
+  } catch (UnrecognizedDirectoryError &ue) {
+    s = Status::NotFound("Directory not found");
+  } catch (IOError &io) {
+    s = Status::IOError(io.message);
+  } catch (ServerInternalError &ie) {
+    s = Status::Corruption(ie.message);
+  } catch (apache::thrift::transport::TTransportException &tx) {
+    s = Status::IOError(tx.what());
+  }
+  return s;
+}
+
+static
+Status RPC_RecvReaddirPlus(RPC* rpc, int srv, ScanPlusResult* result) {
+  Status s;
+  try {
+    s = rpc->RecvReaddirPlus(srv, result);
+  } catch (UnrecognizedDirectoryError &ue) {
+    s = Status::NotFound("Directory not found");
+  } catch (IOError &io) {
+    s = Status::IOError(io.message);
+  } catch (ServerInternalError &ie) {
+    s = Status::Corruption(ie.message);
+  } catch (apache::thrift::transport::TTransportException &tx) {
+    s = Status::IOError(tx.what());
+  }
+  return s;
+}
+
+static
+Status RPC_ReaddirScan(RPC* rpc, int srv, i64 dir_id, i16 index,
+        const std::string& start_hash, i32 max_entries, ScanResult* result) {
+  Status s;
+  try {
+    RPC_Stub(rpc, srv)->ReaddirScan(*result,
+            dir_id, index, start_hash, max_entries);
+  } catch (UnrecognizedDirectoryError &ue) {
+    s = Status::NotFound("Directory not found");
+  } catch (IOError &io) {
+    s = Status::IOError(io.message);
+  } catch (ServerInternalError &ie) {
+    s = Status::Corruption(ie.message);
+  }
+  return s;
+}
+
+static
+Status RPC_ReaddirPlus(RPC* rpc, int srv, i64 dir_id, i16 index,
+        const std::string& start_hash, i32 max_entries, ScanPlusResult* result) {
+  Status s;
+  try {
+    RPC_Stub(rpc, srv)->ReaddirPlus(*result,
+            dir_id, index, start_hash, max_entries);
+  } catch (UnrecognizedDirectoryError &ue) {
+    s = Status::NotFound("Directory not found");
+  } catch (IOError &io) {
+    s = Status::IOError(io.message);
+  } catch (ServerInternalError &ie) {
+    s = Status::Corruption(ie.message);
+  }
+  return s;
+}
+
+// Remembers the pages listed by a directory scan, each along with the
+// directory index returned with it. An entry is covered by a page if its
+// hash falls within the range of the page and the index of that page maps
+// it to the partition the page was read from. Entries that a split has
+// since moved to another partition are covered by the pages listing them
+// before the move, which is how their second copies are recognized.
+//
+class ListedPages {
+ public:
+
+  explicit ListedPages(DirIndexPolicy* policy) : policy_(policy) { }
+
+  ~ListedPages() {
+    for (size_t i = 0; i < indices_.size(); ++i) {
+      delete indices_[i];
+    }
+  }
+
+  // Records a page of a partition covering hashes in [start_hash, end_hash).
+  // An empty end hash stands for the end of the partition.
+  void Add(int index, const std::string& start_hash,
+           const std::string& end_hash, const std::string& dmap_data);
+
+  // Removes entries already covered by pages of other partitions from a
+  // page of the given partition. Stats are kept in step with names unless
+  // they are NULL.
+  void Filter(int index, std::vector<std::string>* names,
+              std::vector<StatInfo>* stats) const;
+
+ private:
+  struct Range {
+    int index;
+    std::string start_hash;
+    std::string end_hash;
+    const DirIndex* dir_idx;
+  };
+
+  DirIndexPolicy* policy_;
+  std::vector<DirIndex*> indices_; // distinct indices seen so far
+  std::vector<Range> ranges_;
+
+  // No copying allowed
+  ListedPages(const ListedPages&);
+  ListedPages& operator=(const ListedPages&);
+};
+
+void ListedPages::Add(int index, const std::string& start_hash,
+        const std::string& end_hash, const std::string& dmap_data) {
+  Range range;
+  range.index = index;
+  range.start_hash = start_hash;
+  range.end_hash = end_hash;
+  range.dir_idx = NULL;
+  for (size_t i = 0; i < indices_.size() && range.dir_idx == NULL; ++i) {
+    if (indices_[i]->ToSlice() == Slice(dmap_data)) {
+      range.dir_idx = indices_[i];
+    }
+  }
+  if (range.dir_idx == NULL) {
+    indices_.push_back(policy_->RecoverDirIndex(dmap_data));
+    range.dir_idx = indices_.back();
+  }
+  ranges_.push_back(range);
+}
+
+void ListedPages::Filter(int index, std::vector<std::string>* names,
+        std::vector<StatInfo>* stats) const {
+  // Only pages read before the given partition existed can cover its entries
+  std::vector<const Range*> candidates;
+  for (size_t i = 0; i < ranges_.size(); ++i) {
+    if (ranges_[i].index != index && !ranges_[i].dir_idx->GetBit(index)) {
+      candidates.push_back(&ranges_[i]);
+    }
+  }
+  if (candidates.empty()) {
+    return;
+  }
+  size_t num_kept = 0;
+  char buf[16];
+  for (size_t i = 0; i < names->size(); ++i) {
+    const std::string& name = (*names)[i];
+    std::string hash(buf, DirIndex::GetNameHash(name, buf));
+    bool covered = false;
+    for (size_t j = 0; j < candidates.size() && !covered; ++j) {
+      const Range* range = candidates[j];
+      covered = hash >= range->start_hash &&
+                (range->end_hash.empty() || hash < range->end_hash) &&
+                range->dir_idx->GetIndex(name) == range->index;
+    }
+    if (!covered) {
+      if (num_kept != i) {
+        (*names)[num_kept].swap((*names)[i]);
+        if (stats != NULL) {
+          std::swap((*stats)[num_kept], (*stats)[i]);
+        }
+      }
+      num_kept++;
+    }
+  }
+  names->resize(num_kept);
+  if (stats != NULL) {
+    stats->resize(num_kept);
+  }
+}
+
+// Walks the partitions of a directory in index order, fetching each
+// partition one page at a time. The directory index is refreshed after
+// each page so that partitions created by concurrent splits are visited
+// as well. Since a child partition always has a larger index than its
+// parent, entries moved by a split are never skipped, and entries moved
+// after the pages listing them had been read are dropped from the pages
+// of their new partition, so that each entry is listed exactly once.
+// In plus mode, entry attributes are fetched in the same round trip.
+//
+// Whenever the walk reaches a partition whose first page has not been
+// fetched, the first pages of the following partitions are fetched along
+// with it, keeping up to FLAGS_readdir_fanout reads outstanding but no
+// more than one per server. A split only ever moves entries to a newly
+// created partition, so pages fetched ahead never miss entries either.
+//
+class ScanIterator: virtual public DirIterator {
+ public:
+
+  ScanIterator(RPC* rpc, DirIndexPolicy* policy,
+               DirIndexEntry* entry, i64 dir_id, bool plus) :
+      rpc_(rpc), entry_(entry), dir_id_(dir_id), plus_(plus),
+      index_(0), pos_(0), listed_(policy) {
+    FetchNextPage();
+  }
+
+  virtual ~ScanIterator() {
+    entry_->GetCache()->Release(entry_);
+  }
+
+  void Next() {
+    DLOG_ASSERT(Valid());
+    if (++pos_ >= page_.names.size()) {
+      FetchNextPage();
+    }
+  }
+
+  bool Valid() {
+    return pos_ < page_.names.size();
+  }
+
+  void RetrieveEntryName(std::string* name) {
+    DLOG_ASSERT(Valid());
+    *name = page_.names[pos_];
+  }
+
+  void RetrieveEntryStat(StatInfo* info) {
+    DLOG_ASSERT(Valid());
+    DLOG_ASSERT(plus_);
+    *info = page_.stats[pos_];
+  }
+
+  Status status() {
+    return status_;
+  }
+
+ private:
+  struct Page {
+    std::vector<std::string> names;
+    std::vector<StatInfo> stats; // plus mode only
+    bool more_entries;
+    std::string end_key;
+    Page() : more_entries(false) { }
+    void Swap(Page* page) {
+      names.swap(page->names);
+      stats.swap(page->stats);
+      std::swap(more_entries, page->more_entries);
+      end_key.swap(page->end_key);
+    }
+  };
+
+  RPC* rpc_;
+  DirIndexEntry* entry_;
+  i64 dir_id_;
+  bool plus_;
+
+  int index_; // current partition
+  std::string start_hash_; // where to resume within that partition
+  Page page_;
+  size_t pos_;
+  std::map<int, Page> prefetched_; // first pages of following partitions
+  ListedPages listed_;
+  Status status_;
+
+  void FetchNextPage();
+  void Prefetch();
+  Status Fetch(int srv, int index, const std::string& start_hash, Page* page);
+  Status Recv(int srv, int index, Page* page);
+  void Admit(int index, const std::string& start_hash,
+             const std::string& dmap_data, Page* page);
+
+  // No copying allowed
+  ScanIterator(const ScanIterator&);
+  ScanIterator& operator=(const ScanIterator&);
+};
+
+// Merges the directory index returned with a page, and drops the entries
+// already listed from the partitions they were split from. Pages must be
+// admitted in the order they are received, which lists the pages read
+// before a split ahead of those read from the partitions it created.
+//
+void ScanIterator::Admit(int index, const std::string& start_hash,
+        const std::string& dmap_data, Page* page) {
+  entry_->index->Update(dmap_data);
+  listed_.Filter(index, &page->names, plus_ ? &page->stats : NULL);
+  listed_.Add(index, start_hash,
+          page->more_entries ? page->end_key : std::string(), dmap_data);
+}
+
+// Fetches a page synchronously.
+//
+Status ScanIterator::Fetch(int srv, int index,
+        const std::string& start_hash, Page* page) {
+  Status s;
+  if (plus_) {
+    ScanPlusResult result;
+    s = RPC_ReaddirPlus(rpc_, srv, dir_id_, index,
+            start_hash, FLAGS_readdir_pagesize, &result);
+    if (s.ok()) {
+      page->names.swap(result.names);
+      page->stats.swap(result.entries);
+      page->more_entries = result.more_entries;
+      page->end_key.swap(result.end_key);
+      Admit(index, start_hash, result.dmap_data, page);
+    }
+  } else {
+    ScanResult result;
+    s = RPC_ReaddirScan(rpc_, srv, dir_id_, index,
+            start_hash, FLAGS_readdir_pagesize, &result);
+    if (s.ok()) {
+      page->names.swap(result.entries);
+      page->more_entries = result.more_entries;
+      page->end_key.swap(result.end_key);
+      Admit(index, start_hash, result.dmap_data, page);
+    }
+  }
+  return s;
+}
+
+// Receives the first page of a partition requested by Prefetch.
+//
+Status ScanIterator::Recv(int srv, int index, Page* page) {
+  Status s;
+  if (plus_) {
+    ScanPlusResult result;
+    s = RPC_RecvReaddirPlus(rpc_, srv, &result);
+    if (s.ok()) {
+      page->names.swap(result.names);
+      page->stats.swap(result.entries);
+      page->more_entries = result.more_entries;
+      page->end_key.swap(result.end_key);
+      Admit(index, std::string(), result.dmap_data, page);
+    }
+  } else {
+    ScanResult result;
+    s = RPC_RecvReaddirScan(rpc_, srv, &result);
+    if (s.ok()) {
+      page->names.swap(result.entries);
+      page->more_entries = result.more_entries;
+      page->end_key.swap(result.end_key);
+      Admit(index, std::string(), result.dmap_data, page);
+    }
+  }
+  return s;
+}
+
+// Fetches the first pages of the current partition and of the ones
+// following it concurrently. Partitions whose reads cannot be issued,
+// such as those on a server with other requests outstanding, are left
+// to be fetched synchronously. All replies are collected even if some
+// of the reads fail.
+//
+void ScanIterator::Prefetch() {
+  DirIndex* dir_idx = entry_->index;
+  const size_t limit = FLAGS_readdir_fanout > 0 ? FLAGS_readdir_fanout : 1;
+  std::set<int> busy_servers;
+  std::vector<std::pair<int, int> > in_flight; // (server, partition)
+  for (int idx = index_;
+       idx < (1 << dir_idx->FetchBitmapRadix()) && in_flight.size() < limit;
        ++idx) {
+    if (dir_idx->GetBit(idx) && prefetched_.count(idx) == 0) {
+      int srv = dir_idx->GetServerForIndex(idx);
+      if (busy_servers.count(srv) == 0) {
+        if (RPC_SendReaddirScan(rpc_, srv, dir_id_, idx,
+                std::string(), FLAGS_readdir_pagesize, plus_).ok()) {
+          busy_servers.insert(srv);
+          in_flight.push_back(std::make_pair(srv, idx));
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < in_flight.size(); ++i) {
+    Page page;
+    Status s = Recv(in_flight[i].first, in_flight[i].second, &page);
+    if (s.ok()) {
+      prefetched_[in_flight[i].second].Swap(&page);
+    } else if (status_.ok()) {
+      status_ = s;
+    }
+  }
+}
+
+void ScanIterator::FetchNextPage() {
+  DirIndex* dir_idx = entry_->index;
+  Page empty_page;
+  page_.Swap(&empty_page);
+  pos_ = 0;
+  while (page_.names.empty() && status_.ok() &&
+         index_ < (1 << dir_idx->FetchBitmapRadix())) {
+    if (!dir_idx->GetBit(index_)) {
+      index_++;
+      continue;
+    }
+    if (start_hash_.empty() && FLAGS_readdir_fanout > 1 &&
+        prefetched_.count(index_) == 0) {
+      Prefetch();
+      if (!status_.ok()) {
+        break;
+      }
+    }
+    std::map<int, Page>::iterator it = prefetched_.find(index_);
+    if (start_hash_.empty() && it != prefetched_.end()) {
+      page_.Swap(&it->second);
+      prefetched_.erase(it);
+    } else {
+      int srv = dir_idx->GetServerForIndex(index_);
+      status_ = Fetch(srv, index_, start_hash_, &page_);
+    }
+    if (status_.ok()) {
+      if (page_.more_entries) {
+        start_hash_.swap(page_.end_key);
+      } else {
+        start_hash_.clear();
+        index_++;
+      }
+    }
+  }
+}
+}
+
+// Reads all partitions of a directory, keeping up to FLAGS_readdir_fanout
+// partition reads outstanding at the same time, but no more than one per
+// server. Replies are merged as they arrive and used to refresh the
+// directory index, so partitions discovered along the way are read as well.
+// Entries of those partitions may have been read already from the partitions
+// they were split from, so names are deduplicated once any has been read.
+// All outstanding replies are collected before an error is returned.
+//
+Status RPCEngine::ReadDir(i64 dir_id, NameList* names) {
+  const size_t limit = FLAGS_readdir_fanout > 0 ? FLAGS_readdir_fanout : 1;
+  const size_t num_listed = names->size();
+  std::set<int16_t> initial;
+  for (int16_t idx = 0; idx < (1 << dir_idx_->FetchBitmapRadix()); ++idx) {
     if (dir_idx_->GetBit(idx)) {
-      EntryList list;
-      srv_id_ = dir_idx_->GetServerForIndex(idx);
-      Status s_ = RPC_Readdir(rpc_, srv_id_, dir_id, idx, &list);
-      if (s_.ok()) {
-        names->insert(names->end(), list.entries.begin(), list.entries.end());
-        dir_idx_->Update(list.dmap_data);
+      initial.insert(idx);
+    }
+  }
+  bool discovered = false;
+  std::set<int16_t> visited;
+  std::set<int> busy_servers;
+  std::deque<std::pair<int, int16_t> > in_flight; // (server, partition)
+  Status s;
+  while (true) {
+    for (int16_t idx = 0;
+         s.ok() && idx < (1 << dir_idx_->FetchBitmapRadix()) &&
+         in_flight.size() < limit;
+         ++idx) {
+      if (dir_idx_->GetBit(idx) && visited.count(idx) == 0) {
+        srv_id_ = dir_idx_->GetServerForIndex(idx);
+        if (busy_servers.count(srv_id_) == 0) {
+          s = RPC_SendReaddir(rpc_, srv_id_, dir_id, idx);
+          if (s.ok()) {
+            discovered |= initial.count(idx) == 0;
+            visited.insert(idx);
+            busy_servers.insert(srv_id_);
+            in_flight.push_back(std::make_pair(srv_id_, idx));
+          }
+        }
       }
     }
+    if (in_flight.empty()) {
+      break;
+    }
+    EntryList list;
+    srv_id_ = in_flight.front().first;
+    in_flight.pop_front();
+    busy_servers.erase(srv_id_);
+    Status s_ = RPC_RecvReaddir(rpc_, srv_id_, &list);
+    if (!s_.ok()) {
+      if (s.ok()) {
+        s = s_;
+      }
+    } else if (s.ok()) {
+      names->insert(names->end(), list.entries.begin(), list.entries.end());
+      dir_idx_->Update(list.dmap_data);
+    }
+  }
+  if (s.ok() && discovered) {
+    NameList::iterator first = names->begin() + num_listed;
+    std::sort(first, names->end());
+    names->erase(std::unique(first, names->end()), names->end());
   }
-  return Status::OK();
+  return s;
 }
 
 Status ClientImpl::ReadDir(const std::string& path, NameList* names) {
@@ -49,10 +543,8 @@ Status ClientImpl::ReadDir(const std::string& path, NameList* names) {
   if (!s.ok()) {
     return s;
   }
-  DirIndexEntry* entry = FetchIndex(oid.dir_id, zeroth_server);
-  if (entry == NULL) {
-    s = Status::Corruption("Missing index");
-  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
   if (s.ok()) {
     DirIndexGuard idx_guard(entry);
     s = RPCEngine(entry->index, rpc_).ReadDir(oid.dir_id, names);
@@ -60,12 +552,51 @@ Status ClientImpl::ReadDir(const std::string& path, NameList* names) {
   return s;
 }
 
-Status RPCEngine::ListDir(i64 dir_id, NameList* names, StatList* stats) {
-  return Status::Corruption("Not implemented");
+Status ClientImpl::OpenDirIterator(const std::string& path,
+        bool plus, DirIterator** iter) {
+  Status s;
+  OID oid;
+  int16_t zeroth_server;
+  *iter = NULL;
+  s = ResolvePath(std::string(path + "/_"), &oid, &zeroth_server);
+  if (!s.ok()) {
+    return s;
+  }
+  DirIndexEntry* entry = NULL;
+  s = FetchIndex(oid.dir_id, zeroth_server, &entry);
+  if (s.ok()) {
+    // The iterator takes over the reference to the directory index
+    *iter = new ScanIterator(rpc_, index_policy_, entry, oid.dir_id, plus);
+  }
+  return s;
+}
+
+Status ClientImpl::ScanDir(const std::string& path, DirIterator** iter) {
+  return OpenDirIterator(path, false, iter);
+}
+
+Status ClientImpl::ScanDirPlus(const std::string& path, DirIterator** iter) {
+  return OpenDirIterator(path, true, iter);
 }
 
-Status ClientImpl::ListDir(const std::string& path, NameList* names, StatList stats) {
-  return Status::Corruption("Not implemented");
+Status ClientImpl::ListDir(const std::string& path,
+        NameList* names, StatList* stats) {
+  DirIterator* iter = NULL;
+  Status s = ScanDirPlus(path, &iter);
+  if (!s.ok()) {
+    return s;
+  }
+  std::string name;
+  StatInfo info;
+  for (; iter->Valid(); iter->Next()) {
+    iter->RetrieveEntryName(&name);
+    iter->RetrieveEntryStat(&info);
+    names->push_back(name);
+    stats->push_back(info);
+  }
+  s = iter->status();
+  delete iter;
+  return s;
 }
 
 } // namespace indexfs
@@ -0,0 +1,298 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <map>
+#include <set>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gflags/gflags.h>
+
+#include "ipc/callback.h"
+#include "ipc/rpc_impl.h"
+#include "client/client_impl.h"
+#include "common/unit_test.h"
+
+DECLARE_int32(readdir_pagesize);
+DECLARE_int32(readdir_fanout);
+
+namespace indexfs { namespace test {
+
+namespace {
+static const int kNumServers = 8;
+static const int kNumFiles = 256;
+static const int kPageSize = 8;
+
+enum ListMode { kReadDir, kScanDir, kListDir };
+
+static std::string FileName(int i) {
+  char name[32];
+  snprintf(name, sizeof(name), "f%d", i);
+  return name;
+}
+
+static std::string NameHash(const std::string& name) {
+  char hash[16];
+  return std::string(hash, DirIndex::GetNameHash(name, hash));
+}
+
+// The root directory spread over all servers. Its partitions are kept in
+// one place so that they can be split at any point during a scan. Pages
+// are served along with the index they were read under, just as the real
+// servers do under the directory lock.
+//
+class FakeDir {
+ public:
+
+  FakeDir() : policy_(DirIndexPolicy::TEST_NewPolicy(kNumServers, kNumServers)),
+      index_(NULL), num_pages_(0) {
+  }
+
+  ~FakeDir() {
+    delete index_;
+    delete policy_;
+  }
+
+  // Starts over with all files in two partitions, splitting every
+  // partition once the given numbers of pages have been served.
+  void Reset(const std::set<int>& split_points) {
+    MutexLock lock(&mu_);
+    delete index_;
+    index_ = policy_->NewDirIndex(0, 0);
+    partitions_.clear();
+    for (int i = 0; i < kNumFiles; ++i) {
+      std::string name = FileName(i);
+      partitions_[0].insert(std::make_pair(NameHash(name), name));
+    }
+    SplitAll();
+    split_points_ = split_points;
+    num_pages_ = 0;
+  }
+
+  int NumPagesServed() {
+    MutexLock lock(&mu_);
+    return num_pages_;
+  }
+
+  void ReadBitmap(std::string& _return) {
+    MutexLock lock(&mu_);
+    _return = index_->ToSlice().ToString();
+  }
+
+  void Scan(int srv, int index, const std::string& start_hash,
+            int max_entries, std::vector<std::string>* names,
+            std::string* end_key, int16_t* more_entries, std::string* dmap_data) {
+    MutexLock lock(&mu_);
+    if (split_points_.count(num_pages_++) != 0) {
+      SplitAll();
+    }
+    ASSERT_TRUE(index_->GetBit(index));
+    ASSERT_EQ(index_->GetServerForIndex(index), srv);
+    Partition& partition = partitions_[index];
+    Partition::iterator it =
+        partition.lower_bound(std::make_pair(start_hash, std::string()));
+    for (; it != partition.end() &&
+           static_cast<int>(names->size()) < max_entries; ++it) {
+      names->push_back(it->second);
+    }
+    *more_entries = it != partition.end() ? 1 : 0;
+    if (*more_entries) {
+      *end_key = it->first;
+    }
+    *dmap_data = index_->ToSlice().ToString();
+  }
+
+ private:
+  typedef std::set<std::pair<std::string, std::string> > Partition;
+
+  Mutex mu_;
+  DirIndexPolicy* policy_;
+  DirIndex* index_;
+  std::map<int, Partition> partitions_;
+  std::set<int> split_points_;
+  int num_pages_;
+
+  // Splits every partition that can be split, moving entries the same way
+  // the servers do.
+  void SplitAll() {
+    std::vector<int> indices;
+    for (int i = 0; i < (1 << index_->FetchBitmapRadix()); ++i) {
+      if (index_->IsSplittable(i)) {
+        indices.push_back(i);
+      }
+    }
+    for (size_t i = 0; i < indices.size(); ++i) {
+      int child = index_->NewIndexForSplitting(indices[i]);
+      Partition& parent = partitions_[indices[i]];
+      Partition::iterator it = parent.begin();
+      while (it != parent.end()) {
+        if (DirIndex::ToBeMigrated(child, it->first.data())) {
+          partitions_[child].insert(*it);
+          parent.erase(it++);
+        } else {
+          ++it;
+        }
+      }
+      index_->SetBit(child);
+    }
+  }
+
+  // No copying allowed
+  FakeDir(const FakeDir&);
+  FakeDir& operator=(const FakeDir&);
+};
+
+// Serves one server's share of the fake directory.
+//
+class FakeService: public MetadataIndexServiceNull {
+ public:
+  FakeService(FakeDir* dir, int srv) : dir_(dir), srv_(srv) { }
+  void ReadBitmap(std::string& _return, const int64_t dir_id) {
+    dir_->ReadBitmap(_return);
+  }
+  void Readdir(EntryList& _return, const int64_t dir_id, const int16_t index) {
+    std::string end_key;
+    int16_t more_entries;
+    dir_->Scan(srv_, index, std::string(), kNumFiles,
+            &_return.entries, &end_key, &more_entries, &_return.dmap_data);
+  }
+  void ReaddirScan(ScanResult& _return, const int64_t dir_id,
+          const int16_t index, const std::string& start_hash,
+          const int32_t max_entries) {
+    dir_->Scan(srv_, index, start_hash, max_entries, &_return.entries,
+            &_return.end_key, &_return.more_entries, &_return.dmap_data);
+    _return.end_partition = index;
+  }
+  void ReaddirPlus(ScanPlusResult& _return, const int64_t dir_id,
+          const int16_t index, const std::string& start_hash,
+          const int32_t max_entries) {
+    dir_->Scan(srv_, index, start_hash, max_entries, &_return.names,
+            &_return.end_key, &_return.more_entries, &_return.dmap_data);
+    _return.end_partition = index;
+    for (size_t i = 0; i < _return.names.size(); ++i) {
+      StatInfo info;
+      info.id = atoi(_return.names[i].c_str() + 1);
+      _return.entries.push_back(info);
+    }
+  }
+ private:
+  FakeDir* dir_;
+  int srv_;
+};
+
+static void* RunServer(void* arg) {
+  reinterpret_cast<SrvRep*>(arg)->Start();
+  return NULL;
+}
+}
+
+class ReadDirTest {
+ public:
+  Config* config_;
+  FakeDir dir_;
+  std::vector<SrvRep*> servers_;
+  std::vector<pthread_t> threads_;
+
+  ReadDirTest() : threads_(kNumServers) {
+    FLAGS_lease_callbacks = false;
+    FLAGS_readdir_pagesize = kPageSize;
+    FLAGS_readdir_fanout = 4;
+    config_ = Config::CreateServerTestingConfig();
+    std::vector<std::pair<std::string, int> > addrs;
+    for (int i = 0; i < kNumServers; ++i) {
+      int port = config_->GetDefaultSrvPort() + i;
+      addrs.push_back(std::make_pair("127.0.0.1", port));
+      // The service is disposed of by the server
+      servers_.push_back(new SrvRep(new FakeService(&dir_, i), port));
+      ASSERT_EQ(pthread_create(&threads_[i], NULL, RunServer, servers_[i]), 0);
+    }
+    ASSERT_TRUE(config_->SetServers(addrs).ok());
+    usleep(100 * 1000); // Wait for the servers to start listening
+  }
+
+  ~ReadDirTest() {
+    for (int i = 0; i < kNumServers; ++i) {
+      servers_[i]->Stop();
+      pthread_join(threads_[i], NULL);
+      delete servers_[i];
+    }
+    delete config_;
+  }
+
+  // Lists the root directory with a new client, which has to fetch the
+  // directory index from scratch, and counts the times each file is listed.
+  void ListRoot(ListMode mode, std::map<std::string, int>* counts) {
+    ClientImpl client(config_, Env::Default());
+    ASSERT_TRUE(client.Init().ok());
+    NameList names;
+    StatList stats;
+    if (mode == kReadDir) {
+      ASSERT_TRUE(client.ReadDir("/", &names).ok());
+    } else if (mode == kScanDir) {
+      DirIterator* iter = NULL;
+      ASSERT_TRUE(client.ScanDir("/", &iter).ok());
+      std::string name;
+      for (; iter->Valid(); iter->Next()) {
+        iter->RetrieveEntryName(&name);
+        names.push_back(name);
+      }
+      ASSERT_TRUE(iter->status().ok());
+      delete iter;
+    } else {
+      ASSERT_TRUE(client.ListDir("/", &names, &stats).ok());
+      ASSERT_EQ(stats.size(), names.size());
+      for (size_t i = 0; i < names.size(); ++i) {
+        ASSERT_EQ(FileName(static_cast<int>(stats[i].id)), names[i]);
+      }
+    }
+    ASSERT_TRUE(client.Dispose().ok());
+    for (size_t i = 0; i < names.size(); ++i) {
+      (*counts)[names[i]]++;
+    }
+  }
+
+  void CheckListedOnce(const std::map<std::string, int>& counts) {
+    ASSERT_EQ(static_cast<int>(counts.size()), kNumFiles);
+    for (int i = 0; i < kNumFiles; ++i) {
+      std::map<std::string, int>::const_iterator it = counts.find(FileName(i));
+      ASSERT_TRUE(it != counts.end());
+      ASSERT_EQ(it->second, 1);
+    }
+  }
+};
+
+// Every file must be listed exactly once whether or not the directory
+// is split while being listed, for every point at which the splits may
+// happen: before, between, or after the pages of any partition.
+//
+TEST(ReadDirTest, ExactlyOnceAcrossSplits) {
+  const ListMode modes[] = { kReadDir, kScanDir, kListDir };
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+    const ListMode mode = modes[m];
+    std::map<std::string, int> counts;
+    dir_.Reset(std::set<int>());
+    ListRoot(mode, &counts);
+    CheckListedOnce(counts);
+    const int num_pages = dir_.NumPagesServed();
+    for (int first = 0; first <= num_pages; ++first) {
+      for (int gap = 1; gap <= 3; ++gap) {
+        std::set<int> split_points;
+        split_points.insert(first);
+        split_points.insert(first + gap);
+        dir_.Reset(split_points);
+        counts.clear();
+        ListRoot(mode, &counts);
+        CheckListedOnce(counts);
+      }
+    }
+  }
+}
+
+} /* namespace test */ } /* namespace indexfs */
+
+int main(int argc, char* argv[]) {
+  return indexfs::test::RunAllTests();
+}
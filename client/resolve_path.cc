@@ -2,17 +2,51 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <limits>
+#include <algorithm>
+
 #include "client/client_impl.h"
 
 namespace indexfs {
 
+DEFINE_int32(zeroth_wait_time, 500 * 1000, "Max time (in micros) to wait for the zeroth partition of a new directory");
+
+namespace {
+// Min and max delays (in micros) between attempts to
+// fetch the index of a directory not yet installed
+static const int kMinZerothRetryDelay = 1000;
+static const int kMaxZerothRetryDelay = 32 * 1000;
+// Collects the names of all intermediate components that follow
+// the given position in a path.
+static
+void ListRemainingNames(const std::string& path,
+        size_t pos, size_t end, NameList* names) {
+  size_t now;
+  while (pos < end) {
+    now = path.find("/", pos + 1);
+    if (now - pos > 1) {
+      names->push_back(path.substr(pos + 1, now - pos - 1));
+    }
+    pos = now;
+  }
+}
+}
+
 // Resolve the given full path by looking up intermediate entries until
-// we reach the last component.
+// we reach the last component. The path cache is consulted first for the
+// longest cached prefix of the parent path, after which the remaining
+// components are resolved one by one through the lookup cache. On a lookup
+// cache miss, the missing component and the ones following it are resolved
+// together with a single request to the server holding the missing component.
+// Once resolved, the parent path is cached with the earliest lease among
+// its components so it never outlives any of them.
 //
 Status ClientImpl::ResolvePath(const std::string& path,
                                OID* oid, int16_t* zeroth_server) {
   Status s;
+  const uint64_t epoch = __sync_add_and_fetch(&revoke_epoch_, 0);
   *zeroth_server = -1;
+  oid->client_id = client_id_;
   oid->dir_id = -1;
   oid->path_depth = 0;
   oid->obj_name = "/";
@@ -31,6 +65,22 @@ Status ClientImpl::ResolvePath(const std::string& path,
   *zeroth_server = 0;
   oid->dir_id = 0;
   size_t now = 0, last = 0, end = path.rfind("/");
+  int64_t lease_due = std::numeric_limits<int64_t>::max();
+  PathEntry prefix;
+  size_t pos = end;
+  while (pos > 0) {
+    if (path_cache_->Get(Slice(path.data(), pos), &prefix)
+        && env_->NowMicros() <= prefix.lease_due && prefix.epoch == epoch) {
+      *zeroth_server = prefix.zeroth_server;
+      oid->dir_id = prefix.inode_no;
+      oid->path_depth = prefix.path_depth;
+      lease_due = prefix.lease_due;
+      last = pos;
+      break;
+    }
+    pos = path.rfind("/", pos - 1);
+  }
+  const bool parent_cached = (last == end);
   while (last < end) {
     now = path.find("/", last + 1);
     if (now - last > 1) {
@@ -38,29 +88,37 @@ Status ClientImpl::ResolvePath(const std::string& path,
       oid->obj_name = path.substr(last + 1, now - last - 1);
       LookupEntry* entry = lookup_cache_->Get(*oid);
       if (entry == NULL || env_->NowMicros() > entry->lease_due) {
-        LookupInfo info;
-        s = Lookup(*oid, *zeroth_server, &info, entry != NULL);
+        lookup_cache_->Release(entry);
+        NameList names;
+        ListRemainingNames(path, now, end, &names);
+        s = LookupPrefix(*oid, *zeroth_server, names);
         if (!s.ok()) {
-          lookup_cache_->Release(entry);
           return s;
         }
+        entry = lookup_cache_->Get(*oid);
         if (entry == NULL) {
-          entry = lookup_cache_->New(*oid, info);
-        } else {
-          entry->uid = info.uid;
-          entry->gid = info.gid;
-          entry->perm = info.perm;
-          entry->lease_due = info.lease_due;
+          return Status::Corruption("Missing lookup entry");
         }
-        DLOG_ASSERT(entry->inode_no == info.id);
-        DLOG_ASSERT(entry->zeroth_server == info.zeroth_server);
+      } else if (entry->IsNegative()) {
+        lookup_cache_->Release(entry);
+        return Status::NotFound(Slice());
       }
       *zeroth_server = entry->zeroth_server;
       oid->dir_id = entry->inode_no;
+      lease_due = std::min(lease_due, entry->lease_due);
       lookup_cache_->Release(entry);
     }
     last = now;
   }
+  if (!parent_cached) {
+    PathEntry parent;
+    parent.inode_no = oid->dir_id;
+    parent.zeroth_server = *zeroth_server;
+    parent.path_depth = oid->path_depth;
+    parent.lease_due = lease_due;
+    parent.epoch = epoch;
+    path_cache_->Put(Slice(path.data(), end), parent);
+  }
   oid->path_depth++;
   oid->obj_name = path.substr(end + 1);
   return s;
@@ -81,13 +139,38 @@ Status RPC_ReadBitmap(RPC* rpc, int srv,
         i64 dir_id, std::string* dmap_data) {
   Status s;
   try {
-    rpc->GetClient(srv)->ReadBitmap(*dmap_data, dir_id);
+    RPC_Stub(rpc, srv)->ReadBitmap(*dmap_data, dir_id);
   } catch (IOError &ioe) {
     s = Status::IOError(ioe.message);
   } catch (ServerInternalError &sie) {
     s = Status::Corruption(sie.message);
   } catch (UnrecognizedDirectoryError &ude) {
-    s = Status::Corruption("Unrecognized directory id");
+    s = Status::NotFound("Unrecognized directory id");
+  }
+  return s;
+}
+// Zeroth partitions of new directories are installed in the background,
+// so the home server of a directory just looked up may not know that
+// directory yet. Such directories are waited for here, at the client,
+// rather than at servers, which never wait for unknown directories.
+// A directory still unknown once the wait is over is reported as an
+// IOError, as for an unreachable server, so that callers may retry.
+static
+Status RPC_ReadBitmapWithRetry(RPC* rpc, int srv,
+        i64 dir_id, std::string* dmap_data) {
+  Status s = RPC_ReadBitmap(rpc, srv, dir_id, dmap_data);
+  if (s.IsNotFound() && FLAGS_zeroth_wait_time > 0) {
+    Env* env = Env::Default();
+    uint64_t deadline = env->NowMicros() + FLAGS_zeroth_wait_time;
+    int delay = kMinZerothRetryDelay;
+    do {
+      env->SleepForMicroseconds(delay);
+      delay = std::min(2 * delay, kMaxZerothRetryDelay);
+      s = RPC_ReadBitmap(rpc, srv, dir_id, dmap_data);
+    } while (s.IsNotFound() && env->NowMicros() < deadline);
+  }
+  if (s.IsNotFound()) {
+    s = Status::IOError("Directory index not yet available");
   }
   return s;
 }
@@ -97,24 +180,28 @@ Status RPC_ReadBitmap(RPC* rpc, int srv,
 // If possible, the index is directly obtained from the local
 // cache albeit with a possible stale value.
 //
-// Returns NULL if no such index can be found either from the local cache
-// or from the remote server, or if the index we retrieved cannot be resolved.
+// Stores NULL in *entry and returns a non-OK status if no such index can be
+// found either from the local cache or from the remote server, or if the
+// index we retrieved cannot be resolved.
 //
-DirIndexEntry* ClientImpl::FetchIndex(int64_t dir_id, int16_t zeroth_server) {
-  DirIndexEntry* result = index_cache_->Get(dir_id);
-  if (result == NULL) {
-    Status s_;
+Status ClientImpl::FetchIndex(int64_t dir_id, int16_t zeroth_server,
+        DirIndexEntry** entry) {
+  Status s;
+  *entry = index_cache_->Get(dir_id);
+  if (*entry == NULL) {
     std::string dmap_data;
-    s_ = RPC_ReadBitmap(rpc_, (U16INT(zeroth_server))
+    s = RPC_ReadBitmapWithRetry(rpc_, (U16INT(zeroth_server))
             % config_->GetSrvNum(), dir_id, &dmap_data);
-    if (s_.ok()) {
+    if (s.ok()) {
       DirIndex* dir_idx = index_policy_->RecoverDirIndex(dmap_data);
       if (dir_idx != NULL) {
-        result = index_cache_->Insert(dir_idx);
+        *entry = index_cache_->Insert(dir_idx);
+      } else {
+        s = Status::Corruption("Missing index");
       }
     }
   }
-  return result;
+  return s;
 }
 
 } // namespace indexfs
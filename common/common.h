@@ -23,6 +23,7 @@ typedef std::vector<std::string> NameList;
 
 typedef const int16_t i16;
 #define U16INT(i16) static_cast<uint16_t>(i16)
+typedef const int32_t i32;
 typedef const int64_t i64;
 #define U64INT(i64) static_cast<uint64_t>(i64)
 
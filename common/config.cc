@@ -80,6 +80,19 @@ Status Config::LoadNetworkInfo() {
   return s;
 }
 
+bool Config::IsSrvOnLocalHost(int srv_id) {
+  const std::string& ip = GetSrvIP(srv_id);
+  if (ip == "127.0.0.1" || ip == "localhost" || ip == host_name_) {
+    return true;
+  }
+  for (size_t i = 0; i < ip_addrs_.size(); i++) {
+    if (ip == ip_addrs_[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // Reset the instance id unconditionally.
 //
 Status Config::SetSrvId(int srv_id) {
@@ -26,6 +26,14 @@ enum InstanceType {
   kBatchClient,
 };
 
+// Durability of metadata updates.
+//
+enum SyncMode {
+  kSyncNone,  // acknowledged before reaching the log on disk
+  kSyncEach,  // synced to the log before being acknowledged
+  kSyncGroup, // same as kSyncEach, but concurrent updates share log syncs
+};
+
 // The main configuration interface shared by both clients and servers
 //
 class Config {
@@ -155,6 +163,10 @@ class Config {
   //
   const std::pair<std::string, int>& GetSrvAddr(int srv_id) { return srv_addrs_[srv_id]; }
 
+  // Returns true iff a given server runs on the local host.
+  //
+  bool IsSrvOnLocalHost(int srv_id);
+
   // Returns the storage directory for user file data
   //
   const std::string& GetFileDir() { return file_dir_; }
@@ -221,6 +233,24 @@ class Config {
     return result > 0 ? result : DEFAULT_DENT_CACHE_SIZE;
   }
 
+  // Returns how durable metadata updates are when acknowledged.
+  //
+  SyncMode GetSyncMode() {
+    const char* env = getenv("FS_SYNC_MODE");
+    int result = ( env != NULL ? atoi(env) : DEFAULT_SYNC_MODE );
+    return static_cast<SyncMode>(
+        result >= kSyncNone && result <= kSyncGroup ? result : DEFAULT_SYNC_MODE);
+  }
+
+  // Returns the max time (in millis) between log syncs
+  // that updates may wait for under group commit.
+  //
+  int GetSyncInterval() {
+    const char* env = getenv("FS_SYNC_INTERVAL");
+    int result = ( env != NULL ? atoi(env) : DEFAULT_LEVELDB_SYNC_INTERVAL );
+    return result > 0 ? result : DEFAULT_LEVELDB_SYNC_INTERVAL;
+  }
+
   Status VerifyInstanceInfoAndServerList();
   Status LoadNetworkInfo();
   Status LoadServerList(const char* server_list);
@@ -11,11 +11,19 @@ namespace indexfs {
 
 DirCtrlBlock::DirCtrlBlock()
   : disable_splitting(false),
-    size_map(),
+    size_map_(),
     locked_(false),
+    splitting_(false),
+    num_readers_(0),
+    num_waiting_writers_(0),
+    num_suspended_(0),
+    locked_partitions_(),
+    index_version_(0),
     mtx_(),
     dir_cv_(&mtx_),
-    lock_cv_(&mtx_) {
+    lock_cv_(&mtx_),
+    part_cv_(&mtx_),
+    split_cv_(&mtx_) {
 # ifndef NDEBUG
   lock_owner_ = -1; // this means nobody owns the lock
 # endif
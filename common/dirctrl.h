@@ -6,6 +6,7 @@
 #define _INDEXFS_COMMON_DIRCTRL_H_
 
 #include <map>
+#include <set>
 
 #include "common/logging.h"
 #include "common/common.h"
@@ -21,6 +22,18 @@ class DirCtrlGuard;
 // Directory Control Block
 // -------------------------------------------------------------
 
+// The directory lock can be held either exclusively by a single thread,
+// or in shared mode by many threads at once. Shared holders that modify
+// a directory partition must in addition lock that partition, which
+// excludes other shared holders working on the same partition only.
+// Writers are preferred over new shared holders to avoid starvation.
+//
+// A partition holder may suspend itself for a long wait, releasing both
+// its partition lock and its shared lock. The directory cannot be locked
+// exclusively until all suspended holders have resumed, so the partition
+// layout they rely on stays the same, but writers waiting for them do not
+// hold back new shared holders in the meantime.
+//
 class DirCtrlBlock {
  public:
 
@@ -43,15 +56,118 @@ class DirCtrlBlock {
     DoLock();
   }
 
+  void LockShared() {
+    MutexLock lock(&mtx_);
+    while (locked_ || num_waiting_writers_ > 0) {
+      lock_cv_.Wait();
+    }
+    num_readers_++;
+  }
+
+  void UnlockShared() {
+    MutexLock lock(&mtx_);
+    DoUnlockShared();
+  }
+
+  // REQUIRES: the directory lock is held in shared mode.
+  void LockPartition(int index) {
+    MutexLock lock(&mtx_);
+    DoLockPartition(index);
+  }
+
+  void UnlockPartition(int index) {
+    MutexLock lock(&mtx_);
+    DoUnlockPartition(index);
+  }
+
+  void WaitPartition(int index) {
+    MutexLock lock(&mtx_);
+    DoSuspendPartition(index);
+    dir_cv_.Wait();
+    DoResumePartition(index);
+  }
+
+  // Releases a partition lock and the shared directory lock held with it.
+  // REQUIRES: the partition lock is held.
+  void SuspendPartition(int index) {
+    MutexLock lock(&mtx_);
+    DoSuspendPartition(index);
+  }
+
+  // Reacquires the locks released by SuspendPartition.
+  void ResumePartition(int index) {
+    MutexLock lock(&mtx_);
+    DoResumePartition(index);
+  }
+
   void NotifyAll() {
     dir_cv_.SignalAll();
   }
 
+  // Serializes directory splitting within this directory only,
+  // allowing other directories to be split at the same time.
+  // Note that this is independent of the directory lock.
+  void BeginSplit() {
+    MutexLock lock(&mtx_);
+    while (splitting_) {
+      split_cv_.Wait();
+    }
+    splitting_ = true;
+  }
+
+  void EndSplit() {
+    MutexLock lock(&mtx_);
+    DLOG_ASSERT(splitting_);
+    splitting_ = false;
+    split_cv_.SignalAll();
+  }
+
+  bool TestIfSplitting() {
+    MutexLock lock(&mtx_);
+    return splitting_;
+  }
+
   bool TestIfLocked() {
     MutexLock lock(&mtx_);
     return locked_;
   }
 
+  bool TestIfLockedShared() {
+    MutexLock lock(&mtx_);
+    return num_readers_ > 0;
+  }
+
+  bool TestIfPartitionLocked(int index) {
+    MutexLock lock(&mtx_);
+    return locked_partitions_.count(index) != 0;
+  }
+
+  // A sequence counter that is odd while the directory index is being
+  // updated. Lock-free readers sample it before and after reading and
+  // retry with the directory lock if it has changed in between.
+  uint64_t ReadIndexVersion() {
+    return __sync_add_and_fetch(&index_version_, 0);
+  }
+
+  // REQUIRES: the directory lock is held in exclusive mode.
+  void BeginIndexUpdate() {
+    __sync_add_and_fetch(&index_version_, 1);
+  }
+
+  void EndIndexUpdate() {
+    __sync_add_and_fetch(&index_version_, 1);
+  }
+
+  bool IsSplittingDisabled() {
+    MutexLock lock(&mtx_);
+    return disable_splitting;
+  }
+
+  void SetSplittingDisabled(bool disabled) {
+    MutexLock lock(&mtx_);
+    disable_splitting = disabled;
+  }
+
 # ifndef NDEBUG
   bool TestIfLockedByMe() {
     MutexLock lock(&mtx_);
@@ -60,27 +176,80 @@ class DirCtrlBlock {
 # endif
 
   bool disable_splitting;
-  std::map<int, int> size_map;
+
+  // Sizes of the partitions of this directory held by this server.
+  // Partitions are added under the exclusive directory lock, while each
+  // size is updated under the lock of its partition.
+
+  bool HasPartition(int index) {
+    MutexLock lock(&mtx_);
+    return size_map_.count(index) != 0;
+  }
+
+  int GetPartitionSize(int index) {
+    MutexLock lock(&mtx_);
+    std::map<int, int>::iterator it = size_map_.find(index);
+    return it != size_map_.end() ? it->second : 0;
+  }
+
+  void SetPartitionSize(int index, int size) {
+    MutexLock lock(&mtx_);
+    size_map_[index] = size;
+  }
+
+  // Sets the sizes of many partitions at once, so that
+  // the control block is never seen partially filled.
+  void SetPartitionSizes(const std::map<int, int>& sizes) {
+    MutexLock lock(&mtx_);
+    std::map<int, int>::const_iterator it = sizes.begin();
+    for (; it != sizes.end(); ++it) {
+      size_map_[it->first] = it->second;
+    }
+  }
+
+  // Returns the new size of the partition.
+  int AddPartitionSize(int index, int delta) {
+    MutexLock lock(&mtx_);
+    return size_map_[index] += delta;
+  }
 
   int TotalPartitionSize() {
+    MutexLock lock(&mtx_);
     int sum = 0;
     std::map<int, int>::iterator it;
-    for (it = size_map.begin(); it != size_map.end();
+    for (it = size_map_.begin(); it != size_map_.end();
          it++) {
       sum += it->second;
     }
     return sum;
   }
 
+  bool Empty() {
+    MutexLock lock(&mtx_);
+    return size_map_.empty();
+  }
+
+  size_t NumPartitions() {
+    MutexLock lock(&mtx_);
+    return size_map_.size();
+  }
+
   DirCtrlTable* GetTable() { return table_; }
-  bool Empty() const { return size_map.empty(); }
-  size_t NumPartitions() const { return size_map.size(); }
 
  private:
+  std::map<int, int> size_map_;
   bool locked_;
+  bool splitting_;
+  int num_readers_;
+  int num_waiting_writers_;
+  int num_suspended_; // partition holders suspended by SuspendPartition
+  std::set<int> locked_partitions_;
+  uint64_t index_version_;
   Mutex mtx_;
   CondVar dir_cv_;
   CondVar lock_cv_;
+  CondVar part_cv_;
+  CondVar split_cv_;
 
 # ifndef NDEBUG
   pthread_t lock_owner_;
@@ -88,8 +257,21 @@ class DirCtrlBlock {
 
   void DoLock() {
     mtx_.AssertHeld();
-    while (locked_) {
-      lock_cv_.Wait();
+    while (true) {
+      // Suspended holders may wait for long, so shared holders
+      // are let in while waiting for them to resume
+      while (num_suspended_ > 0) {
+        lock_cv_.Wait();
+      }
+      num_waiting_writers_++;
+      while ((locked_ || num_readers_ > 0) && num_suspended_ == 0) {
+        lock_cv_.Wait();
+      }
+      num_waiting_writers_--;
+      if (!locked_ && num_readers_ == 0 && num_suspended_ == 0) {
+        break;
+      }
+      lock_cv_.SignalAll();
     }
 #   ifndef NDEBUG
     DLOG_ASSERT(lock_owner_ == -1);
@@ -108,6 +290,51 @@ class DirCtrlBlock {
     lock_cv_.SignalAll();
   }
 
+  void DoUnlockShared() {
+    mtx_.AssertHeld();
+    DLOG_ASSERT(num_readers_ > 0);
+    if (--num_readers_ == 0) {
+      lock_cv_.SignalAll();
+    }
+  }
+
+  void DoSuspendPartition(int index) {
+    mtx_.AssertHeld();
+    DoUnlockPartition(index);
+    num_suspended_++;
+    DoUnlockShared();
+    lock_cv_.SignalAll();
+  }
+
+  // The directory cannot have been locked exclusively while suspended,
+  // so the shared lock is retaken even if writers are waiting.
+  void DoResumePartition(int index) {
+    mtx_.AssertHeld();
+    DLOG_ASSERT(!locked_);
+    DLOG_ASSERT(num_suspended_ > 0);
+    num_readers_++;
+    if (--num_suspended_ == 0) {
+      lock_cv_.SignalAll();
+    }
+    DoLockPartition(index);
+  }
+
+  void DoLockPartition(int index) {
+    mtx_.AssertHeld();
+    DLOG_ASSERT(num_readers_ > 0);
+    while (locked_partitions_.count(index) != 0) {
+      part_cv_.Wait();
+    }
+    locked_partitions_.insert(index);
+  }
+
+  void DoUnlockPartition(int index) {
+    mtx_.AssertHeld();
+    DLOG_ASSERT(locked_partitions_.count(index) != 0);
+    locked_partitions_.erase(index);
+    part_cv_.SignalAll();
+  }
+
   friend class DirCtrlTable;
   DirCtrlTable* table_;
   Cache::Handle* handle_;
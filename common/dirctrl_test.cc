@@ -2,6 +2,9 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <pthread.h>
+#include <unistd.h>
+
 #include "common/dirctrl.h"
 #include "common/logging.h"
 #include "common/unit_test.h"
@@ -13,15 +16,29 @@ struct DirCtrlTest {
   DirCtrlTable table_;
   DirCtrlTest() : table_() { }
 };
+
+struct LockerState {
+  DirCtrlBlock* blk;
+  volatile bool locked;
+};
+
+static
+void* LockAndRelease(void* arg) {
+  LockerState* state = reinterpret_cast<LockerState*>(arg);
+  state->blk->Lock();
+  state->locked = true;
+  state->blk->Unlock();
+  return NULL;
+}
 }
 
 TEST(DirCtrlTest, FetchNew) {
   DirCtrlBlock* blk = table_.Fetch(0);
   ASSERT_TRUE(blk->Empty());
   ASSERT_TRUE(!blk->disable_splitting);
-  blk->size_map[0] = 0;
-  blk->size_map[0]++;
-  ASSERT_TRUE(blk->size_map[0] == 1);
+  blk->SetPartitionSize(0, 0);
+  blk->AddPartitionSize(0, 1);
+  ASSERT_TRUE(blk->GetPartitionSize(0) == 1);
   table_.Evict(0);
   table_.Release(blk);
 }
@@ -51,6 +68,82 @@ TEST(DirCtrlTest, Lock) {
   table_.Release(blk);
 }
 
+TEST(DirCtrlTest, SharedLock) {
+  DirCtrlBlock* blk = table_.Fetch(0);
+  blk->LockShared();
+  blk->LockShared();
+  ASSERT_TRUE(blk->TestIfLockedShared());
+  ASSERT_TRUE(!blk->TestIfLocked());
+  blk->LockPartition(0);
+  blk->LockPartition(1);
+  ASSERT_TRUE(blk->TestIfPartitionLocked(0));
+  ASSERT_TRUE(blk->TestIfPartitionLocked(1));
+  ASSERT_TRUE(!blk->TestIfPartitionLocked(2));
+  blk->UnlockPartition(0);
+  blk->UnlockPartition(1);
+  ASSERT_TRUE(!blk->TestIfPartitionLocked(0));
+  blk->UnlockShared();
+  ASSERT_TRUE(blk->TestIfLockedShared());
+  blk->UnlockShared();
+  ASSERT_TRUE(!blk->TestIfLockedShared());
+  blk->Lock();
+  ASSERT_TRUE(blk->TestIfLocked());
+  ASSERT_TRUE(!blk->TestIfLockedShared());
+  blk->Unlock();
+  table_.Evict(0);
+  table_.Release(blk);
+}
+
+TEST(DirCtrlTest, SuspendPartition) {
+  DirCtrlBlock* blk = table_.Fetch(0);
+  blk->LockShared();
+  blk->LockPartition(0);
+  LockerState state;
+  state.blk = blk;
+  state.locked = false;
+  pthread_t writer;
+  ASSERT_TRUE(pthread_create(&writer, NULL, &LockAndRelease, &state) == 0);
+  usleep(10 * 1000);
+  ASSERT_TRUE(!state.locked);
+  blk->SuspendPartition(0);
+  ASSERT_TRUE(!blk->TestIfPartitionLocked(0));
+  // Shared holders are let in while the writer waits for the suspended one
+  blk->LockShared();
+  blk->LockPartition(0);
+  blk->UnlockPartition(0);
+  blk->UnlockShared();
+  usleep(10 * 1000);
+  ASSERT_TRUE(!state.locked);
+  blk->ResumePartition(0);
+  ASSERT_TRUE(blk->TestIfPartitionLocked(0));
+  ASSERT_TRUE(!state.locked);
+  blk->UnlockPartition(0);
+  blk->UnlockShared();
+  ASSERT_TRUE(pthread_join(writer, NULL) == 0);
+  ASSERT_TRUE(state.locked);
+  table_.Evict(0);
+  table_.Release(blk);
+}
+
+TEST(DirCtrlTest, SplitLock) {
+  DirCtrlBlock* blk1 = table_.Fetch(0);
+  DirCtrlBlock* blk2 = table_.Fetch(1);
+  blk1->BeginSplit();
+  ASSERT_TRUE(blk1->TestIfSplitting());
+  ASSERT_TRUE(!blk1->TestIfLocked());
+  ASSERT_TRUE(!blk2->TestIfSplitting());
+  blk2->BeginSplit();
+  ASSERT_TRUE(blk2->TestIfSplitting());
+  blk1->EndSplit();
+  blk2->EndSplit();
+  ASSERT_TRUE(!blk1->TestIfSplitting());
+  ASSERT_TRUE(!blk2->TestIfSplitting());
+  table_.Evict(0);
+  table_.Evict(1);
+  table_.Release(blk1);
+  table_.Release(blk2);
+}
+
 TEST(DirCtrlTest, Evict) {
   DirCtrlBlock* blk1 = table_.Fetch(0);
   blk1->disable_splitting = true;
@@ -11,7 +11,8 @@ DirGuard::~DirGuard() {
   index_cache_->Release(dir_data_.second);
 }
 
-DirGuard::DirGuard(const DirData& dir_data) : dir_data_(dir_data) {
+DirGuard::DirGuard(const DirData& dir_data) :
+    dir_data_(dir_data), locked_partition_(-1) {
   ctrl_table_ = dir_data_.first->GetTable();
   dir_idx_ = dir_data_.second->index;
   index_cache_ = dir_data_.second->GetCache();
@@ -32,21 +32,77 @@ class DirGuard {
     ctrl_block()->Unlock();
   }
 
+  void LockShared() {
+    ctrl_block()->LockShared();
+  }
+
+  void UnlockShared() {
+    ctrl_block()->UnlockShared();
+  }
+
+  void LockPartition(int index) {
+    DLOG_ASSERT(locked_partition_ < 0);
+    ctrl_block()->LockPartition(index);
+    locked_partition_ = index;
+  }
+
+  void UnlockPartition() {
+    DLOG_ASSERT(locked_partition_ >= 0);
+    ctrl_block()->UnlockPartition(locked_partition_);
+    locked_partition_ = -1;
+  }
+
+  // The following operate on the partition lock if one is held through
+  // this guard, otherwise on the exclusive directory lock. A partition
+  // lock is released along with the shared directory lock held with it.
+
   void Wait() {
-    ctrl_block()->Wait();
+    if (locked_partition_ >= 0) {
+      ctrl_block()->WaitPartition(locked_partition_);
+    } else {
+      ctrl_block()->Wait();
+    }
+  }
+
+  void Suspend() {
+    if (locked_partition_ >= 0) {
+      ctrl_block()->SuspendPartition(locked_partition_);
+    } else {
+      ctrl_block()->Unlock();
+    }
+  }
+
+  void Resume() {
+    if (locked_partition_ >= 0) {
+      ctrl_block()->ResumePartition(locked_partition_);
+    } else {
+      ctrl_block()->Lock();
+    }
   }
 
   void NotifyAll() {
     ctrl_block()->NotifyAll();
   }
 
+  void BeginSplit() {
+    ctrl_block()->BeginSplit();
+  }
+
+  void EndSplit() {
+    ctrl_block()->EndSplit();
+  }
+
   bool Lock_IsInUse() {
     return ctrl_block()->TestIfLocked();
   }
 
   void Lock_AssertHeld() {
 #   ifndef NDEBUG
-    DLOG_ASSERT(ctrl_block()->TestIfLockedByMe());
+    if (locked_partition_ >= 0) {
+      DLOG_ASSERT(ctrl_block()->TestIfPartitionLocked(locked_partition_));
+    } else {
+      DLOG_ASSERT(ctrl_block()->TestIfLockedByMe());
+    }
 #   endif
   }
 
@@ -68,15 +124,32 @@ class DirGuard {
   }
 
   const DirIndex* Set(int index) {
+    ctrl_block()->BeginIndexUpdate();
     dir_idx_->SetBit(index);
+    ctrl_block()->EndIndexUpdate();
     return dir_idx_;
   }
 
   const DirIndex* UpdateDirIndex(const Slice& dmap_data) {
+    ctrl_block()->BeginIndexUpdate();
     dir_idx_->Update(dmap_data);
+    ctrl_block()->EndIndexUpdate();
     return dir_idx_;
   }
 
+  // Starts reading the directory index without the directory lock.
+  // Returns false if the index is being updated at the moment.
+  bool BeginOptimisticRead(uint64_t* version) {
+    *version = ctrl_block()->ReadIndexVersion();
+    return (*version & 1) == 0;
+  }
+
+  // Returns true if the directory index has not changed since
+  // the matching call to BeginOptimisticRead.
+  bool ValidateOptimisticRead(uint64_t version) {
+    return ctrl_block()->ReadIndexVersion() == version;
+  }
+
   int FetchZerothServer() const {
     return dir_idx_->FetchZerothServer();
   }
@@ -86,23 +159,23 @@ class DirGuard {
   }
 
   bool IsSplittingDisabled() {
-    return ctrl_block()->disable_splitting;
+    return ctrl_block()->IsSplittingDisabled();
   }
 
   void DisableSplitting() {
-    ctrl_block()->disable_splitting = true;
+    ctrl_block()->SetSplittingDisabled(true);
   }
 
   void EnableSplitting() {
-    ctrl_block()->disable_splitting = false;
+    ctrl_block()->SetSplittingDisabled(false);
   }
 
   bool HasPartitionData(int index) {
-    return ctrl_block()->size_map.count(index) != 0;
+    return ctrl_block()->HasPartition(index);
   }
 
   int GetPartitionSize(int index) {
-    return ctrl_block()->size_map[index];
+    return ctrl_block()->GetPartitionSize(index);
   }
 
   int GetTotalPartitionSize() {
@@ -110,9 +183,7 @@ class DirGuard {
   }
 
   int InceaseAndGetPartitionSize(int index, int delta) {
-    int size = ctrl_block()->size_map[index];
-    ctrl_block()->size_map[index] = size + delta;
-    return ctrl_block()->size_map[index];
+    return ctrl_block()->AddPartitionSize(index, delta);
   }
 
   bool EligibleToSplit(int index) {
@@ -125,6 +196,7 @@ class DirGuard {
   DirIndexCache* index_cache_;
 
   DirData dir_data_;
+  int locked_partition_; // -1 if no partition is locked
 
    // No copying allowed
   DirGuard(const DirGuard&);
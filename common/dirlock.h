@@ -26,6 +26,52 @@ class DirLock {
   DirLock& operator=(const DirLock&);
 };
 
+class SharedDirLock {
+ public:
+  explicit SharedDirLock(DirGuard* dg) : dg_(dg) {
+    this->dg_->LockShared();
+  }
+  ~SharedDirLock() { this->dg_->UnlockShared(); }
+
+ private:
+  DirGuard* dg_;
+
+  // No copying allowed
+  SharedDirLock(const SharedDirLock&);
+  SharedDirLock& operator=(const SharedDirLock&);
+};
+
+// REQUIRES: the directory lock is held in shared mode.
+class PartitionLock {
+ public:
+  PartitionLock(DirGuard* dg, int index) : dg_(dg) {
+    this->dg_->LockPartition(index);
+  }
+  ~PartitionLock() { this->dg_->UnlockPartition(); }
+
+ private:
+  DirGuard* dg_;
+
+  // No copying allowed
+  PartitionLock(const PartitionLock&);
+  PartitionLock& operator=(const PartitionLock&);
+};
+
+class SplitLock {
+ public:
+  explicit SplitLock(DirGuard* dg) : dg_(dg) {
+    this->dg_->BeginSplit();
+  }
+  ~SplitLock() { this->dg_->EndSplit(); }
+
+ private:
+  DirGuard* dg_;
+
+  // No copying allowed
+  SplitLock(const SplitLock&);
+  SplitLock& operator=(const SplitLock&);
+};
+
 class RawLock {
  public:
   explicit RawLock(DirCtrlBlock* cb) : cb_(cb) {
@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <algorithm>
+
 #include "common/logging.h"
 #include "common/leasectrl.h"
 
@@ -15,18 +17,124 @@ enum LeaseState {
 };
 static const uint64_t kEpsilon = 10 * 1000;
 static const uint64_t kLeaseTime = 1000 * 1000;
+// Max number of clients tracked per lease. Further
+// clients are granted leases that cannot be recalled.
+static const size_t kMaxHolders = 64;
+// Number of old entries a limited lease table checks for expiry
+// on each insertion, and at most when the table is full.
+static const int kMinPurge = 2;
+static const int kMaxPurge = 64;
 }
 
 LeaseEntry::LeaseEntry() :
-    lease_state_(kFree), lease_due_(0) {
+    lease_state_(kFree), lease_due_(0), lease_time_(kLeaseTime),
+    revoking_(false), untracked_due_(0),
+    reads_(kLeaseTime), writes_(kLeaseTime), refs_(0), table_(NULL) {
 }
 
-ReadLock::ReadLock(LeaseEntry* entry, DirGuard* guard, Env* env) :
-    env_(env), guard_(guard), entry_(entry) {
+// Scales the lease time from its lower bound, used when there are as many
+// writes as reads, up to its upper bound as reads outnumber writes.
+//
+uint64_t LeaseEntry::NextLeaseTime(uint64_t now) const {
+  if (IsNegative() || table_ == NULL || table_->max_lease_time_ == 0) {
+    return lease_time_;
+  }
+  uint64_t max_time = table_->max_lease_time_;
+  uint64_t min_time = std::max<uint64_t>(table_->min_lease_time_, 1);
+  if (writes_.GetCount() == 0) {
+    return max_time;
+  }
+  uint64_t write_gap = writes_.GetInterval();
+  if (now > writes_.last_req_ts) {
+    write_gap = std::max(write_gap, now - writes_.last_req_ts);
+  }
+  uint64_t read_gap = std::max<uint64_t>(reads_.GetInterval(), 1);
+  uint64_t reads_per_write = write_gap / read_gap;
+  if (reads_per_write >= max_time / min_time) {
+    return max_time;
+  }
+  return std::max(min_time, min_time * reads_per_write);
+}
+
+void LeaseEntry::AddHolder(int64_t holder, uint64_t now) {
+  if (holder >= 0 && holders_.size() >= kMaxHolders &&
+      holders_.count(holder) == 0) {
+    std::map<int64_t, uint64_t>::iterator it = holders_.begin();
+    while (it != holders_.end()) {
+      if (it->second + kEpsilon < now) {
+        holders_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+  }
+  if (holder < 0 || holders_.size() >= kMaxHolders) {
+    untracked_due_ = std::max(untracked_due_, lease_due_);
+  } else {
+    holders_[holder] = lease_due_;
+  }
+}
+
+// Forgets the lease of a given client, which then no longer
+// has to be waited out.
+//
+void LeaseEntry::DropHolder(int64_t holder) {
+  if (holder < 0 || holders_.erase(holder) == 0) {
+    return;
+  }
+  uint64_t due = untracked_due_;
+  std::map<int64_t, uint64_t>::iterator it = holders_.begin();
+  for (; it != holders_.end(); ++it) {
+    due = std::max(due, it->second);
+  }
+  lease_due_ = due;
+}
+
+// Asks all clients holding live leases to drop them, after which only
+// the leases that have not been acknowledged have to be waited out.
+// The lock is released while waiting for clients to respond.
+//
+void LeaseEntry::RecallHolders(DirGuard* guard, uint64_t now) {
+  LeaseRevoker* revoker = table_ != NULL ? table_->revoker_ : NULL;
+  if (revoker == NULL || holders_.empty()) {
+    return;
+  }
+  std::vector<int64_t> live_holders;
+  uint64_t live_due = 0;
+  std::map<int64_t, uint64_t>::iterator it = holders_.begin();
+  for (; it != holders_.end(); ++it) {
+    if (now <= it->second + kEpsilon) {
+      live_holders.push_back(it->first);
+      live_due = std::max(live_due, it->second);
+    }
+  }
+  if (!live_holders.empty()) {
+    std::vector<int64_t> acked;
+    revoking_ = true;
+    guard->Suspend();
+    revoker->Revoke(oid_, IsNegative(), live_holders,
+        live_due + kEpsilon - now, &acked);
+    guard->Resume();
+    revoking_ = false;
+    for (size_t i = 0; i < acked.size(); ++i) {
+      holders_.erase(acked[i]);
+    }
+  }
+  uint64_t due = untracked_due_;
+  for (it = holders_.begin(); it != holders_.end(); ++it) {
+    due = std::max(due, it->second);
+  }
+  lease_due_ = due;
+}
+
+ReadLock::ReadLock(LeaseEntry* entry, DirGuard* guard, Env* env,
+                   int64_t holder) :
+    env_(env), guard_(guard), entry_(entry), holder_(holder) {
   guard_->Lock_AssertHeld();
   while (entry_->lease_state_ == kWrite) {
     uint64_t now = env_->NowMicros();
-    if (now + kEpsilon < entry_->lease_due_) {
+    // Leases being recalled may no longer be handed out
+    if (!entry_->revoking_ && now + kEpsilon < entry_->lease_due_) {
       break;
     }
     guard_->Wait(); // Wait for the current writer
@@ -34,40 +142,52 @@ ReadLock::ReadLock(LeaseEntry* entry, DirGuard* guard, Env* env) :
   if (entry_->lease_state_ == kFree) {
     entry_->lease_state_ = kRead;
   }
+  entry_->reads_.AddRequest(env_->NowMicros());
 }
 
 ReadLock::~ReadLock() {
   DLOG_ASSERT(entry_->lease_state_ != kFree);
+  uint64_t now = env_->NowMicros();
   if (entry_->lease_state_ == kRead) {
-    uint64_t new_due = env_->NowMicros() + kLeaseTime;
-    DLOG_ASSERT(new_due >= entry_->lease_due_);
-    entry_->lease_due_ = new_due;
+    uint64_t new_due = now + entry_->NextLeaseTime(now);
+    // Lease times may shrink, but granted leases never do
+    entry_->lease_due_ = std::max(entry_->lease_due_, new_due);
   }
+  entry_->AddHolder(holder_, now);
 }
 
-WriteLock::WriteLock(LeaseEntry* entry, DirGuard* guard, Env* env) :
+WriteLock::WriteLock(LeaseEntry* entry, DirGuard* guard, Env* env,
+                     int64_t requester) :
     env_(env), guard_(guard), entry_(entry) {
   guard_->Lock_AssertHeld();
   while (entry_->lease_state_ == kWrite) {
     guard_->Wait(); // Wait for the current writer
   }
+  entry_->DropHolder(requester);
+  entry_->writes_.AddRequest(env_->NowMicros());
   if (entry_->lease_state_ == kFree) {
     entry_->lease_state_ = kWrite;
   }
   while (entry_->lease_state_ == kRead) {
     entry_->lease_state_ = kWrite; // Avoid lease getting renewed
     uint64_t now = env_->NowMicros();
+    if (now <= entry_->lease_due_ + kEpsilon) {
+      entry_->RecallHolders(guard_, now);
+      now = env_->NowMicros();
+    }
     if (now <= entry_->lease_due_ + kEpsilon) {
       uint64_t wait = entry_->lease_due_ + kEpsilon - now;
-      guard_->Unlock();
+      guard_->Suspend();
       env_->SleepForMicroseconds(wait);
-      guard_->Lock();
+      guard_->Resume();
     }
   }
 }
 
 WriteLock::~WriteLock() {
   entry_->lease_due_ = 0;
+  entry_->untracked_due_ = 0;
+  entry_->holders_.clear();
   entry_->lease_state_ = kFree;
   guard_->NotifyAll();
 }
@@ -81,16 +201,37 @@ void DeleteLeaseEntry(const Slice& key, void* value) {
 }
 }
 
+LeaseTable::LeaseTable(int max_entries) :
+    revoker_(NULL), min_lease_time_(0), max_lease_time_(0),
+    max_entries_(std::max(max_entries, 0)), num_entries_(0) {
+  cache_ = NewLRUCache(1 << 30);
+}
+
 void LeaseTable::Evict(const OID& oid) {
   std::string key;
   PutFixed64(&key, oid.dir_id);
   key.append(oid.obj_name);
-  cache_->Erase(key);
+  if (max_entries_ > 0) {
+    MutexLock lock(&mu_);
+    Cache::Handle* handle = cache_->Lookup(key);
+    if (handle != NULL) {
+      cache_->Release(handle);
+      cache_->Erase(key);
+      num_entries_--;
+    }
+  } else {
+    cache_->Erase(key);
+  }
 }
 
 void LeaseTable::Release(LeaseEntry* entry) {
   if (entry != NULL) {
     DLOG_ASSERT(entry->handle_ != NULL);
+    if (max_entries_ > 0) {
+      MutexLock lock(&mu_);
+      DLOG_ASSERT(entry->refs_ > 0);
+      entry->refs_--;
+    }
     cache_->Release(entry->handle_);
   }
 }
@@ -99,6 +240,19 @@ LeaseEntry* LeaseTable::Get(const OID& oid) {
   std::string key;
   PutFixed64(&key, oid.dir_id);
   key.append(oid.obj_name);
+  if (max_entries_ > 0) {
+    // Entries in use must not be purged
+    MutexLock lock(&mu_);
+    LeaseEntry* entry = Lookup(key);
+    if (entry != NULL) {
+      entry->refs_++;
+    }
+    return entry;
+  }
+  return Lookup(key);
+}
+
+LeaseEntry* LeaseTable::Lookup(const std::string& key) {
   Cache::Handle* handle = cache_->Lookup(key);
   if (handle == NULL) {
     return NULL;
@@ -109,21 +263,89 @@ LeaseEntry* LeaseTable::Get(const OID& oid) {
   return entry;
 }
 
+// Drops up to a given number of the oldest entries if their leases have
+// expired and no one is using them. Entries still in use are moved to
+// the back so they are checked again later.
+//
+// REQUIRES: mu_ is held.
+//
+void LeaseTable::Purge(int max_keys, uint64_t now) {
+  mu_.AssertHeld();
+  for (int i = 0; i < max_keys && !keys_.empty(); ++i) {
+    std::string key;
+    key.swap(keys_.front());
+    keys_.pop_front();
+    Cache::Handle* handle = cache_->Lookup(key);
+    if (handle == NULL) {
+      continue; // Already evicted
+    }
+    LeaseEntry* entry = reinterpret_cast<LeaseEntry*>(cache_->Value(handle));
+    bool expired = entry->refs_ == 0 && entry->lease_state_ != kWrite &&
+        entry->lease_due_ + kEpsilon < now;
+    cache_->Release(handle);
+    if (expired) {
+      cache_->Erase(key);
+      num_entries_--;
+    } else {
+      keys_.push_back(key);
+    }
+  }
+}
+
+// Adds a new entry to the table, returning NULL and deleting
+// the entry if the table is full.
+//
+LeaseEntry* LeaseTable::Insert(const std::string& key, LeaseEntry* entry) {
+  if (max_entries_ > 0) {
+    MutexLock lock(&mu_);
+    uint64_t now = Env::Default()->NowMicros();
+    Purge(kMinPurge, now);
+    if (num_entries_ >= max_entries_) {
+      Purge(kMaxPurge, now);
+    }
+    if (num_entries_ >= max_entries_) {
+      delete entry;
+      return NULL;
+    }
+    DLOG_ASSERT(cache_->Lookup(key) == NULL);
+    entry->handle_ = cache_->Insert(key, entry, 1, &DeleteLeaseEntry);
+    entry->refs_ = 1;
+    entry->table_ = this;
+    num_entries_++;
+    keys_.push_back(key);
+  } else {
+    DLOG_ASSERT(cache_->Lookup(key) == NULL);
+    entry->handle_ = cache_->Insert(key, entry, 1, &DeleteLeaseEntry);
+    entry->table_ = this;
+  }
+  return entry;
+}
+
 LeaseEntry* LeaseTable::New(const OID& oid, const StatInfo& info) {
   std::string key;
   PutFixed64(&key, oid.dir_id);
   key.append(oid.obj_name);
-  DLOG_ASSERT(cache_->Lookup(key) == NULL);
   LeaseEntry* entry = new LeaseEntry();
   entry->inode_no = info.id;
   entry->uid = info.uid;
   entry->gid = info.gid;
   entry->perm = info.mode;
   entry->zeroth_server = info.zeroth_server;
-  Cache::Handle* handle = cache_->Insert(key, entry, 1, &DeleteLeaseEntry);
-  entry->table_ = this;
-  entry->handle_ = handle;
-  return entry;
+  entry->oid_ = oid;
+  return Insert(key, entry);
+}
+
+LeaseEntry* LeaseTable::NewNegative(const OID& oid, uint64_t lease_time) {
+  std::string key;
+  PutFixed64(&key, oid.dir_id);
+  key.append(oid.obj_name);
+  LeaseEntry* entry = new LeaseEntry();
+  entry->inode_no = -1;
+  entry->uid = entry->gid = entry->perm = 0;
+  entry->zeroth_server = -1;
+  entry->lease_time_ = lease_time;
+  entry->oid_ = oid;
+  return Insert(key, entry);
 }
 
 } // namespace indexfs
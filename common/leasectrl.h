@@ -5,7 +5,13 @@
 #ifndef _INDEXFS_COMMON_LEASECTRL_H_
 #define _INDEXFS_COMMON_LEASECTRL_H_
 
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+
 #include "common/common.h"
+#include "common/counter.h"
 #include "common/options.h"
 #include "common/dirguard.h"
 
@@ -15,6 +21,30 @@ class ReadLock;
 class WriteLock;
 class LeaseTable;
 
+// Recalls leases from the clients holding them, so that updates do not
+// have to wait for those leases to expire.
+//
+class LeaseRevoker {
+ public:
+
+  LeaseRevoker() { }
+
+  virtual ~LeaseRevoker() { }
+
+  // Asks each of the given holders to drop its lease on an object and
+  // returns the holders that have acknowledged within "max_wait" micros,
+  // after which all their leases have expired anyway. Holders that do not
+  // acknowledge keep their leases until these leases expire.
+  virtual void Revoke(const OID& oid, bool is_negative,
+      const std::vector<int64_t>& holders, uint64_t max_wait,
+      std::vector<int64_t>* acked) = 0;
+
+ private:
+  // No copying allowed
+  LeaseRevoker(const LeaseRevoker&);
+  LeaseRevoker& operator=(const LeaseRevoker&);
+};
+
 class LeaseEntry {
  public:
 
@@ -26,14 +56,33 @@ class LeaseEntry {
   int16_t gid;
   int16_t zeroth_server;
 
+  // Negative entries lease the absence of a name
+  bool IsNegative() const { return inode_no < 0; }
+
   LeaseTable* GetTable() { return table_; }
 
  private:
   int lease_state_;
   uint64_t lease_due_;
+  uint64_t lease_time_;
+  bool revoking_;
+  // Max lease due among clients that cannot be called back
+  uint64_t untracked_due_;
+  // Lease due of each client that can be called back, by client id
+  std::map<int64_t, uint64_t> holders_;
+  RateCounter reads_;
+  RateCounter writes_;
+  OID oid_;
+  // References handed out by tables with a limited number of entries
+  int refs_;
   friend class ReadLock;
   friend class WriteLock;
 
+  uint64_t NextLeaseTime(uint64_t now) const;
+  void AddHolder(int64_t holder, uint64_t now);
+  void DropHolder(int64_t holder);
+  void RecallHolders(DirGuard* guard, uint64_t now);
+
   LeaseTable* table_;
   Cache::Handle* handle_;
   friend class LeaseTable;
@@ -43,10 +92,14 @@ class LeaseEntry {
   LeaseEntry& operator=(const LeaseEntry&);
 };
 
+// Grants a lease to the client identified by ``holder'' when disposed.
+// Clients with a negative id are not tracked and cannot be called back.
+//
 class ReadLock {
  public:
 
-  explicit ReadLock(LeaseEntry* entry, DirGuard* guard, Env* env);
+  explicit ReadLock(LeaseEntry* entry, DirGuard* guard, Env* env,
+                    int64_t holder = -1);
 
   ~ReadLock();
 
@@ -54,16 +107,22 @@ class ReadLock {
   Env* env_;
   DirGuard* guard_;
   LeaseEntry* entry_;
+  int64_t holder_;
 
   // No copying allowed
   ReadLock(const ReadLock&);
   ReadLock& operator=(const ReadLock&);
 };
 
+// Waits out or recalls all leases granted on an entry, except the one
+// held by ``requester'', which is dropped without waiting as the client
+// issuing the update invalidates its own cache.
+//
 class WriteLock {
  public:
 
-  explicit WriteLock(LeaseEntry* entry, DirGuard* guard, Env* env);
+  explicit WriteLock(LeaseEntry* entry, DirGuard* guard, Env* env,
+                     int64_t requester = -1);
 
   ~WriteLock();
 
@@ -88,13 +147,44 @@ class LeaseTable {
   void Release(LeaseEntry* entry);
   LeaseEntry* Get(const OID& oid);
   LeaseEntry* New(const OID& oid, const StatInfo& info);
+  LeaseEntry* NewNegative(const OID& oid, uint64_t lease_time);
+
+  // Recall leases through the given revoker before waiting them out.
+  // The revoker must outlive the table.
+  void SetRevoker(LeaseRevoker* revoker) { revoker_ = revoker; }
+
+  // Adapt the lease time of non-negative entries between the given bounds
+  // to the observed ratio of reads to writes: the more reads per write,
+  // the longer the lease.
+  void SetAdaptiveLeaseTime(uint64_t min_time, uint64_t max_time) {
+    min_lease_time_ = min_time;
+    max_lease_time_ = max_time;
+  }
 
-  LeaseTable(int cap = (1 << 30)) { cache_ = NewLRUCache(cap); }
+  // A table with a limited number of entries never drops an entry before
+  // its lease has expired. Once the table is full, New and NewNegative
+  // return NULL until expired entries can be dropped to make room.
+  explicit LeaseTable(int max_entries = 0);
 
   virtual ~LeaseTable() { delete cache_; }
 
  private:
   Cache* cache_;
+  LeaseRevoker* revoker_;
+  uint64_t min_lease_time_;
+  uint64_t max_lease_time_;
+
+  // Entry accounting for tables with a limited number of entries
+  int max_entries_; // 0 if unlimited
+  Mutex mu_;
+  int num_entries_;
+  std::deque<std::string> keys_; // in the order entries were created
+
+  LeaseEntry* Lookup(const std::string& key);
+  LeaseEntry* Insert(const std::string& key, LeaseEntry* entry);
+  void Purge(int max_keys, uint64_t now);
+  friend class LeaseEntry;
+  friend class WriteLock;
 
   // No copying allowed
   LeaseTable(const LeaseTable&);
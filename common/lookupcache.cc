@@ -62,4 +62,19 @@ LookupEntry* LookupCache::New(const OID& oid, const LookupInfo& info) {
   return entry;
 }
 
+LookupEntry* LookupCache::NewNegative(const OID& oid, int64_t lease_due) {
+  std::string key;
+  PutFixed64(&key, oid.dir_id);
+  key.append(oid.obj_name);
+  LookupEntry* entry = new LookupEntry();
+  entry->inode_no = -1;
+  entry->uid = entry->gid = entry->perm = 0;
+  entry->zeroth_server = -1;
+  entry->lease_due = lease_due;
+  Cache::Handle* handle = cache_->Insert(key, entry, 1, &DeleteLookupEntry);
+  entry->cache_ = this;
+  entry->handle_ = handle;
+  return entry;
+}
+
 } // namespace indexfs
@@ -23,6 +23,9 @@ class LookupEntry {
   int16_t zeroth_server;
   int64_t lease_due;
 
+  // Negative entries cache the absence of a name
+  bool IsNegative() const { return inode_no < 0; }
+
   LookupCache* GetCache() { return cache_; }
 
  private:
@@ -42,6 +45,7 @@ class LookupCache {
   void Release(LookupEntry* entry);
   LookupEntry* Get(const OID& oid);
   LookupEntry* New(const OID& oid, const LookupInfo& info);
+  LookupEntry* NewNegative(const OID& oid, int64_t lease_due);
 
   LookupCache(int cap = (1 << 30)) { cache_ = NewLRUCache(cap); }
 
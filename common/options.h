@@ -27,10 +27,15 @@
 #define DEFAULT_BULK_SIZE        (1<<20)
 // Default directory split threshold
 #define DEFAULT_DIR_SPLIT_THR    (1<<11)
+// Default size of each SSTable chunk shipped during directory splits;
+// each chunk is installed as its own table so keep it sstable-sized
+#define DEFAULT_SPLIT_CHUNK_SIZE DEFAULT_LEVELDB_SSTABLE_SIZE
 // Default size of the directory entry cache
 #define DEFAULT_DENT_CACHE_SIZE  (1<<16)
 // Default size of the directory mapping cache
 #define DEFAULT_DMAP_CACHE_SIZE  (1<<15)
+// Default durability of metadata updates, see SyncMode
+#define DEFAULT_SYNC_MODE        0
 
 // Default server limits
 #ifndef IDXFS_EXTRA_SCALE
@@ -51,7 +56,8 @@
 #define DEFAULT_LEVELDB_SAMPLING_INTERVAL  1
 #define DEFAULT_LEVELDB_FILTER_BYTES    14
 #define DEFAULT_LEVELDB_MAX_OPEN_FILES  128
-#define DEFAULT_LEVELDB_SYNC_INTERVAL   5
+#define DEFAULT_LEVELDB_SYNC_INTERVAL   5 /* millis */
+#define DEFAULT_LEVELDB_SYNC_GROUP_SIZE 256
 #define DEFAULT_LEVELDB_USE_COLUMNDB    false
 #define DEFAULT_LEVELDB_ZERO_FACTOR     10.0
 #define DEFAULT_LEVELDB_LEVEL_FACTOR    10.0
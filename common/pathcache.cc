@@ -0,0 +1,40 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "common/logging.h"
+#include "common/pathcache.h"
+
+namespace indexfs {
+
+namespace {
+static
+void DeletePathEntry(const Slice& key, void* value) {
+  if (value != NULL) {
+    delete reinterpret_cast<PathEntry*>(value);
+  }
+}
+}
+
+void PathCache::Evict(const Slice& path) {
+  cache_->Erase(path);
+}
+
+bool PathCache::Get(const Slice& path, PathEntry* entry) {
+  Cache::Handle* handle = cache_->Lookup(path);
+  if (handle == NULL) {
+    return false;
+  }
+  *entry = *reinterpret_cast<PathEntry*>(cache_->Value(handle));
+  cache_->Release(handle);
+  return true;
+}
+
+// Inserts a new entry for the given path, replacing any existing one.
+//
+void PathCache::Put(const Slice& path, const PathEntry& entry) {
+  PathEntry* value = new PathEntry(entry);
+  cache_->Release(cache_->Insert(path, value, 1, &DeletePathEntry));
+}
+
+} // namespace indexfs
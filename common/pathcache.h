@@ -0,0 +1,53 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef _INDEXFS_COMMON_PATHCACHE_H_
+#define _INDEXFS_COMMON_PATHCACHE_H_
+
+#include "common/common.h"
+#include "common/options.h"
+
+namespace indexfs {
+
+// Resolution result for a full directory path. The lease of a path entry
+// is the earliest lease among all components along that path, so a path
+// entry expires as soon as any of its per-component lookup entries does.
+//
+struct PathEntry {
+  int64_t inode_no;
+  int16_t zeroth_server;
+  int32_t path_depth;
+  int64_t lease_due;
+  // Set by clients to detect entries resolved before
+  // some of their components were revoked
+  uint64_t epoch;
+};
+
+// Maps full directory paths straight to their resolution results so that
+// a fully cached path resolves with a single cache probe instead of one
+// lookup cache probe per path component. Entries are small and are
+// copied out to callers, so no handles need to be released.
+//
+class PathCache {
+ public:
+
+  void Evict(const Slice& path);
+  bool Get(const Slice& path, PathEntry* entry);
+  void Put(const Slice& path, const PathEntry& entry);
+
+  PathCache(int cap = (1 << 30)) { cache_ = NewLRUCache(cap); }
+
+  virtual ~PathCache() { delete cache_; }
+
+ private:
+  Cache* cache_;
+
+  // No copying allowed
+  PathCache(const PathCache&);
+  PathCache& operator=(const PathCache&);
+};
+
+} // namespace indexfs
+
+#endif /* _INDEXFS_COMMON_PATHCACHE_H_ */
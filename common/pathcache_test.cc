@@ -0,0 +1,137 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <stdio.h>
+#include <limits>
+
+#include "common/logging.h"
+#include "common/pathcache.h"
+#include "common/lookupcache.h"
+#include "common/unit_test.h"
+
+namespace indexfs { namespace test {
+
+namespace {
+static const int kCacheSize = 4096;
+static const int kMaxDepth = 16;
+static const int kNumProbes = 100000;
+struct PathCacheTest {
+  PathCache cache_;
+  PathCacheTest() : cache_(kCacheSize) { }
+};
+static PathEntry MakeEntry(int64_t inode_no, int64_t lease_due) {
+  PathEntry entry;
+  entry.inode_no = inode_no;
+  entry.zeroth_server = 0;
+  entry.path_depth = 1;
+  entry.lease_due = lease_due;
+  return entry;
+}
+}
+
+TEST(PathCacheTest, Get) {
+  PathEntry entry;
+  ASSERT_TRUE(!cache_.Get("/a", &entry));
+  cache_.Put("/a", MakeEntry(1, 100));
+  ASSERT_TRUE(cache_.Get("/a", &entry));
+  ASSERT_EQ(entry.inode_no, 1);
+  ASSERT_EQ(entry.lease_due, 100);
+  ASSERT_TRUE(!cache_.Get("/a/b", &entry));
+  ASSERT_TRUE(!cache_.Get(Slice("/a/b", 1), &entry));
+  ASSERT_TRUE(cache_.Get(Slice("/a/b", 2), &entry));
+}
+
+TEST(PathCacheTest, Replace) {
+  PathEntry entry;
+  cache_.Put("/a", MakeEntry(1, 100));
+  cache_.Put("/a", MakeEntry(1, 200));
+  ASSERT_TRUE(cache_.Get("/a", &entry));
+  ASSERT_EQ(entry.lease_due, 200);
+  cache_.Evict("/a");
+  ASSERT_TRUE(!cache_.Get("/a", &entry));
+}
+
+// Compares the cost of resolving a fully cached directory path
+// component by component through the lookup cache against a single probe
+// of the path cache, for path depths ranging from 1 to 16.
+//
+TEST(PathCacheTest, ResolveCost) {
+  char buf[64];
+  LookupCache lookup_cache(kCacheSize);
+  std::string path;
+  OID oid;
+  oid.dir_id = 0;
+  oid.path_depth = 0;
+  for (int i = 0; i < kMaxDepth; ++i) {
+    snprintf(buf, 64, "dir_%d", i);
+    oid.path_depth++;
+    oid.obj_name = buf;
+    LookupInfo info;
+    info.id = i + 1;
+    info.uid = info.gid = info.perm = 0;
+    info.zeroth_server = 0;
+    info.lease_due = std::numeric_limits<int64_t>::max();
+    lookup_cache.Release(lookup_cache.New(oid, info));
+    oid.dir_id = info.id;
+    path.append("/").append(buf);
+    PathEntry entry = MakeEntry(info.id, info.lease_due);
+    entry.path_depth = oid.path_depth;
+    cache_.Put(path, entry);
+  }
+  Env* env = Env::Default();
+  for (int depth = 1; depth <= kMaxDepth; ++depth) {
+    size_t end = 0;
+    for (int i = 0; i < depth; ++i) {
+      end = path.find("/", end + 1);
+    }
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    int64_t last_inode = 0;
+    uint64_t start = env->NowMicros();
+    for (int k = 0; k < kNumProbes; ++k) {
+      OID next;
+      next.dir_id = 0;
+      next.path_depth = 0;
+      size_t now = 0, last = 0;
+      while (last < end) {
+        now = path.find("/", last + 1);
+        if (now == std::string::npos) {
+          now = end;
+        }
+        next.path_depth++;
+        next.obj_name = path.substr(last + 1, now - last - 1);
+        LookupEntry* entry = lookup_cache.Get(next);
+        ASSERT_TRUE(entry != NULL);
+        next.dir_id = entry->inode_no;
+        lookup_cache.Release(entry);
+        last = now;
+      }
+      last_inode = next.dir_id;
+    }
+    uint64_t walk_micros = env->NowMicros() - start;
+    ASSERT_EQ(last_inode, depth);
+    start = env->NowMicros();
+    for (int k = 0; k < kNumProbes; ++k) {
+      PathEntry entry;
+      ASSERT_TRUE(cache_.Get(Slice(path.data(), end), &entry));
+      last_inode = entry.inode_no;
+    }
+    uint64_t probe_micros = env->NowMicros() - start;
+    ASSERT_EQ(last_inode, depth);
+    fprintf(stderr, "resolve depth %2d: lookup cache %.0f ns/op,"
+            " path cache %.0f ns/op\n", depth,
+            walk_micros * 1000.0 / kNumProbes,
+            probe_micros * 1000.0 / kNumProbes);
+  }
+}
+
+} // namespace test
+} // namespace indexfs
+
+
+// Test Driver
+int main(int argc, char* argv[]) {
+  return indexfs::test::RunAllTests();
+}
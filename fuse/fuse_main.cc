@@ -12,6 +12,7 @@
 using indexfs::Status;
 using indexfs::Client;
 using indexfs::StatInfo;
+using indexfs::DirIterator;
 using indexfs::IDXClientManager;
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -102,21 +103,26 @@ int Utimens(const char *path, const struct timespec tv[2]) {
   return 0; // Do Nothing
 }
 
+static
+void FillStat(const StatInfo &info, struct stat *buffer) {
+  buffer->st_ino = info.id;
+  buffer->st_mode = info.mode;
+  buffer->st_uid = info.uid;
+  buffer->st_gid = info.gid;
+  buffer->st_size = info.size;
+  buffer->st_dev = info.zeroth_server;
+  buffer->st_mtime = info.mtime;
+  buffer->st_ctime = info.ctime;
+  buffer->st_atime = time(NULL);
+}
+
 static
 int GetAttr(const char *path, struct stat *buffer) {
   std::string p = path;
   StatInfo info;
   Status s = GetClient()->Getattr(p, &info);
   if (s.ok()) {
-    buffer->st_ino = info.id;
-    buffer->st_mode = info.mode;
-    buffer->st_uid = info.uid;
-    buffer->st_gid = info.gid;
-    buffer->st_size = info.size;
-    buffer->st_dev = info.zeroth_server;
-    buffer->st_mtime = info.mtime;
-    buffer->st_ctime = info.ctime;
-    buffer->st_atime = time(NULL);
+    FillStat(info, buffer);
   }
   return LogErrorAndReturn(s, "getattr", path);
 }
@@ -174,18 +180,28 @@ static
 int ReadDir(const char *path, void *handle,
             fuse_fill_dir_t filler, off_t off, struct fuse_file_info *file) {
   std::string p = path;
-  std::vector<std::string> results;
-  Status s = GetClient()->Readdir(p, &results);
+  DirIterator* iter = NULL;
+  Status s = GetClient()->ScanDirPlus(p, &iter);
 
   if (s.ok()) {
-    std::vector<std::string>::iterator iter = results.begin();
-    while (iter != results.end()) {
-      if (filler(handle, iter->c_str(), NULL, 0) != 0) {
+    // Attributes come along with the names so the kernel
+    // need not issue a separate getattr for each entry
+    std::string name;
+    StatInfo info;
+    struct stat buffer;
+    for (; iter->Valid(); iter->Next()) {
+      iter->RetrieveEntryName(&name);
+      iter->RetrieveEntryStat(&info);
+      memset(&buffer, 0, sizeof(buffer));
+      FillStat(info, &buffer);
+      if (filler(handle, name.c_str(), &buffer, 0) != 0) {
+        delete iter;
         return -ENOMEM;
       }
-      iter++;
     }
+    s = iter->status();
   }
+  delete iter;
 
   return LogErrorAndReturn(s, "readdir", path);
 }
@@ -319,8 +319,9 @@ Status IndexFSClient::ListDirectory(Path &path) {
     printf("readdir %s ... ", path.c_str());
   }
 # endif
-  std::vector<std::string> list;
-  s = Status::NotSupported(Slice());
+  NameList names;
+  StatList stats;
+  s = cli_->ListDir(path, &names, &stats);
 # ifndef NDEBUG
   if (FLAGS_print_ops) {
     printf("%s\n", s.ToString().c_str());
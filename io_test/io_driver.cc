@@ -17,7 +17,7 @@ using ::indexfs::mpi::IOTaskFactory;
 
 // Use TreeTest by default
 DEFINE_string(task,
-    "tree", "Set the benchmark suite [tree|cache|replay|rpc|sstcomp]");
+    "tree", "Set the benchmark suite [tree|cache|replay|rpc|rpccodec|sstcomp|sync]");
 
 DEFINE_int32(rank,
     -1, "Set the rank of a particular driver instance");
@@ -49,6 +49,14 @@ IOTask* FetchTask(int my_rank, int comm_sz) {
     task = "RPCTest";
     result = IOTaskFactory::GetRPCTestTask(my_rank, comm_sz);
   }
+  else if (FLAGS_task == "rpccodec") {
+    task = "RPCCodecTest";
+    result = IOTaskFactory::GetRPCCodecTestTask(my_rank, comm_sz);
+  }
+  else if (FLAGS_task == "sync") {
+    task = "DurableCreateTest";
+    result = IOTaskFactory::GetSyncTestTask(my_rank, comm_sz);
+  }
   if (my_rank == 0) {
     if (result != NULL) {
       fprintf(stderr, "== Run %s ==\n", task);
@@ -81,6 +81,8 @@ class IOTask {
 struct IOTaskFactory {
   // basic RPC baseline
   static IOTask* GetRPCTestTask(int my_rank, int comm_sz);
+  // RPC encoding costs
+  static IOTask* GetRPCCodecTestTask(int my_rank, int comm_sz);
   // FS metadata injection performance
   static IOTask* GetTreeTestTask(int my_rank, int comm_sz);
   // FS general metadata performance
@@ -89,6 +91,8 @@ struct IOTaskFactory {
   static IOTask* GetCacheTestTask(int my_rank, int comm_sz);
   // Parallel LevelDB major compaction
   static IOTask* GetCompactionTestTask(int my_rank, int comm_sz);
+  // Durable metadata create performance
+  static IOTask* GetSyncTestTask(int my_rank, int comm_sz);
 };
 
 } /* namespace mpi */ } /* namespace indexfs */
@@ -2,12 +2,50 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <new>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "io_task.h"
+#include "ipc/wire.h"
+#include "ipc/rpc_impl.h"
+#include "common/common.h"
 #include <gflags/gflags.h>
 
+DEFINE_int32(rpc_codec_ops, 1000 * 1000, "Set the number of calls encoded per codec");
+
+// Counts heap allocations made through operator new, which covers all
+// allocations made by Thrift and std::string. Allocations are only
+// counted while an AllocCounter is alive, so that other tasks sharing
+// this binary are not slowed down.
+//
+static volatile bool count_allocs = false;
+static volatile long num_allocs = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+  if (count_allocs) {
+    __sync_fetch_and_add(&num_allocs, 1);
+  }
+  void* p = malloc(size > 0 ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+  return operator new(size);
+}
+
+void operator delete(void* p) throw() {
+  free(p);
+}
+
+void operator delete[](void* p) throw() {
+  free(p);
+}
+
 namespace indexfs { namespace mpi {
 
 namespace {
@@ -64,10 +102,192 @@ class RPCTest: public IOTask {
 
 };
 
+using apache::thrift::transport::TMemoryBuffer;
+
+class AllocCounter {
+ public:
+  AllocCounter() { count_allocs = true; }
+  ~AllocCounter() { count_allocs = false; }
+ private:
+  // No copying allowed
+  AllocCounter(const AllocCounter&);
+  AllocCounter& operator=(const AllocCounter&);
+};
+
+// A service answering Getattr calls with a fixed reply,
+// so that only the cost of encoding calls is measured.
+//
+class CodecTestService: public MetadataIndexServiceNull {
+ public:
+  StatInfo stat_;
+  void Getattr(StatInfo& _return, const OID& obj_id) {
+    _return = stat_;
+  }
+};
+
+struct CodecResult {
+  double ops_per_sec;
+  double allocs_per_op;
+  double server_allocs_per_op;
+};
+
+// Encodes Getattr calls and their replies using either regular Thrift
+// calls or the compact wire encoding, passing them through the same
+// frame handler used by the reactor server. No network is involved.
+//
+class RPCCodecTest: public IOTask {
+
+  shared_ptr<CodecTestService> service_;
+  shared_ptr<TProcessor> processor_;
+  ThriftFrameHandler handler_;
+
+  int PrintSettings() {
+    return printf("Test Settings:\n"
+      "total processes -> %d\n"
+      "ops per codec -> %d\n"
+      "run_id -> %s\n",
+      comm_sz_,
+      FLAGS_rpc_codec_ops,
+      FLAGS_run_id.c_str());
+  }
+
+  static OID MakeOID() {
+    OID oid;
+    oid.path_depth = 3;
+    oid.dir_id = 12345;
+    oid.obj_name = "file_with_a_typical_name.dat";
+    return oid;
+  }
+
+  CodecResult RunThrift() {
+    OID oid = MakeOID();
+    StatInfo info;
+    std::string reply;
+    shared_ptr<TMemoryBuffer> req_buf(new TMemoryBuffer());
+    shared_ptr<TMemoryBuffer> rep_buf(new TMemoryBuffer());
+    shared_ptr<TProtocol> oprot(new TBinaryProtocol(req_buf));
+    shared_ptr<TProtocol> iprot(new TBinaryProtocol(rep_buf));
+    MetadataIndexServiceClient client(iprot, oprot);
+    long server_allocs = 0;
+    long allocs = num_allocs;
+    uint64_t start = Env::Default()->NowMicros();
+    for (int i = 0; i < FLAGS_rpc_codec_ops; ++i) {
+      req_buf->resetBuffer();
+      client.send_Getattr(oid);
+      uint8_t* data;
+      uint32_t size;
+      req_buf->getBuffer(&data, &size);
+      long before = num_allocs;
+      handler_.Process(Slice(reinterpret_cast<char*>(data), size), &reply);
+      server_allocs += num_allocs - before;
+      rep_buf->resetBuffer(reinterpret_cast<uint8_t*>(&reply[0]), reply.size());
+      client.recv_Getattr(info);
+    }
+    if (info.id != service_->stat_.id) {
+      throw IOError("getattr", "Bad thrift reply");
+    }
+    return MakeResult(start, allocs, server_allocs);
+  }
+
+  CodecResult RunWire() {
+    OID oid = MakeOID();
+    StatInfo info;
+    std::string request;
+    std::string reply;
+    long server_allocs = 0;
+    long allocs = num_allocs;
+    uint64_t start = Env::Default()->NowMicros();
+    for (int i = 0; i < FLAGS_rpc_codec_ops; ++i) {
+      request.clear();
+      EncodeWireRequest(&request, kWireGetattr, oid, 0);
+      long before = num_allocs;
+      handler_.Process(request, &reply);
+      server_allocs += num_allocs - before;
+      WireStatus status;
+      uint32_t size;
+      if (!DecodeWireReplyHeader(reply.data(), &status, &size) ||
+          status != kWireOK || !DecodeWireStatInfo(Slice(reply.data()
+              + kWireReplyHeaderSize, size), &info)) {
+        throw IOError("getattr", "Bad wire reply");
+      }
+    }
+    if (info.id != service_->stat_.id) {
+      throw IOError("getattr", "Bad wire reply");
+    }
+    return MakeResult(start, allocs, server_allocs);
+  }
+
+  static CodecResult MakeResult(uint64_t start,
+          long allocs, long server_allocs) {
+    uint64_t dura = Env::Default()->NowMicros() - start;
+    CodecResult result;
+    result.ops_per_sec = 1000.0 * 1000.0 * FLAGS_rpc_codec_ops / (dura > 0 ? dura : 1);
+    result.allocs_per_op = 1.0 * (num_allocs - allocs) / FLAGS_rpc_codec_ops;
+    result.server_allocs_per_op = 1.0 * server_allocs / FLAGS_rpc_codec_ops;
+    return result;
+  }
+
+  void PrintResult(const char* codec, const CodecResult& result) {
+    printf("%s: %.0f ops/s, %.2f allocs/op (server %.2f allocs/op)\n",
+        codec, result.ops_per_sec, result.allocs_per_op,
+        result.server_allocs_per_op);
+  }
+
+ public:
+
+  RPCCodecTest(int my_rank, int comm_sz)
+    : IOTask(my_rank, comm_sz),
+      service_(new CodecTestService()),
+      processor_(new MetadataIndexServiceProcessor(service_)),
+      handler_(processor_, service_.get()) {
+    service_->stat_.mode = S_IFREG | 0644;
+    service_->stat_.uid = 1;
+    service_->stat_.gid = 1;
+    service_->stat_.size = 4096;
+    service_->stat_.mtime = service_->stat_.ctime = 1400000000;
+    service_->stat_.id = 42;
+    service_->stat_.zeroth_server = 0;
+    service_->stat_.is_embedded = false;
+  }
+
+  virtual void Prepare() {
+    // Warm up per-thread buffers
+    int num_ops = FLAGS_rpc_codec_ops;
+    FLAGS_rpc_codec_ops = 100;
+    RunThrift();
+    RunWire();
+    FLAGS_rpc_codec_ops = num_ops;
+  }
+
+  virtual void Run() {
+    AllocCounter counter;
+    CodecResult thrift = RunThrift();
+    CodecResult wire = RunWire();
+    if (my_rank_ == 0) {
+      PrintResult("thrift binary", thrift);
+      PrintResult("compact wire", wire);
+    }
+  }
+
+  virtual void Clean() {
+    // Do nothing
+  }
+
+  virtual bool CheckPrecondition() {
+    my_rank_ == 0 ? PrintSettings() : 0;
+    return FLAGS_rpc_codec_ops > 0;
+  }
+
+};
+
 } /* anonymous namespace */
 
 IOTask* IOTaskFactory::GetRPCTestTask(int my_rank, int comm_sz) {
   return new RPCTest(my_rank, comm_sz);
 }
 
+IOTask* IOTaskFactory::GetRPCCodecTestTask(int my_rank, int comm_sz) {
+  return new RPCCodecTest(my_rank, comm_sz);
+}
+
 } /* namespace mpi */ } /* namespace indexfs */
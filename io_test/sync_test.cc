@@ -0,0 +1,180 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+
+#include "io_task.h"
+#include "metadb/metadb.h"
+#include "common/config.h"
+#include "common/common.h"
+#include <gflags/gflags.h>
+
+DEFINE_string(sync_root, "/tmp/indexfs-sync",
+    "Set root directory for the durable create test");
+DEFINE_int32(sync_threads, 8, "Set the number of threads creating files");
+DEFINE_int32(sync_creates, 1000, "Set the number of files created per thread");
+
+namespace indexfs { namespace mpi {
+
+namespace {
+
+static const char* kModeNames[] = { "async", "sync", "group commit" };
+
+// Creates files in a directory of its own
+//
+struct CreateWorker {
+  MetaDB* mdb;
+  int64_t dir_id;
+  Status status;
+};
+
+static void* RunCreates(void* arg) {
+  CreateWorker* worker = reinterpret_cast<CreateWorker*>(arg);
+  for (int i = 0; i < FLAGS_sync_creates && worker->status.ok(); ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "file%d", i);
+    worker->status = worker->mdb->NewFile(KeyInfo(worker->dir_id, 0, name));
+  }
+  return NULL;
+}
+
+// Measures file creates on a local metadata database under each
+// sync mode, along with the log syncs made by the database. Every
+// process uses a database of its own.
+//
+class SyncTest: public IOTask {
+
+  static inline
+  void CheckStatus(const char* context, const Status& s) {
+    if (!s.ok()) {
+      throw IOError(context, s.ToString());
+    }
+  }
+
+  int PrintSettings() {
+    return printf("Test Settings:\n"
+      "total processes -> %d\n"
+      "threads per process -> %d\n"
+      "creates per thread -> %d\n"
+      "run_id -> %s\n"
+      "sync_root -> %s\n",
+      comm_sz_,
+      FLAGS_sync_threads,
+      FLAGS_sync_creates,
+      FLAGS_run_id.c_str(),
+      FLAGS_sync_root.c_str());
+  }
+
+  // Removes a directory along with everything beneath it
+  //
+  static void RemoveTree(Env* env, const std::string& dirname) {
+    std::vector<std::string> names;
+    env->GetChildren(dirname, &names);
+    std::vector<std::string>::iterator it = names.begin();
+    for (; it != names.end(); ++it) {
+      if (*it != "." && *it != "..") {
+        const std::string path = dirname + "/" + *it;
+        if (!env->DeleteFile(path).ok()) {
+          RemoveTree(env, path);
+        }
+      }
+    }
+    env->DeleteDir(dirname);
+  }
+
+  std::string GetSrvDir(int mode) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/r%d-m%d", my_rank_, mode);
+    return FLAGS_sync_root + buf;
+  }
+
+  void RemoveSrvDirs() {
+    for (int mode = kSyncNone; mode <= kSyncGroup; ++mode) {
+      Config* config = Config::CreateServerTestingConfig(GetSrvDir(mode));
+      RemoveTree(GetSystemEnv(config), GetSrvDir(mode));
+      delete config;
+    }
+  }
+
+  void RunMode(int mode) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", mode);
+    setenv("FS_SYNC_MODE", buf, 1);
+    Config* config = Config::CreateServerTestingConfig(GetSrvDir(mode));
+    Env* env = GetSystemEnv(config);
+    CheckStatus("mkdir", env->CreateDir(GetSrvDir(mode)));
+    CheckStatus("mkdir", env->CreateDir(config->GetFileDir()));
+    CheckStatus("mkdir", env->CreateDir(config->GetDBRootDir()));
+    CheckStatus("mkdir", env->CreateDir(config->GetDBHomeDir()));
+    CheckStatus("mkdir", env->CreateDir(config->GetDBSplitDir()));
+    MetaDB* mdb;
+    CheckStatus("open", MetaDB::Open(config, &mdb, env));
+    std::vector<CreateWorker> workers(FLAGS_sync_threads);
+    std::vector<pthread_t> tids(FLAGS_sync_threads);
+    uint64_t start = env->NowMicros();
+    for (int i = 0; i < FLAGS_sync_threads; ++i) {
+      workers[i].mdb = mdb;
+      workers[i].dir_id = i + 1;
+      pthread_create(&tids[i], NULL, &RunCreates, &workers[i]);
+    }
+    for (int i = 0; i < FLAGS_sync_threads; ++i) {
+      pthread_join(tids[i], NULL);
+    }
+    uint64_t micros = env->NowMicros() - start;
+    std::string stats;
+    mdb->GetProperty("leveldb.sync-stats", &stats);
+    delete mdb;
+    delete config;
+    unsetenv("FS_SYNC_MODE");
+    for (int i = 0; i < FLAGS_sync_threads; ++i) {
+      CheckStatus("mknod", workers[i].status);
+    }
+    printf("%s: rank %d, %.0f creates/s (%s)\n",
+        kModeNames[mode], my_rank_,
+        1e6 * FLAGS_sync_threads * FLAGS_sync_creates /
+            std::max<uint64_t>(micros, 1),
+        stats.c_str());
+  }
+
+ public:
+
+  SyncTest(int my_rank, int comm_sz)
+    : IOTask(my_rank, comm_sz) {
+  }
+
+  virtual void Prepare() {
+    Config* config = Config::CreateServerTestingConfig(FLAGS_sync_root);
+    GetSystemEnv(config)->CreateDir(FLAGS_sync_root);
+    delete config;
+    RemoveSrvDirs();
+  }
+
+  virtual void Run() {
+    for (int mode = kSyncNone; mode <= kSyncGroup; ++mode) {
+      RunMode(mode);
+    }
+  }
+
+  virtual void Clean() {
+    RemoveSrvDirs();
+  }
+
+  virtual bool CheckPrecondition() {
+    my_rank_ == 0 ? PrintSettings() : 0;
+    return FLAGS_sync_threads > 0 && FLAGS_sync_creates > 0;
+  }
+
+};
+
+} /* anonymous namespace */
+
+IOTask* IOTaskFactory::GetSyncTestTask(int my_rank, int comm_sz) {
+  return new SyncTest(my_rank, comm_sz);
+}
+
+} /* namespace mpi */ } /* namespace indexfs */
@@ -0,0 +1,378 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "ipc/callback.h"
+#include "ipc/wire.h"
+#include "common/network.h"
+#include "common/logging.h"
+
+DEFINE_bool(lease_callbacks, true, "Let servers call the client back to revoke leases early");
+DEFINE_string(lease_callback_ip, "", "Set the IP address servers call the client back at, empty to pick one");
+DEFINE_int32(lease_callback_timeout, 50 * 1000, "Max time (in micros) to wait for a client to acknowledge a revocation");
+
+namespace indexfs {
+
+namespace {
+// Picks the first non-loopback address of this host
+static std::string PickCallbackIP() {
+  if (!FLAGS_lease_callback_ip.empty()) {
+    return FLAGS_lease_callback_ip;
+  }
+  std::vector<std::string> ips;
+  if (GetHostIPAddrs(&ips).ok()) {
+    for (size_t i = 0; i < ips.size(); ++i) {
+      if (ips[i].compare(0, 4, "127.") != 0) {
+        return ips[i];
+      }
+    }
+  }
+  return "127.0.0.1";
+}
+}
+
+int64_t EncodeCallbackAddr(const std::string& ip, int port) {
+  struct in_addr addr;
+  if (inet_pton(AF_INET, ip.c_str(), &addr) != 1 || port <= 0 || port > 0xffff) {
+    return -1;
+  }
+  uint64_t host = ntohl(addr.s_addr);
+  return static_cast<int64_t>((host << 16) | static_cast<uint64_t>(port));
+}
+
+bool DecodeCallbackAddr(int64_t client_id, std::string* ip, int* port) {
+  if (client_id < 0) {
+    return false;
+  }
+  struct in_addr addr;
+  addr.s_addr = htonl(static_cast<uint32_t>(U64INT(client_id) >> 16));
+  char buf[INET_ADDRSTRLEN];
+  if (inet_ntop(AF_INET, &addr, buf, sizeof(buf)) == NULL) {
+    return false;
+  }
+  ip->assign(buf);
+  *port = static_cast<int>(client_id & 0xffff);
+  return *port > 0;
+}
+
+int64_t BindCallbackAddr(int64_t client_id, uint32_t peer_ip) {
+  int port = static_cast<int>(client_id & 0xffff);
+  if (client_id < 0 || peer_ip == 0 || port == 0) {
+    return -1;
+  }
+  return static_cast<int64_t>((static_cast<uint64_t>(peer_ip) << 16) |
+                              static_cast<uint64_t>(port));
+}
+
+CallbackListener::CallbackListener(RevocationHandler* handler) :
+    handler_(handler),
+    server_(this, 0, 1, 1),
+    client_id_(-1),
+    started_(false) {
+  DLOG_ASSERT(handler_ != NULL);
+}
+
+CallbackListener::~CallbackListener() {
+  Stop();
+}
+
+void* CallbackListener::RunServer(void* arg) {
+  CallbackListener* listener = reinterpret_cast<CallbackListener*>(arg);
+  Status s = listener->server_.Serve();
+  LOG_IF(ERROR, !s.ok()) << "Fail to serve lease callbacks: " << s.ToString();
+  return NULL;
+}
+
+Status CallbackListener::Start() {
+  DLOG_ASSERT(!started_);
+  Status s = server_.Open();
+  if (s.ok()) {
+    client_id_ = EncodeCallbackAddr(PickCallbackIP(), server_.GetPort());
+    if (client_id_ < 0) {
+      s = Status::InvalidArgument("Bad callback address");
+    }
+  }
+  if (s.ok()) {
+    if (pthread_create(&tid_, NULL, &RunServer, this) != 0) {
+      s = Status::IOError("Cannot create callback thread");
+    }
+  }
+  if (!s.ok()) {
+    client_id_ = -1;
+    return s;
+  }
+  started_ = true;
+  return s;
+}
+
+void CallbackListener::Stop() {
+  if (started_) {
+    server_.Stop();
+    pthread_join(tid_, NULL);
+    client_id_ = -1;
+    started_ = false;
+  }
+}
+
+bool CallbackListener::Process(const Slice& request, std::string* reply) {
+  WireOp op;
+  OID oid;
+  int16_t perm;
+  if (!DecodeWireRequest(request, &op, &oid, &perm) || op != kWireRevoke) {
+    return false;
+  }
+  handler_->Revoke(oid, perm != 0);
+  EncodeWireReply(reply, kWireOK, Slice());
+  return true;
+}
+
+namespace {
+// Progress of a revocation on a connection
+enum RevokeState {
+  kConnecting,
+  kSending,
+  kReceiving,
+  kReplied,
+  kAcked,
+};
+static uint32_t DecodeFrameSize(const char* p) {
+  uint32_t size;
+  memcpy(&size, p, 4);
+  return ntohl(size);
+}
+}
+
+struct CallbackRevoker::Conn {
+  int64_t client_id;
+  bool reused;
+  int fd;
+  int state;
+  size_t off; // bytes sent or received so far
+  // An acknowledgement is a reply frame with an empty payload
+  char reply[4 + kWireReplyHeaderSize];
+};
+
+void CallbackRevoker::CloseConn(Conn* conn) {
+  close(conn->fd);
+  delete conn;
+}
+
+CallbackRevoker::~CallbackRevoker() {
+  std::multimap<int64_t, Conn*>::iterator it = idle_conns_.begin();
+  for (; it != idle_conns_.end(); ++it) {
+    CloseConn(it->second);
+  }
+}
+
+// Returns an idle connection to a given client, or starts
+// connecting to that client without waiting for it to accept.
+//
+CallbackRevoker::Conn* CallbackRevoker::Checkout(int64_t client_id) {
+  {
+    MutexLock lock(&mu_);
+    std::multimap<int64_t, Conn*>::iterator it = idle_conns_.find(client_id);
+    if (it != idle_conns_.end()) {
+      Conn* conn = it->second;
+      idle_conns_.erase(it);
+      conn->reused = true;
+      conn->state = kSending;
+      conn->off = 0;
+      return conn;
+    }
+  }
+  std::string ip;
+  int port;
+  if (!DecodeCallbackAddr(client_id, &ip, &port)) {
+    return NULL;
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  int r = connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+  if (r < 0 && errno != EINPROGRESS) {
+    DLOG(WARNING) << "Fail to reach client " << ip << ":" << port
+                  << ": " << strerror(errno);
+    close(fd);
+    return NULL;
+  }
+  Conn* conn = new Conn;
+  conn->client_id = client_id;
+  conn->reused = false;
+  conn->fd = fd;
+  conn->state = r < 0 ? kConnecting : kSending;
+  conn->off = 0;
+  return conn;
+}
+
+void CallbackRevoker::Checkin(Conn* conn) {
+  MutexLock lock(&mu_);
+  idle_conns_.insert(std::make_pair(conn->client_id, conn));
+}
+
+// Sends the request and receives the reply as far as possible without
+// blocking, given the events last polled on the connection.
+// Returns false if the connection has failed.
+//
+bool CallbackRevoker::Advance(Conn* conn,
+        const std::string& request, short revents) {
+  if (conn->state == kConnecting) {
+    if (revents == 0) {
+      return true;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+      return false;
+    }
+    conn->state = kSending;
+  }
+  while (conn->state == kSending) {
+    ssize_t r = send(conn->fd, request.data() + conn->off,
+                     request.size() - conn->off, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    conn->off += r;
+    if (conn->off == request.size()) {
+      conn->state = kReceiving;
+      conn->off = 0;
+    }
+  }
+  while (conn->state == kReceiving) {
+    ssize_t r = recv(conn->fd, conn->reply + conn->off,
+                     sizeof(conn->reply) - conn->off, 0);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    conn->off += r;
+    if (conn->off == sizeof(conn->reply)) {
+      WireStatus status;
+      uint32_t payload_size;
+      if (DecodeFrameSize(conn->reply) != kWireReplyHeaderSize ||
+          !DecodeWireReplyHeader(conn->reply + 4, &status, &payload_size) ||
+          payload_size != 0) {
+        return false;
+      }
+      conn->state = status == kWireOK ? kAcked : kReplied;
+    }
+  }
+  return true;
+}
+
+// Sends the request to a given client, retrying with a new
+// connection if an idle one has been closed by the client since
+// last used. Returns NULL if the client cannot be reached.
+//
+CallbackRevoker::Conn* CallbackRevoker::Start(int64_t client_id,
+        const std::string& request) {
+  Conn* conn = Checkout(client_id);
+  while (conn != NULL && !Advance(conn, request, 0)) {
+    bool reused = conn->reused;
+    CloseConn(conn);
+    conn = reused ? Checkout(client_id) : NULL;
+  }
+  return conn;
+}
+
+void CallbackRevoker::Revoke(const OID& oid, bool is_negative,
+        const std::vector<int64_t>& holders, uint64_t max_wait,
+        std::vector<int64_t>* acked) {
+  std::string request(4, '\0');
+  EncodeWireRequest(&request, kWireRevoke, oid, is_negative ? 1 : 0);
+  uint32_t frame_size = htonl(static_cast<uint32_t>(request.size() - 4));
+  memcpy(&request[0], &frame_size, 4);
+  Env* env = Env::Default();
+  uint64_t deadline = env->NowMicros() + std::min(max_wait,
+      static_cast<uint64_t>(std::max(FLAGS_lease_callback_timeout, 0)));
+  // All holders are called at once, and their replies are
+  // polled for until all have arrived or the deadline passes
+  std::vector<Conn*> conns(holders.size(), NULL);
+  for (size_t i = 0; i < holders.size(); ++i) {
+    conns[i] = Start(holders[i], request);
+  }
+  std::vector<struct pollfd> fds;
+  std::vector<size_t> polled;
+  while (true) {
+    fds.clear();
+    polled.clear();
+    for (size_t i = 0; i < conns.size(); ++i) {
+      Conn* conn = conns[i];
+      if (conn != NULL && conn->state < kReplied) {
+        struct pollfd fd;
+        fd.fd = conn->fd;
+        fd.events = conn->state == kReceiving ? POLLIN : POLLOUT;
+        fd.revents = 0;
+        fds.push_back(fd);
+        polled.push_back(i);
+      }
+    }
+    uint64_t now = env->NowMicros();
+    if (fds.empty() || now >= deadline) {
+      break;
+    }
+    int timeout = static_cast<int>((deadline - now + 999) / 1000);
+    int r = poll(&fds[0], fds.size(), timeout);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    for (size_t j = 0; j < fds.size(); ++j) {
+      Conn* conn = conns[polled[j]];
+      if (fds[j].revents != 0 && !Advance(conn, request, fds[j].revents)) {
+        bool reused = conn->reused;
+        CloseConn(conn);
+        conns[polled[j]] = reused ? Start(holders[polled[j]], request) : NULL;
+      }
+    }
+  }
+  for (size_t i = 0; i < conns.size(); ++i) {
+    Conn* conn = conns[i];
+    if (conn != NULL && conn->state >= kReplied) {
+      if (conn->state == kAcked) {
+        acked->push_back(holders[i]);
+      }
+      Checkin(conn);
+    } else {
+      DLOG(WARNING) << "Fail to revoke lease from client " << holders[i];
+      if (conn != NULL) {
+        CloseConn(conn);
+      }
+    }
+  }
+}
+
+} /* namespace indexfs */
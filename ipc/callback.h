@@ -0,0 +1,134 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef _INDEXFS_IPC_CALLBACK_H_
+#define _INDEXFS_IPC_CALLBACK_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <gflags/gflags.h>
+
+#include "ipc/reactor.h"
+#include "common/common.h"
+#include "common/leasectrl.h"
+
+DECLARE_bool(lease_callbacks);
+DECLARE_string(lease_callback_ip);
+DECLARE_int32(lease_callback_timeout);
+
+namespace indexfs {
+
+// -------------------------------------------------------------
+// Lease Callbacks
+// -------------------------------------------------------------
+//
+// Clients willing to be called back listen on an ephemeral port and
+// present themselves to servers with an id encoding the IPv4 address
+// and port at which they listen. Servers only trust the port, and call
+// clients back at the address their requests come from. Servers revoking
+// a lease call each of its holders back with a kWireRevoke request, and
+// treat the reply as an acknowledgement that the lease will no longer
+// be used.
+
+// Returns the client id corresponding to an address, or -1 if the
+// address is not a valid IPv4 address.
+extern int64_t EncodeCallbackAddr(const std::string& ip, int port);
+
+extern bool DecodeCallbackAddr(int64_t client_id, std::string* ip, int* port);
+
+// Returns the id of the client listening on the port given by a
+// client-supplied id, at the given IPv4 address in host byte order,
+// or -1 if either is not valid.
+extern int64_t BindCallbackAddr(int64_t client_id, uint32_t peer_ip);
+
+// Invalidates client-side state derived from a revoked lease.
+//
+class RevocationHandler {
+ public:
+
+  RevocationHandler() { }
+
+  virtual ~RevocationHandler() { }
+
+  // Invoked from a background thread. Once returned,
+  // the lease must no longer be used.
+  virtual void Revoke(const OID& oid, bool is_negative) = 0;
+
+ private:
+  // No copying allowed
+  RevocationHandler(const RevocationHandler&);
+  RevocationHandler& operator=(const RevocationHandler&);
+};
+
+// Serves lease callbacks at the client side with a single-threaded server.
+//
+class CallbackListener: public FrameHandler {
+ public:
+
+  explicit CallbackListener(RevocationHandler* handler);
+
+  virtual ~CallbackListener();
+
+  Status Start();
+  void Stop();
+
+  // Returns the id servers may call this client back with,
+  // or -1 if the listener has not been started.
+  int64_t GetClientId() { return client_id_; }
+
+  uint64_t GetRoutingKey(const Slice& request) { return 0; }
+  bool Process(const Slice& request, std::string* reply);
+
+ private:
+  RevocationHandler* handler_;
+  ReactorServer server_;
+  int64_t client_id_;
+  bool started_;
+  pthread_t tid_;
+
+  static void* RunServer(void* arg);
+
+  // No copying allowed
+  CallbackListener(const CallbackListener&);
+  CallbackListener& operator=(const CallbackListener&);
+};
+
+// Revokes leases by calling their holders back. Requests are sent to all
+// holders at once over non-blocking sockets, and their replies awaited
+// together. Holders that fail to acknowledge within the remaining lease
+// time, or FLAGS_lease_callback_timeout if shorter, are left to their
+// leases expiring. Connections to clients are kept open and reused.
+//
+class CallbackRevoker: public LeaseRevoker {
+ public:
+
+  CallbackRevoker() { }
+
+  virtual ~CallbackRevoker();
+
+  void Revoke(const OID& oid, bool is_negative,
+      const std::vector<int64_t>& holders, uint64_t max_wait,
+      std::vector<int64_t>* acked);
+
+ private:
+  struct Conn;
+  Mutex mu_;
+  std::multimap<int64_t, Conn*> idle_conns_;
+
+  Conn* Checkout(int64_t client_id);
+  void Checkin(Conn* conn);
+  Conn* Start(int64_t client_id, const std::string& request);
+  static bool Advance(Conn* conn, const std::string& request, short revents);
+  static void CloseConn(Conn* conn);
+
+  // No copying allowed
+  CallbackRevoker(const CallbackRevoker&);
+  CallbackRevoker& operator=(const CallbackRevoker&);
+};
+
+} /* namespace indexfs */
+
+#endif /* _INDEXFS_IPC_CALLBACK_H_ */
@@ -2,10 +2,69 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "ipc/membset.h"
 
+DEFINE_string(rpc_local_socket_dir, "/tmp", "Set the parent directory of the private"
+    " directory holding Unix domain sockets used between clients and servers"
+    " run by a same user on a same host, empty to disable");
+
 namespace indexfs {
 
+namespace {
+// Returns the directory holding the sockets of the calling user,
+// which is only accessible to that user.
+static std::string GetLocalSocketDir() {
+  char name[32];
+  snprintf(name, sizeof(name), "/indexfs-%u", static_cast<unsigned>(geteuid()));
+  return FLAGS_rpc_local_socket_dir + name;
+}
+// Returns true if a file is owned by the calling user
+// and cannot be accessed by any other user.
+static bool IsPrivate(const struct stat& st) {
+  return st.st_uid == geteuid() && (st.st_mode & 077) == 0;
+}
+}
+
+std::string GetLocalSocketPath(int port) {
+  if (FLAGS_rpc_local_socket_dir.empty()) {
+    return std::string();
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "/indexfs-%d.sock", port);
+  return GetLocalSocketDir() + name;
+}
+
+Status CreateLocalSocketDir() {
+  std::string dir = GetLocalSocketDir();
+  if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+    return Status::IOError(dir, strerror(errno));
+  }
+  struct stat st;
+  if (lstat(dir.c_str(), &st) < 0) {
+    return Status::IOError(dir, strerror(errno));
+  }
+  if (!S_ISDIR(st.st_mode) || !IsPrivate(st)) {
+    return Status::Corruption(dir, "Not a private directory");
+  }
+  return Status::OK();
+}
+
+bool IsTrustedLocalSocket(const std::string& path) {
+  struct stat st;
+  if (lstat(GetLocalSocketDir().c_str(), &st) < 0 ||
+      !S_ISDIR(st.st_mode) || !IsPrivate(st)) {
+    return false;
+  }
+  return lstat(path.c_str(), &st) == 0 &&
+      S_ISSOCK(st.st_mode) && st.st_uid == geteuid();
+}
+
 struct StaticMemberSet: virtual public MemberSet {
   Config* conf_;
   virtual ~StaticMemberSet() { }
@@ -13,6 +72,7 @@ struct StaticMemberSet: virtual public MemberSet {
   virtual Status Init() { return Status::OK(); }
   virtual int TotalServers() { return conf_->GetSrvNum(); }
   virtual Status FindServer(int srv_id, std::string *ip, int *port);
+  virtual Status FindLocalServer(int srv_id, std::string *path);
 };
 
 MemberSet* CreateStaticMemberSet(Config* conf) {
@@ -28,4 +88,21 @@ Status StaticMemberSet::FindServer(int srv_id, std::string *ip, int *port) {
   return Status::OK();
 }
 
+// Only servers whose socket file exists are advertised, which excludes
+// servers built without the reactor server or not yet started. Sockets
+// not created by the calling user are ignored, so that clients never
+// talk to servers run by other users through them.
+//
+Status StaticMemberSet::FindLocalServer(int srv_id, std::string *path) {
+  DLOG_ASSERT(srv_id >= 0 && srv_id < TotalServers());
+  if (conf_->IsSrvOnLocalHost(srv_id)) {
+    *path = GetLocalSocketPath(conf_->GetSrvPort(srv_id));
+    if (!path->empty() && IsTrustedLocalSocket(*path)) {
+      return Status::OK();
+    }
+  }
+  path->clear();
+  return Status::NotFound(Slice());
+}
+
 } /* namespace indexfs */
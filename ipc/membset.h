@@ -5,10 +5,14 @@
 #ifndef _INDEXFS_COMM_MEMBSET_H_
 #define _INDEXFS_COMM_MEMBSET_H_
 
+#include <gflags/gflags.h>
+
 #include "common/common.h"
 #include "common/config.h"
 #include "common/logging.h"
 
+DECLARE_string(rpc_local_socket_dir);
+
 namespace indexfs {
 
 struct MemberSet {
@@ -16,8 +20,26 @@ struct MemberSet {
   virtual Status Init() = 0;
   virtual int TotalServers() = 0;
   virtual Status FindServer(int srv_id, std::string *ip, int *port) = 0;
+  // Returns the Unix domain socket of a server running on the local host.
+  virtual Status FindLocalServer(int srv_id, std::string *path) {
+    return Status::NotFound(Slice());
+  }
 };
 
+// Returns the Unix domain socket a server listening
+// on a given TCP port also listens on, or an empty string
+// if local sockets are disabled. Sockets are kept in a
+// directory private to the user running the server.
+extern std::string GetLocalSocketPath(int port);
+
+// Creates the private directory holding local sockets if missing.
+// Fails if that directory can be accessed by any other user.
+extern Status CreateLocalSocketDir();
+
+// Returns true if a local socket was created by the calling
+// user and is kept in a directory private to that user.
+extern bool IsTrustedLocalSocket(const std::string& path);
+
 extern MemberSet* CreateZKMemberSet(Config* conf);
 
 extern MemberSet* CreateStaticMemberSet(Config* conf);
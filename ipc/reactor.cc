@@ -0,0 +1,737 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "common/logging.h"
+#include "ipc/reactor.h"
+
+DEFINE_int32(rpc_reactors, 0, "Set the number of event loop threads, 0 for one per core");
+DEFINE_int32(rpc_workers_per_reactor, 4, "Set the number of worker threads serving each event loop");
+DEFINE_bool(rpc_pin_threads, true, "Pin event loop and worker threads to cores");
+
+namespace indexfs {
+
+namespace {
+// Max number of events handled per epoll_wait
+static const int kMaxEvents = 256;
+// Size of the stack buffer used to drain sockets
+static const int kReadSize = 64 << 10;
+// Max size of a request frame, larger frames close the connection
+static const uint32_t kMaxFrameSize = 64 << 20;
+// Tags distinguishing the listening socket and the wakeup fd from connections
+static char kListenTag;
+static char kLocalListenTag;
+static char kWakeupTag;
+// Key to the partition served by the calling worker thread
+static pthread_key_t worker_key;
+// Key to the peer address of the request being processed
+static pthread_key_t peer_key;
+static pthread_once_t worker_once = PTHREAD_ONCE_INIT;
+static void InitWorkerKey() {
+  pthread_key_create(&worker_key, NULL);
+  pthread_key_create(&peer_key, NULL);
+}
+static void JoinThread(pthread_t tid) {
+  if (pthread_join(tid, NULL) != 0) {
+    perror("Fail to join thread!");
+    abort();
+  }
+}
+static pthread_t CreateThread(void*(*func)(void*), void* arg) {
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, func, arg) != 0) {
+    perror("Fail to create thread!");
+    abort();
+  }
+  return tid;
+}
+static void PinThread(int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  int r = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  DLOG_IF(WARNING, r != 0) << "Fail to pin thread to cpu " << cpu;
+}
+static void SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+static uint32_t DecodeFrameSize(const char* p) {
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return (static_cast<uint32_t>(b[0]) << 24) |
+         (static_cast<uint32_t>(b[1]) << 16) |
+         (static_cast<uint32_t>(b[2]) << 8) | static_cast<uint32_t>(b[3]);
+}
+static void AppendFrameSize(std::string* dst, uint32_t size) {
+  char buf[4];
+  buf[0] = static_cast<char>((size >> 24) & 0xff);
+  buf[1] = static_cast<char>((size >> 16) & 0xff);
+  buf[2] = static_cast<char>((size >> 8) & 0xff);
+  buf[3] = static_cast<char>(size & 0xff);
+  dst->append(buf, 4);
+}
+}
+
+// A client connection owned by a reactor. Reads are only performed by that
+// reactor, while writes may also be performed by workers completing requests.
+// A connection is released once it is closed and no request is in flight.
+//
+struct ReactorServer::Conn {
+  int fd;
+  int epfd;
+  uint32_t peer_ip; // 0 if unknown
+  std::string rbuf; // read by the reactor only
+  uint64_t next_seq; // read by the reactor only
+
+  Mutex mu;
+  int refs;
+  bool closed;
+  bool want_write;
+  uint64_t next_reply;
+  std::map<uint64_t, std::string> replies; // out-of-order replies
+  std::string wbuf;
+  size_t woff;
+
+  Conn(int fd, int epfd, uint32_t peer_ip) :
+      fd(fd), epfd(epfd), peer_ip(peer_ip), next_seq(0),
+      refs(1), closed(false), want_write(false), next_reply(0), woff(0) {
+  }
+};
+
+struct ReactorServer::Request {
+  Conn* conn;
+  uint64_t seq;
+  std::string data;
+};
+
+struct ReactorServer::Reactor {
+  ReactorServer* server;
+  int epfd;
+  int cpu;
+  pthread_t tid;
+  std::vector<Request*> free_requests; // recycled request objects
+};
+
+// Requests routed to a same core, served by worker threads pinned to
+// that core. Spare workers are added while workers are blocked.
+//
+struct ReactorServer::Partition {
+  ReactorServer* server;
+  int cpu;
+  Mutex mu;
+  CondVar cv;
+  bool done;
+  std::vector<pthread_t> tids;
+  int num_idle; // workers waiting for requests
+  int num_blocked; // workers inside a blocking region
+  std::deque<Request*> queue;
+  std::vector<Request*> free_requests; // executed requests to be recycled
+  Partition() : cv(&mu), done(false), num_idle(0), num_blocked(0) { }
+};
+
+ReactorServer::ReactorServer(FrameHandler* handler, int port) :
+    handler_(handler),
+    port_(port),
+    listen_fd_(-1),
+    local_fd_(-1),
+    wakeup_fd_(-1),
+    num_workers_(FLAGS_rpc_workers_per_reactor),
+    pin_threads_(FLAGS_rpc_pin_threads),
+    cv_(&mu_),
+    done_(false),
+    next_reactor_(0) {
+  Init(FLAGS_rpc_reactors);
+}
+
+ReactorServer::ReactorServer(FrameHandler* handler, int port,
+                             int num_reactors, int num_workers) :
+    handler_(handler),
+    port_(port),
+    listen_fd_(-1),
+    local_fd_(-1),
+    wakeup_fd_(-1),
+    num_workers_(num_workers),
+    pin_threads_(false),
+    cv_(&mu_),
+    done_(false),
+    next_reactor_(0) {
+  Init(num_reactors);
+}
+
+void ReactorServer::Init(int num_reactors) {
+  DLOG_ASSERT(handler_ != NULL);
+  num_cpus_ = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  if (num_cpus_ <= 0) {
+    num_cpus_ = 1;
+  }
+  if (num_reactors <= 0) {
+    num_reactors = num_cpus_;
+  }
+  for (int i = 0; i < num_reactors; ++i) {
+    Reactor* reactor = new Reactor;
+    reactor->server = this;
+    reactor->epfd = -1;
+    reactor->cpu = i % num_cpus_;
+    reactors_.push_back(reactor);
+    Partition* partition = new Partition;
+    partition->server = this;
+    partition->cpu = reactor->cpu;
+    partitions_.push_back(partition);
+  }
+}
+
+ReactorServer::~ReactorServer() {
+  for (std::set<Conn*>::iterator it = conns_.begin();
+       it != conns_.end(); ++it) {
+    close((*it)->fd);
+    delete *it;
+  }
+  for (size_t i = 0; i < partitions_.size(); ++i) {
+    std::deque<Request*>& queue = partitions_[i]->queue;
+    for (size_t j = 0; j < queue.size(); ++j) {
+      delete queue[j];
+    }
+    std::vector<Request*>& free_requests = partitions_[i]->free_requests;
+    for (size_t j = 0; j < free_requests.size(); ++j) {
+      delete free_requests[j];
+    }
+    delete partitions_[i];
+  }
+  for (size_t i = 0; i < reactors_.size(); ++i) {
+    if (reactors_[i]->epfd >= 0) {
+      close(reactors_[i]->epfd);
+    }
+    std::vector<Request*>& free_requests = reactors_[i]->free_requests;
+    for (size_t j = 0; j < free_requests.size(); ++j) {
+      delete free_requests[j];
+    }
+    delete reactors_[i];
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+  if (wakeup_fd_ >= 0) {
+    close(wakeup_fd_);
+  }
+  if (local_fd_ >= 0) {
+    close(local_fd_);
+    unlink(local_path_.c_str());
+  }
+}
+
+Status ReactorServer::Open() {
+  if (listen_fd_ >= 0) {
+    return Status::OK();
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return Status::IOError("Cannot create socket", strerror(errno));
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(port_));
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0
+          || listen(fd, 1024) < 0) {
+    Status s = Status::IOError("Cannot listen on socket", strerror(errno));
+    close(fd);
+    return s;
+  }
+  socklen_t len = sizeof(addr);
+  getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+  port_ = ntohs(addr.sin_port);
+  SetNonBlocking(fd);
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK);
+  if (wakeup_fd_ < 0) {
+    close(fd);
+    return Status::IOError("Cannot create eventfd", strerror(errno));
+  }
+  listen_fd_ = fd;
+  for (size_t i = 0; i < reactors_.size(); ++i) {
+    Reactor* reactor = reactors_[i];
+    reactor->epfd = epoll_create(kMaxEvents);
+    if (reactor->epfd < 0) {
+      return Status::IOError("Cannot create epoll", strerror(errno));
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &kWakeupTag;
+    epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &kListenTag;
+  epoll_ctl(reactors_[0]->epfd, EPOLL_CTL_ADD, listen_fd_, &ev);
+  return Status::OK();
+}
+
+Status ReactorServer::OpenLocal(const std::string& path) {
+  Status s = Open();
+  if (!s.ok() || local_fd_ >= 0) {
+    return s;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return Status::InvalidArgument("Socket path too long", path);
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return Status::IOError("Cannot create socket", strerror(errno));
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0
+          || listen(fd, 1024) < 0) {
+    s = Status::IOError("Cannot listen on socket", strerror(errno));
+    close(fd);
+    return s;
+  }
+  SetNonBlocking(fd);
+  local_fd_ = fd;
+  local_path_ = path;
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &kLocalListenTag;
+  epoll_ctl(reactors_[0]->epfd, EPOLL_CTL_ADD, local_fd_, &ev);
+  return s;
+}
+
+int ReactorServer::GetPort() {
+  return listen_fd_ >= 0 ? port_ : -1;
+}
+
+Status ReactorServer::Serve() {
+  Status s = Open();
+  if (!s.ok()) {
+    return s;
+  }
+  for (size_t i = 0; i < partitions_.size(); ++i) {
+    MutexLock lock(&partitions_[i]->mu);
+    for (int j = 0; j < num_workers_ || j == 0; ++j) {
+      partitions_[i]->tids.push_back(CreateThread(&RunWorker, partitions_[i]));
+    }
+  }
+  for (size_t i = 0; i < reactors_.size(); ++i) {
+    reactors_[i]->tid = CreateThread(&RunReactor, reactors_[i]);
+  }
+  {
+    MutexLock lock(&mu_);
+    while (!done_) {
+      cv_.Wait();
+    }
+  }
+  uint64_t one = 1;
+  if (write(wakeup_fd_, &one, sizeof(one)) < 0) {
+    LOG(WARNING) << "Fail to wake up event loops: " << strerror(errno);
+  }
+  for (size_t i = 0; i < reactors_.size(); ++i) {
+    JoinThread(reactors_[i]->tid);
+  }
+  for (size_t i = 0; i < partitions_.size(); ++i) {
+    Partition* partition = partitions_[i];
+    {
+      MutexLock lock(&partition->mu);
+      partition->done = true;
+      partition->cv.SignalAll();
+    }
+    for (size_t j = 0; j < partition->tids.size(); ++j) {
+      JoinThread(partition->tids[j]);
+    }
+    partition->tids.clear();
+  }
+  return s;
+}
+
+void ReactorServer::Stop() {
+  MutexLock lock(&mu_);
+  done_ = true;
+  cv_.SignalAll();
+}
+
+void ReactorServer::AcceptConns(int listen_fd) {
+  while (true) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = accept(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      DLOG_IF(WARNING, errno != EAGAIN && errno != EWOULDBLOCK)
+          << "Fail to accept connection: " << strerror(errno);
+      break;
+    }
+    SetNonBlocking(fd);
+    uint32_t peer_ip = INADDR_LOOPBACK;
+    if (listen_fd == listen_fd_) {
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      peer_ip = addr.sin_family == AF_INET ? ntohl(addr.sin_addr.s_addr) : 0;
+    }
+    Reactor* reactor;
+    Conn* conn;
+    {
+      MutexLock lock(&mu_);
+      reactor = reactors_[next_reactor_++ % reactors_.size()];
+      conn = new Conn(fd, reactor->epfd, peer_ip);
+      conns_.insert(conn);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+// Drains a readable connection and decodes all complete requests.
+// Requests are accumulated in per-partition batches.
+//
+void ReactorServer::ReadConn(Reactor* reactor, Conn* conn,
+        std::vector<std::vector<Request*> >* batches) {
+  char buf[kReadSize];
+  bool eof = false;
+  while (true) {
+    ssize_t n = read(conn->fd, buf, sizeof(buf));
+    if (n > 0) {
+      conn->rbuf.append(buf, n);
+      if (static_cast<size_t>(n) < sizeof(buf)) {
+        break;
+      }
+    } else if (n == 0) {
+      eof = true;
+      break;
+    } else if (errno == EINTR) {
+      continue;
+    } else {
+      eof = (errno != EAGAIN && errno != EWOULDBLOCK);
+      break;
+    }
+  }
+  size_t off = 0;
+  while (conn->rbuf.size() - off >= 4) {
+    uint32_t size = DecodeFrameSize(conn->rbuf.data() + off);
+    if (size > kMaxFrameSize) {
+      LOG(WARNING) << "Dropping connection with oversized frame: " << size;
+      eof = true;
+      break;
+    }
+    if (conn->rbuf.size() - off - 4 < size) {
+      break;
+    }
+    Request* request;
+    if (!reactor->free_requests.empty()) {
+      request = reactor->free_requests.back();
+      reactor->free_requests.pop_back();
+    } else {
+      request = new Request;
+    }
+    request->conn = conn;
+    request->seq = conn->next_seq++;
+    request->data.assign(conn->rbuf.data() + off + 4, size);
+    off += 4 + size;
+    uint64_t key = handler_->GetRoutingKey(request->data);
+    (*batches)[key % partitions_.size()].push_back(request);
+    MutexLock lock(&conn->mu);
+    conn->refs++;
+  }
+  conn->rbuf.erase(0, off);
+  if (eof) {
+    CloseConn(conn);
+  }
+}
+
+void ReactorServer::WriteConn(Conn* conn) {
+  MutexLock lock(&conn->mu);
+  if (!conn->closed && TryWrite(conn) && conn->want_write) {
+    conn->want_write = false;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+// Writes as much buffered reply data as the socket accepts.
+// Returns true if all buffered data has been written.
+//
+// REQUIRES: conn->mu is held.
+//
+bool ReactorServer::TryWrite(Conn* conn) {
+  while (conn->woff < conn->wbuf.size()) {
+    ssize_t n = send(conn->fd, conn->wbuf.data() + conn->woff,
+        conn->wbuf.size() - conn->woff, MSG_NOSIGNAL);
+    if (n >= 0) {
+      conn->woff += n;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return false;
+    } else {
+      // Let the reactor find out and close the connection
+      shutdown(conn->fd, SHUT_RDWR);
+      break;
+    }
+  }
+  conn->wbuf.clear();
+  conn->woff = 0;
+  return true;
+}
+
+// Queues the reply of a request and sends all replies
+// that are no longer waiting for an earlier one.
+//
+void ReactorServer::SendReply(Conn* conn,
+        uint64_t seq, const std::string& reply) {
+  MutexLock lock(&conn->mu);
+  if (seq != conn->next_reply) {
+    conn->replies[seq] = reply;
+    return;
+  }
+  // Common case: the reply is next in line and goes straight to the buffer
+  if (!reply.empty()) {
+    AppendFrameSize(&conn->wbuf, reply.size());
+    conn->wbuf.append(reply);
+  }
+  conn->next_reply++;
+  std::map<uint64_t, std::string>::iterator it = conn->replies.begin();
+  while (it != conn->replies.end() && it->first == conn->next_reply) {
+    if (!it->second.empty()) {
+      AppendFrameSize(&conn->wbuf, it->second.size());
+      conn->wbuf.append(it->second);
+    }
+    conn->replies.erase(it++);
+    conn->next_reply++;
+  }
+  if (!conn->closed && !conn->want_write && !TryWrite(conn)) {
+    conn->want_write = true;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = conn;
+    epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+void ReactorServer::CloseConn(Conn* conn) {
+  {
+    MutexLock lock(&conn->mu);
+    if (conn->closed) {
+      return;
+    }
+    conn->closed = true;
+    epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+  }
+  Unref(conn);
+}
+
+void ReactorServer::Unref(Conn* conn) {
+  bool last;
+  {
+    MutexLock lock(&conn->mu);
+    last = (--conn->refs == 0);
+  }
+  if (last) {
+    {
+      MutexLock lock(&mu_);
+      conns_.erase(conn);
+    }
+    close(conn->fd);
+    delete conn;
+  }
+}
+
+// Hands batches of requests to their partitions, and takes back
+// request objects those partitions are done with.
+//
+void ReactorServer::Dispatch(Reactor* reactor,
+        std::vector<std::vector<Request*> >* batches) {
+  for (size_t i = 0; i < batches->size(); ++i) {
+    std::vector<Request*>& batch = (*batches)[i];
+    if (!batch.empty()) {
+      Partition* partition = partitions_[i];
+      MutexLock lock(&partition->mu);
+      reactor->free_requests.insert(reactor->free_requests.end(),
+          partition->free_requests.begin(), partition->free_requests.end());
+      partition->free_requests.clear();
+      partition->queue.insert(partition->queue.end(),
+          batch.begin(), batch.end());
+      if (batch.size() > 1) {
+        partition->cv.SignalAll();
+      } else {
+        partition->cv.Signal();
+      }
+      batch.clear();
+    }
+  }
+}
+
+void ReactorServer::ReactorLoop(Reactor* reactor) {
+  if (pin_threads_) {
+    PinThread(reactor->cpu);
+  }
+  struct epoll_event events[kMaxEvents];
+  std::vector<std::vector<Request*> > batches(partitions_.size());
+  while (true) {
+    int n = epoll_wait(reactor->epfd, events, kMaxEvents, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG(ERROR) << "Fail to wait for events: " << strerror(errno);
+      break;
+    }
+    bool stopped = false;
+    for (int i = 0; i < n; ++i) {
+      void* ptr = events[i].data.ptr;
+      if (ptr == &kWakeupTag) {
+        stopped = true;
+      } else if (ptr == &kListenTag) {
+        AcceptConns(listen_fd_);
+      } else if (ptr == &kLocalListenTag) {
+        AcceptConns(local_fd_);
+      } else {
+        Conn* conn = reinterpret_cast<Conn*>(ptr);
+        if (events[i].events & EPOLLOUT) {
+          WriteConn(conn);
+        }
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+          ReadConn(reactor, conn, &batches);
+        }
+      }
+    }
+    Dispatch(reactor, &batches);
+    if (stopped) {
+      break;
+    }
+  }
+}
+
+void ReactorServer::WorkerLoop(Partition* partition) {
+  if (pin_threads_) {
+    PinThread(partition->cpu);
+  }
+  pthread_once(&worker_once, &InitWorkerKey);
+  pthread_setspecific(worker_key, partition);
+  Request* done_request = NULL;
+  std::string reply; // reused across requests
+  while (true) {
+    Request* request;
+    {
+      MutexLock lock(&partition->mu);
+      if (done_request != NULL) {
+        partition->free_requests.push_back(done_request);
+        done_request = NULL;
+      }
+      while (partition->queue.empty() && !partition->done) {
+        partition->num_idle++;
+        partition->cv.Wait();
+        partition->num_idle--;
+      }
+      if (partition->done) {
+        break;
+      }
+      request = partition->queue.front();
+      partition->queue.pop_front();
+    }
+    reply.clear();
+    Conn* conn = request->conn;
+    bool ok;
+    {
+      PeerAddrScope peer(conn->peer_ip);
+      ok = handler_->Process(request->data, &reply);
+    }
+    if (!ok) {
+      shutdown(conn->fd, SHUT_RDWR);
+      reply.clear();
+    }
+    SendReply(conn, request->seq, reply);
+    done_request = request;
+    Unref(conn);
+  }
+}
+
+void ReactorServer::BeginBlocking() {
+  pthread_once(&worker_once, &InitWorkerKey);
+  Partition* partition = reinterpret_cast<Partition*>(
+      pthread_getspecific(worker_key));
+  if (partition == NULL) {
+    return;
+  }
+  MutexLock lock(&partition->mu);
+  partition->num_blocked++;
+  int num_runnable = static_cast<int>(partition->tids.size())
+      - partition->num_blocked;
+  if (!partition->done && partition->num_idle == 0 &&
+      num_runnable < std::max(partition->server->num_workers_, 1)) {
+    partition->tids.push_back(CreateThread(&RunWorker, partition));
+  }
+}
+
+void ReactorServer::EndBlocking() {
+  pthread_once(&worker_once, &InitWorkerKey);
+  Partition* partition = reinterpret_cast<Partition*>(
+      pthread_getspecific(worker_key));
+  if (partition == NULL) {
+    return;
+  }
+  MutexLock lock(&partition->mu);
+  DLOG_ASSERT(partition->num_blocked > 0);
+  partition->num_blocked--;
+}
+
+bool ReactorServer::GetPeerAddr(uint32_t* ip) {
+  pthread_once(&worker_once, &InitWorkerKey);
+  uint32_t* peer_ip = reinterpret_cast<uint32_t*>(
+      pthread_getspecific(peer_key));
+  if (peer_ip == NULL || *peer_ip == 0) {
+    return false;
+  }
+  *ip = *peer_ip;
+  return true;
+}
+
+PeerAddrScope::PeerAddrScope(uint32_t ip) : ip_(ip) {
+  pthread_once(&worker_once, &InitWorkerKey);
+  saved_ = pthread_getspecific(peer_key);
+  pthread_setspecific(peer_key, &ip_);
+}
+
+PeerAddrScope::~PeerAddrScope() {
+  pthread_setspecific(peer_key, saved_);
+}
+
+void* ReactorServer::RunReactor(void* arg) {
+  Reactor* reactor = reinterpret_cast<Reactor*>(arg);
+  reactor->server->ReactorLoop(reactor);
+  return NULL;
+}
+
+void* ReactorServer::RunWorker(void* arg) {
+  Partition* partition = reinterpret_cast<Partition*>(arg);
+  partition->server->WorkerLoop(partition);
+  return NULL;
+}
+
+} /* namespace indexfs */
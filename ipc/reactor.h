@@ -0,0 +1,189 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef _INDEXFS_IPC_REACTOR_H_
+#define _INDEXFS_IPC_REACTOR_H_
+
+#include <set>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <gflags/gflags.h>
+
+#include "common/common.h"
+
+DECLARE_int32(rpc_reactors);
+DECLARE_int32(rpc_workers_per_reactor);
+DECLARE_bool(rpc_pin_threads);
+
+namespace indexfs {
+
+// Executes requests received by a reactor server. Requests and replies
+// travel as frames, each prefixed by its length encoded as a 4-byte
+// big-endian integer, which is the framing used by TFramedTransport.
+//
+class FrameHandler {
+ public:
+
+  FrameHandler() { }
+
+  virtual ~FrameHandler() { }
+
+  // Returns the key used to route a request to a worker thread.
+  // Requests sharing a same key are always executed on a same core.
+  virtual uint64_t GetRoutingKey(const Slice& request) = 0;
+
+  // Executes a request and sets its reply, without the frame header.
+  // An empty reply is not sent back. Returns false if the
+  // connection the request came from should be dropped.
+  virtual bool Process(const Slice& request, std::string* reply) = 0;
+
+ private:
+  // No copying allowed
+  FrameHandler(const FrameHandler&);
+  FrameHandler& operator=(const FrameHandler&);
+};
+
+// An event-driven server multiplexing client connections over a fixed
+// number of epoll reactors, one per core by default. Each reactor drains
+// all readable sockets it owns before handing the requests decoded to a
+// pool of worker threads partitioned by routing key. Reactors and their
+// worker partition are pinned to a same core. Replies are always sent in
+// the order requests arrive on each connection.
+//
+class ReactorServer {
+ public:
+
+  ReactorServer(FrameHandler* handler, int port);
+
+  // Creates a server with a fixed number of threads, which are never
+  // pinned to cores. Meant for small servers embedded in clients.
+  ReactorServer(FrameHandler* handler, int port,
+                int num_reactors, int num_workers);
+
+  virtual ~ReactorServer();
+
+  // Binds the listening socket. Port 0 asks for an ephemeral port.
+  Status Open();
+
+  // Additionally accepts clients over a Unix domain socket bound to
+  // the given path. Any stale socket file at that path is replaced.
+  Status OpenLocal(const std::string& path);
+
+  // Returns the port actually bound, or -1 if not yet opened.
+  int GetPort();
+
+  // Serves clients until Stop() is called.
+  // The server will be opened first if it has not been opened.
+  Status Serve();
+
+  void Stop();
+
+  // Called by a worker thread about to block for long, for example on a
+  // call to another server, and once it is done. A spare worker is started
+  // if needed so that the partition of the calling thread keeps as many
+  // runnable workers as it was configured with, which prevents servers
+  // calling each other from deadlocking. Spare workers are kept for later
+  // use until the server stops. Has no effect on other threads.
+  static void BeginBlocking();
+  static void EndBlocking();
+
+  // Returns the IPv4 address, in host byte order, of the client that sent
+  // the request being processed by the calling thread. Clients connected
+  // through the Unix domain socket are reported at the loopback address.
+  // Returns false if the address is unknown or the calling thread is not
+  // processing a request.
+  static bool GetPeerAddr(uint32_t* ip);
+
+ private:
+
+  struct Conn;
+  struct Request;
+  struct Reactor;
+  struct Partition;
+
+  FrameHandler* handler_;
+  int port_;
+  int listen_fd_;
+  int local_fd_;
+  std::string local_path_;
+  int wakeup_fd_;
+  int num_cpus_;
+  int num_workers_;
+  bool pin_threads_;
+  std::vector<Reactor*> reactors_;
+  std::vector<Partition*> partitions_;
+
+  Mutex mu_;
+  CondVar cv_;
+  bool done_;
+  int next_reactor_;
+  std::set<Conn*> conns_;
+
+  void Init(int num_reactors);
+  void AcceptConns(int listen_fd);
+  void ReadConn(Reactor* reactor, Conn* conn,
+      std::vector<std::vector<Request*> >* batches);
+  void WriteConn(Conn* conn);
+  void CloseConn(Conn* conn);
+  void Unref(Conn* conn);
+  void SendReply(Conn* conn, uint64_t seq, const std::string& reply);
+  bool TryWrite(Conn* conn);
+  void Dispatch(Reactor* reactor,
+      std::vector<std::vector<Request*> >* batches);
+
+  void ReactorLoop(Reactor* reactor);
+  void WorkerLoop(Partition* partition);
+  static void* RunReactor(void* arg);
+  static void* RunWorker(void* arg);
+
+  // No copying allowed
+  ReactorServer(const ReactorServer&);
+  ReactorServer& operator=(const ReactorServer&);
+};
+
+// Sets the address reported by ReactorServer::GetPeerAddr() for the
+// requests processed by the calling thread within the scope. A zero
+// address is unknown.
+//
+class PeerAddrScope {
+ public:
+
+  explicit PeerAddrScope(uint32_t ip);
+
+  ~PeerAddrScope();
+
+ private:
+  uint32_t ip_;
+  void* saved_;
+
+  // No copying allowed
+  PeerAddrScope(const PeerAddrScope&);
+  PeerAddrScope& operator=(const PeerAddrScope&);
+};
+
+// Marks the scope of a blocking call made by a reactor worker.
+//
+class BlockingRegion {
+ public:
+
+  explicit BlockingRegion(bool may_block = true) : may_block_(may_block) {
+    if (may_block_) ReactorServer::BeginBlocking();
+  }
+
+  ~BlockingRegion() {
+    if (may_block_) ReactorServer::EndBlocking();
+  }
+
+ private:
+  bool may_block_;
+
+  // No copying allowed
+  BlockingRegion(const BlockingRegion&);
+  BlockingRegion& operator=(const BlockingRegion&);
+};
+
+} /* namespace indexfs */
+
+#endif /* _INDEXFS_IPC_REACTOR_H_ */
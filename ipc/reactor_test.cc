@@ -0,0 +1,293 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ipc/reactor.h"
+#include "common/logging.h"
+#include "common/unit_test.h"
+
+namespace indexfs { namespace test {
+
+namespace {
+static const int kNumRequests = 2000;
+static const int kNumClients = 4;
+
+// Echoes each request back. Requests are routed by their first byte,
+// and requests whose first byte is even are slowed down so that
+// replies complete out of order across partitions. Requests starting
+// with "wait" block until a request starting with "wake" is served.
+// Requests starting with "peer" are answered with the peer address.
+//
+class EchoHandler: public FrameHandler {
+ public:
+  EchoHandler() : cv_(&mu_), woken_(false) { }
+  uint64_t GetRoutingKey(const Slice& request) {
+    return request.empty() ? 0 : static_cast<unsigned char>(request[0]);
+  }
+  bool Process(const Slice& request, std::string* reply) {
+    if (!request.empty() && request[0] % 2 == 0) {
+      usleep(50);
+    }
+    if (request.starts_with("wake")) {
+      MutexLock lock(&mu_);
+      woken_ = true;
+      cv_.SignalAll();
+    } else if (request.starts_with("wait")) {
+      BlockingRegion blocking;
+      MutexLock lock(&mu_);
+      while (!woken_) {
+        cv_.Wait();
+      }
+    }
+    uint32_t ip;
+    if (request.starts_with("oneway")) {
+      reply->clear();
+    } else if (request.starts_with("peer")) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%08x",
+               ReactorServer::GetPeerAddr(&ip) ? ip : 0);
+      reply->assign(buf);
+    } else {
+      reply->assign(request.data(), request.size());
+    }
+    return true;
+  }
+ private:
+  Mutex mu_;
+  CondVar cv_;
+  bool woken_;
+};
+
+static void* RunServer(void* arg) {
+  reinterpret_cast<ReactorServer*>(arg)->Serve();
+  return NULL;
+}
+
+static std::string Frame(const std::string& data) {
+  std::string result;
+  uint32_t size = htonl(static_cast<uint32_t>(data.size()));
+  result.append(reinterpret_cast<const char*>(&size), 4);
+  result.append(data);
+  return result;
+}
+
+static std::string MakeRequest(int client, int i) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%c-%d-%d", 'a' + (i % 8), client, i);
+  return std::string(buf) + std::string(i % 97, 'x');
+}
+
+static int Connect(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int ConnectLocal(const std::string& path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool ReadFully(int fd, char* buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buf, size);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool ReadFrame(int fd, std::string* data) {
+  uint32_t size;
+  if (!ReadFully(fd, reinterpret_cast<char*>(&size), 4)) {
+    return false;
+  }
+  data->resize(ntohl(size));
+  return data->empty() || ReadFully(fd, &(*data)[0], data->size());
+}
+
+// Pipelines all requests over a single connection, then
+// checks that all replies come back in sending order.
+//
+struct ClientArgs {
+  int port;
+  int client;
+  int num_errors;
+};
+
+static void* RunClient(void* arg) {
+  ClientArgs* args = reinterpret_cast<ClientArgs*>(arg);
+  int fd = Connect(args->port);
+  if (fd < 0) {
+    args->num_errors = kNumRequests;
+    return NULL;
+  }
+  std::string out;
+  for (int i = 0; i < kNumRequests; ++i) {
+    out.append(Frame(MakeRequest(args->client, i)));
+    if (i % 10 == 0) {
+      out.append(Frame("oneway"));
+    }
+  }
+  size_t off = 0;
+  while (off < out.size()) {
+    ssize_t n = write(fd, out.data() + off, out.size() - off);
+    if (n <= 0) {
+      break;
+    }
+    off += n;
+  }
+  for (int i = 0; i < kNumRequests; ++i) {
+    std::string reply;
+    if (!ReadFrame(fd, &reply) || reply != MakeRequest(args->client, i)) {
+      args->num_errors++;
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+struct ReactorTest {
+  EchoHandler handler_;
+  ReactorServer server_;
+  std::string local_path_;
+  pthread_t tid_;
+  ReactorTest() : server_(&handler_, 0, 2, 2) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/reactor_test-%d.sock", getpid());
+    local_path_ = path;
+    Status s = server_.OpenLocal(local_path_);
+    DLOG_ASSERT(s.ok());
+    pthread_create(&tid_, NULL, &RunServer, &server_);
+  }
+  ~ReactorTest() {
+    server_.Stop();
+    pthread_join(tid_, NULL);
+  }
+};
+}
+
+TEST(ReactorTest, Echo) {
+  ClientArgs args;
+  args.port = server_.GetPort();
+  args.client = 0;
+  args.num_errors = 0;
+  RunClient(&args);
+  ASSERT_EQ(args.num_errors, 0);
+}
+
+TEST(ReactorTest, ManyClients) {
+  pthread_t tids[kNumClients];
+  ClientArgs args[kNumClients];
+  for (int i = 0; i < kNumClients; ++i) {
+    args[i].port = server_.GetPort();
+    args[i].client = i;
+    args[i].num_errors = 0;
+    pthread_create(&tids[i], NULL, &RunClient, &args[i]);
+  }
+  for (int i = 0; i < kNumClients; ++i) {
+    pthread_join(tids[i], NULL);
+    ASSERT_EQ(args[i].num_errors, 0);
+  }
+}
+
+TEST(ReactorTest, Disconnect) {
+  int fd = Connect(server_.GetPort());
+  ASSERT_GE(fd, 0);
+  std::string out = Frame(MakeRequest(0, 0)) + Frame(MakeRequest(0, 1));
+  ASSERT_EQ(write(fd, out.data(), out.size()), out.size());
+  close(fd);
+  ClientArgs args;
+  args.port = server_.GetPort();
+  args.client = 1;
+  args.num_errors = 0;
+  RunClient(&args);
+  ASSERT_EQ(args.num_errors, 0);
+}
+
+// Blocks all workers of a partition on a request that
+// can only be released by a later request to that partition.
+//
+TEST(ReactorTest, BlockingWorkers) {
+  int fd = Connect(server_.GetPort());
+  ASSERT_GE(fd, 0);
+  std::string out = Frame("wait-0") + Frame("wait-1") + Frame("wait-2");
+  out.append(Frame("wake"));
+  ASSERT_EQ(write(fd, out.data(), out.size()), out.size());
+  std::string reply;
+  ASSERT_TRUE(ReadFrame(fd, &reply));
+  ASSERT_EQ(reply, "wait-0");
+  ASSERT_TRUE(ReadFrame(fd, &reply));
+  ASSERT_EQ(reply, "wait-1");
+  ASSERT_TRUE(ReadFrame(fd, &reply));
+  ASSERT_EQ(reply, "wait-2");
+  ASSERT_TRUE(ReadFrame(fd, &reply));
+  ASSERT_EQ(reply, "wake");
+  close(fd);
+}
+
+TEST(ReactorTest, LocalSocket) {
+  int fd = ConnectLocal(local_path_);
+  ASSERT_GE(fd, 0);
+  std::string request = MakeRequest(0, 1);
+  std::string out = Frame(request);
+  ASSERT_EQ(write(fd, out.data(), out.size()), out.size());
+  std::string reply;
+  ASSERT_TRUE(ReadFrame(fd, &reply));
+  ASSERT_EQ(reply, request);
+  close(fd);
+}
+
+TEST(ReactorTest, PeerAddr) {
+  char loopback[32];
+  snprintf(loopback, sizeof(loopback), "%08x", INADDR_LOOPBACK);
+  std::string out = Frame("peer");
+  std::string reply;
+  int fd = Connect(server_.GetPort());
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, out.data(), out.size()), out.size());
+  ASSERT_TRUE(ReadFrame(fd, &reply));
+  ASSERT_EQ(reply, loopback);
+  close(fd);
+  fd = ConnectLocal(local_path_);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(write(fd, out.data(), out.size()), out.size());
+  ASSERT_TRUE(ReadFrame(fd, &reply));
+  ASSERT_EQ(reply, loopback);
+  close(fd);
+  uint32_t ip;
+  ASSERT_TRUE(!ReactorServer::GetPeerAddr(&ip));
+}
+
+} /* namespace test */ } /* namespace indexfs */
+
+int main(int argc, char* argv[]) {
+  return indexfs::test::RunAllTests();
+}
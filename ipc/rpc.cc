@@ -2,32 +2,80 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <map>
+#include <set>
+#include <algorithm>
+
 #include "rpc.h"
 #include "rpc_impl.h"
 
+DEFINE_int32(rpc_pool_size, 4, "Set the max number of connections to each server");
+
 namespace indexfs {
 
 // -------------------------------------------------------------
 // RPC Implementation
 // -------------------------------------------------------------
 
+// Clients to a given server. New clients are created on demand when all
+// existing ones are checked out, until the pool reaches its max size.
+//
+struct RPC::ConnPool {
+  Mutex mu;
+  CondVar cv;
+  int num_clients;
+  std::vector<FTCliRepWrapper*> idle;
+  std::vector<FTCliRepWrapper*> all;
+  ConnPool() : cv(&mu), num_clients(0) { }
+};
+
+RPC::RPC(Config* conf, MetadataIndexServiceIf* self)
+  : conf_(conf)
+  , self_(self) {
+  member_set_ = CreateStaticMemberSet(conf_);
+  int total_server = member_set_->TotalServers();
+  pools_ = new ConnPool[total_server];
+  split_clients_ = new FTCliRepWrapper*[total_server];
+  pending_clients_ = new FTCliRepWrapper*[total_server];
+  num_pending_ = new int[total_server];
+  for (int i = 0; i < total_server; i++) {
+    split_clients_[i] = NULL;
+    pending_clients_[i] = NULL;
+    num_pending_[i] = 0;
+    if (self_ == NULL || !IsServerLocal(i)) {
+      FTCliRepWrapper* client = CreateClientFor(i);
+      pools_[i].num_clients = 1;
+      pools_[i].idle.push_back(client);
+      pools_[i].all.push_back(client);
+    }
+  }
+}
+
 RPC::~RPC() {
-  if (clients_ != NULL) {
+  if (pools_ != NULL) {
     for (int i = 0; i < TotolServers(); i++) {
-      if (clients_[i] != NULL) {
-        delete clients_[i];
-        clients_[i] = NULL;
+      DLOG_ASSERT(pools_[i].idle.size() == pools_[i].all.size());
+      for (size_t j = 0; j < pools_[i].all.size(); j++) {
+        delete pools_[i].all[j];
       }
     }
-    delete [] clients_;
+    delete [] pools_;
   }
-  if (mtxes_ != NULL) delete [] mtxes_;
+  if (split_clients_ != NULL) {
+    for (int i = 0; i < TotolServers(); i++) {
+      delete split_clients_[i];
+    }
+    delete [] split_clients_;
+  }
+  if (pending_clients_ != NULL) delete [] pending_clients_;
+  if (num_pending_ != NULL) delete [] num_pending_;
 }
 
 Status RPC::Init() {
   for (int i = 0; i < TotolServers(); i++) {
-    if (clients_[i] != NULL) {
-      Status s = clients_[i]->Open();
+    MutexLock lock(&pools_[i].mu);
+    for (size_t j = 0; j < pools_[i].all.size(); j++) {
+      Status s = pools_[i].all[j]->Open();
       LOG_IF(WARNING, !s.ok())
           << "Fail to open RPC client #" << i
           << " (" << s.ToCodeString() << "), will retry later";
@@ -39,11 +87,17 @@ Status RPC::Init() {
 
 Status RPC::Shutdown() {
   for (int i = 0; i < TotolServers(); i++) {
-    if (clients_[i] != NULL) {
-      clients_[i]->Shutdown();
+    MutexLock lock(&pools_[i].mu);
+    for (size_t j = 0; j < pools_[i].all.size(); j++) {
+      pools_[i].all[j]->Shutdown();
       DLOG(INFO) << "RPC client #" << i << " closed";
     }
   }
+  for (int i = 0; i < TotolServers(); i++) {
+    if (split_clients_[i] != NULL) {
+      split_clients_[i]->Shutdown();
+    }
+  }
   return Status::OK();
 }
 
@@ -56,52 +110,441 @@ FTCliRepWrapper* RPC::CreateClientFor(int srv_id) {
   return new FTCliRepWrapper(srv_id, conf_, member_set_);
 }
 
-FTCliRepWrapper* RPC::CreateClientIfNotLocal(int srv_id) {
-  if (self_ == NULL) {
-    return CreateClientFor(srv_id);
+// Checks out an idle client to a given server, creating a new one if none
+// is idle and the pool is not yet full, or otherwise waiting for one to
+// be checked in. Returns NULL if the server is local.
+//
+FTCliRepWrapper* RPC::Checkout(int srv_id) {
+  DLOG_ASSERT(srv_id >= 0);
+  DLOG_ASSERT(srv_id < conf_->GetSrvNum());
+  if (self_ != NULL && IsServerLocal(srv_id)) {
+    return NULL;
+  }
+  ConnPool* pool = &pools_[srv_id];
+  {
+    MutexLock lock(&pool->mu);
+    while (pool->idle.empty()) {
+      if (pool->num_clients < std::max(FLAGS_rpc_pool_size, 1)) {
+        pool->num_clients++;
+        break;
+      }
+      pool->cv.Wait();
+    }
+    if (!pool->idle.empty()) {
+      FTCliRepWrapper* client = pool->idle.back();
+      pool->idle.pop_back();
+      return client;
+    }
+  }
+  // Connect outside the lock
+  FTCliRepWrapper* client = CreateClientFor(srv_id);
+  Status s = client->Open();
+  LOG_IF(WARNING, !s.ok())
+      << "Fail to open RPC client #" << srv_id
+      << " (" << s.ToCodeString() << "), will retry later";
+  MutexLock lock(&pool->mu);
+  pool->all.push_back(client);
+  return client;
+}
+
+void RPC::Checkin(int srv_id, FTCliRepWrapper* client) {
+  if (client != NULL) {
+    ConnPool* pool = &pools_[srv_id];
+    MutexLock lock(&pool->mu);
+    pool->idle.push_back(client);
+    pool->cv.Signal();
+  }
+}
+
+// Retrieves the "service" of a given server. Returns the local server handle if
+// possible, otherwise returns the given RPC client stub to the remote server.
+// Re-establishes the TCP connection to the server if previous attempts failed.
+// Throws TTransportException if that server cannot be reached at the moment.
+//
+MetadataIndexServiceIf* RPC::GetService(int srv_id, FTCliRepWrapper* client) {
+  if (client == NULL) {
+    DLOG_ASSERT(self_ != NULL && IsServerLocal(srv_id));
+    return self_;
   }
-  return IsServerLocal(srv_id) ? NULL : CreateClientFor(srv_id);
+  if (!client->IsReady()) {
+    client->RecoverConnectionToServer();
+    DLOG_ASSERT(client->IsReady());
+    DLOG(INFO) << "RPC client #" << srv_id << " re-initialized";
+  }
+  return client;
 }
 
-// Retrieves the advisory lock associated with a given RPC client.
+// Returns the client holding outstanding requests to a given server.
+// Split-phase requests use a connection of their own, which is never
+// part of the connection pool, so that synchronous calls made while
+// they are outstanding cannot block on a pool kept busy by them.
 //
-Mutex* RPC::GetMutex(int srv_id) {
+FTCliRepWrapper* RPC::BeginPending(int srv_id) {
   DLOG_ASSERT(srv_id >= 0);
   DLOG_ASSERT(srv_id < conf_->GetSrvNum());
-  return mtxes_ + srv_id;
+  DLOG_ASSERT(self_ == NULL || !IsServerLocal(srv_id));
+  FTCliRepWrapper* client = pending_clients_[srv_id];
+  if (client == NULL) {
+    DLOG_ASSERT(num_pending_[srv_id] == 0);
+    client = split_clients_[srv_id];
+    if (client == NULL) {
+      client = CreateClientFor(srv_id);
+      Status s = client->Open();
+      LOG_IF(WARNING, !s.ok())
+          << "Fail to open RPC client #" << srv_id
+          << " (" << s.ToCodeString() << "), will retry later";
+      split_clients_[srv_id] = client;
+    }
+    GetService(srv_id, client);
+    pending_clients_[srv_id] = client;
+  }
+  return client;
 }
 
-// Retrieves the "service" of a given server. Returns the local server handle if
-// possible, otherwise returns a RPC client stub associated with the remote server.
-// Re-establishes the TCP connection to the server if previous attempts failed.
+// Accounts for a received reply.
 //
-Status RPC::GetMetadataService(int srv_id, MetadataIndexServiceIf** _return) {
-  *_return = NULL;
+void RPC::EndPending(int srv_id) {
+  DLOG_ASSERT(num_pending_[srv_id] > 0);
+  if (--num_pending_[srv_id] == 0) {
+    pending_clients_[srv_id] = NULL;
+  }
+}
+
+// Drops all outstanding requests to a given server after a failure.
+// The connection is closed so that it is rebuilt on its next use.
+//
+void RPC::AbortPending(int srv_id) {
+  FTCliRepWrapper* client = pending_clients_[srv_id];
+  if (client != NULL) {
+    client->Shutdown();
+    pending_clients_[srv_id] = NULL;
+  }
+  num_pending_[srv_id] = 0;
+}
+
+int RPC::GetPendingFD(int srv_id) {
   DLOG_ASSERT(srv_id >= 0);
   DLOG_ASSERT(srv_id < conf_->GetSrvNum());
-  if (self_ != NULL && IsServerLocal(srv_id)) {
-    DLOG_ASSERT(clients_[srv_id] == NULL);
-    *_return = self_;
-    return Status::OK();
-  }
-  DLOG_ASSERT(clients_[srv_id] != NULL);
-  if (!clients_[srv_id]->IsReady()) {
-    clients_[srv_id]->RecoverConnectionToServer();
-    DLOG_ASSERT(clients_[srv_id]->IsReady());
-    DLOG(INFO) << "RPC client #" << srv_id << " re-initialized";
+  FTCliRepWrapper* client = pending_clients_[srv_id];
+  return client != NULL ? client->GetSocketFD() : -1;
+}
+
+// Checks that the split-phase request outstanding on a given server is of
+// the expected kind, where kNoCall means no request may be outstanding.
+//
+Status RPC::CheckPendingCall(int srv_id, int call) {
+  if (srv_id < 0 || srv_id >= conf_->GetSrvNum()) {
+    return Status::InvalidArgument("No such server");
+  }
+  FTCliRepWrapper* client = pending_clients_[srv_id];
+  if (call == FTCliRepWrapper::kNoCall) {
+    if (client != NULL) {
+      return Status::InvalidArgument("Requests outstanding on server");
+    }
+  } else if (client == NULL || client->PendingCall() != call) {
+    return Status::InvalidArgument("No such request outstanding on server");
   }
-  *_return = clients_[srv_id];
   return Status::OK();
 }
 
-// Returns the "RPC stub" associated with a given server.
-// Throws TTransportException if that server cannot be reached at the moment.
+// Sends a Readdir request without waiting for its reply. The client used
+// stays checked out until the reply is received.
 //
-MetadataIndexServiceIf* RPC::GetClient(int srv_id) {
-  MetadataIndexServiceIf* _return;
-  Status s = GetMetadataService(srv_id, &_return);
-  DLOG_ASSERT(s.ok());
-  return _return;
+Status RPC::SendReaddir(int srv_id, int64_t dir_id, int16_t index) {
+  Status s = CheckPendingCall(srv_id, FTCliRepWrapper::kNoCall);
+  if (s.ok()) {
+    FTCliRepWrapper* client = BeginPending(srv_id);
+    try {
+      client->send_Readdir(dir_id, index);
+    } catch (TTransportException &tx) {
+      AbortPending(srv_id);
+      throw;
+    }
+    num_pending_[srv_id]++;
+  }
+  return s;
+}
+
+// Waits for the reply of the last Readdir request sent to a given server.
+//
+Status RPC::RecvReaddir(int srv_id, EntryList* _return) {
+  Status s = CheckPendingCall(srv_id, FTCliRepWrapper::kReaddirCall);
+  if (s.ok()) {
+    FTCliRepWrapper* client = pending_clients_[srv_id];
+    try {
+      client->recv_Readdir(*_return);
+    } catch (TTransportException &tx) {
+      AbortPending(srv_id);
+      throw;
+    } catch (...) {
+      EndPending(srv_id);
+      throw;
+    }
+    EndPending(srv_id);
+  }
+  return s;
+}
+
+Status RPC::SendReaddirScan(int srv_id, int64_t dir_id, int16_t index,
+        const std::string& start_hash, int32_t max_entries) {
+  Status s = CheckPendingCall(srv_id, FTCliRepWrapper::kNoCall);
+  if (s.ok()) {
+    FTCliRepWrapper* client = BeginPending(srv_id);
+    try {
+      client->send_ReaddirScan(dir_id, index, start_hash, max_entries);
+    } catch (TTransportException &tx) {
+      AbortPending(srv_id);
+      throw;
+    }
+    num_pending_[srv_id]++;
+  }
+  return s;
+}
+
+Status RPC::RecvReaddirScan(int srv_id, ScanResult* _return) {
+  Status s = CheckPendingCall(srv_id, FTCliRepWrapper::kReaddirScanCall);
+  if (s.ok()) {
+    FTCliRepWrapper* client = pending_clients_[srv_id];
+    try {
+      client->recv_ReaddirScan(*_return);
+    } catch (TTransportException &tx) {
+      AbortPending(srv_id);
+      throw;
+    } catch (...) {
+      EndPending(srv_id);
+      throw;
+    }
+    EndPending(srv_id);
+  }
+  return s;
+}
+
+Status RPC::SendReaddirPlus(int srv_id, int64_t dir_id, int16_t index,
+        const std::string& start_hash, int32_t max_entries) {
+  Status s = CheckPendingCall(srv_id, FTCliRepWrapper::kNoCall);
+  if (s.ok()) {
+    FTCliRepWrapper* client = BeginPending(srv_id);
+    try {
+      client->send_ReaddirPlus(dir_id, index, start_hash, max_entries);
+    } catch (TTransportException &tx) {
+      AbortPending(srv_id);
+      throw;
+    }
+    num_pending_[srv_id]++;
+  }
+  return s;
+}
+
+Status RPC::RecvReaddirPlus(int srv_id, ScanPlusResult* _return) {
+  Status s = CheckPendingCall(srv_id, FTCliRepWrapper::kReaddirPlusCall);
+  if (s.ok()) {
+    FTCliRepWrapper* client = pending_clients_[srv_id];
+    try {
+      client->recv_ReaddirPlus(*_return);
+    } catch (TTransportException &tx) {
+      AbortPending(srv_id);
+      throw;
+    } catch (...) {
+      EndPending(srv_id);
+      throw;
+    }
+    EndPending(srv_id);
+  }
+  return s;
+}
+
+void RPC::SendMknod(int srv_id, const OID& obj_id, int16_t perm) {
+  FTCliRepWrapper* client = BeginPending(srv_id);
+  try {
+    client->send_Mknod(obj_id, perm);
+  } catch (TTransportException &tx) {
+    AbortPending(srv_id);
+    throw;
+  }
+  num_pending_[srv_id]++;
+}
+
+void RPC::RecvMknod(int srv_id) {
+  FTCliRepWrapper* client = pending_clients_[srv_id];
+  DLOG_ASSERT(client != NULL);
+  try {
+    client->recv_Mknod();
+  } catch (TTransportException &tx) {
+    AbortPending(srv_id);
+    throw;
+  } catch (...) {
+    EndPending(srv_id);
+    throw;
+  }
+  EndPending(srv_id);
+}
+
+void RPC::SendGetattr(int srv_id, const OID& obj_id) {
+  FTCliRepWrapper* client = BeginPending(srv_id);
+  try {
+    client->send_Getattr(obj_id);
+  } catch (TTransportException &tx) {
+    AbortPending(srv_id);
+    throw;
+  }
+  num_pending_[srv_id]++;
+}
+
+void RPC::RecvGetattr(int srv_id, StatInfo* _return) {
+  FTCliRepWrapper* client = pending_clients_[srv_id];
+  DLOG_ASSERT(client != NULL);
+  try {
+    client->recv_Getattr(*_return);
+  } catch (TTransportException &tx) {
+    AbortPending(srv_id);
+    throw;
+  } catch (...) {
+    EndPending(srv_id);
+    throw;
+  }
+  EndPending(srv_id);
+}
+
+// A request multicast to many servers.
+//
+class MulticastCall {
+ public:
+  MulticastCall() { }
+  virtual ~MulticastCall() { }
+  virtual void Send(FTCliRepWrapper* client, size_t i) = 0;
+  virtual void Recv(FTCliRepWrapper* client, size_t i) = 0;
+
+ private:
+  // No copying allowed
+  MulticastCall(const MulticastCall&);
+  MulticastCall& operator=(const MulticastCall&);
+};
+
+namespace {
+class PartitionCall: public MulticastCall {
+ public:
+  PartitionCall(int64_t dir_id, const std::vector<int16_t>& indexes,
+          const std::string& dmap_data)
+    : dir_id_(dir_id), indexes_(indexes), dmap_data_(dmap_data) {
+  }
+  void Send(FTCliRepWrapper* client, size_t i) {
+    client->send_InsertSplit(dir_id_, indexes_[i], indexes_[i],
+        std::string(), dmap_data_, 0, 0, 0);
+  }
+  void Recv(FTCliRepWrapper* client, size_t i) {
+    client->recv_InsertSplit();
+  }
+
+ private:
+  int64_t dir_id_;
+  const std::vector<int16_t>& indexes_;
+  const std::string& dmap_data_;
+};
+
+class ZerothCall: public MulticastCall {
+ public:
+  ZerothCall(const std::vector<int64_t>& dir_ids,
+          const std::vector<int16_t>& zeroth_servers)
+    : dir_ids_(dir_ids), zeroth_servers_(zeroth_servers) {
+  }
+  void Send(FTCliRepWrapper* client, size_t i) {
+    client->send_CreateZeroth(dir_ids_[i], zeroth_servers_[i]);
+  }
+  void Recv(FTCliRepWrapper* client, size_t i) {
+    client->recv_CreateZeroth();
+  }
+
+ private:
+  const std::vector<int64_t>& dir_ids_;
+  const std::vector<int16_t>& zeroth_servers_;
+};
+}
+
+// Each server is reached through a single connection checked out for
+// the whole call, on which requests to that server are pipelined.
+//
+void RPC::Multicast(const std::vector<int>& srv_ids,
+        MulticastCall* call, std::vector<Status>* results) {
+  std::set<int> failed;
+  std::map<int, FTCliRepWrapper*> clients;
+  std::vector<bool> sent(srv_ids.size(), false);
+  results->assign(srv_ids.size(), Status::OK());
+  for (size_t i = 0; i < srv_ids.size(); ++i) {
+    DLOG_ASSERT(self_ == NULL || !IsServerLocal(srv_ids[i]));
+    clients[srv_ids[i]] = NULL;
+  }
+  // Check out connections in server order so that concurrent
+  // callers cannot deadlock on each other's connections
+  std::map<int, FTCliRepWrapper*>::iterator it = clients.begin();
+  for (; it != clients.end(); ++it) {
+    it->second = Checkout(it->first);
+  }
+  for (size_t i = 0; i < srv_ids.size(); ++i) {
+    int srv_id = srv_ids[i];
+    FTCliRepWrapper* client = clients[srv_id];
+    if (failed.count(srv_id) != 0) {
+      (*results)[i] = Status::IOError("Server unreachable");
+      continue;
+    }
+    try {
+      GetService(srv_id, client);
+      call->Send(client, i);
+      sent[i] = true;
+    } catch (apache::thrift::TException &tx) {
+      client->Shutdown();
+      failed.insert(srv_id);
+      (*results)[i] = Status::IOError("Cannot send request", tx.what());
+    }
+  }
+  for (size_t i = 0; i < srv_ids.size(); ++i) {
+    if (!sent[i]) {
+      continue;
+    }
+    if (failed.count(srv_ids[i]) != 0) {
+      (*results)[i] = Status::IOError("Server unreachable");
+      continue;
+    }
+    FTCliRepWrapper* client = clients[srv_ids[i]];
+    try {
+      call->Recv(client, i);
+    } catch (TTransportException &tx) {
+      client->Shutdown();
+      failed.insert(srv_ids[i]);
+      (*results)[i] = Status::IOError("Cannot receive reply", tx.what());
+    } catch (FileAlreadyExistsException &ae) {
+      (*results)[i] = Status::AlreadyExists(Slice());
+    } catch (apache::thrift::TException &tx) {
+      (*results)[i] = Status::Corruption(tx.what());
+    }
+  }
+  for (it = clients.begin(); it != clients.end(); ++it) {
+    Checkin(it->first, it->second);
+  }
+}
+
+Status RPC::MulticastPartitions(int64_t dir_id,
+        const std::vector<int>& srv_ids, const std::vector<int16_t>& indexes,
+        const std::string& dmap_data) {
+  DLOG_ASSERT(srv_ids.size() == indexes.size());
+  std::vector<Status> results;
+  PartitionCall call(dir_id, indexes, dmap_data);
+  Multicast(srv_ids, &call, &results);
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (!results[i].ok()) {
+      return results[i];
+    }
+  }
+  return Status::OK();
+}
+
+void RPC::MulticastZeroths(const std::vector<int>& srv_ids,
+        const std::vector<int64_t>& dir_ids,
+        const std::vector<int16_t>& zeroth_servers,
+        std::vector<Status>* results) {
+  DLOG_ASSERT(srv_ids.size() == dir_ids.size());
+  DLOG_ASSERT(srv_ids.size() == zeroth_servers.size());
+  ZerothCall call(dir_ids, zeroth_servers);
+  Multicast(srv_ids, &call, results);
 }
 
 // -------------------------------------------------------------
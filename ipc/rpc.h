@@ -19,6 +19,7 @@ namespace indexfs {
 class SrvRep;
 class CliRep;
 class FTCliRepWrapper;
+class MulticastCall;
 
 class RPC {
  public:
@@ -33,41 +34,126 @@ class RPC {
   int TotolServers() { return member_set_->TotalServers(); }
 
   virtual ~RPC();
-  Mutex* GetMutex(int srv_id);
-  MetadataIndexServiceIf* GetClient(int srv_id);
-  Status GetMetadataService(int srv_id, MetadataIndexServiceIf** _return);
+
+  // Split-phase directory reads against a remote server. Requests to
+  // different servers may be outstanding at the same time, but each server
+  // can only have one outstanding request per RPC object. A send returns
+  // a non-OK status without sending anything if a request to that server
+  // is already outstanding, and a receive does so unless the outstanding
+  // request is of the matching kind.
+  // Throws TTransportException if that server cannot be reached at the moment.
+  Status SendReaddir(int srv_id, int64_t dir_id, int16_t index);
+  Status RecvReaddir(int srv_id, EntryList* _return);
+  Status SendReaddirScan(int srv_id, int64_t dir_id, int16_t index,
+      const std::string& start_hash, int32_t max_entries);
+  Status RecvReaddirScan(int srv_id, ScanResult* _return);
+  Status SendReaddirPlus(int srv_id, int64_t dir_id, int16_t index,
+      const std::string& start_hash, int32_t max_entries);
+  Status RecvReaddirPlus(int srv_id, ScanPlusResult* _return);
+
+  // Pipelined requests against a remote server. Any number of requests
+  // may be outstanding on a server at once, and their replies must be
+  // received in the order those requests were sent. Outstanding requests
+  // to a server are all lost once a TTransportException is thrown.
+  void SendMknod(int srv_id, const OID& obj_id, int16_t perm);
+  void RecvMknod(int srv_id);
+  void SendGetattr(int srv_id, const OID& obj_id);
+  void RecvGetattr(int srv_id, StatInfo* _return);
+
+  // Returns the socket on which replies from a given server are
+  // expected, or -1 if no request to that server is outstanding.
+  int GetPendingFD(int srv_id);
+
+  // Multicast requests, sent to a set of servers at once, the i-th request
+  // going to the i-th server. All requests are sent before any reply is
+  // awaited. Unlike the calls above, these keep no state in the RPC object
+  // and are safe to use from concurrent threads. All replies are drained
+  // even if some requests fail.
+
+  // Installs empty partitions of a new directory.
+  // Returns the first error encountered, if any.
+  Status MulticastPartitions(int64_t dir_id,
+      const std::vector<int>& srv_ids, const std::vector<int16_t>& indexes,
+      const std::string& dmap_data);
+
+  // Installs the zeroth partitions of new directories and sets the outcome
+  // of each request. Requests failing with an IOError may or may not have
+  // reached their server.
+  void MulticastZeroths(const std::vector<int>& srv_ids,
+      const std::vector<int64_t>& dir_ids,
+      const std::vector<int16_t>& zeroth_servers,
+      std::vector<Status>* results);
 
  private:
 
-  explicit RPC(Config* conf, MetadataIndexServiceIf* self = NULL)
-    : conf_(conf)
-    , self_(self) {
-    member_set_ = CreateStaticMemberSet(conf_);
-    int total_server = member_set_->TotalServers();
-    mtxes_ = new Mutex[total_server];
-    clients_ = new FTCliRepWrapper*[total_server];
-    for (int i = 0; i < total_server; i++) {
-      clients_[i] = CreateClientIfNotLocal(i);
-    }
-  }
+  explicit RPC(Config* conf, MetadataIndexServiceIf* self = NULL);
 
   Config* conf_;
   MemberSet* member_set_;
   MetadataIndexServiceIf* self_;
 
-  // Advisory lock for RPC client sharing in MT contexts
-  Mutex* mtxes_;
+  // Per-server pools of RPC clients
+  struct ConnPool;
+  ConnPool* pools_;
+
+  // Per-server clients dedicated to split-phase requests
+  FTCliRepWrapper** split_clients_;
+  // Clients holding outstanding split-phase requests
+  FTCliRepWrapper** pending_clients_;
+  int* num_pending_;
 
-  FTCliRepWrapper** clients_;
   bool IsServerLocal(int srv_id);
   FTCliRepWrapper* CreateClientFor(int srv_id);
-  FTCliRepWrapper* CreateClientIfNotLocal(int srv_id);
+  FTCliRepWrapper* Checkout(int srv_id);
+  void Checkin(int srv_id, FTCliRepWrapper* client);
+  MetadataIndexServiceIf* GetService(int srv_id, FTCliRepWrapper* client);
+  FTCliRepWrapper* BeginPending(int srv_id);
+  void EndPending(int srv_id);
+  void AbortPending(int srv_id);
+  Status CheckPendingCall(int srv_id, int call);
+  void Multicast(const std::vector<int>& srv_ids,
+      MulticastCall* call, std::vector<Status>* results);
+  friend class RPC_Stub;
 
   // No copy allowed
   RPC(const RPC&);
   RPC& operator=(const RPC&);
 };
 
+// Checks out a client connection to a given server for the lifetime of
+// the stub, so that concurrent requests to the same server proceed on
+// different connections. A stub is meant to be used for a single request:
+//
+//   RPC_Stub(rpc, srv_id)->Getattr(info, oid);
+//
+class RPC_Stub {
+ public:
+
+  RPC_Stub(RPC* rpc, int srv_id)
+    : rpc_(rpc), srv_id_(srv_id) {
+    client_ = rpc_->Checkout(srv_id_);
+  }
+
+  ~RPC_Stub() {
+    rpc_->Checkin(srv_id_, client_);
+  }
+
+  // Returns the local server handle if possible, otherwise the checked out
+  // client. Throws TTransportException if that server cannot be reached.
+  MetadataIndexServiceIf* operator->() {
+    return rpc_->GetService(srv_id_, client_);
+  }
+
+ private:
+  RPC* rpc_;
+  int srv_id_;
+  FTCliRepWrapper* client_;
+
+  // No copying allowed
+  RPC_Stub(const RPC_Stub&);
+  RPC_Stub& operator=(const RPC_Stub&);
+};
+
 class RPC_Client {
  public:
 
@@ -15,6 +15,72 @@ DEFINE_int32(rpc_conn_attempts, 1, "Set the max number of TCP connection attempt
 
 namespace indexfs {
 
+#if !defined(IDXFS_RPC_NOBLOCKING) && !defined(IDXFS_RPC_THREADED)
+using apache::thrift::protocol::TType;
+using apache::thrift::protocol::T_I64;
+using apache::thrift::protocol::T_STOP;
+using apache::thrift::protocol::T_STRUCT;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::transport::TMemoryBuffer;
+
+uint64_t ThriftFrameHandler::GetRoutingKey(const Slice& request) {
+  if (IsWireRequest(request)) {
+    return request.size() >= 12 ? DecodeFixed64(request.data() + 4) : 0;
+  }
+  uint8_t* data = reinterpret_cast<uint8_t*>(const_cast<char*>(request.data()));
+  shared_ptr<TMemoryBuffer> buffer(new TMemoryBuffer(data, request.size()));
+  TBinaryProtocol protocol(buffer);
+  std::string name;
+  TMessageType msg_type;
+  TType field_type;
+  int32_t seqid;
+  int16_t field_id;
+  try {
+    protocol.readMessageBegin(name, msg_type, seqid);
+    protocol.readStructBegin(name);
+    protocol.readFieldBegin(name, field_type, field_id);
+    if (field_type == T_STRUCT) {
+      protocol.readStructBegin(name);
+      protocol.readFieldBegin(name, field_type, field_id);
+      while (field_type != T_STOP && field_type != T_I64) {
+        protocol.skip(field_type);
+        protocol.readFieldBegin(name, field_type, field_id);
+      }
+    }
+    if (field_type == T_I64) {
+      int64_t dir_id;
+      protocol.readI64(dir_id);
+      return static_cast<uint64_t>(dir_id);
+    }
+  } catch (apache::thrift::TException &tx) {
+    DLOG(WARNING) << "Fail to decode RPC request: " << tx.what();
+  }
+  return 0;
+}
+
+bool ThriftFrameHandler::Process(const Slice& request, std::string* reply) {
+  if (IsWireRequest(request)) {
+    return ProcessWireRequest(service_, request, reply);
+  }
+  uint8_t* data = reinterpret_cast<uint8_t*>(const_cast<char*>(request.data()));
+  shared_ptr<TMemoryBuffer> input(new TMemoryBuffer(data, request.size()));
+  shared_ptr<TMemoryBuffer> output(new TMemoryBuffer());
+  shared_ptr<TProtocol> in_proto(new TBinaryProtocol(input));
+  shared_ptr<TProtocol> out_proto(new TBinaryProtocol(output));
+  try {
+    processor_->process(in_proto, out_proto, NULL);
+  } catch (apache::thrift::TException &tx) {
+    LOG(WARNING) << "Fail to process RPC request: " << tx.what();
+    return false;
+  }
+  uint8_t* result;
+  uint32_t size;
+  output->getBuffer(&result, &size);
+  reply->assign(reinterpret_cast<char*>(result), size);
+  return true;
+}
+#endif
+
 FTCliRepWrapper::~FTCliRepWrapper() {
   if (client_ != NULL) {
     if (client_->IsReady()) {
@@ -30,7 +96,11 @@ FTCliRepWrapper::FTCliRepWrapper(
   , srv_id_(srv_id)
   , conf_(conf)
   , env_(Env::Default())
-  , member_set_(member_set) {
+  , member_set_(member_set)
+  , pending_(kNoCall)
+  , pending_dir_id_(-1)
+  , pending_index_(-1)
+  , pending_max_entries_(0) {
 }
 
 namespace {
@@ -46,14 +116,14 @@ int GetBackoffDuration(int attempt) {
 
 // Dispose the existing client and create a new one.
 //
-void FTCliRepWrapper::PrepareClient() {
+void FTCliRepWrapper::PrepareClient(bool local) {
   if (client_ != NULL) {
     if (client_->IsReady()) {
       client_->Close();
     }
     delete client_;
   }
-  client_ = new CliRep(ip_, port_);
+  client_ = local ? new CliRep(local_path_) : new CliRep(ip_, port_);
 }
 
 // Retrieve the latest address of the target server.
@@ -64,12 +134,17 @@ void FTCliRepWrapper::RetrieveServerAddress() {
   CHECK(s.ok())
       << "Fail to retrieve the address of "
       << "server " << srv_id_ << ": " << s.ToString();
+  if (!member_set_->FindLocalServer(srv_id_, &local_path_).ok()) {
+    local_path_.clear();
+  }
   DLOG(INFO) << "RPC setting address [server=" << srv_id_ << "]"
-      << ": ip=" << ip_ << ", port=" << port_;
+      << ": ip=" << ip_ << ", port=" << port_ << ", local=" << local_path_;
 }
 
 // Reconnect the target server by
 // disposing the existing RPC client and creating a new one.
+// Servers on the local host are reached through their Unix domain
+// socket, falling back to TCP if that socket cannot be connected.
 //
 Status FTCliRepWrapper::Reconnect(int max_attempts) {
   Status s;
@@ -80,8 +155,14 @@ Status FTCliRepWrapper::Reconnect(int max_attempts) {
     if (msecs > 0) {
       env_->SleepForMicroseconds(msecs);
     }
-    PrepareClient();
-    s = client_->Open();
+    if (!local_path_.empty()) {
+      PrepareClient(true);
+      s = client_->Open();
+    }
+    if (!s.ok()) {
+      PrepareClient(false);
+      s = client_->Open();
+    }
   }
   DLOG(INFO) << "RPC connecting to server"
       << " [server=" << srv_id_ << "]"
@@ -193,16 +274,21 @@ void FTCliRepWrapper::FlushDB() {
 void FTCliRepWrapper::Mknod(const OID& obj_id, const int16_t perm) {
   RPC_TRACE(__func__);
   EXEC_WITH_RETRY_TRY() {
-    GetInternalStub()->Mknod(obj_id, perm);
+    if (FLAGS_rpc_fast_wire) {
+      GetInternalClient()->CallWire(kWireMknod, obj_id, perm);
+    } else {
+      GetInternalStub()->Mknod(obj_id, perm);
+    }
     EXEC_EXIT();
   }
   EXEC_WITH_RETRY_CATCH();
 }
 
-void FTCliRepWrapper::Mknod_Bulk(const OIDS& obj_ids, const int16_t perm) {
+void FTCliRepWrapper::Mknod_Bulk(MknodBulkResult& _return,
+        const OIDS& obj_ids, const int16_t perm) {
   RPC_TRACE(__func__);
   EXEC_WITH_RETRY_TRY() {
-    GetInternalStub()->Mknod_Bulk(obj_ids, perm);
+    GetInternalStub()->Mknod_Bulk(_return, obj_ids, perm);
     EXEC_EXIT();
   }
   EXEC_WITH_RETRY_CATCH();
@@ -275,7 +361,24 @@ void FTCliRepWrapper::Renew(LookupInfo& _return, const OID& obj_id) {
 void FTCliRepWrapper::Access(LookupInfo& _return, const OID& obj_id) {
   RPC_TRACE(__func__);
   EXEC_WITH_RETRY_TRY() {
-    GetInternalStub()->Access(_return, obj_id);
+    if (FLAGS_rpc_fast_wire) {
+      Slice reply = GetInternalClient()->CallWire(kWireAccess, obj_id, 0);
+      if (!DecodeWireLookupInfo(reply, &_return)) {
+        throw TTransportException("Malformed reply");
+      }
+    } else {
+      GetInternalStub()->Access(_return, obj_id);
+    }
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
+void FTCliRepWrapper::ResolvePrefix(std::vector<LookupInfo>& _return,
+        const OID& obj_id, const std::vector<std::string>& names) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->ResolvePrefix(_return, obj_id, names);
     EXEC_EXIT();
   }
   EXEC_WITH_RETRY_CATCH();
@@ -284,7 +387,14 @@ void FTCliRepWrapper::Access(LookupInfo& _return, const OID& obj_id) {
 void FTCliRepWrapper::Getattr(StatInfo& _return, const OID& obj_id) {
   RPC_TRACE(__func__);
   EXEC_WITH_RETRY_TRY() {
-    GetInternalStub()->Getattr(_return, obj_id);
+    if (FLAGS_rpc_fast_wire) {
+      Slice reply = GetInternalClient()->CallWire(kWireGetattr, obj_id, 0);
+      if (!DecodeWireStatInfo(reply, &_return)) {
+        throw TTransportException("Malformed reply");
+      }
+    } else {
+      GetInternalStub()->Getattr(_return, obj_id);
+    }
     EXEC_EXIT();
   }
   EXEC_WITH_RETRY_CATCH();
@@ -319,6 +429,182 @@ void FTCliRepWrapper::Readdir(EntryList& _return,
   EXEC_WITH_RETRY_CATCH();
 }
 
+void FTCliRepWrapper::BeginSplitCall(int call,
+        const int64_t dir_id, const int16_t index,
+        const std::string& start_hash, const int32_t max_entries) {
+  DLOG_ASSERT(pending_ == kNoCall);
+  pending_ = call;
+  pending_dir_id_ = dir_id;
+  pending_index_ = index;
+  pending_start_hash_ = start_hash;
+  pending_max_entries_ = max_entries;
+}
+
+// Marks the outstanding split-phase request, which must be of
+// the given kind, as answered.
+//
+void FTCliRepWrapper::EndSplitCall(int call) {
+  DLOG_ASSERT(pending_ == call);
+  pending_ = kNoCall;
+}
+
+void FTCliRepWrapper::send_Readdir(
+        const int64_t dir_id, const int16_t index) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->send_Readdir(dir_id, index);
+    BeginSplitCall(kReaddirCall, dir_id, index, std::string(), 0);
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
+void FTCliRepWrapper::recv_Readdir(EntryList& _return) {
+  RPC_TRACE(__func__);
+  EndSplitCall(kReaddirCall);
+  try {
+    GetInternalStub()->recv_Readdir(_return);
+    return;
+  } catch (TTransportException &ex) {
+    if (FLAGS_rpc_retries <= 0) {
+      throw ex;
+    }
+    Status s = ReestabilishConnectionToServer();
+    if (!s.ok()) throw ex;
+  }
+  // Readdir is idempotent so it is safe to simply re-issue it
+  Readdir(_return, pending_dir_id_, pending_index_);
+}
+
+void FTCliRepWrapper::send_ReaddirScan(
+        const int64_t dir_id, const int16_t index,
+        const std::string& start_hash, const int32_t max_entries) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->send_ReaddirScan(dir_id, index,
+            start_hash, max_entries);
+    BeginSplitCall(kReaddirScanCall, dir_id, index, start_hash, max_entries);
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
+void FTCliRepWrapper::recv_ReaddirScan(ScanResult& _return) {
+  RPC_TRACE(__func__);
+  EndSplitCall(kReaddirScanCall);
+  try {
+    GetInternalStub()->recv_ReaddirScan(_return);
+    return;
+  } catch (TTransportException &ex) {
+    if (FLAGS_rpc_retries <= 0) {
+      throw ex;
+    }
+    Status s = ReestabilishConnectionToServer();
+    if (!s.ok()) throw ex;
+  }
+  ReaddirScan(_return, pending_dir_id_, pending_index_,
+          pending_start_hash_, pending_max_entries_);
+}
+
+void FTCliRepWrapper::send_ReaddirPlus(
+        const int64_t dir_id, const int16_t index,
+        const std::string& start_hash, const int32_t max_entries) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->send_ReaddirPlus(dir_id, index,
+            start_hash, max_entries);
+    BeginSplitCall(kReaddirPlusCall, dir_id, index, start_hash, max_entries);
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
+void FTCliRepWrapper::recv_ReaddirPlus(ScanPlusResult& _return) {
+  RPC_TRACE(__func__);
+  EndSplitCall(kReaddirPlusCall);
+  try {
+    GetInternalStub()->recv_ReaddirPlus(_return);
+    return;
+  } catch (TTransportException &ex) {
+    if (FLAGS_rpc_retries <= 0) {
+      throw ex;
+    }
+    Status s = ReestabilishConnectionToServer();
+    if (!s.ok()) throw ex;
+  }
+  ReaddirPlus(_return, pending_dir_id_, pending_index_,
+          pending_start_hash_, pending_max_entries_);
+}
+
+void FTCliRepWrapper::send_Mknod(const OID& obj_id, const int16_t perm) {
+  RPC_TRACE(__func__);
+  GetInternalStub()->send_Mknod(obj_id, perm);
+}
+
+void FTCliRepWrapper::recv_Mknod() {
+  RPC_TRACE(__func__);
+  GetInternalStub()->recv_Mknod();
+}
+
+void FTCliRepWrapper::send_Getattr(const OID& obj_id) {
+  RPC_TRACE(__func__);
+  GetInternalStub()->send_Getattr(obj_id);
+}
+
+void FTCliRepWrapper::recv_Getattr(StatInfo& _return) {
+  RPC_TRACE(__func__);
+  GetInternalStub()->recv_Getattr(_return);
+}
+
+void FTCliRepWrapper::send_InsertSplit(const int64_t dir_id,
+        const int16_t parent_index, const int16_t child_index,
+        const std::string& path_split_files, const std::string& dmap_data,
+        const int64_t min_seq, const int64_t max_seq, const int64_t num_entries) {
+  RPC_TRACE(__func__);
+  GetInternalStub()->send_InsertSplit(dir_id, parent_index, child_index,
+      path_split_files, dmap_data, min_seq, max_seq, num_entries);
+}
+
+void FTCliRepWrapper::recv_InsertSplit() {
+  RPC_TRACE(__func__);
+  GetInternalStub()->recv_InsertSplit();
+}
+
+void FTCliRepWrapper::send_CreateZeroth(
+        const int64_t dir_id, const int16_t zeroth_server) {
+  RPC_TRACE(__func__);
+  GetInternalStub()->send_CreateZeroth(dir_id, zeroth_server);
+}
+
+void FTCliRepWrapper::recv_CreateZeroth() {
+  RPC_TRACE(__func__);
+  GetInternalStub()->recv_CreateZeroth();
+}
+
+void FTCliRepWrapper::ReaddirScan(ScanResult& _return,
+        const int64_t dir_id, const int16_t index,
+        const std::string& start_hash, const int32_t max_entries) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->ReaddirScan(_return,
+            dir_id, index, start_hash, max_entries);
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
+void FTCliRepWrapper::ReaddirPlus(ScanPlusResult& _return,
+        const int64_t dir_id, const int16_t index,
+        const std::string& start_hash, const int32_t max_entries) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->ReaddirPlus(_return,
+            dir_id, index, start_hash, max_entries);
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
 void FTCliRepWrapper::InsertSplit(const int64_t dir_id,
         const int16_t parent_index, const int16_t child_index,
         const std::string& path_split_files,
@@ -334,4 +620,27 @@ void FTCliRepWrapper::InsertSplit(const int64_t dir_id,
   EXEC_WITH_RETRY_CATCH();
 }
 
+void FTCliRepWrapper::PreloadSplit(const int64_t dir_id,
+        const int16_t child_index,
+        const std::string& path_split_files,
+        const int64_t min_seq, const int64_t max_seq, const int64_t num_entries) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->PreloadSplit(dir_id, child_index,
+            path_split_files, min_seq, max_seq, num_entries);
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
+void FTCliRepWrapper::DiscardSplit(const int64_t dir_id,
+        const int16_t child_index) {
+  RPC_TRACE(__func__);
+  EXEC_WITH_RETRY_TRY() {
+    GetInternalStub()->DiscardSplit(dir_id, child_index);
+    EXEC_EXIT();
+  }
+  EXEC_WITH_RETRY_CATCH();
+}
+
 } /* namespace indexfs */
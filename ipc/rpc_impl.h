@@ -8,6 +8,8 @@
 #include "ipc/membset.h"
 #include "ipc/rpc.h"
 #include "ipc/rpc_types.h"
+#include "ipc/reactor.h"
+#include "ipc/wire.h"
 
 // -------------------------------------------------------------
 // Internal RPC Implementation
@@ -36,16 +38,30 @@ class CliRep {
   shared_ptr<TSocket> socket_;
   shared_ptr<TTransport> transport_;
   shared_ptr<TProtocol> protocol_;
-  scoped_ptr<MetadataIndexServiceIf> stub_;
+  scoped_ptr<MetadataIndexServiceClient> stub_;
+  std::string wire_buf_; // reused by all fast-path calls
 
  public:
 
   CliRep(const std::string& ip, int port)
     : socket_(new TSocket(ip, port))
-#   ifdef IDXFS_RPC_NOBLOCKING
-    , transport_(new TFramedTransport(socket_))
+#   ifdef IDXFS_RPC_THREADED
+    , transport_(new TBufferedTransport(socket_))
 #   else
+    , transport_(new TFramedTransport(socket_))
+#   endif
+    , protocol_(new TBinaryProtocol(transport_))
+    , stub_(new MetadataIndexServiceClient(protocol_)) {
+    alive_ = opened_ = false;
+  }
+
+  // Connects to a server on the local host through a Unix domain socket.
+  explicit CliRep(const std::string& socket_path)
+    : socket_(new TSocket(socket_path))
+#   ifdef IDXFS_RPC_THREADED
     , transport_(new TBufferedTransport(socket_))
+#   else
+    , transport_(new TFramedTransport(socket_))
 #   endif
     , protocol_(new TBinaryProtocol(transport_))
     , stub_(new MetadataIndexServiceClient(protocol_)) {
@@ -76,7 +92,35 @@ class CliRep {
   }
 
   bool IsReady() { return opened_ && alive_; }
-  MetadataIndexServiceIf* GetClientStub() { return stub_.get(); }
+  MetadataIndexServiceClient* GetClientStub() { return stub_.get(); }
+
+  // Issues a call using the compact wire encoding and returns the payload
+  // of its reply, which stays valid until the next call. Throws the Thrift
+  // exception the server reported, if any.
+  Slice CallWire(WireOp op, const OID& obj_id, int16_t perm) {
+    wire_buf_.clear();
+    EncodeWireRequest(&wire_buf_, op, obj_id, perm);
+    transport_->write(reinterpret_cast<const uint8_t*>(wire_buf_.data()),
+        static_cast<uint32_t>(wire_buf_.size()));
+    transport_->flush();
+    char header[kWireReplyHeaderSize];
+    transport_->readAll(reinterpret_cast<uint8_t*>(header), sizeof(header));
+    WireStatus status;
+    uint32_t size;
+    if (!DecodeWireReplyHeader(header, &status, &size)) {
+      throw TTransportException("Malformed reply");
+    }
+    wire_buf_.resize(size);
+    if (size > 0) {
+      transport_->readAll(reinterpret_cast<uint8_t*>(&wire_buf_[0]), size);
+    }
+    transport_->readEnd();
+    if (status != kWireOK) {
+      ThrowWireError(status, wire_buf_);
+    }
+    return wire_buf_;
+  }
+  int GetSocketFD() { return socket_->getSocketFD(); }
 };
 
 // An internal abstraction representing a RPC server exposing a set of RPC
@@ -120,7 +164,7 @@ class SrvRep {
   }
 
 };
-#else
+#elif defined(IDXFS_RPC_THREADED)
 class SrvRep {
 
   // No copying allowed
@@ -154,6 +198,72 @@ class SrvRep {
         processor_, socket_, transport_factory_, protocol_factory_));
   }
 
+};
+#else
+// Executes framed Thrift calls, as well as fast-path calls using the
+// compact wire encoding, on behalf of a reactor server. Calls are
+// routed by the directory they target, which is the first i64 field found
+// in their first argument, so that operations against a same directory
+// are executed on a same core.
+//
+class ThriftFrameHandler: public FrameHandler {
+
+  shared_ptr<TProcessor> processor_;
+  MetadataIndexServiceIf* service_; // for fast-path calls
+
+ public:
+
+  ThriftFrameHandler(shared_ptr<TProcessor> processor,
+          MetadataIndexServiceIf* service)
+    : processor_(processor), service_(service) {
+  }
+
+  uint64_t GetRoutingKey(const Slice& request);
+  bool Process(const Slice& request, std::string* reply);
+};
+
+class SrvRep {
+
+  // No copying allowed
+  SrvRep(const SrvRep&);
+  SrvRep& operator=(const SrvRep&);
+
+  shared_ptr<MetadataIndexServiceIf> handler_;
+  shared_ptr<MetadataIndexServiceProcessor> processor_;
+  ThriftFrameHandler frame_handler_;
+  ReactorServer server_;
+  int port_;
+
+ public:
+
+  void Start() {
+    std::string path = GetLocalSocketPath(port_);
+    if (!path.empty()) {
+      Status s = CreateLocalSocketDir();
+      if (s.ok()) {
+        s = server_.OpenLocal(path);
+      }
+      LOG_IF(WARNING, !s.ok())
+          << "Fail to listen on local socket " << path << ": " << s.ToString();
+    }
+    Status s = server_.Serve();
+    if (!s.ok()) {
+      LOG(FATAL) << "Fail to start RPC server: " << s.ToString();
+    }
+  }
+
+  void Stop() {
+    server_.Stop();
+  }
+
+  SrvRep(MetadataIndexServiceIf* handler, int port)
+    : handler_(handler)
+    , processor_(new MetadataIndexServiceProcessor(handler_))
+    , frame_handler_(processor_, handler)
+    , server_(&frame_handler_, port)
+    , port_(port) {
+  }
+
 };
 #endif
 
@@ -177,16 +287,35 @@ class FTCliRepWrapper: virtual public MetadataIndexServiceIf {
   // The last server address used to initialize the client
   int port_;
   std::string ip_;
+  // The local socket of the server, if it runs on the same host
+  std::string local_path_;
+
+  // Kind and arguments of the outstanding split-phase request, if any
+  int pending_;
+  int64_t pending_dir_id_;
+  int16_t pending_index_;
+  std::string pending_start_hash_;
+  int32_t pending_max_entries_;
+
+  void BeginSplitCall(int call, const int64_t dir_id, const int16_t index,
+      const std::string& start_hash, const int32_t max_entries);
+  void EndSplitCall(int call);
+
+  CliRep* GetInternalClient() {
+    DLOG_ASSERT(client_ != NULL);
+    DLOG_ASSERT(client_->IsReady());
+    return client_;
+  }
 
-  MetadataIndexServiceIf* GetInternalStub() {
+  MetadataIndexServiceClient* GetInternalStub() {
     DLOG_ASSERT(client_ != NULL);
     DLOG_ASSERT(client_->IsReady());
-    MetadataIndexServiceIf* stub = client_->GetClientStub();
+    MetadataIndexServiceClient* stub = client_->GetClientStub();
     DLOG_ASSERT(stub != NULL);
     return stub;
   }
 
-  void PrepareClient(); // allocate new internal client
+  void PrepareClient(bool local); // allocate new internal client
   void RetrieveServerAddress(); // get latest address from membership service
   Status Reconnect(int max_attempts);
   Status ReestabilishConnectionToServer();
@@ -221,11 +350,20 @@ class FTCliRepWrapper: virtual public MetadataIndexServiceIf {
 
   void Access(LookupInfo& _return, const OID& obj_id);
   void Renew(LookupInfo& _return, const OID& obj_id);
+  void ResolvePrefix(std::vector<LookupInfo>& _return,
+      const OID& obj_id, const std::vector<std::string>& names);
   void Getattr(StatInfo& _return, const OID& obj_id);
   void Readdir(EntryList& _return, const int64_t dir_id, const int16_t index);
+  void ReaddirScan(ScanResult& _return, const int64_t dir_id,
+      const int16_t index, const std::string& start_hash,
+      const int32_t max_entries);
+  void ReaddirPlus(ScanPlusResult& _return, const int64_t dir_id,
+      const int16_t index, const std::string& start_hash,
+      const int32_t max_entries);
 
   void Mknod(const OID& obj_id, const int16_t perm);
-  void Mknod_Bulk(const OIDS& obj_ids, const int16_t perm);
+  void Mknod_Bulk(MknodBulkResult& _return,
+      const OIDS& obj_ids, const int16_t perm);
   void Mkdir(const OID& obj_id, const int16_t perm,
       const int16_t hint_server1, const int16_t hint_server2);
   void Mkdir_Presplit(const OID& obj_id, const int16_t perm,
@@ -241,6 +379,60 @@ class FTCliRepWrapper: virtual public MetadataIndexServiceIf {
       const int16_t parent_index, const int16_t child_index,
       const std::string& path_split_files, const std::string& dmap_data,
       const int64_t min_seq, const int64_t max_seq, const int64_t num_entries);
+
+  void PreloadSplit(const int64_t dir_id, const int16_t child_index,
+      const std::string& path_split_files,
+      const int64_t min_seq, const int64_t max_seq, const int64_t num_entries);
+
+  void DiscardSplit(const int64_t dir_id, const int16_t child_index);
+
+  // -------------------------------------------------------------
+  // Split-phase calls, which let a caller keep requests outstanding
+  // on several servers at once. At most one request can be outstanding
+  // per connection. If the reply is lost, the connection is rebuilt
+  // and the request is re-issued synchronously.
+  // -------------------------------------------------------------
+
+  enum SplitCall {
+    kNoCall,
+    kReaddirCall,
+    kReaddirScanCall,
+    kReaddirPlusCall
+  };
+
+  // Returns the kind of the outstanding split-phase request, or kNoCall.
+  int PendingCall() { return pending_; }
+
+  void send_Readdir(const int64_t dir_id, const int16_t index);
+  void recv_Readdir(EntryList& _return);
+  void send_ReaddirScan(const int64_t dir_id, const int16_t index,
+      const std::string& start_hash, const int32_t max_entries);
+  void recv_ReaddirScan(ScanResult& _return);
+  void send_ReaddirPlus(const int64_t dir_id, const int16_t index,
+      const std::string& start_hash, const int32_t max_entries);
+  void recv_ReaddirPlus(ScanPlusResult& _return);
+
+  // -------------------------------------------------------------
+  // Pipelined calls, which let a caller keep any number of requests
+  // outstanding on a single connection. Replies arrive in the order
+  // requests were sent. No recovery is attempted: if the connection
+  // fails, all outstanding requests are lost.
+  // -------------------------------------------------------------
+
+  void send_Mknod(const OID& obj_id, const int16_t perm);
+  void recv_Mknod();
+  void send_Getattr(const OID& obj_id);
+  void recv_Getattr(StatInfo& _return);
+  void send_InsertSplit(const int64_t dir_id,
+      const int16_t parent_index, const int16_t child_index,
+      const std::string& path_split_files, const std::string& dmap_data,
+      const int64_t min_seq, const int64_t max_seq, const int64_t num_entries);
+  void recv_InsertSplit();
+  void send_CreateZeroth(const int64_t dir_id, const int16_t zeroth_server);
+  void recv_CreateZeroth();
+
+  // Returns the socket used by the underlying connection.
+  int GetSocketFD() { return client_ != NULL ? client_->GetSocketFD() : -1; }
 };
 
 } /* namespace indexfs */
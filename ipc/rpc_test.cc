@@ -0,0 +1,176 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <map>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <gflags/gflags.h>
+
+#include "ipc/rpc.h"
+#include "ipc/rpc_impl.h"
+#include "common/logging.h"
+#include "common/unit_test.h"
+
+DECLARE_int32(rpc_pool_size);
+
+namespace indexfs { namespace test {
+
+namespace {
+static const int kNumFiles = 64;
+static const int kNumRoundTrips = 20000;
+
+// Keeps files in memory, keyed by their name only.
+//
+class FakeService: public MetadataIndexServiceNull {
+ public:
+  void Getattr(StatInfo& _return, const OID& obj_id) {
+    MutexLock lock(&mu_);
+    std::map<std::string, StatInfo>::iterator it = files_.find(obj_id.obj_name);
+    if (it == files_.end()) {
+      FileNotFoundException not_found;
+      not_found.lease_due = 0;
+      throw not_found;
+    }
+    _return = it->second;
+  }
+  void Mknod(const OID& obj_id, const int16_t perm) {
+    MutexLock lock(&mu_);
+    if (files_.count(obj_id.obj_name) != 0) {
+      throw FileAlreadyExistsException();
+    }
+    StatInfo info;
+    info.mode = S_IFREG | perm;
+    info.id = -1;
+    files_[obj_id.obj_name] = info;
+  }
+ private:
+  Mutex mu_;
+  std::map<std::string, StatInfo> files_;
+};
+
+static void* RunServer(void* arg) {
+  reinterpret_cast<SrvRep*>(arg)->Start();
+  return NULL;
+}
+
+// Issues synchronous Getattr calls through a given client,
+// returning the average round-trip time in microseconds.
+//
+static double MeasureGetattr(CliRep* client, const OID& oid) {
+  StatInfo info;
+  uint64_t start = Env::Default()->NowMicros();
+  for (int i = 0; i < kNumRoundTrips; ++i) {
+    client->GetClientStub()->Getattr(info, oid);
+  }
+  uint64_t end = Env::Default()->NowMicros();
+  return static_cast<double>(end - start) / kNumRoundTrips;
+}
+
+static OID MakeOID(int i) {
+  OID oid;
+  oid.dir_id = 0;
+  oid.path_depth = 1;
+  char name[32];
+  snprintf(name, sizeof(name), "f%d", i);
+  oid.obj_name = name;
+  return oid;
+}
+}
+
+class RPCTest {
+ public:
+  Config* config_;
+  SrvRep* server_;
+  pthread_t thread_;
+  RPC* rpc_;
+
+  RPCTest() {
+    FLAGS_rpc_pool_size = 1;
+    config_ = Config::CreateServerTestingConfig();
+    // The service is disposed of by the server
+    server_ = new SrvRep(new FakeService(), config_->GetDefaultSrvPort());
+    ASSERT_EQ(pthread_create(&thread_, NULL, RunServer, server_), 0);
+    usleep(100 * 1000); // Wait for the server to start listening
+    rpc_ = RPC::CreateRPC(config_);
+    ASSERT_TRUE(rpc_->Init().ok());
+  }
+
+  ~RPCTest() {
+    rpc_->Shutdown();
+    delete rpc_;
+    server_->Stop();
+    pthread_join(thread_, NULL);
+    delete server_;
+    delete config_;
+  }
+};
+
+// Pipelined creates and lookups interleaved with synchronous calls to the
+// same server, which must not wait on a connection held by the pipeline
+// even when the connection pool only has one connection.
+//
+TEST(RPCTest, OverlappingPipelinedCalls) {
+  for (int i = 0; i < kNumFiles; i++) {
+    rpc_->SendMknod(0, MakeOID(i), 0644);
+    rpc_->SendGetattr(0, MakeOID(i));
+    rpc_->SendGetattr(0, MakeOID(kNumFiles + i));
+    if (i == kNumFiles / 2) {
+      StatInfo info;
+      RPC_Stub(rpc_, 0)->Mknod(MakeOID(2 * kNumFiles), 0600);
+      RPC_Stub(rpc_, 0)->Getattr(info, MakeOID(2 * kNumFiles));
+      ASSERT_EQ(info.mode, S_IFREG | 0600);
+    }
+  }
+  ASSERT_GE(rpc_->GetPendingFD(0), 0);
+  for (int i = 0; i < kNumFiles; i++) {
+    StatInfo info;
+    rpc_->RecvMknod(0);
+    rpc_->RecvGetattr(0, &info);
+    ASSERT_EQ(info.mode, S_IFREG | 0644);
+    try {
+      rpc_->RecvGetattr(0, &info);
+      ASSERT_TRUE(false);
+    } catch (FileNotFoundException &e) {
+      // Expected
+    }
+  }
+  ASSERT_EQ(rpc_->GetPendingFD(0), -1);
+  // The pipeline connection is left for reuse, and the pool still works
+  StatInfo info;
+  RPC_Stub(rpc_, 0)->Getattr(info, MakeOID(0));
+  ASSERT_EQ(info.mode, S_IFREG | 0644);
+  rpc_->SendMknod(0, MakeOID(0), 0644);
+  try {
+    rpc_->RecvMknod(0);
+    ASSERT_TRUE(false);
+  } catch (FileAlreadyExistsException &e) {
+    // Expected
+  }
+}
+
+TEST(RPCTest, TransportLatency) {
+  RPC_Stub(rpc_, 0)->Mknod(MakeOID(0), 0644);
+  MemberSet* member_set = CreateStaticMemberSet(config_);
+  std::string path;
+  ASSERT_TRUE(member_set->FindLocalServer(0, &path).ok());
+  delete member_set;
+  CliRep tcp_client("127.0.0.1", config_->GetDefaultSrvPort());
+  ASSERT_TRUE(tcp_client.Open().ok());
+  CliRep local_client(path);
+  ASSERT_TRUE(local_client.Open().ok());
+  double tcp_latency = MeasureGetattr(&tcp_client, MakeOID(0));
+  double local_latency = MeasureGetattr(&local_client, MakeOID(0));
+  fprintf(stderr, "getattr round trip, loopback tcp: %.2f us\n", tcp_latency);
+  fprintf(stderr, "getattr round trip, unix socket: %.2f us\n", local_latency);
+  tcp_client.Close();
+  local_client.Close();
+}
+
+} /* namespace test */ } /* namespace indexfs */
+
+int main(int argc, char* argv[]) {
+  return indexfs::test::RunAllTests();
+}
@@ -0,0 +1,254 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <pthread.h>
+
+#include "ipc/wire.h"
+#include "common/logging.h"
+
+DEFINE_bool(rpc_fast_wire, false, "Use the compact encoding for Getattr,"
+    " Mknod, and Access calls, which requires servers using the reactor server");
+
+namespace indexfs {
+
+namespace {
+// Size of a request without its name
+static const size_t kWireRequestHeaderSize = 24;
+static const size_t kWireStatInfoSize = 43;
+static const size_t kWireLookupInfoSize = 24;
+
+static void PutFixed16(std::string* dst, uint16_t value) {
+  char buf[2];
+  EncodeFixed16(buf, value);
+  dst->append(buf, 2);
+}
+
+static void BeginReply(std::string* dst, WireStatus status) {
+  dst->clear();
+  dst->push_back(static_cast<char>(status));
+  dst->append(4, '\0');
+}
+
+static void EndReply(std::string* dst) {
+  EncodeFixed32(&(*dst)[1], static_cast<uint32_t>(dst->size() - kWireReplyHeaderSize));
+}
+
+static void PutStatInfo(std::string* dst, const StatInfo& info) {
+  leveldb::PutFixed32(dst, static_cast<uint32_t>(info.mode));
+  PutFixed16(dst, U16INT(info.uid));
+  PutFixed16(dst, U16INT(info.gid));
+  PutFixed64(dst, U64INT(info.size));
+  PutFixed64(dst, U64INT(info.mtime));
+  PutFixed64(dst, U64INT(info.ctime));
+  PutFixed64(dst, U64INT(info.id));
+  PutFixed16(dst, U16INT(info.zeroth_server));
+  dst->push_back(info.is_embedded ? 1 : 0);
+}
+
+static void PutLookupInfo(std::string* dst, const LookupInfo& info) {
+  PutFixed64(dst, U64INT(info.id));
+  PutFixed16(dst, U16INT(info.zeroth_server));
+  PutFixed16(dst, U16INT(info.perm));
+  PutFixed16(dst, U16INT(info.uid));
+  PutFixed16(dst, U16INT(info.gid));
+  PutFixed64(dst, U64INT(info.lease_due));
+}
+
+// Decoding state reused by all fast-path requests served by a thread
+struct WireContext {
+  OID oid;
+  StatInfo stat;
+  LookupInfo lookup;
+};
+
+static pthread_key_t context_key;
+static pthread_once_t context_once = PTHREAD_ONCE_INIT;
+
+static void DeleteContext(void* arg) {
+  delete reinterpret_cast<WireContext*>(arg);
+}
+
+static void InitContextKey() {
+  pthread_key_create(&context_key, &DeleteContext);
+}
+
+static WireContext* GetContext() {
+  pthread_once(&context_once, &InitContextKey);
+  WireContext* ctx = reinterpret_cast<WireContext*>(
+      pthread_getspecific(context_key));
+  if (ctx == NULL) {
+    ctx = new WireContext;
+    pthread_setspecific(context_key, ctx);
+  }
+  return ctx;
+}
+}
+
+void EncodeWireRequest(std::string* dst,
+        WireOp op, const OID& oid, int16_t perm) {
+  DLOG_ASSERT(oid.obj_name.size() <= 0xffff);
+  dst->push_back(static_cast<char>(kWireMagic));
+  dst->push_back(static_cast<char>(op));
+  PutFixed16(dst, U16INT(oid.path_depth));
+  PutFixed64(dst, U64INT(oid.dir_id));
+  PutFixed16(dst, U16INT(perm));
+  PutFixed64(dst, U64INT(oid.client_id));
+  PutFixed16(dst, static_cast<uint16_t>(oid.obj_name.size()));
+  dst->append(oid.obj_name);
+}
+
+bool DecodeWireRequest(const Slice& src,
+        WireOp* op, OID* oid, int16_t* perm) {
+  if (src.size() < kWireRequestHeaderSize || !IsWireRequest(src)) {
+    return false;
+  }
+  const char* p = src.data();
+  *op = static_cast<WireOp>(static_cast<unsigned char>(p[1]));
+  oid->path_depth = static_cast<int16_t>(DecodeFixed16(p + 2));
+  oid->dir_id = static_cast<int64_t>(DecodeFixed64(p + 4));
+  *perm = static_cast<int16_t>(DecodeFixed16(p + 12));
+  oid->client_id = static_cast<int64_t>(DecodeFixed64(p + 14));
+  size_t name_size = DecodeFixed16(p + 22);
+  if (src.size() != kWireRequestHeaderSize + name_size) {
+    return false;
+  }
+  oid->obj_name.assign(p + kWireRequestHeaderSize, name_size);
+  return true;
+}
+
+void EncodeWireReply(std::string* dst,
+        WireStatus status, const Slice& payload) {
+  BeginReply(dst, status);
+  dst->append(payload.data(), payload.size());
+  EndReply(dst);
+}
+
+bool DecodeWireReplyHeader(const char* src,
+        WireStatus* status, uint32_t* payload_size) {
+  unsigned char code = static_cast<unsigned char>(src[0]);
+  if (code > kWireInternalError) {
+    return false;
+  }
+  *status = static_cast<WireStatus>(code);
+  *payload_size = DecodeFixed32(src + 1);
+  return true;
+}
+
+bool DecodeWireStatInfo(const Slice& src, StatInfo* info) {
+  if (src.size() != kWireStatInfoSize) {
+    return false;
+  }
+  const char* p = src.data();
+  info->mode = static_cast<int32_t>(DecodeFixed32(p));
+  info->uid = static_cast<int16_t>(DecodeFixed16(p + 4));
+  info->gid = static_cast<int16_t>(DecodeFixed16(p + 6));
+  info->size = static_cast<int64_t>(DecodeFixed64(p + 8));
+  info->mtime = static_cast<int64_t>(DecodeFixed64(p + 16));
+  info->ctime = static_cast<int64_t>(DecodeFixed64(p + 24));
+  info->id = static_cast<int64_t>(DecodeFixed64(p + 32));
+  info->zeroth_server = static_cast<int16_t>(DecodeFixed16(p + 40));
+  info->is_embedded = (p[42] != 0);
+  return true;
+}
+
+bool DecodeWireLookupInfo(const Slice& src, LookupInfo* info) {
+  if (src.size() != kWireLookupInfoSize) {
+    return false;
+  }
+  const char* p = src.data();
+  info->id = static_cast<int64_t>(DecodeFixed64(p));
+  info->zeroth_server = static_cast<int16_t>(DecodeFixed16(p + 8));
+  info->perm = static_cast<int16_t>(DecodeFixed16(p + 10));
+  info->uid = static_cast<int16_t>(DecodeFixed16(p + 12));
+  info->gid = static_cast<int16_t>(DecodeFixed16(p + 14));
+  info->lease_due = static_cast<int64_t>(DecodeFixed64(p + 16));
+  return true;
+}
+
+void ThrowWireError(WireStatus status, const Slice& payload) {
+  switch (status) {
+    case kWireNotFound: {
+      FileNotFoundException nf;
+      nf.lease_due = payload.size() == 8 ?
+          static_cast<int64_t>(DecodeFixed64(payload.data())) : 0;
+      throw nf;
+    }
+    case kWireAlreadyExists:
+      throw FileAlreadyExistsException();
+    case kWireRedirect: {
+      ServerRedirectionException sx;
+      sx.dmap_data = payload.ToString();
+      throw sx;
+    }
+    case kWireUnknownDir:
+      throw UnrecognizedDirectoryError();
+    case kWireNotADir:
+      throw DirectoryExpectedError();
+    case kWireIOError: {
+      IOError io;
+      io.message = payload.ToString();
+      throw io;
+    }
+    default: {
+      ServerInternalError ie;
+      ie.message = payload.ToString();
+      throw ie;
+    }
+  }
+}
+
+bool ProcessWireRequest(MetadataIndexServiceIf* service,
+        const Slice& request, std::string* reply) {
+  WireOp op;
+  int16_t perm;
+  WireContext* ctx = GetContext();
+  if (!DecodeWireRequest(request, &op, &ctx->oid, &perm)) {
+    return false;
+  }
+  try {
+    switch (op) {
+      case kWireGetattr:
+        service->Getattr(ctx->stat, ctx->oid);
+        BeginReply(reply, kWireOK);
+        PutStatInfo(reply, ctx->stat);
+        break;
+      case kWireMknod:
+        service->Mknod(ctx->oid, perm);
+        BeginReply(reply, kWireOK);
+        break;
+      case kWireAccess:
+        service->Access(ctx->lookup, ctx->oid);
+        BeginReply(reply, kWireOK);
+        PutLookupInfo(reply, ctx->lookup);
+        break;
+      default:
+        return false;
+    }
+  } catch (FileNotFoundException &nf) {
+    BeginReply(reply, kWireNotFound);
+    PutFixed64(reply, U64INT(nf.lease_due));
+  } catch (FileAlreadyExistsException &ae) {
+    BeginReply(reply, kWireAlreadyExists);
+  } catch (ServerRedirectionException &sx) {
+    BeginReply(reply, kWireRedirect);
+    reply->append(sx.dmap_data);
+  } catch (UnrecognizedDirectoryError &ude) {
+    BeginReply(reply, kWireUnknownDir);
+  } catch (DirectoryExpectedError &de) {
+    BeginReply(reply, kWireNotADir);
+  } catch (IOError &io) {
+    BeginReply(reply, kWireIOError);
+    reply->append(io.message);
+  } catch (ServerInternalError &ie) {
+    BeginReply(reply, kWireInternalError);
+    reply->append(ie.message);
+  } catch (apache::thrift::TException &tx) {
+    BeginReply(reply, kWireInternalError);
+    reply->append(tx.what());
+  }
+  EndReply(reply);
+  return true;
+}
+
+} /* namespace indexfs */
@@ -0,0 +1,94 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef _INDEXFS_IPC_WIRE_H_
+#define _INDEXFS_IPC_WIRE_H_
+
+#include <string>
+#include <gflags/gflags.h>
+
+#include "common/common.h"
+#include "thrift/MetadataIndexService.h"
+
+DECLARE_bool(rpc_fast_wire);
+
+namespace indexfs {
+
+// -------------------------------------------------------------
+// Compact Wire Encoding
+// -------------------------------------------------------------
+//
+// A fixed-layout encoding for the hottest metadata calls, exchanged as
+// frames on the same connections as regular Thrift calls. All integers
+// are little-endian.
+//
+//   request := magic(1) op(1) path_depth(2) dir_id(8) perm(2)
+//              client_id(8) name_size(2) name
+//   reply   := status(1) payload_size(4) payload
+//
+// Successful Getattr and Access calls reply with a StatInfo or LookupInfo
+// in a fixed layout. Failed calls reply with the payload of the Thrift
+// exception they would have thrown, if any.
+//
+// Servers use the same encoding to call clients back when revoking
+// leases, in which case the perm field is set to 1 for negative leases.
+// Clients acknowledge with an empty successful reply.
+
+// Leading byte of all fast-path requests. Thrift messages encoded
+// by a TBinaryProtocol in strict mode always start with 0x80.
+enum { kWireMagic = 0x49 };
+
+enum WireOp {
+  kWireGetattr = 1,
+  kWireMknod = 2,
+  kWireAccess = 3,
+  kWireRevoke = 4
+};
+
+enum WireStatus {
+  kWireOK = 0,
+  kWireNotFound = 1,
+  kWireAlreadyExists = 2,
+  kWireRedirect = 3,
+  kWireUnknownDir = 4,
+  kWireNotADir = 5,
+  kWireIOError = 6,
+  kWireInternalError = 7
+};
+
+enum { kWireReplyHeaderSize = 5 };
+
+inline bool IsWireRequest(const Slice& frame) {
+  return !frame.empty() && static_cast<unsigned char>(frame[0]) == kWireMagic;
+}
+
+extern void EncodeWireRequest(std::string* dst,
+    WireOp op, const OID& oid, int16_t perm);
+
+// Returns false if the request is malformed.
+extern bool DecodeWireRequest(const Slice& src,
+    WireOp* op, OID* oid, int16_t* perm);
+
+extern void EncodeWireReply(std::string* dst,
+    WireStatus status, const Slice& payload);
+
+extern bool DecodeWireReplyHeader(const char* src,
+    WireStatus* status, uint32_t* payload_size);
+
+extern bool DecodeWireStatInfo(const Slice& src, StatInfo* info);
+
+extern bool DecodeWireLookupInfo(const Slice& src, LookupInfo* info);
+
+// Throws the Thrift exception corresponding to a failed reply.
+extern void ThrowWireError(WireStatus status, const Slice& payload);
+
+// Executes a fast-path request against a given service and sets its reply.
+// Decoding state is kept per thread so that no heap allocation is needed
+// in steady state. Returns false if the request is malformed.
+extern bool ProcessWireRequest(MetadataIndexServiceIf* service,
+    const Slice& request, std::string* reply);
+
+} /* namespace indexfs */
+
+#endif /* _INDEXFS_IPC_WIRE_H_ */
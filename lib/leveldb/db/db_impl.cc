@@ -182,6 +182,8 @@ DBImpl::DBImpl(const Options& options, const std::string& dbname)
       logfile_(NULL),
       logfile_number_(0),
       log_(NULL),
+      last_sync_micros_(0),
+      last_sync_group_size_(0),
       tmp_batch_(new WriteBatch),
       bg_compaction_scheduled_(false),
       bg_bulkinsert_scheduled_(false),
@@ -927,17 +929,23 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
 static UDPSocket sock;
 void DBImpl::SendMetrics() {
   int now_time = (int) time(NULL);
-  char metricString[256];
+  char metricString[512];
 
   sprintf(metricString,
           "compaction_num %d %ld\n"
           "compaction_time %d %ld\n"
           "compaction_bytes_read %d %ld\n"
-          "compaction_bytes_written %d %ld\n",
+          "compaction_bytes_written %d %ld\n"
+          "sync_num %d %ld\n"
+          "sync_writes %d %ld\n"
+          "sync_time %d %ld\n",
           now_time, sum_stats_.counter,
           now_time, sum_stats_.micros,
           now_time, sum_stats_.bytes_read,
-          now_time, sum_stats_.bytes_written);
+          now_time, sum_stats_.bytes_written,
+          now_time, op_stats_.sync_count,
+          now_time, op_stats_.synced_write_count,
+          now_time, op_stats_.sync_micros);
 
   try {
       sock.sendTo(metricString, strlen(metricString),
@@ -1182,9 +1190,35 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+namespace {
+static void UnpinBlock(void* iter, void* ignored) {
+  delete reinterpret_cast<Iterator*>(iter);
+}
+}  // namespace
+
+void DBImpl::UnpinMemTable(void* db, void* mem) {
+  DBImpl* impl = reinterpret_cast<DBImpl*>(db);
+  MutexLock l(&impl->mutex_);
+  reinterpret_cast<MemTable*>(mem)->Unref();
+}
+
 Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
+  return Get(options, key, value, NULL);
+}
+
+Status DBImpl::Get(const ReadOptions& options,
+                   const Slice& key,
+                   PinnedValue* value) {
+  value->Reset();
+  return Get(options, key, NULL, value);
+}
+
+Status DBImpl::Get(const ReadOptions& options,
+                   const Slice& key,
+                   std::string* value,
+                   PinnedValue* pinned) {
   Status s;
   MutexLock l(&mutex_);
   SequenceNumber snapshot;
@@ -1203,19 +1237,33 @@ Status DBImpl::Get(const ReadOptions& options,
 
   bool have_stat_update = false;
   Version::GetStats stats;
+  Slice v;
+  MemTable* pinned_mem = NULL;
+  Iterator* block_iter = NULL;
 
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
     // First look in the memtable, then in the immutable memtable (if any).
     LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, &s)) {
-      // Done
+    if (value != NULL) {
+      if (mem->Get(lkey, value, &s)) {
+        // Done
+      } else if (imm != NULL && imm->Get(lkey, value, &s)) {
+        // Done
+      } else {
+        s = current->Get(options, lkey, value, &stats);
+        have_stat_update = true;
+      }
     } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
+      if (mem->Get(lkey, &v, &s)) {
+        pinned_mem = mem;
+      } else if (imm != NULL && imm->Get(lkey, &v, &s)) {
+        pinned_mem = imm;
+      } else {
+        s = current->Get(options, lkey, &v, &block_iter, &stats);
+        have_stat_update = true;
+      }
     }
     mutex_.Lock();
   }
@@ -1223,6 +1271,14 @@ Status DBImpl::Get(const ReadOptions& options,
   if (have_stat_update && current->UpdateStats(stats)) {
     MaybeScheduleCompaction();
   }
+  if (pinned != NULL && s.ok()) {
+    if (pinned_mem != NULL) {
+      pinned_mem->Ref();
+      pinned->Pin(v, &DBImpl::UnpinMemTable, this, pinned_mem);
+    } else {
+      pinned->Pin(v, &UnpinBlock, block_iter, NULL);
+    }
+  }
   mem->Unref();
   if (imm != NULL) imm->Unref();
   current->Unref();
@@ -1293,7 +1349,11 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(my_batch == NULL);
   Writer* last_writer = &w;
+  bool synced = false;
   if (status.ok() && my_batch != NULL) {  // NULL batch is for minor compactions
+    if (w.sync && options_.sync_interval > 0) {
+      WaitForSyncGroup();
+    }
     WriteBatch* updates = BuildBatchGroup(&last_writer);
     uint64_t last_sequence = versions_->LastSequence();
     WriteBatchInternal::SetSequence(updates, last_sequence + 1);
@@ -1303,12 +1363,16 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     // during this phase since &w is currently responsible for logging
     // and protects against concurrent loggers and concurrent writes
     // into mem_.
+    uint64_t sync_micros = 0;
     {
       mutex_.Unlock();
       if (!options_.disable_write_ahead_log) {
         status = log_->AddRecord(WriteBatchInternal::Contents(updates));
         if (status.ok() && options.sync) {
+          const uint64_t sync_start = env_->NowMicros();
           status = logfile_->Sync();
+          sync_micros = env_->NowMicros() - sync_start;
+          synced = true;
         }
       }
       if (status.ok()) {
@@ -1316,15 +1380,25 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
       }
       mutex_.Lock();
     }
+    if (synced) {
+      last_sync_micros_ = env_->NowMicros();
+      op_stats_.sync_count += 1;
+      op_stats_.sync_micros += sync_micros;
+    }
     if (updates == tmp_batch_) tmp_batch_->Clear();
 
     if (last_sequence > versions_->LastSequence())
       versions_->SetLastSequence(last_sequence);
   }
 
+  size_t group_size = 0;
   while (true) {
     Writer* ready = writers_.front();
     writers_.pop_front();
+    group_size += 1;
+    if (synced) {
+      op_stats_.synced_write_count += 1;
+    }
     if (ready != &w) {
       ready->status = status;
       ready->done = true;
@@ -1332,6 +1406,9 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     }
     if (ready == last_writer) break;
   }
+  if (synced) {
+    last_sync_group_size_ = group_size;
+  }
 
   // Notify new head of write queue
   if (!writers_.empty()) {
@@ -1393,6 +1470,39 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   return result;
 }
 
+// Holds a synced write at the front of the writer queue while the
+// writes covered by the previous log sync are still rejoining the queue,
+// so that they may share a single log sync again. Writes that arrive
+// while a sync is in flight queue up behind it and need no wait, so a
+// write is synced right away once as many writes are queued as the
+// previous sync covered, or as soon as no more writes seem to be coming.
+// Waiting writes only yield the processor, and never wait longer than a
+// log sync takes on average.
+// REQUIRES: mutex_ is held
+// REQUIRES: this thread is currently at the front of the writer queue
+void DBImpl::WaitForSyncGroup() {
+  mutex_.AssertHeld();
+  uint64_t now = env_->NowMicros();
+  uint64_t deadline = last_sync_micros_ + options_.sync_interval;
+  if (op_stats_.sync_count > 0) {
+    deadline = std::min(deadline,
+        now + op_stats_.sync_micros / op_stats_.sync_count);
+  }
+  const size_t group_size = std::min(last_sync_group_size_,
+      static_cast<size_t>(std::max(options_.sync_group_size, 1)));
+  size_t queued = writers_.size();
+  while (queued < group_size && now < deadline) {
+    mutex_.Unlock();
+    env_->SleepForMicroseconds(0);
+    mutex_.Lock();
+    now = env_->NowMicros();
+    if (writers_.size() == queued) {
+      break;  // No more writes seem to be coming
+    }
+    queued = writers_.size();
+  }
+}
+
 // REQUIRES: mutex_ is held
 // REQUIRES: this thread is currently at the front of the writer queue
 Status DBImpl::MakeRoomForWrite(bool force) {
@@ -1503,6 +1613,17 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
         op_stats_.get_count);
     value->append(buf);
     return true;
+  } else if (in == "sync-stats") {
+    char buf[200];
+    const int64_t syncs = op_stats_.sync_count;
+    snprintf(buf, sizeof(buf),
+             "syncs=%lld writes=%lld avg_group_size=%.2f avg_sync_micros=%.1f",
+             static_cast<long long>(syncs),
+             static_cast<long long>(op_stats_.synced_write_count),
+             syncs > 0 ? double(op_stats_.synced_write_count) / syncs : 0.0,
+             syncs > 0 ? double(op_stats_.sync_micros) / syncs : 0.0);
+    value->append(buf);
+    return true;
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
@@ -36,6 +36,9 @@ class DBImpl : public DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key,
+                     PinnedValue* value);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -71,6 +74,13 @@ class DBImpl : public DB {
   friend class DB;
   struct CompactionState;
   struct DeletionState;
+
+  // Shared by both Get() calls, one of "value" and "pinned" is NULL
+  Status Get(const ReadOptions& options, const Slice& key,
+             std::string* value, PinnedValue* pinned);
+
+  // Releases a memtable pinned by a PinnedValue
+  static void UnpinMemTable(void* db, void* mem);
   struct Writer;
 
   Iterator* NewInternalIterator(const ReadOptions&,
@@ -100,6 +110,7 @@ class DBImpl : public DB {
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
+  void WaitForSyncGroup();
 
   void MaybeScheduleCompaction();
   static void BGWork(void* db);
@@ -144,6 +155,8 @@ class DBImpl : public DB {
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
+  uint64_t last_sync_micros_;    // When the log was last synced
+  size_t last_sync_group_size_;  // Number of writes covered by the last sync
 
   // Queue of writers.
   std::deque<Writer*> writers_;
@@ -197,8 +210,12 @@ class DBImpl : public DB {
   struct OperationStats {
     int64_t get_count;
     int64_t write_count;
+    int64_t sync_count;          // Number of log syncs
+    int64_t synced_write_count;  // Number of writes covered by log syncs
+    int64_t sync_micros;         // Time spent syncing the log
 
-    OperationStats() : write_count(0), get_count(0) { }
+    OperationStats() : get_count(0), write_count(0),
+        sync_count(0), synced_write_count(0), sync_micros(0) { }
   };
   OperationStats op_stats_;
 
@@ -63,6 +63,10 @@ class MemTable {
   // Else, return false.
   bool Get(const LookupKey& key, std::string* value, Status* s);
 
+  // Same as above, but *value points into the memtable, and is only
+  // valid for as long as the memtable is referenced.
+  bool Get(const LookupKey& key, Slice* value, Status* s);
+
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
 
@@ -101,13 +101,22 @@ Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_size,
                        const Slice& k,
                        void* arg,
-                       void (*saver)(void*, const Slice&, const Slice&)) {
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       Iterator** pin) {
   Cache::Handle* handle = NULL;
+  if (pin != NULL) {
+    *pin = NULL;
+  }
   Status s = FindTable(file_number, file_size, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, saver);
-    cache_->Release(handle);
+    s = t->InternalGet(options, k, arg, saver, pin);
+    if (pin != NULL && *pin != NULL) {
+      // Blocks may point into the table's file when it is mmapped
+      (*pin)->RegisterCleanup(&UnrefEntry, cache_, handle);
+    } else {
+      cache_->Release(handle);
+    }
   }
   return s;
 }
@@ -36,13 +36,16 @@ class TableCache {
                         Table** tableptr = NULL);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  If "pin" is
+  // non-NULL, it is set to an iterator keeping the entry found (and
+  // its table) alive until deleted, or NULL if no block was read.
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
              const Slice& k,
              void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             Iterator** pin = NULL);
 
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
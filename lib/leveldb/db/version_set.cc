@@ -294,6 +294,7 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  Slice* pinned_value;
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -305,7 +306,11 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
       s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
       if (s->state == kFound) {
-        s->value->assign(v.data(), v.size());
+        if (s->value != NULL) {
+          s->value->assign(v.data(), v.size());
+        } else {
+          *s->pinned_value = v;
+        }
       }
     }
   }
@@ -319,6 +324,23 @@ Status Version::Get(const ReadOptions& options,
                     const LookupKey& k,
                     std::string* value,
                     GetStats* stats) {
+  return Get(options, k, value, NULL, NULL, stats);
+}
+
+Status Version::Get(const ReadOptions& options,
+                    const LookupKey& k,
+                    Slice* value,
+                    Iterator** pin,
+                    GetStats* stats) {
+  return Get(options, k, NULL, value, pin, stats);
+}
+
+Status Version::Get(const ReadOptions& options,
+                    const LookupKey& k,
+                    std::string* value,
+                    Slice* pinned_value,
+                    Iterator** pin,
+                    GetStats* stats) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
@@ -391,8 +413,16 @@ Status Version::Get(const ReadOptions& options,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
+      saver.pinned_value = pinned_value;
+      Iterator* block_iter = NULL;
       s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+                                   ikey, &saver, SaveValue,
+                                   pin != NULL ? &block_iter : NULL);
+      if (s.ok() && saver.state == kFound && pin != NULL) {
+        *pin = block_iter;
+      } else {
+        delete block_iter;
+      }
       if (!s.ok()) {
         return s;
       }
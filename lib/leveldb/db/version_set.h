@@ -78,6 +78,12 @@ class Version {
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
 
+  // Same as above, but *val points into the block holding it, which
+  // stays alive until "*pin" is deleted.  *pin is only set on success.
+  // REQUIRES: lock is not held
+  Status Get(const ReadOptions&, const LookupKey& key, Slice* val,
+             Iterator** pin, GetStats* stats);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -119,6 +125,10 @@ class Version {
   class LevelFileNumIterator;
   Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
 
+  // Shared by both Get() calls, one of "val" and "pinned_val" is NULL
+  Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
+             Slice* pinned_val, Iterator** pin, GetStats* stats);
+
   VersionSet* vset_;            // VersionSet to which this Version belongs
   Version* next_;               // Next version in linked list
   Version* prev_;               // Previous version in linked list
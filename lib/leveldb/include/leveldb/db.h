@@ -38,6 +38,49 @@ struct Range {
   Range(const Slice& s, const Slice& l) : start(s), limit(l) { }
 };
 
+// A value read by DB::Get() without being copied out of the block
+// cache or memtable holding it. That storage stays pinned until
+// Reset() is called or the object is destroyed, so a PinnedValue
+// should be released soon and must not outlive its DB.
+class PinnedValue {
+ public:
+  PinnedValue() : cleanup_(NULL) { }
+  ~PinnedValue() { Reset(); }
+
+  const Slice& data() const { return data_; }
+
+  // Unpin the storage backing data() and clear it.
+  void Reset() {
+    if (cleanup_ != NULL) {
+      (*cleanup_)(arg1_, arg2_);
+      cleanup_ = NULL;
+    }
+    data_.clear();
+  }
+
+ private:
+  friend class DB;
+  friend class DBImpl;
+
+  Slice data_;
+  std::string buf_;  // Holds values that cannot be pinned
+  Iterator::CleanupFunction cleanup_;
+  void* arg1_;
+  void* arg2_;
+
+  void Pin(const Slice& data, Iterator::CleanupFunction cleanup,
+           void* arg1, void* arg2) {
+    data_ = data;
+    cleanup_ = cleanup;
+    arg1_ = arg1;
+    arg2_ = arg2;
+  }
+
+  // No copying allowed
+  PinnedValue(const PinnedValue&);
+  void operator=(const PinnedValue&);
+};
+
 // A DB is a persistent ordered map from keys to values.
 // A DB is safe for concurrent access from multiple threads without
 // any external synchronization.
@@ -87,9 +130,22 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Same as above, but *value references the entry in place instead
+  // of holding a copy of it. Any value previously pinned by *value is
+  // released first. The default implementation copies.
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key, PinnedValue* value) {
+    value->Reset();
+    Status s = Get(options, key, &value->buf_);
+    if (s.ok()) {
+      value->data_ = value->buf_;
+    }
+    return s;
+  }
+
   virtual Status Exists(const ReadOptions& options,
                         const Slice& key) {
-    std::string tmp;
+    PinnedValue tmp;
     return Get(options, key, &tmp);
   }
 
@@ -125,6 +181,8 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.sync-stats" - returns the number of log syncs, the number of
+  //     writes they covered, and their average group size and latency.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
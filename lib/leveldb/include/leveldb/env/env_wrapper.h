@@ -44,9 +44,15 @@ class EnvWrapper : virtual public Env {
   Status CopyFile(const std::string& s, const std::string& t) {
     return target_->CopyFile(s, t);
   }
+  Status SymlinkFile(const std::string& s, const std::string& t) {
+    return target_->SymlinkFile(s, t);
+  }
   Status RenameFile(const std::string& s, const std::string& t) {
     return target_->RenameFile(s, t);
   }
+  Status LinkFile(const std::string& s, const std::string& t) {
+    return target_->LinkFile(s, t);
+  }
   Status LockFile(const std::string& f, FileLock** l) {
     return target_->LockFile(f, l);
   }
@@ -160,6 +160,17 @@ struct Options {
   // Default: false
   bool disable_write_ahead_log;
 
+  // If positive, a synced write that finds fewer writes queued than the
+  // last log sync covered waits for more writes to join its group, but
+  // only as long as the queue keeps growing and until either sync_interval
+  // micros have passed since the last log sync or sync_group_size writes
+  // are queued. The whole group is then covered by a single log sync.
+  // Writes never wait longer than a log sync takes on average.
+  //
+  // Default: 0
+  int sync_interval;
+  int sync_group_size;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -64,12 +64,15 @@ class Table {
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
-  // that key is not present.
+  // that key is not present.  If "pinned_iter" is non-NULL, the iterator
+  // over the block searched is stored there instead of being deleted,
+  // so that the entry stays valid until the caller deletes it.
   friend class TableCache;
   Status InternalGet(
       const ReadOptions&, const Slice& key,
       void* arg,
-      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v),
+      Iterator** pinned_iter = NULL);
 
 
   void ReadMeta(const Footer& footer);
@@ -215,8 +215,12 @@ Iterator* Table::NewIterator(const ReadOptions& options) const {
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
-                          void (*saver)(void*, const Slice&, const Slice&)) {
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          Iterator** pinned_iter) {
   Status s;
+  if (pinned_iter != NULL) {
+    *pinned_iter = NULL;
+  }
   Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
   iiter->Seek(k);
   if (iiter->Valid()) {
@@ -235,7 +239,11 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
         (*saver)(arg, block_iter->key(), block_iter->value());
       }
       s = block_iter->status();
-      delete block_iter;
+      if (pinned_iter != NULL) {
+        *pinned_iter = block_iter;
+      } else {
+        delete block_iter;
+      }
     }
   }
   if (s.ok()) {
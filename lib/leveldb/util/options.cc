@@ -28,7 +28,9 @@ Options::Options()
       max_sst_file_size(16 << 20),
       enable_monitor_thread(false),
       disable_compaction(false),
-      disable_write_ahead_log(false) {
+      disable_write_ahead_log(false),
+      sync_interval(0),
+      sync_group_size(0) {
 }
 
 
@@ -59,6 +59,10 @@ void DefaultLevelDBOptionInitializer(Options* options,
   options->disable_compaction = false;
   options->disable_write_ahead_log = false;
   options->block_cache = NewLRUCache(DEFAULT_LEVELDB_CACHE_SIZE);
+  if (config->GetSyncMode() == kSyncGroup) {
+    options->sync_interval = config->GetSyncInterval() * 1000;
+    options->sync_group_size = DEFAULT_LEVELDB_SYNC_GROUP_SIZE;
+  }
 }
 
 void BatchClientLevelDBOptionInitializer(Options* options,
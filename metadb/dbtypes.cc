@@ -83,6 +83,7 @@ void MDBValue::Unmarshall(const Slice &raw_bytes) {
 // Reconstruct the in-memory representation of an MDBValue.
 //
 void MDBValueRef::Unmarshall() {
+  memcpy(&file_stat_, rep_, sizeof(FileStat));
   const char* ptr = rep_ + sizeof(FileStat);
 
   ptr = const_cast<char*>(GetVarint32Ptr(ptr, ptr + 5, &name_size_));
@@ -303,6 +303,8 @@ inline void MDBValue::SetFileStat(const FileStat &file_stat) {
 
 // A read-only reference to a piece of memory to be interpreted as an MDBValue
 // object. This helper structure is introduced to reduce unnecessary memory copy.
+// Only the fixed header is copied, since the memory referenced, such as a value
+// pinned in a memtable or a table block, need not be aligned for FileStat.
 //
 struct MDBValueRef {
 
@@ -335,13 +337,15 @@ struct MDBValueRef {
   }
 
   inline const FileStat* GetFileStat() const {
-    return reinterpret_cast<const FileStat*>(rep_);
+    return &file_stat_;
   }
 
  private:
 
   void Unmarshall(); // re-construct in-memory representation
 
+  FileStat file_stat_; // aligned copy of the header
+
   char* name_;
   char* path_;
   char* data_;
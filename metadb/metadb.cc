@@ -9,6 +9,8 @@ using leveldb::ObjEnvFactory;
 #endif
 
 #include <algorithm>
+#include <map>
+#include <set>
 #include <sstream>
 #include <iomanip>
 #include <time.h>
@@ -29,6 +31,18 @@ namespace mdb {
 
 class LevelMDB;
 
+// Keys written to the entries to be migrated by a split in progress.
+// Splits read these keys instead of rescanning the partition.
+//
+struct ChangeLog {
+  int64_t dir_id;
+  int16_t old_partition;
+  int16_t new_partition;
+  int num_writers; // number of writes in progress
+  bool draining;
+  std::vector<std::string> keys;
+};
+
 // Local configuration.
 //
 static const bool kDeleteCheck = false;
@@ -49,6 +63,21 @@ Status ERR_ALREADY_EXISTS = Status::AlreadyExists("File exists");
 static const
 Status ERR_OP_NOT_SUPPORTED = Status::NotSupported("Operation not supported");
 
+// Number of inode numbers reserved per durable write.
+//
+static const int64_t kInodeRangeSize = 64 << 10;
+
+// Partition sizes are kept in a system partition of their directory,
+// one key per partition, right next to the directory mapping.
+//
+static const int16_t kSizePartition = -2;
+static inline
+MDBKey PartitionSizeKey(int64_t dir_id, int16_t partition_id) {
+  MDBKey mdb_key(dir_id, kSizePartition);
+  EncodeFixed16(mdb_key.GetNameHash(), static_cast<uint16_t>(partition_id));
+  return mdb_key;
+}
+
 // Overrides the original name hash with the specified hash prefix.
 //
 static inline
@@ -88,22 +117,27 @@ struct MDBDirScanner: public DirScanner {
 struct MDBLocalBulkExtractor:
         virtual public BulkExtractor {
 
-  virtual ~MDBLocalBulkExtractor() {
-    if (batch_ != NULL) {
-      delete batch_;
-    }
-  }
+  virtual ~MDBLocalBulkExtractor();
 
   WriteBatch* batch_;
   int num_entries_extracted_;
 
+  // Incremental extraction state
+  int num_rounds_;
+  int num_entries_changed_;
+  ChangeLog* change_log_;
+  const Snapshot* last_snapshot_; // snapshot read by the previous round
+
   DB* db_;
   LevelMDB* mdb_;
   const std::string null_output_dir_;
 
   Status Commit();
   Status Extract(uint64_t *min_seq, uint64_t *max_seq);
+  void TrackChanges();
+  Status ExtractChanges(uint64_t *min_seq, uint64_t *max_seq);
 
+  int GetNumEntriesChanged() { return num_entries_changed_; }
   int GetNumEntriesExtracted() { return num_entries_extracted_; }
   const std::string& GetBulkExtractOutputDir() { return null_output_dir_; }
 };
@@ -113,29 +147,60 @@ struct MDBLocalBulkExtractor:
 struct MDBBulkExtractor:
         virtual public BulkExtractor {
 
-  virtual ~MDBBulkExtractor() {
-    if (batch_ != NULL) {
-      delete batch_;
-    }
-  }
+  virtual ~MDBBulkExtractor();
 
   WriteBatch* batch_;
   int num_entries_extracted_;
 
+  // Incremental extraction state
+  int num_rounds_;
+  int num_entries_changed_;
+  uint64_t watermark_; // max seq of all entries extracted so far
+  ChangeLog* change_log_;
+  const Snapshot* last_snapshot_; // snapshot read by the previous round
+
+  // Output of the current ExtractChanges() call
+  MDBTableBuilder* builder_;
+  std::string chunk_dir_;
+  uint64_t chunk_min_seq_;
+  uint64_t chunk_max_seq_;
+  size_t chunk_bytes_;
+
   DB* db_;
   Env* env_;
   LevelMDB* mdb_;
   std::string dir_path_;
   std::string sstable_path_;
+  std::vector<std::string> chunk_dirs_;
 
   // Setup the temporary sstable file for storing
   // a sorted list of bulk insertion entries to be extracted from the DB.
+  // Each extraction round gets a new file, replacing the previous one.
   //
   Status PrepareFile(WritableFile **sst_file);
+  // Setup the temporary sstable file for the next chunk, which
+  // is stored in its own sub-directory of the output directory.
+  //
+  Status PrepareChunk(WritableFile **sst_file, std::string *chunk_dir);
+  // Seal the current output file and hand it over to the chunk handler.
+  //
+  Status SealChunk(MDBTableBuilder* builder, const std::string &chunk_dir,
+                   uint64_t min_seq, uint64_t max_seq, int num_entries);
+  // Add an internal key to the output of the current round, starting
+  // a new output file or chunk if needed.
+  //
+  Status AddChange(const Slice &internal_key, const Slice &value,
+                   uint64_t *min_seq, uint64_t *max_seq);
+  // Seal whatever output the current round has left open.
+  //
+  Status FinishChanges(const Status &status);
 
   Status Commit();
   Status Extract(uint64_t *min_seq, uint64_t *max_seq);
+  void TrackChanges();
+  Status ExtractChanges(uint64_t *min_seq, uint64_t *max_seq);
 
+  int GetNumEntriesChanged() { return num_entries_changed_; }
   int GetNumEntriesExtracted() { return num_entries_extracted_; }
   const std::string& GetBulkExtractOutputDir() { return dir_path_; }
 };
@@ -154,6 +219,8 @@ class LevelMDB: virtual public MetaDB {
 
   Status Flush();
 
+  bool GetProperty(const Slice &property, std::string *value);
+
   Status Init(OptionInitializer opt_initializer);
 
   DirScanner* CreateDirScanner(const KeyOffset &offset);
@@ -170,13 +237,25 @@ class LevelMDB: virtual public MetaDB {
 
   Status UpdateEntry(const KeyInfo &key, const StatInfo &info);
 
-  Status InsertEntry(const KeyInfo &key, const StatInfo &info);
+  Status InsertEntry(const KeyInfo &key, const StatInfo &info,
+                     int64_t partition_size);
 
   Status SetFileMode(const KeyInfo &key, mode_t new_mode);
 
-  Status NewFile(const KeyInfo &key);
+  Status NewFile(const KeyInfo &key, int64_t partition_size);
+
+  Status NewFiles(int64_t parent_id, const std::vector<int16_t> &partitions,
+                  const NameList &names, mode_t perm,
+                  std::vector<bool> *created,
+                  const std::map<int16_t, int64_t> *partition_sizes);
+
+  Status NewDirectory(const KeyInfo &key, int16_t zeroth_server, int64_t inode_no,
+      bool pending_zeroth, int64_t partition_size);
+
+  Status RemovePendingZeroth(int64_t dir_id);
 
-  Status NewDirectory(const KeyInfo &key, int16_t zeroth_server, int64_t inode_no);
+  Status ListPendingZeroths(std::vector<int64_t> *dir_ids,
+      std::vector<int16_t> *zeroth_servers);
 
   Status GetMapping(int64_t dir_id, std::string *dmap_data);
 
@@ -184,12 +263,18 @@ class LevelMDB: virtual public MetaDB {
 
   Status InsertMapping(int64_t dir_id, const Slice &dmap_data);
 
+  Status GetPartitionSize(int64_t dir_id, int16_t partition_id, int64_t *size);
+
+  Status SetPartitionSize(int64_t dir_id, int16_t partition_id, int64_t size);
+
   BulkExtractor* CreateLocalBulkExtractor();
 
   BulkExtractor* CreateBulkExtractor(const std::string &tmp_path);
 
   Status BulkInsert(uint64_t min_seq, uint64_t max_seq, const std::string &tmp_path);
 
+  Status DiscardPartition(int64_t dir_id, int16_t partition_id);
+
   Status ListEntries(const KeyOffset &offset, NameList *names, StatList *infos);
 
   Status FetchData(const KeyInfo &key, int32_t *size, char *buffer);
@@ -209,11 +294,45 @@ class LevelMDB: virtual public MetaDB {
 
   enum SpecialKeys {
     kInodeKey = -1,
+    kPendingZerothKey = -2, // followed by the directory id
   };
 
-  Status SaveInodeCounter(); // save to disk
+  static MDBKey PendingZerothKey(int64_t dir_id) {
+    MDBKey mdb_key(kPendingZerothKey);
+    EncodeFixed64(mdb_key.GetNameHash(), static_cast<uint64_t>(dir_id));
+    return mdb_key;
+  }
+
+  Status SaveInodeCounter(int64_t inode_no); // save to disk
   Status RetrieveInodeCounter(); // read from disk
 
+  // Durably reserves a new range of inode numbers
+  // beyond the specified inode number.
+  void ExtendInodeRange(int64_t inode_no);
+
+  // Writes a batch of new entries along with the updated sizes of the
+  // partitions they belong to, if the current sizes of those are given.
+  Status WriteNewEntries(int64_t dir_id,
+      const std::map<int16_t, int> &deltas,
+      const std::map<int16_t, int64_t> *partition_sizes, WriteBatch *batch);
+  Status WriteNewEntry(const KeyInfo &key,
+      int64_t partition_size, WriteBatch *batch);
+
+  // Apply updates, logging the keys of the entries being migrated
+  // by splits in progress once the updates have been applied.
+  Status Put(const Slice &key, const Slice &value);
+  Status Delete(const Slice &key);
+  Status Write(WriteBatch *batch);
+
+  ChangeLog* NewChangeLog(int64_t dir_id,
+      int16_t old_partition, int16_t new_partition);
+  void DeleteChangeLog(ChangeLog *log);
+
+  // Takes the keys logged so far, along with a snapshot that
+  // reflects all writes to these keys but none logged afterwards.
+  const Snapshot* DrainChangeLog(ChangeLog *log,
+      std::vector<std::string> *keys);
+
   Status CreateNewFileSystem(const std::string &db_path); // initialize an empty namespace
   Status LoadExistingFileSystem(const std::string &db_path); // restore existing namespace
 
@@ -223,12 +342,23 @@ class LevelMDB: virtual public MetaDB {
   Options options_; // Use options_.env to access Env
   Options builder_options_;
 
+  // Inode numbers are handed out with atomic increments. Only those not
+  // exceeding inode_limit_ are safe to use, which is the last inode number
+  // persisted to disk. Extending that limit requires holding inode_mu_.
   Mutex inode_mu_;
   int64_t inode_counter_;
+  int64_t inode_limit_;
 
-  // LevelDB write options
+  // Change logs of the splits in progress. Writers
+  // skip log_mu_ as long as num_change_logs_ is zero.
+  Mutex log_mu_;
+  CondVar log_cv_;
+  int num_change_logs_;
+  std::vector<ChangeLog*> change_logs_;
+
+  // LevelDB write options, updates are synced in durable modes
   WriteOptions write_sync_;
-  WriteOptions write_async_;
+  WriteOptions write_update_;
 
   // LevelDB read options
   ReadOptions read_fill_cache_;
@@ -245,7 +375,8 @@ class LevelMDB: virtual public MetaDB {
 
 LevelMDB::~LevelMDB() {
   if (db_ != NULL) {
-    SaveInodeCounter();
+    // Unused inode numbers reserved are returned on clean shutdowns
+    SaveInodeCounter(GetCurrentInodeNo());
     delete db_;
   }
   if (options_.block_cache != NULL) {
@@ -255,12 +386,15 @@ LevelMDB::~LevelMDB() {
 }
 
 LevelMDB::LevelMDB(Config* config, Env* env) :
-    config_(config), user_env_(env), db_(NULL), inode_counter_(0) {
+    config_(config), user_env_(env), db_(NULL),
+    inode_counter_(0), inode_limit_(0),
+    log_cv_(&log_mu_), num_change_logs_(0) {
 
   DLOG_ASSERT(config_ != NULL);
 
   write_sync_.sync = true;
-  write_async_.sync = false;
+  write_update_.sync =
+      config_->IsServer() && config_->GetSyncMode() != kSyncNone;
   read_fill_cache_.fill_cache = true;
   read_pass_cache_.fill_cache = false;
 }
@@ -270,6 +404,11 @@ Status LevelMDB::Flush() {
   return db_->Flush();
 }
 
+bool LevelMDB::GetProperty(const Slice &property, std::string *value) {
+  DLOG_ASSERT(db_ != NULL);
+  return db_->GetProperty(property, value);
+}
+
 Status LevelMDB::Init(OptionInitializer opt_initializer) {
   DLOG_ASSERT(db_ == NULL);
 
@@ -297,8 +436,8 @@ Status LevelMDB::CreateNewFileSystem(const std::string &db_path) {
     return Status::Corruption("Cannot open LevelDB", s.ToString());
   }
   if (config_->IsServer()) {
-    inode_counter_ = config_->GetSrvId();
-    s = SaveInodeCounter();
+    inode_counter_ = inode_limit_ = config_->GetSrvId();
+    s = SaveInodeCounter(inode_limit_);
     if (!s.ok()) {
       return Status::Corruption("Cannot initialize inode counter", s.ToString());
     }
@@ -318,8 +457,8 @@ Status LevelMDB::LoadExistingFileSystem(const std::string &db_path) {
     s = RetrieveInodeCounter();
     if (!s.ok()) {
       if (config_->HasOldData()) {
-        inode_counter_ = config_->GetSrvId();
-        s = SaveInodeCounter();
+        inode_counter_ = inode_limit_ = config_->GetSrvId();
+        s = SaveInodeCounter(inode_limit_);
       } else {
         s = Status::Corruption("Cannot fetch inode counter", s.ToString());
       }
@@ -328,36 +467,211 @@ Status LevelMDB::LoadExistingFileSystem(const std::string &db_path) {
   return s;
 }
 
-Status LevelMDB::SaveInodeCounter() {
+Status LevelMDB::SaveInodeCounter(int64_t inode_no) {
   MDBKey key(kInodeKey);
   std::string value;
-  MutexLock lock(&inode_mu_);
-  PutFixed64(&value, inode_counter_);
+  PutFixed64(&value, inode_no);
   return db_->Put(write_sync_, key.ToSlice(), value);
 }
 
+// Resumes right after the last inode number persisted, which either
+// ends the last range reserved, or is the last inode number handed out
+// if the database was cleanly shut down.
+//
 Status LevelMDB::RetrieveInodeCounter() {
   MDBKey key(kInodeKey);
   std::string value;
   MutexLock lock(&inode_mu_);
   Status s = db_->Get(read_fill_cache_, key.ToSlice(), &value);
   if (s.ok()) {
-    inode_counter_ = DecodeFixed64(value.data());
+    inode_counter_ = inode_limit_ = DecodeFixed64(value.data());
   }
   return s;
 }
 
-inline
-int64_t LevelMDB::GetCurrentInodeNo() {
+void LevelMDB::ExtendInodeRange(int64_t inode_no) {
   MutexLock lock(&inode_mu_);
-  return inode_counter_;
+  int64_t limit = __sync_add_and_fetch(&inode_limit_, 0);
+  if (inode_no <= limit) {
+    return; // Already extended by others
+  }
+  // Cover inode numbers concurrently handed out as well
+  int64_t new_limit = std::max(inode_no, GetCurrentInodeNo()) +
+      kInodeRangeSize * DEFAULT_MAX_NUM_SERVERS;
+  Status s = SaveInodeCounter(new_limit);
+  if (!s.ok()) {
+    // Inode numbers not persisted may get reused after restarts
+    LOG(FATAL) << "Cannot reserve inode numbers: " << s.ToString();
+  }
+  __sync_val_compare_and_swap(&inode_limit_, limit, new_limit);
+}
+
+Status LevelMDB::WriteNewEntries(int64_t dir_id,
+        const std::map<int16_t, int> &deltas,
+        const std::map<int16_t, int64_t> *partition_sizes, WriteBatch *batch) {
+  std::map<int16_t, int>::const_iterator it = deltas.begin();
+  for (; partition_sizes != NULL && it != deltas.end(); ++it) {
+    std::map<int16_t, int64_t>::const_iterator size_it =
+        partition_sizes->find(it->first);
+    if (size_it != partition_sizes->end()) {
+      std::string value;
+      PutFixed64(&value, size_it->second + it->second);
+      batch->Put(PartitionSizeKey(dir_id, it->first).ToSlice(), value);
+    }
+  }
+  return Write(batch);
+}
+
+Status LevelMDB::WriteNewEntry(const KeyInfo &key,
+        int64_t partition_size, WriteBatch *batch) {
+  if (partition_size >= 0) {
+    std::string value;
+    PutFixed64(&value, partition_size + 1);
+    batch->Put(PartitionSizeKey(key.parent_id_, key.partition_id_).ToSlice(), value);
+  }
+  return Write(batch);
+}
+
+namespace {
+static inline
+bool IsLogged(const ChangeLog *log, const Slice &key) {
+  const MDBKey* mdb_key = reinterpret_cast<const MDBKey*>(key.data());
+  return mdb_key->GetParent() == log->dir_id &&
+         mdb_key->GetPartition() == log->old_partition &&
+         DirIndex::ToBeMigrated(log->new_partition, mdb_key->GetNameHash());
+}
+
+// Collects the keys in a write batch that belong to a change log.
+class LoggedKeys: public WriteBatch::Handler {
+ public:
+  LoggedKeys(const std::vector<ChangeLog*> &logs) : logs_(logs), log_(NULL) { }
+  virtual void Put(const Slice &key, const Slice &value) { Add(key); }
+  virtual void Delete(const Slice &key) { Add(key); }
+  // Splits are serialized per directory and batches never span
+  // directories, so a batch belongs to at most one change log.
+  ChangeLog* log() { return log_; }
+  std::vector<Slice> keys;
+ private:
+  void Add(const Slice &key) {
+    for (size_t i = 0; log_ == NULL && i < logs_.size(); ++i) {
+      if (IsLogged(logs_[i], key)) {
+        log_ = logs_[i];
+      }
+    }
+    if (log_ != NULL && IsLogged(log_, key)) {
+      keys.push_back(key);
+    }
+  }
+  const std::vector<ChangeLog*> &logs_;
+  ChangeLog* log_;
+};
+}
+
+Status LevelMDB::Put(const Slice &key, const Slice &value) {
+  if (__sync_add_and_fetch(&num_change_logs_, 0) == 0) {
+    return db_->Put(write_update_, key, value);
+  }
+  WriteBatch batch;
+  batch.Put(key, value);
+  return Write(&batch);
+}
+
+Status LevelMDB::Delete(const Slice &key) {
+  if (__sync_add_and_fetch(&num_change_logs_, 0) == 0) {
+    return db_->Delete(write_update_, key);
+  }
+  WriteBatch batch;
+  batch.Delete(key);
+  return Write(&batch);
+}
+
+// Writes to logged entries are excluded from DrainChangeLog() so that
+// each write is either entirely before or entirely after a snapshot
+// handed out to splits, and logged accordingly.
+//
+Status LevelMDB::Write(WriteBatch *batch) {
+  if (__sync_add_and_fetch(&num_change_logs_, 0) == 0) {
+    return db_->Write(write_update_, batch);
+  }
+  LoggedKeys logged(change_logs_);
+  ChangeLog* log = NULL;
+  {
+    MutexLock lock(&log_mu_);
+    batch->Iterate(&logged);
+    log = logged.log();
+    if (log != NULL) {
+      while (log->draining) {
+        log_cv_.Wait();
+      }
+      log->num_writers++;
+    }
+  }
+  Status s = db_->Write(write_update_, batch);
+  if (log != NULL) {
+    MutexLock lock(&log_mu_);
+    // Keys are logged even if the write fails since it may
+    // still have been applied. Extra keys are harmless.
+    for (size_t i = 0; i < logged.keys.size(); ++i) {
+      log->keys.push_back(logged.keys[i].ToString());
+    }
+    if (--log->num_writers == 0) {
+      log_cv_.SignalAll();
+    }
+  }
+  return s;
+}
+
+ChangeLog* LevelMDB::NewChangeLog(int64_t dir_id,
+        int16_t old_partition, int16_t new_partition) {
+  ChangeLog* log = new ChangeLog;
+  log->dir_id = dir_id;
+  log->old_partition = old_partition;
+  log->new_partition = new_partition;
+  log->num_writers = 0;
+  log->draining = false;
+  MutexLock lock(&log_mu_);
+  change_logs_.push_back(log);
+  __sync_add_and_fetch(&num_change_logs_, 1);
+  return log;
+}
+
+void LevelMDB::DeleteChangeLog(ChangeLog *log) {
+  MutexLock lock(&log_mu_);
+  change_logs_.erase(std::find(change_logs_.begin(), change_logs_.end(), log));
+  __sync_sub_and_fetch(&num_change_logs_, 1);
+  while (log->num_writers > 0) {
+    log_cv_.Wait();
+  }
+  delete log;
+}
+
+const Snapshot* LevelMDB::DrainChangeLog(ChangeLog *log,
+        std::vector<std::string> *keys) {
+  MutexLock lock(&log_mu_);
+  log->draining = true;
+  while (log->num_writers > 0) {
+    log_cv_.Wait();
+  }
+  const Snapshot* snapshot = db_->GetSnapshot();
+  keys->clear();
+  keys->swap(log->keys);
+  log->draining = false;
+  log_cv_.SignalAll();
+  return snapshot;
 }
 
 inline
+int64_t LevelMDB::GetCurrentInodeNo() {
+  return __sync_add_and_fetch(&inode_counter_, 0);
+}
+
 int64_t LevelMDB::ReserveNextInodeNo() {
-  MutexLock lock(&inode_mu_);
-  inode_counter_ += DEFAULT_MAX_NUM_SERVERS;
-  return inode_counter_;
+  int64_t inode_no =
+      __sync_add_and_fetch(&inode_counter_, DEFAULT_MAX_NUM_SERVERS);
+  if (inode_no > __sync_add_and_fetch(&inode_limit_, 0)) {
+    ExtendInodeRange(inode_no);
+  }
+  return inode_no;
 }
 
 Status LevelMDB::PutEntry(const KeyInfo &key,
@@ -373,7 +687,7 @@ Status LevelMDB::PutEntry(const KeyInfo &key,
   mdb_val->SetGroupId(-1);
   mdb_val->SetChangeTime(info.ctime);
   mdb_val->SetModifyTime(info.mtime);
-  return db_->Put(write_async_, mdb_key.ToSlice(), mdb_val.ToSlice());
+  return Put(mdb_key.ToSlice(), mdb_val.ToSlice());
 }
 
 Status LevelMDB::PutEntryWithMode(const KeyInfo &key,
@@ -391,7 +705,7 @@ Status LevelMDB::PutEntryWithMode(const KeyInfo &key,
   mdb_val->SetGroupId(-1);
   mdb_val->SetChangeTime(info.ctime);
   mdb_val->SetModifyTime(info.mtime);
-  return db_->Put(write_async_, mdb_key.ToSlice(), mdb_val.ToSlice());
+  return Put(mdb_key.ToSlice(), mdb_val.ToSlice());
 }
 
 Status LevelMDB::SetFileMode(const KeyInfo &key,
@@ -407,7 +721,7 @@ Status LevelMDB::SetFileMode(const KeyInfo &key,
   new_mode &= (S_IRWXU | S_IRWXG | S_IRWXO);
   mode_t old_mode = file_stat->FileMode() & ~(S_IRWXU | S_IRWXG | S_IRWXO);
   file_stat->SetFileMode(old_mode | new_mode);
-  return db_->Put(write_async_, mdb_key.ToSlice(), buffer);
+  return Put(mdb_key.ToSlice(), buffer);
 }
 
 Status LevelMDB::EntryExists(const KeyInfo &key) {
@@ -418,30 +732,29 @@ Status LevelMDB::EntryExists(const KeyInfo &key) {
 Status LevelMDB::DeleteEntry(const KeyInfo &key) {
   MDBKey mdb_key(key.parent_id_, key.partition_id_, key.file_name_);
   if (kDeleteCheck) {
-    std::string buffer;
-    Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &buffer);
+    PinnedValue value;
+    Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &value);
     if (!s.ok()) {
       return s.IsNotFound() ? ERR_NOT_FOUND : s;
     }
-    const char* ptr = buffer.data();
-    const FileStat* file_stat = reinterpret_cast<const FileStat*>(ptr);
-    if (S_ISDIR(file_stat->FileMode())) {
+    MDBValueRef val(value.data());
+    if (S_ISDIR(val->FileMode())) {
       return ERR_OP_NOT_SUPPORTED;
     }
   }
-  return db_->Delete(write_async_, mdb_key.ToSlice());
+  return Delete(mdb_key.ToSlice());
 }
 
 Status LevelMDB::GetEntry(const KeyInfo &key,
         StatInfo *info) {
   MDBKey mdb_key(key.parent_id_, key.partition_id_, key.file_name_);
-  std::string buffer;
-  Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &buffer);
+  PinnedValue value;
+  Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &value);
   if (!s.ok()) {
     return s.IsNotFound() ? ERR_NOT_FOUND : s;
   }
-  const char* ptr = buffer.data();
-  const FileStat* file_stat = reinterpret_cast<const FileStat*>(ptr);
+  MDBValueRef val(value.data());
+  const FileStat* file_stat = val.GetFileStat();
   info->id = file_stat->InodeNo();
   info->size = file_stat->FileSize();
   info->mode = file_stat->FileMode();
@@ -472,11 +785,11 @@ Status LevelMDB::UpdateEntry(const KeyInfo &key,
   file_stat->SetGroupId(-1);
   file_stat->SetChangeTime(info.ctime);
   file_stat->SetModifyTime(info.mtime);
-  return db_->Put(write_async_, mdb_key.ToSlice(), buffer);
+  return Put(mdb_key.ToSlice(), buffer);
 }
 
 Status LevelMDB::InsertEntry(const KeyInfo &key,
-        const StatInfo &info) {
+        const StatInfo &info, int64_t partition_size) {
   MDBKey mdb_key(key.parent_id_, key.partition_id_, key.file_name_);
   Status s = db_->Exists(read_fill_cache_, mdb_key.ToSlice());
   if (!s.IsNotFound()) {
@@ -492,10 +805,12 @@ Status LevelMDB::InsertEntry(const KeyInfo &key,
   mdb_val->SetGroupId(-1);
   mdb_val->SetChangeTime(info.ctime);
   mdb_val->SetModifyTime(info.mtime);
-  return db_->Put(write_async_, mdb_key.ToSlice(), mdb_val.ToSlice());
+  WriteBatch batch;
+  batch.Put(mdb_key.ToSlice(), mdb_val.ToSlice());
+  return WriteNewEntry(key, partition_size, &batch);
 }
 
-Status LevelMDB::NewFile(const KeyInfo &key) {
+Status LevelMDB::NewFile(const KeyInfo &key, int64_t partition_size) {
   MDBKey mdb_key(key.parent_id_, key.partition_id_, key.file_name_);
   Status s = db_->Exists(read_fill_cache_, mdb_key.ToSlice());
   if (!s.IsNotFound()) {
@@ -510,11 +825,65 @@ Status LevelMDB::NewFile(const KeyInfo &key) {
   mdb_val->SetUserId(-1);
   mdb_val->SetGroupId(-1);
   mdb_val->SetTime(time(NULL));
-  return db_->Put(write_async_, mdb_key.ToSlice(), mdb_val.ToSlice());
+  WriteBatch batch;
+  batch.Put(mdb_key.ToSlice(), mdb_val.ToSlice());
+  return WriteNewEntry(key, partition_size, &batch);
+}
+
+Status LevelMDB::NewFiles(int64_t parent_id,
+        const std::vector<int16_t> &partitions,
+        const NameList &names, mode_t perm, std::vector<bool> *created,
+        const std::map<int16_t, int64_t> *partition_sizes) {
+  DLOG_ASSERT(partitions.size() == names.size());
+  created->assign(names.size(), false);
+  Status s;
+  WriteBatch batch;
+  int num_new_files = 0;
+  std::map<int16_t, int> deltas;
+  std::set<std::string> batch_keys;
+  time_t now = time(NULL);
+  const mode_t mode = S_IFREG | (perm & ~S_IFMT);
+  for (size_t i = 0; s.ok() && i < names.size(); ++i) {
+    MDBKey mdb_key(parent_id, partitions[i], names[i]);
+    std::string key_data = mdb_key.ToSlice().ToString();
+    if (batch_keys.count(key_data) != 0) {
+      continue;
+    }
+    s = db_->Exists(read_fill_cache_, mdb_key.ToSlice());
+    if (!s.IsNotFound()) {
+      if (s.ok()) {
+        batch_keys.insert(key_data);
+      }
+      continue;
+    }
+    s = Status::OK();
+    MDBValue mdb_val(names[i]);
+    mdb_val->SetInodeNo(-1);
+    mdb_val->SetFileSize(0);
+    mdb_val->SetFileMode(mode);
+    mdb_val->SetFileStatus(kEmbedded);
+    mdb_val->SetZerothServer(-1);
+    mdb_val->SetUserId(-1);
+    mdb_val->SetGroupId(-1);
+    mdb_val->SetTime(now);
+    batch.Put(mdb_key.ToSlice(), mdb_val.ToSlice());
+    batch_keys.insert(key_data);
+    (*created)[i] = true;
+    deltas[partitions[i]]++;
+    num_new_files++;
+  }
+  if (s.ok() && num_new_files > 0) {
+    s = WriteNewEntries(parent_id, deltas, partition_sizes, &batch);
+  }
+  if (!s.ok()) {
+    created->assign(names.size(), false);
+  }
+  return s;
 }
 
 Status LevelMDB::NewDirectory(const KeyInfo &key,
-        int16_t zeroth_server, int64_t inode_no) {
+        int16_t zeroth_server, int64_t inode_no, bool pending_zeroth,
+        int64_t partition_size) {
   MDBKey mdb_key(key.parent_id_, key.partition_id_, key.file_name_);
   Status s = db_->Exists(read_fill_cache_, mdb_key.ToSlice());
   if (!s.IsNotFound()) {
@@ -529,7 +898,39 @@ Status LevelMDB::NewDirectory(const KeyInfo &key,
   mdb_val->SetUserId(-1);
   mdb_val->SetGroupId(-1);
   mdb_val->SetTime(time(NULL));
-  return db_->Put(write_async_, mdb_key.ToSlice(), mdb_val.ToSlice());
+  WriteBatch batch;
+  batch.Put(mdb_key.ToSlice(), mdb_val.ToSlice());
+  if (pending_zeroth) {
+    char value[2];
+    EncodeFixed16(value, static_cast<uint16_t>(zeroth_server));
+    batch.Put(PendingZerothKey(inode_no).ToSlice(), Slice(value, 2));
+  }
+  return WriteNewEntry(key, partition_size, &batch);
+}
+
+Status LevelMDB::RemovePendingZeroth(int64_t dir_id) {
+  MDBKey mdb_key = PendingZerothKey(dir_id);
+  return db_->Delete(write_update_, mdb_key.ToSlice());
+}
+
+Status LevelMDB::ListPendingZeroths(std::vector<int64_t> *dir_ids,
+        std::vector<int16_t> *zeroth_servers) {
+  MDBKey start_key(kPendingZerothKey);
+  MDBIterator it(db_->NewIterator(read_pass_cache_));
+  for (it->Seek(start_key.ToSlice()); it->Valid(); it->Next()) {
+    const MDBKey* key = reinterpret_cast<const MDBKey*>(it->key().data());
+    if (key->GetParent() != kPendingZerothKey) {
+      break;
+    }
+    if (it->value().size() != 2) {
+      return Status::Corruption("Bad pending zeroth partition");
+    }
+    dir_ids->push_back(static_cast<int64_t>(
+        DecodeFixed64(key->GetNameHash())));
+    zeroth_servers->push_back(static_cast<int16_t>(
+        DecodeFixed16(it->value().data())));
+  }
+  return Status::OK();
 }
 
 Status LevelMDB::GetMapping(int64_t dir_id,
@@ -546,7 +947,7 @@ Status LevelMDB::UpdateMapping(int64_t dir_id,
   if (!s.ok()) {
     return s.IsNotFound() ? ERR_NOT_FOUND : s;
   }
-  return db_->Put(write_async_, mdb_key.ToSlice(), dmap_data);
+  return Put(mdb_key.ToSlice(), dmap_data);
 }
 
 Status LevelMDB::InsertMapping(int64_t dir_id,
@@ -556,7 +957,33 @@ Status LevelMDB::InsertMapping(int64_t dir_id,
   if (!s.IsNotFound()) {
     return s.ok() ? ERR_ALREADY_EXISTS : s;
   }
-  return db_->Put(write_async_, mdb_key.ToSlice(), dmap_data);
+  return Put(mdb_key.ToSlice(), dmap_data);
+}
+
+Status LevelMDB::GetPartitionSize(int64_t dir_id,
+        int16_t partition_id, int64_t *size) {
+  MDBKey mdb_key = PartitionSizeKey(dir_id, partition_id);
+  PinnedValue value;
+  Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &value);
+  if (s.IsNotFound()) {
+    *size = 0;
+    return Status::OK();
+  }
+  if (s.ok()) {
+    if (value.data().size() != 8) {
+      return Status::Corruption("Bad partition size");
+    }
+    *size = static_cast<int64_t>(DecodeFixed64(value.data().data()));
+  }
+  return s;
+}
+
+Status LevelMDB::SetPartitionSize(int64_t dir_id,
+        int16_t partition_id, int64_t size) {
+  MDBKey mdb_key = PartitionSizeKey(dir_id, partition_id);
+  std::string value;
+  PutFixed64(&value, size);
+  return Put(mdb_key.ToSlice(), value);
 }
 
 Status LevelMDB::ListEntries(const KeyOffset &offset,
@@ -593,12 +1020,12 @@ Status LevelMDB::ListEntries(const KeyOffset &offset,
 Status LevelMDB::FetchData(const KeyInfo &key,
         int32_t *size, char *databuf) {
   MDBKey mdb_key(key.parent_id_, key.partition_id_, key.file_name_);
-  std::string buffer;
-  Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &buffer);
+  PinnedValue value;
+  Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &value);
   if (!s.ok()) {
     return s.IsNotFound() ? ERR_NOT_FOUND : s;
   }
-  MDBValueRef val(buffer.data(), buffer.size());
+  MDBValueRef val(value.data());
   if (!IsEmbedded(val->FileStatus())) {
     *size = -1;
     return Status::OK();
@@ -614,18 +1041,18 @@ Status LevelMDB::WriteData(const KeyInfo &key,
         uint32_t offset, uint32_t size, const char *data) {
   DLOG_ASSERT(offset + size <= DEFAULT_SMALLFILE_THRESHOLD);
   MDBKey mdb_key(key.parent_id_, key.partition_id_, key.file_name_);
-  std::string buffer;
-  Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &buffer);
+  PinnedValue value;
+  Status s = db_->Get(read_fill_cache_, mdb_key.ToSlice(), &value);
   if (!s.ok()) {
     return s.IsNotFound() ? ERR_NOT_FOUND : s;
   }
-  MDBValueRef old_val(buffer.data(), buffer.size());
+  MDBValueRef old_val(value.data());
   DLOG_ASSERT(IsEmbedded(old_val->FileStatus()));
   DLOG_ASSERT(old_val.GetStoragePath().size() == 0);
   DLOG_ASSERT(old_val.GetEmbeddedData().size() <= DEFAULT_SMALLFILE_THRESHOLD);
   MDBValue new_val(old_val, offset, size, data);
   new_val->SetFileSize(new_val.GetEmbeddedData().size());
-  return db_->Put(write_async_, mdb_key.ToSlice(), new_val.ToSlice());
+  return Put(mdb_key.ToSlice(), new_val.ToSlice());
 }
 
 DirScanner* LevelMDB::CreateDirScanner(const KeyOffset &offset) {
@@ -645,6 +1072,10 @@ BulkExtractor* LevelMDB::CreateLocalBulkExtractor() {
   extractor->mdb_ = this;
   extractor->batch_ = new WriteBatch();
   extractor->num_entries_extracted_ = 0;
+  extractor->num_rounds_ = 0;
+  extractor->num_entries_changed_ = 0;
+  extractor->change_log_ = NULL;
+  extractor->last_snapshot_ = NULL;
   return extractor;
 }
 
@@ -656,12 +1087,46 @@ BulkExtractor* LevelMDB::CreateBulkExtractor(const std::string &tmp_path) {
   extractor->dir_path_ = tmp_path;
   extractor->batch_ = new WriteBatch();
   extractor->num_entries_extracted_ = 0;
+  extractor->num_rounds_ = 0;
+  extractor->num_entries_changed_ = 0;
+  extractor->watermark_ = 0;
+  extractor->change_log_ = NULL;
+  extractor->last_snapshot_ = NULL;
+  extractor->builder_ = NULL;
   return extractor;
 }
 
 Status LevelMDB::BulkInsert(uint64_t min_seq, uint64_t max_seq,
         const std::string &tmp_path) {
-  return db_->BulkInsert(write_async_, tmp_path, min_seq, max_seq);
+  return db_->BulkInsert(write_update_, tmp_path, min_seq, max_seq);
+}
+
+Status LevelMDB::DiscardPartition(int64_t dir_id, int16_t partition_id) {
+  WriteBatch batch;
+  int num_entries = 0;
+  Status s;
+  {
+    MDBIterator it(db_->NewIterator(read_pass_cache_));
+    for (it->Seek(MDBKey(dir_id, partition_id).ToSlice());
+         it->Valid(); it->Next()) {
+      const MDBKey* key = reinterpret_cast<const MDBKey*>(it->key().data());
+      if (key->GetParent() != dir_id ||
+          key->GetPartition() != partition_id) {
+        break;
+      }
+      batch.Delete(it->key());
+      num_entries++;
+    }
+    s = it->status();
+  }
+  if (s.ok()) {
+    batch.Delete(PartitionSizeKey(dir_id, partition_id).ToSlice());
+    s = db_->Write(write_update_, &batch);
+  }
+  DLOG_IF(INFO, s.ok()) << "Partition Discard "
+          "[dir=" << dir_id << "][index=" << partition_id << "] done"
+          " >> " << num_entries << " entries removed";
+  return s;
 }
 
 // --------------------------------------------
@@ -711,12 +1176,67 @@ static
 const MDBKey* ToMDBKey(const Slice& key) {
   return reinterpret_cast<const MDBKey*>(key.data());
 }
+
+// Positions the iterator at a logged key and checks whether that key
+// exists at the snapshot of the iterator, and whether it existed
+// at the snapshot read by the previous extraction round.
+//
+static
+Status CheckChange(DB* db, const ReadOptions& last_round, MDBIterator& it,
+                   const Slice& key, bool* exists, bool* existed) {
+  it->Seek(key);
+  *exists = it->Valid() && it->key() == key;
+  Status s = it->status();
+  if (s.ok()) {
+    s = db->Exists(last_round, key);
+    *existed = s.ok();
+    if (s.IsNotFound()) {
+      s = Status::OK();
+    }
+  }
+  return s;
+}
+
+static
+void SortUnique(std::vector<std::string>* keys) {
+  std::sort(keys->begin(), keys->end());
+  keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+}
+}
+
+MDBLocalBulkExtractor::~MDBLocalBulkExtractor() {
+  if (last_snapshot_ != NULL) {
+    db_->ReleaseSnapshot(last_snapshot_);
+  }
+  if (change_log_ != NULL) {
+    mdb_->DeleteChangeLog(change_log_);
+  }
+  if (batch_ != NULL) {
+    delete batch_;
+  }
+}
+
+MDBBulkExtractor::~MDBBulkExtractor() {
+  if (last_snapshot_ != NULL) {
+    db_->ReleaseSnapshot(last_snapshot_);
+  }
+  if (change_log_ != NULL) {
+    mdb_->DeleteChangeLog(change_log_);
+  }
+  if (batch_ != NULL) {
+    delete batch_;
+  }
 }
 
 Status MDBLocalBulkExtractor::Commit() {
   Status s;
-  if (num_entries_extracted_ > 0) {
-    s = db_->Write(mdb_->write_async_, batch_);
+  if (old_partition_size_ >= 0) {
+    std::string value;
+    PutFixed64(&value, old_partition_size_);
+    batch_->Put(PartitionSizeKey(dir_id_, old_partition_).ToSlice(), value);
+  }
+  if (num_entries_extracted_ > 0 || old_partition_size_ >= 0) {
+    s = db_->Write(mdb_->write_update_, batch_);
   }
   return s;
 }
@@ -745,17 +1265,111 @@ Status MDBLocalBulkExtractor::Extract(uint64_t *min_seq, uint64_t *max_seq) {
   return s;
 }
 
+void MDBLocalBulkExtractor::TrackChanges() {
+  DLOG_ASSERT(change_log_ == NULL);
+  change_log_ = mdb_->NewChangeLog(dir_id_, old_partition_, new_partition_);
+}
+
+Status MDBLocalBulkExtractor::ExtractChanges(uint64_t *min_seq, uint64_t *max_seq) {
+  if (change_log_ == NULL) {
+    TrackChanges();
+  }
+  Status s;
+  WriteBatch changes;
+  std::vector<std::string> keys;
+  ReadOptions options = mdb_->read_pass_cache_;
+  options.snapshot = mdb_->DrainChangeLog(change_log_, &keys);
+  num_entries_changed_ = 0;
+  {
+    MDBIterator it(db_->NewIterator(options));
+    if (num_rounds_ == 0) {
+      // Keys logged so far are covered by this full copy
+      for (it->Seek(MDBKey(dir_id_, old_partition_).ToSlice());
+           it->Valid(); it->Next()) {
+        const MDBKey* key = ToMDBKey(it->key());
+        if (key->GetParent() != dir_id_ ||
+            key->GetPartition() != old_partition_) {
+          break;
+        }
+        if (DirIndex::ToBeMigrated(new_partition_, key->GetNameHash())) {
+          batch_->Delete(it->key());
+          num_entries_extracted_++;
+          num_entries_changed_++;
+          MDBKey new_key(dir_id_, new_partition_);
+          PutHash(&new_key, Slice(key->GetNameHash(), key->GetHashSize()));
+          changes.Put(new_key.ToSlice(), it->value());
+        }
+      }
+    } else {
+      ReadOptions last_round = mdb_->read_pass_cache_;
+      last_round.snapshot = last_snapshot_;
+      SortUnique(&keys);
+      for (size_t i = 0; s.ok() && i < keys.size(); ++i) {
+        Slice old_key(keys[i]);
+        bool exists, existed;
+        s = CheckChange(db_, last_round, it, old_key, &exists, &existed);
+        if (!s.ok() || (!exists && !existed)) {
+          continue;
+        }
+        const MDBKey* key = ToMDBKey(old_key);
+        MDBKey new_key(dir_id_, new_partition_);
+        PutHash(&new_key, Slice(key->GetNameHash(), key->GetHashSize()));
+        if (exists) {
+          if (!existed) {
+            batch_->Delete(old_key);
+            num_entries_extracted_++;
+          }
+          changes.Put(new_key.ToSlice(), it->value());
+        } else {
+          num_entries_extracted_--;
+          changes.Delete(new_key.ToSlice());
+        }
+        num_entries_changed_++;
+      }
+    }
+  }
+  if (last_snapshot_ != NULL) {
+    db_->ReleaseSnapshot(last_snapshot_);
+  }
+  last_snapshot_ = options.snapshot;
+  // Entries are copied into the new partition right away. They
+  // remain invisible until the new partition is added to the bitmap.
+  if (s.ok() && num_entries_changed_ > 0) {
+    s = db_->Write(mdb_->write_update_, &changes);
+  }
+  *min_seq = *max_seq = 0;
+  num_rounds_++;
+  return s;
+}
+
 Status MDBBulkExtractor::Commit() {
   Status s;
-  if (num_entries_extracted_ > 0) {
-    s = db_->Write(mdb_->write_async_, batch_);
+  if (old_partition_size_ >= 0) {
+    std::string value;
+    PutFixed64(&value, old_partition_size_);
+    batch_->Put(PartitionSizeKey(dir_id_, old_partition_).ToSlice(), value);
+  }
+  if (num_entries_extracted_ > 0 || old_partition_size_ >= 0) {
+    s = db_->Write(mdb_->write_update_, batch_);
   }
 # if !defined(HDFS)
-  if (s.ok()) {
+  if (s.ok() && !sstable_path_.empty()) {
     s = env_->DeleteFile(sstable_path_);
   }
 # endif
-  return !s.ok() ? s : env_->DeleteDir(dir_path_);
+  std::vector<std::string>::iterator it = chunk_dirs_.begin();
+  for (; s.ok() && it != chunk_dirs_.end(); ++it) {
+#   if !defined(HDFS)
+    s = env_->DeleteFile(TableFileName(*it, 1));
+#   endif
+    if (s.ok()) {
+      s = env_->DeleteDir(*it);
+    }
+  }
+  if (!s.ok() || !env_->FileExists(dir_path_)) {
+    return s;
+  }
+  return env_->DeleteDir(dir_path_);
 }
 
 Status MDBBulkExtractor::PrepareFile(WritableFile **sst_file) {
@@ -766,10 +1380,50 @@ Status MDBBulkExtractor::PrepareFile(WritableFile **sst_file) {
       return s;
     }
   }
-  sstable_path_ = TableFileName(dir_path_, 1);
+# if !defined(HDFS)
+  if (!sstable_path_.empty()) {
+    s = env_->DeleteFile(sstable_path_);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+# endif
+  sstable_path_ = TableFileName(dir_path_, num_rounds_ + 1);
   return env_->NewWritableFile(sstable_path_, sst_file);
 }
 
+Status MDBBulkExtractor::PrepareChunk(WritableFile **sst_file,
+                                      std::string *chunk_dir) {
+  Status s;
+  if (!env_->FileExists(dir_path_)) {
+    s = env_->CreateDir(dir_path_);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  std::stringstream ss;
+  ss << dir_path_ << "/c" << chunk_dirs_.size() + 1;
+  chunk_dir->assign(ss.str());
+  s = env_->CreateDir(*chunk_dir);
+  if (!s.ok()) {
+    return s;
+  }
+  chunk_dirs_.push_back(*chunk_dir);
+  return env_->NewWritableFile(TableFileName(*chunk_dir, 1), sst_file);
+}
+
+Status MDBBulkExtractor::SealChunk(MDBTableBuilder* builder,
+                                   const std::string &chunk_dir,
+                                   uint64_t min_seq, uint64_t max_seq,
+                                   int num_entries) {
+  Status s = builder->Seal();
+  delete builder; // Also closes the file
+  if (s.ok() && chunk_handler_ != NULL) {
+    s = chunk_handler_->HandleChunk(chunk_dir, min_seq, max_seq, num_entries);
+  }
+  return s;
+}
+
 Status MDBBulkExtractor::Extract(uint64_t *min_seq, uint64_t *max_seq) {
   *min_seq = *max_seq = 0;
   WritableFile* sst_file;
@@ -810,6 +1464,138 @@ Status MDBBulkExtractor::Extract(uint64_t *min_seq, uint64_t *max_seq) {
   return builder.Seal();
 }
 
+void MDBBulkExtractor::TrackChanges() {
+  DLOG_ASSERT(change_log_ == NULL);
+  change_log_ = mdb_->NewChangeLog(dir_id_, old_partition_, new_partition_);
+}
+
+Status MDBBulkExtractor::AddChange(const Slice &internal_key,
+                                   const Slice &value,
+                                   uint64_t *min_seq, uint64_t *max_seq) {
+  Status s;
+  uint64_t seq = MDBHelper::FetchSeqNum(internal_key);
+  if (builder_ == NULL) {
+    WritableFile* sst_file;
+    s = chunk_handler_ != NULL ?
+        PrepareChunk(&sst_file, &chunk_dir_) : PrepareFile(&sst_file);
+    if (!s.ok()) {
+      return s;
+    }
+    builder_ = new MDBTableBuilder(mdb_->builder_options_, sst_file);
+    chunk_min_seq_ = chunk_max_seq_ = seq;
+    chunk_bytes_ = 0;
+  }
+  (*builder_)->Add(internal_key, value);
+  if (num_entries_changed_ == 0) {
+    *min_seq = *max_seq = seq;
+  }
+  num_entries_changed_++;
+  *min_seq = std::min(*min_seq, seq);
+  *max_seq = std::max(*max_seq, seq);
+  chunk_bytes_ += internal_key.size() + value.size();
+  chunk_min_seq_ = std::min(chunk_min_seq_, seq);
+  chunk_max_seq_ = std::max(chunk_max_seq_, seq);
+  if (chunk_handler_ != NULL && chunk_bytes_ >= chunk_size_) {
+    s = FinishChanges(s);
+  }
+  return s;
+}
+
+Status MDBBulkExtractor::FinishChanges(const Status &status) {
+  Status s = status;
+  if (builder_ != NULL) {
+    if (s.ok()) {
+      s = SealChunk(builder_, chunk_dir_, chunk_min_seq_, chunk_max_seq_,
+              static_cast<int>((*builder_)->NumEntries()));
+    } else {
+      delete builder_;
+    }
+    builder_ = NULL;
+  }
+  return s;
+}
+
+Status MDBBulkExtractor::ExtractChanges(uint64_t *min_seq, uint64_t *max_seq) {
+  if (change_log_ == NULL) {
+    TrackChanges();
+  }
+  *min_seq = *max_seq = 0;
+  Status s;
+  std::vector<std::string> keys;
+  ReadOptions options = mdb_->read_pass_cache_;
+  options.snapshot = mdb_->DrainChangeLog(change_log_, &keys);
+  num_entries_changed_ = 0;
+  // Deletions get a sequence number above that of any entry previously
+  // extracted, but below that of any later write to the same keys.
+  uint64_t deletion_seq = watermark_ + 1;
+  {
+    char key_space[128];
+    MDBIterator it(db_->NewIterator(options));
+    if (num_rounds_ == 0) {
+      // Keys logged so far are covered by this full copy
+      for (it->Seek(MDBKey(dir_id_, old_partition_).ToSlice());
+           s.ok() && it->Valid(); it->Next()) {
+        const Slice& internal_key = it->internalkey();
+        const MDBKey* key = ToMDBKey(internal_key);
+        if (key->GetParent() != dir_id_ ||
+            key->GetPartition() != old_partition_) {
+          break;
+        }
+        if (DirIndex::ToBeMigrated(new_partition_, key->GetNameHash())) {
+          batch_->Delete(it->key());
+          num_entries_extracted_++;
+          MDBKey new_key(dir_id_, new_partition_);
+          DLOG_ASSERT(internal_key.size() < sizeof(key_space));
+          memcpy(key_space, internal_key.data(), internal_key.size());
+          memcpy(key_space, new_key.data(), new_key.GetPrefixSize());
+          watermark_ = std::max(watermark_, MDBHelper::FetchSeqNum(internal_key));
+          s = AddChange(Slice(key_space, internal_key.size()), it->value(),
+                  min_seq, max_seq);
+        }
+      }
+    } else {
+      ReadOptions last_round = mdb_->read_pass_cache_;
+      last_round.snapshot = last_snapshot_;
+      SortUnique(&keys);
+      for (size_t i = 0; s.ok() && i < keys.size(); ++i) {
+        Slice old_key(keys[i]);
+        bool exists, existed;
+        s = CheckChange(db_, last_round, it, old_key, &exists, &existed);
+        if (!s.ok() || (!exists && !existed)) {
+          continue;
+        }
+        const MDBKey* key = ToMDBKey(old_key);
+        MDBKey new_key(dir_id_, new_partition_);
+        PutHash(&new_key, Slice(key->GetNameHash(), key->GetHashSize()));
+        if (exists) {
+          if (!existed) {
+            batch_->Delete(old_key);
+            num_entries_extracted_++;
+          }
+          const Slice& internal_key = it->internalkey();
+          DLOG_ASSERT(internal_key.size() < sizeof(key_space));
+          memcpy(key_space, internal_key.data(), internal_key.size());
+          memcpy(key_space, new_key.data(), new_key.GetPrefixSize());
+          watermark_ = std::max(watermark_, MDBHelper::FetchSeqNum(internal_key));
+          s = AddChange(Slice(key_space, internal_key.size()), it->value(),
+                  min_seq, max_seq);
+        } else {
+          num_entries_extracted_--;
+          InternalKey deletion(new_key.ToSlice(), deletion_seq, kTypeDeletion);
+          s = AddChange(deletion.Encode(), Slice(), min_seq, max_seq);
+        }
+      }
+    }
+    s = FinishChanges(s);
+  }
+  if (last_snapshot_ != NULL) {
+    db_->ReleaseSnapshot(last_snapshot_);
+  }
+  last_snapshot_ = options.snapshot;
+  num_rounds_++;
+  return s;
+}
+
 } /* namespace mdb */
 
 // --------------------------------------------
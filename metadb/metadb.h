@@ -5,6 +5,7 @@
 #ifndef _INDEXFS_METADB_INTERFACE_H_
 #define _INDEXFS_METADB_INTERFACE_H_
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -38,6 +39,21 @@ class DirScanner {
   DirScanner& operator=(const DirScanner&);
 };
 
+// Receives the output of a bulk extractor one chunk at a time.
+//
+class BulkChunkHandler {
+ public:
+
+  virtual ~BulkChunkHandler() { }
+
+  // Invoked each time the extractor seals a chunk. Each chunk is stored
+  // in its own directory and can be bulk inserted on its own. Returning
+  // a non-OK status aborts the extraction.
+  //
+  virtual Status HandleChunk(const std::string &chunk_dir,
+      uint64_t min_seq, uint64_t max_seq, int num_entries) = 0;
+};
+
 class BulkExtractor {
  public:
 
@@ -49,17 +65,56 @@ class BulkExtractor {
   virtual Status Commit() = 0;
   virtual Status Extract(uint64_t *min_seq, uint64_t *max_seq) = 0;
 
+  // Starts logging the keys of all writes to the entries to be migrated.
+  // REQUIRES: the old partition is not being written at the moment,
+  // otherwise writes in progress may be missed.
+  //
+  virtual void TrackChanges() = 0;
+
+  // Incrementally extract the entries to be migrated. Each call reads
+  // from a fresh DB snapshot, so the directory can remain writable. The
+  // first call copies the whole partition, and starts tracking changes
+  // if TrackChanges() has not been called. Subsequent calls only visit
+  // the keys written since the previous call, shipping their latest
+  // value or their deletion. Extracted entries stay in the old partition
+  // until Commit(). GetNumEntriesExtracted() returns the number of
+  // entries currently extracted by all calls so far.
+  //
+  virtual Status ExtractChanges(uint64_t *min_seq, uint64_t *max_seq) = 0;
+  // Returns the number of entries extracted or deleted
+  // by the last ExtractChanges().
+  virtual int GetNumEntriesChanged() = 0;
+
   void SetDirectory(int64_t dir_id) { dir_id_ = dir_id; }
   void SetOldPartition(int16_t old_id) { old_partition_ = old_id; }
   void SetNewPartition(int16_t new_id) { new_partition_ = new_id; }
 
+  // Have Commit() record the given size of the old partition in the
+  // same write batch as the removal of the migrated entries.
+  void SetOldPartitionSize(int64_t size) { old_partition_size_ = size; }
+
+  // Have ExtractChanges() cut its output into SSTable chunks of roughly
+  // the given size, passing each chunk to the handler as soon as it is
+  // sealed. Otherwise, each call produces a single SSTable in the bulk
+  // extraction output directory. Ignored by local extractors.
+  //
+  void SetChunkHandler(BulkChunkHandler* handler, size_t chunk_size) {
+    chunk_handler_ = handler;
+    chunk_size_ = chunk_size;
+  }
+
  protected:
   int64_t dir_id_;
   int16_t old_partition_;
   int16_t new_partition_;
+  int64_t old_partition_size_;
+
+  BulkChunkHandler* chunk_handler_;
+  size_t chunk_size_;
 
   BulkExtractor() : dir_id_(-1),
-          old_partition_(-1), new_partition_(-1) {
+          old_partition_(-1), new_partition_(-1), old_partition_size_(-1),
+          chunk_handler_(NULL), chunk_size_(0) {
   }
 
  private:
@@ -90,6 +145,11 @@ class MetaDB {
   virtual ~MetaDB() { }
   virtual Status Flush() = 0;
 
+  // Returns the value of a property of the underlying key-value store,
+  // such as "leveldb.sync-stats" summarizing log syncs and the number
+  // of updates grouped into each of them.
+  virtual bool GetProperty(const Slice &property, std::string *value) = 0;
+
   virtual int64_t GetCurrentInodeNo() = 0;
   virtual int64_t ReserveNextInodeNo() = 0;
 
@@ -98,7 +158,8 @@ class MetaDB {
   virtual Status DeleteEntry(const KeyInfo &key) = 0;
   virtual Status GetEntry(const KeyInfo &key, StatInfo *info) = 0;
   virtual Status UpdateEntry(const KeyInfo &key, const StatInfo &info) = 0;
-  virtual Status InsertEntry(const KeyInfo &key, const StatInfo &info) = 0;
+  virtual Status InsertEntry(const KeyInfo &key, const StatInfo &info,
+      int64_t partition_size = -1) = 0;
 
   // Blindly put a new entry into the underlying DB
   // without checking the existence of entries currently
@@ -120,15 +181,39 @@ class MetaDB {
   // Different from directories, files don't get inode#s.
   // Returns error if file with the same key already exists.
   //
-  virtual Status NewFile(const KeyInfo &key) = 0;
+  virtual Status NewFile(const KeyInfo &key,
+      int64_t partition_size = -1) = 0;
+  // Create a set of new files under a given directory using a single
+  // write batch. Both "partitions" and "names" must have the same length.
+  // New files are regular files with the permission bits given in "perm".
+  // Names that collide with existing entries, or with an earlier name
+  // in the same batch, are skipped and reported through *created, which
+  // will be resized to match "names".
+  // Returns error only if the underlying DB fails, in which case none of
+  // the new files will be created.
+  //
+  virtual Status NewFiles(int64_t parent_id,
+      const std::vector<int16_t> &partitions,
+      const NameList &names, mode_t perm, std::vector<bool> *created,
+      const std::map<int16_t, int64_t> *partition_sizes = NULL) = 0;
   // Make a new directory with the given inode# and server id.
   // Directories are just inode entries associated with their own parent.
   // Entries under this new directory are stored separately (not
   // with the entry being created here) and are very likely on other servers.
+  // If "pending_zeroth" is set, the zeroth partition of the new directory
+  // is recorded as pending in the same write batch as the new entry.
   // Returns error if directory with the same key already exists.
   //
   virtual Status NewDirectory(const KeyInfo &key,
-      int16_t zeroth_server, int64_t inode_no) = 0;
+      int16_t zeroth_server, int64_t inode_no,
+      bool pending_zeroth = false, int64_t partition_size = -1) = 0;
+  // Pending zeroth partitions are those of new directories that are yet to
+  // be installed on another server. They are removed once installed, and
+  // listed after restarts so that their installation can be resumed.
+  //
+  virtual Status RemovePendingZeroth(int64_t dir_id) = 0;
+  virtual Status ListPendingZeroths(std::vector<int64_t> *dir_ids,
+      std::vector<int16_t> *zeroth_servers) = 0;
   // Override the original file mode according to the new mode.
   // Returns error if no file with the specified key is found.
   //
@@ -138,6 +223,20 @@ class MetaDB {
   virtual Status UpdateMapping(int64_t dir_id, const Slice &dmap_data) = 0;
   virtual Status InsertMapping(int64_t dir_id, const Slice &dmap_data) = 0;
 
+  // The number of entries in each directory partition is persisted next to
+  // the directory mapping. Callers of NewFile(), NewFiles(), NewDirectory(),
+  // and InsertEntry() may pass the current size of the partitions written,
+  // which is then advanced by the number of new entries and recorded in the
+  // same write batch as the entries themselves. Such callers must serialize
+  // writes to each partition. Sizes of partitions changed by other means,
+  // such as bulk insertion and extraction, must be set explicitly.
+  // Partitions without a recorded size have a size of 0.
+  //
+  virtual Status GetPartitionSize(int64_t dir_id,
+      int16_t partition_id, int64_t *size) = 0;
+  virtual Status SetPartitionSize(int64_t dir_id,
+      int16_t partition_id, int64_t size) = 0;
+
   virtual Status FetchData(const KeyInfo &key,
       int32_t *size, char *buffer) = 0;
   virtual Status WriteData(const KeyInfo &key,
@@ -151,6 +250,10 @@ class MetaDB {
 
   virtual Status BulkInsert(uint64_t min_seq, uint64_t max_seq,
      const std::string &tmp_path) = 0;
+  // Delete all entries under a given directory partition, such as those
+  // preloaded for a partition whose split has been abandoned.
+  //
+  virtual Status DiscardPartition(int64_t dir_id, int16_t partition_id) = 0;
   virtual BulkExtractor* CreateLocalBulkExtractor() = 0;
   virtual BulkExtractor* CreateBulkExtractor(const std::string &tmp_path) = 0;
 
@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <map>
+#include <algorithm>
 #include <set>
 #include <vector>
 #include <sstream>
@@ -11,6 +13,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "metadb/dboptions.h"
@@ -20,6 +23,7 @@
 #include "common/common.h"
 #include "common/config.h"
 #include "common/unit_test.h"
+#include "leveldb/env/env_wrapper.h"
 
 namespace indexfs { namespace test {
 
@@ -32,6 +36,98 @@ static std::string FileName(int file_no) {
 static int run_id = 0;
 static const int kBatchSize = 1000;
 static const char* kRunPrefix = "/tmp/indexfs-test";
+
+// Tracks how much of each file written through it has been synced,
+// so that crash images may leave out data that has only reached the
+// operating system, as would happen after a power failure.
+//
+class SyncTrackingEnv: public leveldb::EnvWrapper {
+ public:
+  explicit SyncTrackingEnv(Env* base) : leveldb::EnvWrapper(base) { }
+
+  Status NewWritableFile(const std::string& fname, WritableFile** result);
+
+  Status DeleteFile(const std::string& fname) {
+    Untrack(fname);
+    return target()->DeleteFile(fname);
+  }
+
+  Status RenameFile(const std::string& src, const std::string& target) {
+    Untrack(target);
+    Status s = this->target()->RenameFile(src, target);
+    MutexLock lock(&mu_);
+    std::map<std::string, size_t>::iterator it = synced_.find(src);
+    if (s.ok() && it != synced_.end()) {
+      synced_[target] = it->second;
+      synced_.erase(it);
+    }
+    return s;
+  }
+
+  // Returns the portion of the given file contents that has been synced.
+  // Files not written through this env are deemed to be synced in full.
+  size_t GetSyncedSize(const std::string& fname, size_t size) {
+    MutexLock lock(&mu_);
+    std::map<std::string, size_t>::iterator it = synced_.find(fname);
+    return it != synced_.end() ? std::min(it->second, size) : size;
+  }
+
+  void Synced(const std::string& fname, size_t size) {
+    MutexLock lock(&mu_);
+    synced_[fname] = size;
+  }
+
+  void Untrack(const std::string& fname) {
+    MutexLock lock(&mu_);
+    synced_.erase(fname);
+  }
+
+ private:
+  Mutex mu_;
+  std::map<std::string, size_t> synced_;
+};
+
+class SyncTrackingFile: public WritableFile {
+ public:
+  SyncTrackingFile(SyncTrackingEnv* env,
+                   const std::string& fname, WritableFile* base)
+    : env_(env), fname_(fname), base_(base), size_(0) {
+  }
+
+  virtual ~SyncTrackingFile() { delete base_; }
+
+  virtual Status Append(const Slice& data) {
+    size_ += data.size();
+    return base_->Append(data);
+  }
+
+  virtual Status Close() { return base_->Close(); }
+  virtual Status Flush() { return base_->Flush(); }
+
+  virtual Status Sync() {
+    Status s = base_->Sync();
+    if (s.ok()) {
+      env_->Synced(fname_, size_);
+    }
+    return s;
+  }
+
+ private:
+  SyncTrackingEnv* env_;
+  std::string fname_;
+  WritableFile* base_;
+  size_t size_;
+};
+
+Status SyncTrackingEnv::NewWritableFile(const std::string& fname,
+                                        WritableFile** result) {
+  Status s = target()->NewWritableFile(fname, result);
+  if (s.ok()) {
+    Synced(fname, 0);
+    *result = new SyncTrackingFile(this, fname, *result);
+  }
+  return s;
+}
 }
 
 class MetaDBTest {
@@ -44,9 +140,11 @@ class MetaDBTest {
 
   int CheckNamespace(int64_t dir_id, int16_t partition_id);
   Status PopulateNamespace(int64_t dir_id, int16_t partition_id);
+  Status CrashAndReopen();
 
  protected:
   Env* env_;
+  SyncTrackingEnv* sync_env_;
   MetaDB* mdb_;
   Config* config_;
   std::string srv_dir_;
@@ -59,7 +157,8 @@ Status MetaDBTest::Init() {
   ss << "-" << "metadb" << "." << rand() % 65521;
   srv_dir_.assign(ss.str());
   config_ = Config::CreateServerTestingConfig(srv_dir_);
-  env_ = GetSystemEnv(config_);
+  sync_env_ = new SyncTrackingEnv(GetSystemEnv(config_));
+  env_ = sync_env_;
   CreateDirectory(env_, srv_dir_);
   CreateDirectory(env_, config_->GetFileDir());
   CreateDirectory(env_, config_->GetDBRootDir());
@@ -96,6 +195,42 @@ Status MetaDBTest::PopulateNamespace(int64_t dir_id, int16_t partition_id) {
   return s;
 }
 
+// Reopens the database from an image of its files taken while it is
+// still open, as if the server crashed at this point. Only data that
+// has been synced is kept in the image.
+//
+Status MetaDBTest::CrashAndReopen() {
+  std::map<std::string, std::string> image;
+  std::vector<std::string> names;
+  const std::string db_home = config_->GetDBHomeDir();
+  Status s = env_->GetChildren(db_home, &names);
+  std::vector<std::string>::iterator it = names.begin();
+  for (; s.ok() && it != names.end(); ++it) {
+    if (!it->empty() && (*it)[0] != '.') {
+      const std::string fname = db_home + "/" + *it;
+      s = leveldb::ReadFileToString(env_, fname, &image[*it]);
+      image[*it].resize(sync_env_->GetSyncedSize(fname, image[*it].size()));
+    }
+  }
+  delete mdb_;
+  mdb_ = NULL;
+  names.clear();
+  if (s.ok()) {
+    s = env_->GetChildren(db_home, &names);
+  }
+  for (it = names.begin(); s.ok() && it != names.end(); ++it) {
+    if (!it->empty() && (*it)[0] != '.') {
+      s = env_->DeleteFile(db_home + "/" + *it);
+    }
+  }
+  std::map<std::string, std::string>::iterator file = image.begin();
+  for (; s.ok() && file != image.end(); ++file) {
+    s = leveldb::WriteStringToFile(sync_env_->target(),
+        file->second, db_home + "/" + file->first);
+  }
+  return s.ok() ? MetaDB::Open(config_, &mdb_, env_) : s;
+}
+
 // -------------------------------------------------------------
 // Test Cases
 // -------------------------------------------------------------
@@ -132,6 +267,40 @@ TEST(MetaDBTest, CreateFile) {
   ASSERT_TRUE(mdb_->NewFile(key).IsAlreadyExists());
 }
 
+TEST(MetaDBTest, CreateFiles) {
+  StatInfo info;
+  const std::string filename = "file";
+  KeyInfo key(0, 0, filename);
+  ASSERT_OK(Init());
+  ASSERT_OK(mdb_->NewFile(key));
+  NameList names;
+  std::vector<int16_t> partitions;
+  std::vector<bool> created;
+  names.push_back(filename);
+  names.push_back("file1");
+  names.push_back("file2");
+  names.push_back("file1");
+  partitions.assign(names.size(), 0);
+  ASSERT_OK(mdb_->NewFiles(0, partitions, names, 0600, &created));
+  ASSERT_EQ(created.size(), names.size());
+  ASSERT_FALSE(created[0]);
+  ASSERT_TRUE(created[1]);
+  ASSERT_TRUE(created[2]);
+  ASSERT_FALSE(created[3]);
+  for (size_t i = 0; i < names.size(); ++i) {
+    KeyInfo key_i(0, 0, names[i]);
+    ASSERT_OK(mdb_->GetEntry(key_i, &info));
+    ASSERT_TRUE(S_ISREG(info.mode));
+    if (i == 1 || i == 2) {
+      ASSERT_EQ(info.mode & ~S_IFMT, 0600);
+    }
+  }
+  ASSERT_OK(mdb_->NewFiles(0, partitions, names, 0600, &created));
+  for (size_t i = 0; i < created.size(); ++i) {
+    ASSERT_FALSE(created[i]);
+  }
+}
+
 TEST(MetaDBTest, CreateDirectory) {
   StatInfo info;
   const int16_t zeroth_server = 16;
@@ -161,6 +330,63 @@ TEST(MetaDBTest, DeleteEntry) {
   ASSERT_TRUE(mdb_->GetEntry(key, &info).IsNotFound());
 }
 
+// Values are read in place from the memtable and from table blocks,
+// where they may sit at any offset. Names of varying lengths shift
+// the offsets of the values that follow them.
+//
+TEST(MetaDBTest, PinnedGet) {
+  static const int kNumNames = 64;
+  std::vector<std::string> names;
+  for (int i = 0; i < kNumNames; ++i) {
+    names.push_back(std::string(i % 16 + 1, 'a' + i % 26) + "-" +
+        static_cast<char>('A' + i % 26));
+  }
+  StatInfo info, info_read;
+  info.mode = S_IFREG | S_IRWXU;
+  info.is_embedded = true;
+  info.zeroth_server = 3;
+  info.uid = info.gid = -1;
+  ASSERT_OK(Init());
+  for (int i = 0; i < kNumNames; ++i) {
+    info.id = i;
+    info.size = 1000 + i;
+    info.ctime = info.mtime = 65536 + i;
+    ASSERT_OK(mdb_->InsertEntry(KeyInfo(0, 0, names[i]), info));
+  }
+  // Round 0 reads the memtable, round 1 reads a table from disk,
+  // and round 2 reads the same table blocks from the block cache.
+  for (int round = 0; round < 3; ++round) {
+    if (round == 1) {
+      ASSERT_OK(mdb_->Flush());
+    }
+    for (int i = 0; i < kNumNames; ++i) {
+      KeyInfo key(0, 0, names[i]);
+      if (round > 0 && i % 2 == 1) {
+        ASSERT_TRUE(mdb_->GetEntry(key, &info_read).IsNotFound());
+        continue;
+      }
+      ASSERT_OK(mdb_->GetEntry(key, &info_read));
+      ASSERT_EQ(info_read.id, i);
+      ASSERT_EQ(info_read.size, 1000 + i);
+      ASSERT_EQ(info_read.mode, info.mode);
+      ASSERT_EQ(info_read.is_embedded, info.is_embedded);
+      ASSERT_EQ(info_read.zeroth_server, info.zeroth_server);
+      ASSERT_EQ(info_read.mtime, 65536 + i);
+      int32_t size;
+      char buffer[DEFAULT_SMALLFILE_THRESHOLD];
+      ASSERT_OK(mdb_->FetchData(key, &size, buffer));
+      ASSERT_EQ(size, 0);
+    }
+    if (round == 0) {
+      for (int i = 1; i < kNumNames; i += 2) {
+        ASSERT_OK(mdb_->DeleteEntry(KeyInfo(0, 0, names[i])));
+        ASSERT_TRUE(mdb_->GetEntry(KeyInfo(0, 0, names[i]),
+                &info_read).IsNotFound());
+      }
+    }
+  }
+}
+
 TEST(MetaDBTest, InsertEntry) {
   StatInfo info, info_inserted;
   info.id = -1;
@@ -370,6 +596,54 @@ TEST(MetaDBTest, Bitmap) {
   ASSERT_EQ(dir_idx2->FetchZerothServer(), zeroth_server);
 }
 
+TEST(MetaDBTest, PartitionSize) {
+  const int64_t dir_id = 512;
+  int64_t size;
+  ASSERT_OK(Init());
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, 0, &size));
+  ASSERT_EQ(size, 0);
+  ASSERT_OK(mdb_->NewFile(KeyInfo(dir_id, 0, "file"), 0));
+  ASSERT_TRUE(mdb_->NewFile(KeyInfo(dir_id, 0, "file"), 1).IsAlreadyExists());
+  ASSERT_OK(mdb_->NewDirectory(KeyInfo(dir_id, 1, "dir"), 0,
+      mdb_->ReserveNextInodeNo(), false, 0));
+  // Sizes are only recorded when given
+  ASSERT_OK(mdb_->NewFile(KeyInfo(dir_id, 3, "file")));
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, 3, &size));
+  ASSERT_EQ(size, 0);
+  NameList names;
+  std::vector<int16_t> partitions;
+  std::vector<bool> created;
+  names.push_back("file");
+  names.push_back("file1");
+  names.push_back("file2");
+  names.push_back("file3");
+  partitions.push_back(0);
+  partitions.push_back(0);
+  partitions.push_back(1);
+  partitions.push_back(2);
+  std::map<int16_t, int64_t> sizes;
+  sizes[0] = 1;
+  sizes[1] = 1;
+  sizes[2] = 0;
+  ASSERT_OK(mdb_->NewFiles(dir_id, partitions, names, 0644, &created, &sizes));
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, 0, &size));
+  ASSERT_EQ(size, 2);
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, 1, &size));
+  ASSERT_EQ(size, 2);
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, 2, &size));
+  ASSERT_EQ(size, 1);
+  ASSERT_OK(mdb_->SetPartitionSize(dir_id, 2, 1000));
+  ASSERT_OK(Reinit());
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, 0, &size));
+  ASSERT_EQ(size, 2);
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, 2, &size));
+  ASSERT_EQ(size, 1000);
+  ASSERT_EQ(CheckNamespace(dir_id, 0), 1);
+  std::vector<std::string> entries;
+  ASSERT_OK(mdb_->ListEntries(KeyOffset(dir_id, 0, ""), &entries, NULL));
+  ASSERT_EQ(entries.size(), 2);
+}
+
 TEST(MetaDBTest, EmbeddedIO) {
   StatInfo info;
   int32_t size;
@@ -387,6 +661,15 @@ TEST(MetaDBTest, EmbeddedIO) {
   ASSERT_EQ(memcmp(buffer, data, size), 0);
   ASSERT_OK(mdb_->GetEntry(key, &info));
   ASSERT_EQ(info.size, strlen(data));
+  // Reads now come from tables rather than from the memtable
+  ASSERT_OK(Reinit());
+  ASSERT_OK(mdb_->WriteData(key, strlen(data), strlen(data), data));
+  ASSERT_OK(Reinit());
+  ASSERT_OK(mdb_->FetchData(key, &size, buffer));
+  ASSERT_EQ(size, 2 * strlen(data));
+  ASSERT_EQ(memcmp(buffer + strlen(data), data, strlen(data)), 0);
+  ASSERT_OK(mdb_->GetEntry(key, &info));
+  ASSERT_EQ(info.size, 2 * strlen(data));
 }
 
 TEST(MetaDBTest, Extraction) {
@@ -462,6 +745,135 @@ TEST(MetaDBTest, BulkInsertion) {
   fprintf(stderr, "Bulk insertion completed, %d/%d files have been moved\n", num_files_moved, num_files);
 }
 
+TEST(MetaDBTest, OnlineBulkInsertion) {
+  const int64_t dir_id = 0;
+  const int16_t old_partition_id = 0;
+  const int16_t new_partition_id = 1;
+  const mode_t new_mode = S_IFREG | S_IRUSR;
+  uint64_t min_seq, max_seq;
+  std::stringstream ss;
+  ss << config_->GetDBSplitDir() << "/" << "test";
+  ASSERT_OK(Init());
+  ASSERT_OK(PopulateNamespace(dir_id, old_partition_id));
+  BulkExtractor* extractor = mdb_->CreateBulkExtractor(ss.str());
+  ASSERT_TRUE(extractor != NULL);
+  extractor->SetDirectory(dir_id);
+  extractor->SetOldPartition(old_partition_id);
+  extractor->SetNewPartition(new_partition_id);
+  ASSERT_OK(extractor->ExtractChanges(&min_seq, &max_seq));
+  ASSERT_OK(mdb_->BulkInsert(min_seq, max_seq, ss.str()));
+  int num_files_moved = CheckNamespace(dir_id, new_partition_id);
+  ASSERT_EQ(extractor->GetNumEntriesChanged(), num_files_moved);
+  // Update or delete all entries being migrated while the
+  // extraction is in progress
+  int num_files_deleted = 0;
+  std::set<int> deleted;
+  for (int i = 0; i < kBatchSize; ++i) {
+    std::string fname = FileName(i);
+    if (mdb_->EntryExists(KeyInfo(dir_id, new_partition_id, fname)).ok()) {
+      if (i % 4 == 0) {
+        ASSERT_OK(mdb_->DeleteEntry(KeyInfo(dir_id, old_partition_id, fname)));
+        deleted.insert(i);
+        num_files_deleted++;
+      } else {
+        ASSERT_OK(mdb_->SetFileMode(KeyInfo(dir_id, old_partition_id, fname), new_mode));
+      }
+    }
+  }
+  ASSERT_OK(extractor->ExtractChanges(&min_seq, &max_seq));
+  ASSERT_EQ(extractor->GetNumEntriesChanged(), num_files_moved);
+  ASSERT_EQ(extractor->GetNumEntriesExtracted(), num_files_moved - num_files_deleted);
+  ASSERT_OK(mdb_->BulkInsert(min_seq, max_seq, ss.str()));
+  // Create new entries, some of which are to be migrated
+  for (int i = kBatchSize; i < 2 * kBatchSize; ++i) {
+    ASSERT_OK(mdb_->NewFile(KeyInfo(dir_id, old_partition_id, FileName(i))));
+  }
+  ASSERT_OK(extractor->ExtractChanges(&min_seq, &max_seq));
+  int num_files_created = extractor->GetNumEntriesChanged();
+  ASSERT_TRUE(num_files_created > 0);
+  ASSERT_OK(mdb_->BulkInsert(min_seq, max_seq, ss.str()));
+  ASSERT_OK(extractor->ExtractChanges(&min_seq, &max_seq));
+  ASSERT_EQ(extractor->GetNumEntriesChanged(), 0);
+  num_files_moved += num_files_created - num_files_deleted;
+  ASSERT_EQ(extractor->GetNumEntriesExtracted(), num_files_moved);
+  ASSERT_OK(extractor->Commit());
+  ASSERT_FALSE(env_->FileExists(ss.str()));
+  delete extractor;
+  for (int i = 0; i < kBatchSize; ++i) {
+    StatInfo info;
+    std::string fname = FileName(i);
+    Status s = mdb_->GetEntry(KeyInfo(dir_id, new_partition_id, fname), &info);
+    if (deleted.count(i) != 0) {
+      ASSERT_TRUE(s.IsNotFound());
+    } else if (s.ok()) {
+      ASSERT_EQ(info.mode, new_mode);
+    }
+  }
+  int num_files_remained = 0;
+  int num_files_found = 0;
+  for (int i = 0; i < 2 * kBatchSize; ++i) {
+    std::string fname = FileName(i);
+    if (mdb_->EntryExists(KeyInfo(dir_id, new_partition_id, fname)).ok()) {
+      num_files_found++;
+    }
+    if (mdb_->EntryExists(KeyInfo(dir_id, old_partition_id, fname)).ok()) {
+      num_files_remained++;
+    }
+  }
+  ASSERT_EQ(num_files_found, num_files_moved);
+  ASSERT_EQ(num_files_moved + num_files_remained + num_files_deleted,
+            2 * static_cast<int>(kBatchSize));
+}
+
+namespace {
+// Bulk inserts each chunk as soon as it is sealed.
+class ChunkInserter: public BulkChunkHandler {
+ public:
+  explicit ChunkInserter(MetaDB* mdb)
+    : mdb_(mdb), num_chunks_(0), num_entries_(0) {
+  }
+  Status HandleChunk(const std::string &chunk_dir,
+                     uint64_t min_seq, uint64_t max_seq, int num_entries) {
+    num_chunks_++;
+    num_entries_ += num_entries;
+    return mdb_->BulkInsert(min_seq, max_seq, chunk_dir);
+  }
+  MetaDB* mdb_;
+  int num_chunks_;
+  int num_entries_;
+};
+}
+
+TEST(MetaDBTest, ChunkedBulkInsertion) {
+  const int64_t dir_id = 0;
+  const int16_t old_partition_id = 0;
+  const int16_t new_partition_id = 1;
+  uint64_t min_seq, max_seq;
+  std::stringstream ss;
+  ss << config_->GetDBSplitDir() << "/" << "test";
+  ASSERT_OK(Init());
+  ASSERT_OK(PopulateNamespace(dir_id, old_partition_id));
+  ChunkInserter inserter(mdb_);
+  BulkExtractor* extractor = mdb_->CreateBulkExtractor(ss.str());
+  ASSERT_TRUE(extractor != NULL);
+  extractor->SetDirectory(dir_id);
+  extractor->SetOldPartition(old_partition_id);
+  extractor->SetNewPartition(new_partition_id);
+  extractor->SetChunkHandler(&inserter, 4 << 10);
+  ASSERT_OK(extractor->ExtractChanges(&min_seq, &max_seq));
+  ASSERT_TRUE(inserter.num_chunks_ > 1);
+  ASSERT_EQ(inserter.num_entries_, extractor->GetNumEntriesChanged());
+  int num_files_moved = CheckNamespace(dir_id, new_partition_id);
+  ASSERT_EQ(extractor->GetNumEntriesExtracted(), num_files_moved);
+  ASSERT_OK(extractor->Commit());
+  ASSERT_FALSE(env_->FileExists(ss.str()));
+  delete extractor;
+  int num_files_remained = CheckNamespace(dir_id, old_partition_id);
+  ASSERT_EQ(num_files_moved + num_files_remained, static_cast<int>(kBatchSize));
+  fprintf(stderr, "Chunked bulk insertion completed, %d/%d files have been moved"
+          " in %d chunks\n", num_files_moved, kBatchSize, inserter.num_chunks_);
+}
+
 TEST(MetaDBTest, LocalBulkInsert) {
   const int64_t dir_id = 0;
   const int16_t old_partition_id = 0;
@@ -477,12 +889,16 @@ TEST(MetaDBTest, LocalBulkInsert) {
   extractor->SetOldPartition(old_partition_id);
   extractor->SetNewPartition(new_partition_id);
   ASSERT_OK(extractor->Extract(&min_seq, &max_seq));
+  extractor->SetOldPartitionSize(num_files - extractor->GetNumEntriesExtracted());
   ASSERT_OK(extractor->Commit());
   int num_files_moved = CheckNamespace(dir_id, new_partition_id);
   ASSERT_EQ(extractor->GetNumEntriesExtracted(), num_files_moved);
   delete extractor;
   int num_files_remained = CheckNamespace(dir_id, old_partition_id);
   ASSERT_EQ(num_files_moved + num_files_remained, num_files);
+  int64_t size;
+  ASSERT_OK(mdb_->GetPartitionSize(dir_id, old_partition_id, &size));
+  ASSERT_EQ(size, num_files_remained);
   fprintf(stderr, "Local bulk insertion completed, %d/%d files have been moved\n", num_files_moved, num_files); 
 }
 
@@ -521,6 +937,104 @@ TEST(MetaDBTest, Restart) {
   ASSERT_EQ(num_files_after, num_files_before);
 }
 
+TEST(MetaDBTest, PendingZeroth) {
+  ASSERT_OK(Init());
+  ASSERT_OK(mdb_->NewDirectory(KeyInfo(0, 0, "a"), 1, 1001, true));
+  ASSERT_OK(mdb_->NewDirectory(KeyInfo(0, 0, "b"), 2, 1002, true));
+  ASSERT_OK(mdb_->NewDirectory(KeyInfo(0, 0, "c"), 0, 1003));
+  std::vector<int64_t> dir_ids;
+  std::vector<int16_t> zeroth_servers;
+  ASSERT_OK(mdb_->ListPendingZeroths(&dir_ids, &zeroth_servers));
+  ASSERT_EQ(dir_ids.size(), 2);
+  ASSERT_EQ(dir_ids[0], 1001);
+  ASSERT_EQ(zeroth_servers[0], 1);
+  ASSERT_EQ(dir_ids[1], 1002);
+  ASSERT_EQ(zeroth_servers[1], 2);
+  ASSERT_OK(mdb_->RemovePendingZeroth(1001));
+  // Pending partitions must outlive the server
+  ASSERT_OK(Reinit());
+  dir_ids.clear();
+  zeroth_servers.clear();
+  ASSERT_OK(mdb_->ListPendingZeroths(&dir_ids, &zeroth_servers));
+  ASSERT_EQ(dir_ids.size(), 1);
+  ASSERT_EQ(dir_ids[0], 1002);
+  ASSERT_EQ(zeroth_servers[0], 2);
+  ASSERT_OK(mdb_->EntryExists(KeyInfo(0, 0, "b")));
+}
+
+TEST(MetaDBTest, CrashRestart) {
+  ASSERT_OK(Init());
+  ASSERT_EQ(mdb_->GetCurrentInodeNo(), 0);
+  // Enough to span more than one range of inode numbers
+  int64_t inode_no = 0;
+  for (int i = 0; i < 100 * kBatchSize; ++i) {
+    int64_t next_inode_no = mdb_->ReserveNextInodeNo();
+    ASSERT_TRUE(next_inode_no > inode_no);
+    inode_no = next_inode_no;
+  }
+  ASSERT_EQ(inode_no, 100 * kBatchSize * DEFAULT_MAX_NUM_SERVERS);
+  fprintf(stderr, "Reserved inodes up to %lld; recovering from crash ... \n", (long long) inode_no);
+  ASSERT_OK(CrashAndReopen());
+  // Inode numbers handed out before the crash are never reused
+  ASSERT_TRUE(mdb_->GetCurrentInodeNo() >= inode_no);
+  int64_t next_inode_no = mdb_->ReserveNextInodeNo();
+  ASSERT_TRUE(next_inode_no > inode_no);
+  ASSERT_EQ(next_inode_no % DEFAULT_MAX_NUM_SERVERS, 0);
+  fprintf(stderr, "Recovery completed; next inode is %lld\n", (long long) next_inode_no);
+}
+
+namespace {
+// Creates files in a directory of its own
+struct CreateWorker {
+  MetaDB* mdb;
+  int64_t dir_id;
+  Status status;
+};
+static void* RunCreates(void* arg) {
+  CreateWorker* worker = reinterpret_cast<CreateWorker*>(arg);
+  for (int i = 0; i < kBatchSize && worker->status.ok(); ++i) {
+    KeyInfo key(worker->dir_id, 0, FileName(i));
+    worker->status = worker->mdb->NewFile(key);
+  }
+  return NULL;
+}
+}
+
+// Files acknowledged in durable sync modes survive a crash, including
+// those created concurrently and covered by a shared log sync.
+//
+TEST(MetaDBTest, DurableCreates) {
+  static const int kNumThreads = 4;
+  for (int mode = kSyncEach; mode <= kSyncGroup; ++mode) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", mode);
+    setenv("FS_SYNC_MODE", buf, 1);
+    if (mode != kSyncEach) {
+      delete mdb_;
+      mdb_ = NULL;
+    }
+    ASSERT_OK(Init());
+    CreateWorker workers[kNumThreads];
+    pthread_t tids[kNumThreads];
+    for (int i = 0; i < kNumThreads; ++i) {
+      workers[i].mdb = mdb_;
+      workers[i].dir_id = i + 1;
+      ASSERT_EQ(pthread_create(&tids[i], NULL, &RunCreates, &workers[i]), 0);
+    }
+    for (int i = 0; i < kNumThreads; ++i) {
+      pthread_join(tids[i], NULL);
+    }
+    for (int i = 0; i < kNumThreads; ++i) {
+      ASSERT_OK(workers[i].status);
+    }
+    ASSERT_OK(CrashAndReopen());
+    for (int i = 0; i < kNumThreads; ++i) {
+      ASSERT_EQ(CheckNamespace(workers[i].dir_id, 0), static_cast<int>(kBatchSize));
+    }
+  }
+  unsetenv("FS_SYNC_MODE");
+}
+
 } /* namespace test */
 } /* namespace indexfs */
 
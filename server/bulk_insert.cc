@@ -16,6 +16,10 @@ using leveldb::ObjEnvFactory;
 
 namespace indexfs {
 
+DEFINE_bool(online_split, true, "Copy split partitions while directories remain writable");
+DEFINE_int32(split_catchup_rounds, 2, "Max number of online catch-up rounds per split");
+DEFINE_int32(split_chunk_size, DEFAULT_SPLIT_CHUNK_SIZE, "Size in bytes of each SSTable chunk shipped during splits");
+
 void IndexServer::TriggerDirSplitting(i64 dir_id, i16 index, DirGuard& dir_guard) {
   dir_guard.Lock_AssertHeld();
   int size = dir_guard.GetPartitionSize(index);
@@ -26,98 +30,330 @@ void IndexServer::TriggerDirSplitting(i64 dir_id, i16 index, DirGuard& dir_guard
     return;
   }
   // Avoid concurrent splitting within a single directory
-  dir_guard.DisableSplitting();
-  SplitTask* t =  new SplitTask();
-  t->dir_id = dir_id;
-  t->index = index;
-  t->idx_srv = this;
-  exec_srv_->SubmitTask(t);
+  if (split_pool_->AddSplitTask(dir_id, index, size)) {
+    dir_guard.DisableSplitting();
+  }
+}
+
+ChunkShipper::ChunkShipper(RPC* rpc, i64 dir_id, i16 dst_idx, int dst_srv) :
+    rpc_(rpc),
+    dir_id_(dir_id),
+    dst_idx_(dst_idx),
+    dst_srv_(dst_srv),
+    cv_(&mu_),
+    busy_(false),
+    done_(false),
+    num_chunks_(0),
+    ship_micros_(0) {
+  int ret = pthread_create(&thread_, NULL, &Run, this);
+  CHECK(ret == 0) << "Cannot create new thread";
+}
+
+ChunkShipper::~ChunkShipper() {
+  {
+    MutexLock lock(&mu_);
+    done_ = true;
+    cv_.SignalAll();
+  }
+  int ret = pthread_join(thread_, NULL);
+  CHECK(ret == 0) << "Cannot join existing thread";
+}
+
+Status ChunkShipper::HandleChunk(const std::string &chunk_dir,
+                                 uint64_t min_seq, uint64_t max_seq,
+                                 int num_entries) {
+  MutexLock lock(&mu_);
+  if (status_.ok()) {
+    Chunk chunk;
+    chunk.dir = chunk_dir;
+    chunk.min_seq = min_seq;
+    chunk.max_seq = max_seq;
+    chunk.num_entries = num_entries;
+    queue_.push_back(chunk);
+    cv_.SignalAll();
+  }
+  return status_;
+}
+
+Status ChunkShipper::Flush() {
+  MutexLock lock(&mu_);
+  while (busy_ || !queue_.empty()) {
+    cv_.Wait();
+  }
+  return status_;
+}
+
+int ChunkShipper::NumChunks() {
+  MutexLock lock(&mu_);
+  return num_chunks_;
+}
+
+uint64_t ChunkShipper::ShipMicros() {
+  MutexLock lock(&mu_);
+  return ship_micros_;
+}
+
+void ChunkShipper::ShipChunk(const Chunk& chunk) {
+  // Sync the SSTable directory
+# ifdef RADOS
+  ObjEnv* obj_env = ObjEnvFactory::FetchObjEnv();
+  DLOG_ASSERT(obj_env != NULL);
+  obj_env->SyncSet(chunk.dir);
+# endif
+  RPC_Stub(rpc_, dst_srv_)->PreloadSplit(dir_id_, dst_idx_,
+          chunk.dir, chunk.min_seq, chunk.max_seq, chunk.num_entries);
+}
+
+void ChunkShipper::ExecuteThread() {
+  MutexLock lock(&mu_);
+  while (true) {
+    while (queue_.empty() && !done_) {
+      cv_.Wait();
+    }
+    if (done_) {
+      break; // Discard pending chunks
+    }
+    Chunk chunk = queue_.front();
+    queue_.pop_front();
+    if (!status_.ok()) {
+      cv_.SignalAll();
+      continue;
+    }
+    busy_ = true;
+    mu_.Unlock();
+    Status s;
+    uint64_t start_ts = Env::Default()->NowMicros();
+    try {
+      ShipChunk(chunk);
+    } catch (IOError &io) {
+      s = Status::IOError(io.message);
+    } catch (ServerInternalError &ie) {
+      s = Status::IOError(ie.message);
+    } catch (apache::thrift::TException &tx) {
+      s = Status::IOError(tx.what());
+    }
+    uint64_t finish_ts = Env::Default()->NowMicros();
+    mu_.Lock();
+    busy_ = false;
+    if (status_.ok()) {
+      status_ = s;
+    }
+    num_chunks_++;
+    ship_micros_ += finish_ts - start_ts;
+    cv_.SignalAll();
+  }
+}
+
+void* ChunkShipper::Run(void* arg) {
+  ChunkShipper* shipper = reinterpret_cast<ChunkShipper*>(arg);
+  shipper->ExecuteThread();
+  return NULL;
+}
+
+SplitAbortGuard::SplitAbortGuard(IndexContext* ctx, RPC* rpc,
+                                 DirGuard* dir_guard,
+                                 i64 dir_id, i16 dst_idx, int dst_srv) :
+    ctx_(ctx),
+    rpc_(rpc),
+    dir_guard_(dir_guard),
+    dir_id_(dir_id),
+    dst_idx_(dst_idx),
+    dst_srv_(dst_srv) {
+}
+
+// Splitting remains disabled if the destination cannot discard its
+// entries, since a later split would otherwise resurrect entries
+// removed from the directory in the meantime.
+//
+SplitAbortGuard::~SplitAbortGuard() {
+  if (dir_guard_ == NULL) {
+    return;
+  }
+  Status s;
+  if (dst_srv_ == ctx_->GetMyRank()) {
+    s = ctx_->DiscardSplit(dir_id_, dst_idx_);
+  } else {
+    try {
+      RPC_Stub(rpc_, dst_srv_)->DiscardSplit(dir_id_, dst_idx_);
+    } catch (FileAlreadyExistsException &fae) {
+      s = Status::AlreadyExists("Partition already exists");
+    } catch (IOError &io) {
+      s = Status::IOError(io.message);
+    } catch (ServerInternalError &ie) {
+      s = Status::IOError(ie.message);
+    } catch (apache::thrift::TException &tx) {
+      s = Status::IOError(tx.what());
+    }
+  }
+  if (!s.ok()) {
+    LOG(ERROR) << "Fail to discard split partition [dir=" << dir_id_ << "]"
+            "[index=" << dst_idx_ << "]: " << s.ToString();
+    return;
+  }
+  DirLock lock(dir_guard_);
+  dir_guard_->EnableSplitting();
 }
 
+// Splits a directory partition in two. With online splitting, entries
+// are first copied from a series of DB snapshots while the directory
+// remains writable, each round only copying entries changed since the
+// previous one. Changed entries are found from a log of the keys written
+// to the partition since the split started, so later rounds never rescan
+// the partition. The directory lock is then taken for a final catch-up
+// round and for the bitmap flip. Without online splitting, everything
+// happens within the final round.
+//
+// For distributed splits, extracted entries are cut into SSTable chunks
+// that are preloaded by the destination server while extraction goes on.
+// The new partition is installed only after all chunks have arrived.
+// Chunks from the online rounds are flushed before the directory lock
+// is taken; only the final delta is shipped while holding it.
+//
+// A split that fails before the new partition is installed is abandoned:
+// entries already copied to the new partition are discarded and the
+// directory may be split again later.
+//
 void IndexServer::DoSplit(i64 dir_id, i16 index) {
   MonitorHelper helper(oSplit, monitor_);
 
-  MutexLock split_lock(&mtx_);
   DirGuard::DirData dir_data = ctx_->FetchDir(dir_id);
   DLOG_ASSERT(!DirGuard::Empty(dir_data));
   DirGuard dir_guard(dir_data);
-  DirLock lock(&dir_guard);
+  // Splits are serialized per directory; the number of splits running
+  // on this server at the same time is bounded by the split thread pool.
+  SplitLock split_lock(&dir_guard);
 
   int src_idx = index;
-  int src_srv = dir_guard.ToServer(src_idx);
-  DLOG_ASSERT(src_srv == ctx_->GetMyRank());
-  int dst_idx = dir_guard.NextIndex(src_idx);
-  int dst_srv = dir_guard.ToServer(dst_idx);
+  int src_srv, dst_idx, dst_srv;
+  bool is_local;
+  BulkExtractor* bk_ext = NULL;
+  ChunkShipper* shipper = NULL;
+  {
+    DirLock lock(&dir_guard);
+    src_srv = dir_guard.ToServer(src_idx);
+    DLOG_ASSERT(src_srv == ctx_->GetMyRank());
+    dst_idx = dir_guard.NextIndex(src_idx);
+    dst_srv = dir_guard.ToServer(dst_idx);
+    is_local = dst_srv == ctx_->GetMyRank();
+    if (!is_local) {
+      bk_ext = ctx_->CreateBulkExtractor(dir_id,
+              src_idx, src_srv, dst_idx, dst_srv);
+      shipper = new ChunkShipper(rpc_, dir_id, dst_idx, dst_srv);
+      bk_ext->SetChunkHandler(shipper, FLAGS_split_chunk_size);
+    } else {
+      bk_ext = ctx_->CreateLocalBulkExtractor(dir_id,
+              src_idx, src_srv, dst_idx, dst_srv);
+    }
+    // Writes to the partition are excluded by the directory lock, so
+    // none can slip by before the extractor starts logging them.
+    bk_ext->TrackChanges();
+  }
+
+  // Declared first so that the shipper is stopped before it runs
+  SplitAbortGuard abort_guard(ctx_, rpc_,
+          &dir_guard, dir_id, dst_idx, dst_srv);
+  SplitGuard sg(bk_ext, shipper);
 
-  bool is_local = dst_srv == ctx_->GetMyRank();
   std::string type = is_local ?
           "Local Directory Split" : "Distributed Directory Split";
-  uint64_t start_ts = ctx_->GetEnv()->NowMicros();
-
-# ifndef NDEBUG
-  int old_total_partition_size = dir_guard.GetTotalPartitionSize();
-# endif
+  Env* env = ctx_->GetEnv();
+  uint64_t start_ts = env->NowMicros();
+  uint64_t extract_time = 0;
+  uint64_t lock_time = 0;
+  uint64_t install_time = 0;
+  uint64_t ts;
 
-  BulkExtractor* bk_ext = NULL;
+  uint64_t min_seq, max_seq;
+  int num_rounds = 0;
+  if (FLAGS_online_split) {
+    do {
+      ts = env->NowMicros();
+      MaybeThrowException(bk_ext->ExtractChanges(&min_seq, &max_seq));
+      extract_time += env->NowMicros() - ts;
+      num_rounds++;
+      MaybeThrowException(test_split_error_);
+    } while (bk_ext->GetNumEntriesChanged() > 0 &&
+             num_rounds <= FLAGS_split_catchup_rounds);
+  }
+  // Wait for the chunks of previous rounds to arrive before taking the
+  // directory lock, so the lock only covers shipping the final delta.
   if (!is_local) {
-    bk_ext = ctx_->CreateBulkExtractor(dir_id,
-            src_idx, src_srv, dst_idx, dst_srv);
-  } else {
-    bk_ext = ctx_->CreateLocalBulkExtractor(dir_id,
-            src_idx, src_srv, dst_idx, dst_srv);
+    MaybeThrowException(shipper->Flush());
   }
 
-  SplitGuard sg(bk_ext);
-  uint64_t min_seq, max_seq;
-  MaybeThrowException(bk_ext->Extract(&min_seq, &max_seq));
-  int num_entries = bk_ext->GetNumEntriesExtracted();
-
+  int num_entries;
   std::string dmap_data;
-  dir_guard.Set(dst_idx);
-  dir_guard.PutDirIndex(&dmap_data);
+  {
+    DirLock lock(&dir_guard);
+    uint64_t lock_ts = env->NowMicros();
 
-  if (!is_local) {
-    std::string sst_dir = bk_ext->GetBulkExtractOutputDir();
-    // Sync the SSTable directory
-#   ifdef RADOS
-    ObjEnv* obj_env = ObjEnvFactory::FetchObjEnv();
-    DLOG_ASSERT(obj_env != NULL);
-    obj_env->SyncSet(sst_dir);
+#   ifndef NDEBUG
+    int old_total_partition_size = dir_guard.GetTotalPartitionSize();
 #   endif
-    {
-      MutexLock lock(rpc_->GetMutex(dst_srv));
-      rpc_->GetClient(dst_srv)->InsertSplit(dir_id, src_idx, dst_idx,
-              sst_dir, dmap_data, min_seq, max_seq, num_entries);
+
+    ts = env->NowMicros();
+    MaybeThrowException(bk_ext->ExtractChanges(&min_seq, &max_seq));
+    extract_time += env->NowMicros() - ts;
+    num_entries = bk_ext->GetNumEntriesExtracted();
+    if (!is_local) {
+      MaybeThrowException(shipper->Flush());
     }
-    MaybeThrowException(ctx_->SetDirIndex_Unlocked(dir_guard.FetchDirIndex()));
-  } else {
-    MaybeThrowException(ctx_->InstallSplit_Unlocked(dir_id,
-            std::string(), dmap_data, src_idx, dst_idx, 0, 0, num_entries));
-  }
 
-  dir_guard.InceaseAndGetPartitionSize(src_idx, -1 * num_entries);
-  MaybeThrowException(bk_ext->Commit());
-  dir_guard.EnableSplitting();
+    abort_guard.Release();
+    dir_guard.Set(dst_idx);
+    dir_guard.PutDirIndex(&dmap_data);
+
+    if (!is_local) {
+      ts = env->NowMicros();
+      RPC_Stub(rpc_, dst_srv)->InsertSplit(dir_id, src_idx, dst_idx,
+              std::string(), dmap_data, 0, 0, num_entries);
+      install_time = env->NowMicros() - ts;
+      MaybeThrowException(ctx_->SetDirIndex_Unlocked(dir_guard.FetchDirIndex()));
+    } else {
+      ts = env->NowMicros();
+      MaybeThrowException(ctx_->InstallSplit_Unlocked(dir_id,
+              std::string(), dmap_data, src_idx, dst_idx, 0, 0, num_entries));
+      install_time = env->NowMicros() - ts;
+    }
 
-# ifndef NDEBUG
-  if (is_local) {
-    int new_total_partition_size = dir_guard.GetTotalPartitionSize();
-    DLOG_ASSERT(old_total_partition_size == new_total_partition_size);
+    int src_size = dir_guard.InceaseAndGetPartitionSize(src_idx, -1 * num_entries);
+    bk_ext->SetOldPartitionSize(src_size);
+    MaybeThrowException(bk_ext->Commit());
+    dir_guard.EnableSplitting();
+
+#   ifndef NDEBUG
+    if (is_local) {
+      int new_total_partition_size = dir_guard.GetTotalPartitionSize();
+      DLOG_ASSERT(old_total_partition_size == new_total_partition_size);
+    }
+#   endif
+    lock_time = env->NowMicros() - lock_ts;
   }
-# endif
 
   int home_srv = dir_guard.ToServer(0);
   if (home_srv != ctx_->GetMyRank()) {
-    MutexLock lock(rpc_->GetMutex(home_srv));
-    rpc_->GetClient(home_srv)->UpdateBitmap(dir_id, dmap_data);
+    RPC_Stub(rpc_, home_srv)->UpdateBitmap(dir_id, dmap_data);
+  }
+
+  int num_chunks = 0;
+  uint64_t ship_time = 0;
+  if (shipper != NULL) {
+    num_chunks = shipper->NumChunks();
+    ship_time = shipper->ShipMicros();
   }
 
-  uint64_t finish_ts = ctx_->GetEnv()->NowMicros();
+  uint64_t finish_ts = env->NowMicros();
   uint64_t duration = (finish_ts - start_ts) / 1000;
 
   LOG(INFO) << type << " [dir=" << dir_id << "]"
           "[index=" << src_idx << "(me)->" << dst_idx << "] done"
-          " >> " << num_entries << " entries moved - " << duration << " ms";
+          " >> " << num_entries << " entries moved"
+          " in " << num_rounds << " online rounds"
+          " and " << num_chunks << " chunks - " << duration << " ms"
+          " (extract=" << extract_time / 1000 << " ms,"
+          " ship=" << ship_time / 1000 << " ms,"
+          " install=" << install_time / 1000 << " ms,"
+          " locked=" << lock_time / 1000 << " ms)";
 }
 
 void IndexServer::InsertSplit(i64 dir_id,
@@ -148,4 +384,33 @@ void IndexServer::InsertSplit(i64 dir_id,
           " >> " << num_entries << " entries inserted";
 }
 
+void IndexServer::PreloadSplit(i64 dir_id, i16 child_index,
+                               const std::string& sst_dir,
+                               i64 min_seq, i64 max_seq, i64 num_entries) {
+
+  MonitorHelper helper(oPreloadSplit, monitor_);
+  // Load the SSTable directory
+# ifdef RADOS
+  ObjEnv* obj_env = ObjEnvFactory::FetchObjEnv();
+  DLOG_ASSERT(obj_env != NULL);
+  obj_env->LoadSet(sst_dir);
+# endif
+  MaybeThrowException(ctx_->PreloadSplit(dir_id,
+          child_index, sst_dir, min_seq, max_seq));
+  // Unload the SSTable directory
+# ifdef RADOS
+  obj_env->ForgetSet(sst_dir);
+# endif
+  DLOG(INFO) << "Bulk Preload [dir=" << dir_id << "]"
+          << "[index=" << child_index << "(me)] done"
+          " >> " << num_entries << " entries inserted";
+}
+
+void IndexServer::DiscardSplit(i64 dir_id, i16 child_index) {
+  MonitorHelper helper(oDiscardSplit, monitor_);
+  MaybeThrowException(ctx_->DiscardSplit(dir_id, child_index));
+  LOG(INFO) << "Bulk Discard [dir=" << dir_id << "]"
+          << "[index=" << child_index << "(me)] done";
+}
+
 } // namespace indexfs
@@ -2,36 +2,116 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
-#include "util/exec_srv.h"
+#include <deque>
+#include <pthread.h>
+
 #include "server/index_server.h"
 
 namespace indexfs {
 
+// Ships the SSTable chunks of a distributed directory split to the
+// destination server from a background thread, so that extracting the
+// next chunk overlaps with transferring and ingesting the previous one.
+// Chunks are preloaded in the order they are sealed.
+//
+class ChunkShipper: virtual public BulkChunkHandler {
+ public:
+
+  ChunkShipper(RPC* rpc, i64 dir_id, i16 dst_idx, int dst_srv);
+
+  virtual ~ChunkShipper();
+
+  Status HandleChunk(const std::string &chunk_dir,
+      uint64_t min_seq, uint64_t max_seq, int num_entries);
+
+  // Wait until all pending chunks have been shipped.
+  // Returns the first error encountered, if any.
+  //
+  Status Flush();
+
+  int NumChunks();
+  // Total time spent shipping chunks, in micros.
+  uint64_t ShipMicros();
+
+ private:
+
+  struct Chunk {
+    std::string dir;
+    uint64_t min_seq;
+    uint64_t max_seq;
+    int num_entries;
+  };
+
+  void ShipChunk(const Chunk& chunk);
+  void ExecuteThread();
+  static void* Run(void* arg);
+
+  RPC* rpc_;
+  i64 dir_id_;
+  i16 dst_idx_;
+  int dst_srv_;
+  pthread_t thread_;
+
+  Mutex mu_;
+  CondVar cv_;
+  bool busy_;
+  bool done_;
+  Status status_;
+  std::deque<Chunk> queue_;
+  int num_chunks_;
+  uint64_t ship_micros_;
+
+  // No copying allowed
+  ChunkShipper(const ChunkShipper&);
+  ChunkShipper& operator=(const ChunkShipper&);
+};
+
+// Rolls back a split that fails before its new partition is installed.
+// The destination discards the entries loaded for the new partition so
+// far, and the directory becomes eligible for splitting again. Release()
+// must be called once the split can no longer be abandoned.
+//
+class SplitAbortGuard {
+ public:
+  SplitAbortGuard(IndexContext* ctx, RPC* rpc, DirGuard* dir_guard,
+                  i64 dir_id, i16 dst_idx, int dst_srv);
+
+  ~SplitAbortGuard();
+
+  void Release() {
+    dir_guard_ = NULL;
+  }
+
+ private:
+  IndexContext* ctx_;
+  RPC* rpc_;
+  DirGuard* dir_guard_;
+  i64 dir_id_;
+  i16 dst_idx_;
+  int dst_srv_;
+
+  // No copying allowed
+  SplitAbortGuard(const SplitAbortGuard&);
+  SplitAbortGuard& operator=(const SplitAbortGuard&);
+};
+
 class SplitGuard {
  public:
-  explicit SplitGuard(BulkExtractor* ext)
-      :ext_(ext) {
+  explicit SplitGuard(BulkExtractor* ext, ChunkShipper* shipper = NULL)
+      :ext_(ext), shipper_(shipper) {
   }
   ~SplitGuard() {
+    delete shipper_;
     delete ext_;
   }
 
  private:
   BulkExtractor* ext_;
+  ChunkShipper* shipper_;
 
   // No copying allowed
   SplitGuard(const SplitGuard&);
   SplitGuard& operator=(const SplitGuard&);
 };
 
-struct SplitTask: virtual public Runnable {
-  virtual ~SplitTask() { }
-  int64_t dir_id;
-  int16_t index;
-  IndexServer* idx_srv;
-  void Run() {
-    idx_srv->DoSplit(dir_id, index);
-  }
-};
-
-} // namespace indexfs
\ No newline at end of file
+} // namespace indexfs
@@ -14,6 +14,7 @@ namespace {
 static const char* kOpNames[kNumSrvOps] = {
   "access",
   "renew",
+  "resolveprefix",
   "getattr",
   "mknod",
   "mkdir",
@@ -28,15 +29,24 @@ static const char* kOpNames[kNumSrvOps] = {
   "updatebitmap",
   "split",
   "insertsplit",
+  "preloadsplit",
+  "discardsplit",
+  "splitwait",
   "open",
   "read",
   "write",
   "close",
 };
+static const char* kGaugeNames[kNumSrvGauges] = {
+  "splitqueue",
+  "zerothqueue",
+};
 }
 
 Monitor* CreateMonitorForServer(int server_id) {
-  return new Monitor(kOpNames, kNumSrvOps, server_id);
+  Monitor* monitor = new Monitor(kOpNames, kNumSrvOps, server_id);
+  monitor->RegisterGauges(kGaugeNames, kNumSrvGauges);
+  return monitor;
 }
 
 
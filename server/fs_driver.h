@@ -36,6 +36,7 @@ class ServerDriver {
 enum MetadataServerOps {
   oAccess,
   oRenew,
+  oResolvePrefix,
   oGetattr,
   oMknod,
   oMkdir,
@@ -50,6 +51,9 @@ enum MetadataServerOps {
   oUpdateBitmap,
   oSplit,
   oInsertSplit,
+  oPreloadSplit,
+  oDiscardSplit,
+  oSplitWait,
   oOpen,
   oRead,
   oWrite,
@@ -57,6 +61,12 @@ enum MetadataServerOps {
   kNumSrvOps
 };
 
+enum MetadataServerGauges {
+  gSplitQueue,
+  gZerothQueue,
+  kNumSrvGauges
+};
+
 extern Monitor* CreateMonitorForServer(int server_id);
 
 } // namespace indexfs
@@ -13,18 +13,30 @@ DEFINE_bool(index_context_new_dir_if_not_found, false, "create dir on demand");
 namespace indexfs {
 
 Status IndexContext::Mknod_Unlocked(const OID& oid,
-                                    int16_t idx, mode_t mode) {
+                                    int16_t idx, mode_t mode,
+                                    int partition_size) {
   DLOG_ASSERT(mdb_ != NULL);
   KeyInfo key(oid.dir_id, idx, oid.obj_name);
-  return mdb_->NewFile(key);
+  return mdb_->NewFile(key, partition_size);
+}
+
+Status IndexContext::Mknods_Unlocked(int64_t dir_id,
+                                     const std::vector<int16_t>& idxs,
+                                     const NameList& names, mode_t mode,
+                                     const std::map<int16_t, int64_t>& partition_sizes,
+                                     std::vector<bool>* created) {
+  DLOG_ASSERT(mdb_ != NULL);
+  return mdb_->NewFiles(dir_id, idxs, names, mode, created, &partition_sizes);
 }
 
 Status IndexContext::Mkdir_Unlocked(const OID& oid,
                                     int16_t idx, mode_t mode,
-                                    int64_t inode_no, int16_t zero_srv) {
+                                    int64_t inode_no, int16_t zero_srv,
+                                    int partition_size, bool pending_zeroth) {
   DLOG_ASSERT(mdb_ != NULL);
   KeyInfo key(oid.dir_id, idx, oid.obj_name);
-  return mdb_->NewDirectory(key, zero_srv, inode_no);
+  return mdb_->NewDirectory(key, zero_srv, inode_no,
+                            pending_zeroth, partition_size);
 }
 
 Status IndexContext::Getattr_Unlocked(const OID& oid,
@@ -132,21 +144,18 @@ Status IndexContext::Open() {
         return s;
       }
       DirCtrlBlock* rt_blk = ctrl_table_->Fetch(rt_id);
-      rt_blk->size_map[0] = 0;
+      rt_blk->SetPartitionSize(0, 0);
       ctrl_table_->Release(rt_blk);
     }
   }
   else if (s.ok()) {
     DirCtrlBlock* rt_blk = ctrl_table_->Fetch(rt_id);
-    int idx = 0;
-    while (idx < (1 << rt_idx->FetchBitmapRadix())) {
-      if (rt_idx->GetBit(idx) &&
-          rt_idx->GetServerForIndex(idx) == options_->GetSrvId()) {
-        rt_blk->size_map[idx] = 0;
-      }
-      idx++;
-    }
+    s = LoadPartitionSizes_Unlocked(rt_blk, rt_idx);
     ctrl_table_->Release(rt_blk);
+    if (!s.ok()) {
+      delete rt_idx;
+      return s;
+    }
   }
 
   if (rt_idx != NULL) {
@@ -157,6 +166,35 @@ Status IndexContext::Open() {
   return s;
 }
 
+// Rebuilds the in-memory sizes of all partitions of a directory
+// that are owned by this server from their persisted counters.
+// Sizes are installed all at once, and only if all of them are read,
+// as threads skip this whenever they find the control block non-empty.
+//
+Status IndexContext::LoadPartitionSizes_Unlocked(DirCtrlBlock* ctrl_blk,
+                                                 const DirIndex* dir_idx) {
+  DLOG_ASSERT(mdb_ != NULL);
+  Status s;
+  std::map<int, int> sizes;
+  int64_t dir_id = dir_idx->FetchDirId();
+  int idx = 0;
+  while (s.ok() && idx < (1 << dir_idx->FetchBitmapRadix())) {
+    if (dir_idx->GetBit(idx) &&
+        dir_idx->GetServerForIndex(idx) == options_->GetSrvId()) {
+      int64_t size;
+      s = mdb_->GetPartitionSize(dir_id, idx, &size);
+      if (s.ok()) {
+        sizes[idx] = static_cast<int>(size);
+      }
+    }
+    idx++;
+  }
+  if (s.ok()) {
+    ctrl_blk->SetPartitionSizes(sizes);
+  }
+  return s;
+}
+
 bool IndexContext::TEST_HasDir(int64_t dir_id) {
   DirGuard::DirData dir_data = FetchDir(dir_id);
   bool empty = DirGuard::Empty(dir_data);
@@ -172,7 +210,7 @@ Status IndexContext::TEST_Getattr(const OID& oid, int16_t idx,
   DirCtrlBlock* ctrl_blk = ctrl_table_->Fetch(oid.dir_id);
   DirCtrlGuard ctrl_guard(ctrl_blk);
   RawLock lock(ctrl_blk);
-  if (ctrl_blk->size_map.count(idx) == 0) {
+  if (!ctrl_blk->HasPartition(idx)) {
     s = Status::NotFound("No such partition");
   }
   if (s.ok()) {
@@ -187,7 +225,7 @@ Status IndexContext::TEST_Setattr(const OID& oid, int16_t idx,
   DirCtrlBlock* ctrl_blk = ctrl_table_->Fetch(oid.dir_id);
   DirCtrlGuard ctrl_guard(ctrl_blk);
   RawLock lock(ctrl_blk);
-  if (ctrl_blk->size_map.count(idx) == 0) {
+  if (!ctrl_blk->HasPartition(idx)) {
     s = Status::NotFound("No such partition");
   }
   if (s.ok()) {
@@ -201,13 +239,13 @@ Status IndexContext::TEST_Mknod(const OID& oid, int16_t idx, mode_t mode) {
   DirCtrlBlock* ctrl_blk = ctrl_table_->Fetch(oid.dir_id);
   DirCtrlGuard ctrl_guard(ctrl_blk);
   RawLock lock(ctrl_blk);
-  if (ctrl_blk->size_map.count(idx) == 0) {
+  if (!ctrl_blk->HasPartition(idx)) {
     s = Status::NotFound("No such partition");
   }
   if (s.ok()) {
-    s = Mknod_Unlocked(oid, idx, mode);
+    s = Mknod_Unlocked(oid, idx, mode, ctrl_blk->GetPartitionSize(idx));
     if (s.ok()) {
-      ctrl_blk->size_map[idx]++;
+      ctrl_blk->AddPartitionSize(idx, 1);
     }
   }
   return s;
@@ -219,13 +257,14 @@ Status IndexContext::TEST_Mkdir(const OID& oid, int16_t idx,
   DirCtrlBlock* ctrl_blk = ctrl_table_->Fetch(oid.dir_id);
   DirCtrlGuard ctrl_guard(ctrl_blk);
   RawLock lock(ctrl_blk);
-  if (ctrl_blk->size_map.count(idx) == 0) {
+  if (!ctrl_blk->HasPartition(idx)) {
     s = Status::NotFound("No such partition");
   }
   if (s.ok()) {
-    s = Mkdir_Unlocked(oid, idx, mode, inode_no, zero_srv);
+    s = Mkdir_Unlocked(oid, idx, mode, inode_no, zero_srv,
+                       ctrl_blk->GetPartitionSize(idx));
     if (s.ok()) {
-      ctrl_blk->size_map[idx]++;
+      ctrl_blk->AddPartitionSize(idx, 1);
       s = InstallZeroth_Unlocked(inode_no, zero_srv);
     }
   }
@@ -260,6 +299,23 @@ DirGuard::DirData IndexContext::FetchDir(int64_t dir_id) {
 
   DLOG_ASSERT(index_entry != NULL);
   DLOG_ASSERT(index_entry->index->FetchDirId() == dir_id);
+
+  // Partition sizes are lost whenever the control block is evicted
+  // or the server restarts, so reload them along with the index. Sizes
+  // are published all at once, so a non-empty control block seen without
+  // the lock is always complete.
+  if (ctrl_blk->Empty()) {
+    RawLock lock(ctrl_blk);
+    if (ctrl_blk->Empty()) {
+      s = LoadPartitionSizes_Unlocked(ctrl_blk, index_entry->index);
+    }
+  }
+  if (!s.ok()) {
+    index_cache_->Release(index_entry);
+    ctrl_table_->Release(ctrl_blk);
+    return DirGuard::DirData(NULL, NULL);
+  }
+
   return DirGuard::DirData(ctrl_blk, index_entry);
 }
 
@@ -272,8 +328,8 @@ Status IndexContext::InstallZeroth_Unlocked(int64_t dir_id,
 
   if (!ctrl_blk->Empty()) {
     if (ctrl_blk->NumPartitions() != 1 ||
-        ctrl_blk->size_map.count(0) == 0 ||
-        ctrl_blk->size_map[0] != 0) {
+        !ctrl_blk->HasPartition(0) ||
+        ctrl_blk->GetPartitionSize(0) != 0) {
       s = Status::AlreadyExists("Partition already exists");
     }
   }
@@ -287,7 +343,7 @@ Status IndexContext::InstallZeroth_Unlocked(int64_t dir_id,
       s = AddDirIndex_Unlocked(dir_idx);
     }
     if (s.ok()) {
-      ctrl_blk->size_map[0] = 0;
+      ctrl_blk->SetPartitionSize(0, 0);
       // Assuming we are going to need this directory index pretty soon.
       index_cache_->Release(index_cache_->Insert(dir_idx));
     }
@@ -339,9 +395,9 @@ Status IndexContext::InstallSplit_Unlocked(int64_t dir_id,
   if (s.ok()) {
     if (ctrl_blk->Empty()) {
       s = AddDirIndex_Unlocked(dir_idx);
-    } else if (ctrl_blk->size_map.count(child_index) != 0) {
+    } else if (ctrl_blk->HasPartition(child_index)) {
       if (ctrl_blk->NumPartitions() == 1 &&
-          ctrl_blk->size_map[child_index] == 0) {
+          ctrl_blk->GetPartitionSize(child_index) == 0) {
         s = AddDirIndex_Unlocked(dir_idx);
       } else {
         s = Status::AlreadyExists("Partition already exists");
@@ -362,10 +418,14 @@ Status IndexContext::InstallSplit_Unlocked(int64_t dir_id,
       s = mdb_->BulkInsert(min_seq, max_seq, sst_dir);
     }
     if (s.ok()) {
-      ctrl_blk->size_map[child_index] = 0;
-      ctrl_blk->size_map[child_index] += num_entries;
+      s = mdb_->SetPartitionSize(dir_id, child_index, num_entries);
+    }
+    if (s.ok()) {
+      ctrl_blk->SetPartitionSize(child_index, static_cast<int>(num_entries));
+      ctrl_blk->BeginIndexUpdate();
       index_cache_->Evict(dir_id);
       index_cache_->Release(index_cache_->Insert(dir_idx));
+      ctrl_blk->EndIndexUpdate();
     }
   }
 
@@ -397,6 +457,48 @@ Status IndexContext::InstallSplit(int64_t dir_id,
           parent_index, child_index, min_seq, max_seq, num_entries);
 }
 
+Status IndexContext::PreloadSplit(int64_t dir_id,
+                                  int16_t child_index,
+                                  const std::string& sst_dir,
+                                  uint64_t min_seq, uint64_t max_seq) {
+  DLOG_ASSERT(mdb_ != NULL);
+  Status s = mdb_->BulkInsert(min_seq, max_seq, sst_dir);
+  DLOG_IF(INFO, s.ok()) << "Partition Preload "
+          "[dir=" << dir_id << "][index=" << child_index << "] done";
+  return s;
+}
+
+Status IndexContext::DiscardSplit(int64_t dir_id,
+                                  int16_t child_index) {
+  DLOG_ASSERT(mdb_ != NULL);
+  DirCtrlBlock* ctrl_blk = ctrl_table_->Fetch(dir_id);
+  DirCtrlGuard ctrl_guard(ctrl_blk);
+  RawLock lock(ctrl_blk);
+  Status s;
+  std::string dmap_data;
+  if (ctrl_blk->HasPartition(child_index)) {
+    s = Status::AlreadyExists("Partition already exists");
+  } else {
+    s = mdb_->GetMapping(dir_id, &dmap_data);
+    if (s.ok()) {
+      DirIndex* dir_idx = index_policy_->RecoverDirIndex(dmap_data);
+      if (dir_idx->GetBit(child_index)) {
+        s = Status::AlreadyExists("Partition already exists");
+      }
+      delete dir_idx;
+    } else if (s.IsNotFound()) {
+      s = Status::OK();
+    }
+  }
+  if (s.ok()) {
+    s = mdb_->DiscardPartition(dir_id, child_index);
+  }
+  if (ctrl_blk->Empty()) {
+    ctrl_table_->Evict(dir_id);
+  }
+  return s;
+}
+
 BulkExtractor*
 IndexContext::CreateBulkExtractor(int64_t dir_id,
                                   int16_t src_idx, int16_t src_srv,
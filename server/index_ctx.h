@@ -62,6 +62,12 @@ class IndexContext {
     return index_policy_->NewDirIndex(dir_id, options_->GetSrvId());
   }
 
+  // Replace the system-wide directory index policy. Must be called
+  // before the context is opened. The policy must outlive the context.
+  void TEST_SetIndexPolicy(DirIndexPolicy* policy) {
+    index_policy_ = policy;
+  }
+
   Status InstallSplit(int64_t dir_id,
                       const std::string& sst_dir,
                       const Slice& dmap_data,
@@ -75,9 +81,28 @@ class IndexContext {
                       uint64_t min_seq, uint64_t max_seq,
                       int64_t num_entries);
 
+  // Load entries of a partition that is still being split. These
+  // entries remain unreachable until the partition is installed.
+  Status PreloadSplit(int64_t dir_id, int16_t child_index,
+                      const std::string& sst_dir,
+                      uint64_t min_seq, uint64_t max_seq);
+  // Drop entries preloaded for a partition whose split has been abandoned.
+  // Returns AlreadyExists if the partition has been installed after all.
+  Status DiscardSplit(int64_t dir_id, int16_t child_index);
+
   Status InstallZeroth(int64_t dir_id, int16_t zeroth_server);
   Status InstallZeroth_Unlocked(int64_t dir_id, int16_t zeroth_server);
 
+  // Zeroth partitions recorded as pending by Mkdir_Unlocked()
+  // and yet to be installed on their home servers.
+  Status RemovePendingZeroth(int64_t dir_id) {
+    return mdb_->RemovePendingZeroth(dir_id);
+  }
+  Status ListPendingZeroths(std::vector<int64_t>* dir_ids,
+                            std::vector<int16_t>* zeroth_servers) {
+    return mdb_->ListPendingZeroths(dir_ids, zeroth_servers);
+  }
+
   DirScanner* CreateDirScanner(int64_t dir_id, int16_t index,
                                const std::string& start_hash);
 
@@ -95,10 +120,17 @@ class IndexContext {
   Status TEST_Getattr(const OID& oid, int16_t idx, StatInfo* info);
   Status TEST_Setattr(const OID& oid, int16_t idx, const StatInfo& info);
 
+  // Partition sizes passed to the following are the in-memory sizes of
+  // the partitions written, which are persisted along with new entries.
   Status Mknod_Unlocked(const OID& oid, int16_t idx,
-                        mode_t mode);
+                        mode_t mode, int partition_size);
+  Status Mknods_Unlocked(int64_t dir_id, const std::vector<int16_t>& idxs,
+                         const NameList& names, mode_t mode,
+                         const std::map<int16_t, int64_t>& partition_sizes,
+                         std::vector<bool>* created);
   Status Mkdir_Unlocked(const OID& oid, int16_t idx,
-                        mode_t mode, int64_t inode_no, int16_t zero_srv);
+                        mode_t mode, int64_t inode_no, int16_t zero_srv,
+                        int partition_size, bool pending_zeroth = false);
   Status Getattr_Unlocked(const OID& oid, int16_t idx, StatInfo* info);
   Status Setattr_Unlocked(const OID& oid, int16_t idx, const StatInfo& info);
 
@@ -111,6 +143,9 @@ class IndexContext {
   DirIndexCache* index_cache_;
   DirIndexPolicy* index_policy_;
 
+  Status LoadPartitionSizes_Unlocked(DirCtrlBlock* ctrl_blk,
+                                     const DirIndex* dir_idx);
+
   // No copying allowed
   IndexContext(const IndexContext&);
   IndexContext& operator=(const IndexContext&);
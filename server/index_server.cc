@@ -3,22 +3,60 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <fcntl.h>
+#include <algorithm>
 #include <sys/stat.h>
 
+#include "ipc/reactor.h"
+#include "ipc/callback.h"
 #include "server/fs_errors.h"
 #include "server/index_server.h"
 
 namespace indexfs {
 
+namespace {
+#ifndef IDXFS_EXTRA_SCALE
+static const bool kOptimisticGetattr = true;
+#else
+// Large directory indices may be reallocated while being read
+static const bool kOptimisticGetattr = false;
+#endif
+// Bounds the memory held by negative leases. Unexpired leases are never
+// dropped; no new ones are granted while the table is full.
+static const int kNegativeLeaseTableSize = 1 << 18;
+}
+
+DEFINE_bool(optimistic_getattr, kOptimisticGetattr, "Serve getattr without the directory lock when possible");
+DEFINE_int32(negative_lease_time, 100 * 1000, "Lease time (in micros) for clients caching missing names, 0 to disable");
+DEFINE_bool(async_zeroth, true, "Install the zeroth partitions of new directories in the background");
+DEFINE_int32(lease_time, 1000 * 1000, "Max lease time (in micros) for clients caching directory lookups");
+DEFINE_int32(min_lease_time, 10 * 1000, "Min lease time (in micros) for directories updated as often as they are looked up");
+
 IndexServer::IndexServer(IndexContext* ctx, Monitor* monitor, RPC* rpc) :
-    monitor_(monitor), ctx_(ctx), rpc_(rpc) {
+    monitor_(monitor), ctx_(ctx), rpc_(rpc), revoker_(NULL) {
+  if (FLAGS_lease_callbacks) {
+    revoker_ = new CallbackRevoker();
+  }
   lease_table_ = new LeaseTable();
-  exec_srv_ = ExecService::Default();
+  lease_table_->SetRevoker(revoker_);
+  lease_table_->SetAdaptiveLeaseTime(
+      std::min(FLAGS_min_lease_time, FLAGS_lease_time), FLAGS_lease_time);
+  neg_lease_table_ = new LeaseTable(kNegativeLeaseTableSize);
+  neg_lease_table_->SetRevoker(revoker_);
+  split_pool_ = new SplitThreadPool(this, monitor_, FLAGS_split_threads);
+  split_pool_->Start();
+  zeroth_thread_ = new ZerothThread(ctx_, rpc_, monitor_);
+  zeroth_thread_->Start();
+  if (rpc_ != NULL) {
+    ResumeZerothTasks();
+  }
 }
 
 IndexServer::~IndexServer() {
-  delete exec_srv_;
+  delete zeroth_thread_;
+  delete split_pool_;
+  delete neg_lease_table_;
   delete lease_table_;
+  delete revoker_;
 }
 
 void IndexServer::FlushDB() {
@@ -30,9 +68,9 @@ using apache::thrift::TException;
 static
 void RPC_CreateZeroth(RPC* rpc, int srv,
         i64 dir_id, i16 zero_srv) {
-  MutexLock lock(rpc->GetMutex(srv));
+  BlockingRegion blocking;
   try {
-    rpc->GetClient(srv)->CreateZeroth(dir_id, zero_srv);
+    RPC_Stub(rpc, srv)->CreateZeroth(dir_id, zero_srv);
   } catch (TException &tx) {
     std::string err_msg = tx.what();
     LOG(ERROR) << "RPC execution [" << __func__ << "] failed: " << err_msg;
@@ -50,18 +88,34 @@ void Local_CreatePartition(IndexContext* ctx,
           std::string(), dmap_data, idx, idx, 0, 0, 0);
 }
 static
-void RPC_CreateParition(RPC* rpc, int srv,
-        i64 dir_id, i16 idx, const std::string& dmap_data) {
-  MutexLock lock(rpc->GetMutex(srv));
-  try {
-    rpc->GetClient(srv)->InsertSplit(dir_id,
-            idx, idx, std::string(), dmap_data, 0, 0, 0);
-  } catch (TException &tx) {
-    std::string err_msg = tx.what();
-    LOG(ERROR) << "RPC execution [" << __func__ << "] failed: " << err_msg;
-    SERVER_INTERNAL_ERROR(err_msg);
-  }
+Status RPC_CreatePartitions(RPC* rpc, i64 dir_id,
+        const std::vector<int>& srv_ids, const std::vector<int16_t>& idxs,
+        const std::string& dmap_data) {
+  BlockingRegion blocking;
+  Status s = rpc->MulticastPartitions(dir_id, srv_ids, idxs, dmap_data);
+  LOG_IF(ERROR, !s.ok()) << "RPC execution ["
+          << __func__ << "] failed: " << s.ToString();
+  return s;
+}
 }
+
+// Resumes the installation of the zeroth partitions
+// left pending by an earlier run of this server.
+//
+void IndexServer::ResumeZerothTasks() {
+  std::vector<int64_t> dir_ids;
+  std::vector<int16_t> zeroth_servers;
+  Status s = ctx_->ListPendingZeroths(&dir_ids, &zeroth_servers);
+  if (!s.ok()) {
+    LOG(FATAL) << "Cannot list pending zeroth partitions: " << s.ToString();
+  }
+  for (size_t i = 0; i < dir_ids.size(); ++i) {
+    int home_srv = (U16INT(zeroth_servers[i])) % ctx_->GetNumServers();
+    zeroth_thread_->AddZerothTask(home_srv,
+            dir_ids[i], zeroth_servers[i], true);
+  }
+  LOG_IF(INFO, !dir_ids.empty()) << "Resuming "
+          << dir_ids.size() << " pending zeroth partitions";
 }
 
 // Creates the zeroth partition for a given directory.
@@ -82,34 +136,57 @@ void IndexServer::CreateZeroth(i64 dir_id, i16 zeroth_server) {
 // NOTE: by ``index'' we means the directory partition map
 // EXCEPTION: if we are not responsible for the specified object name
 //
-#define _DIR_GUARD(dir_id, obj_name)                                      \
+#define _DIR_GUARD(dir_id, obj_name, lock_type)                           \
   DirGuard::DirData dir_data = ctx_->FetchDir(dir_id);                    \
   MaybeThrowUnknownDirException(dir_data);                                \
   DirGuard dir_guard(dir_data);                                           \
-  DirLock lock(&dir_guard);                                               \
+  lock_type lock(&dir_guard);                                             \
   if (!obj_name.empty()) {                                                \
     obj_idx = dir_guard.GetIndex(obj_name);                               \
     MaybeThrowRedirectException(dir_guard, obj_idx, ctx_->GetMyRank());   \
   }
 
-// Obtain the directory lock.
+// Obtain the directory lock in exclusive mode.
 //
 // INPUT: directory id (int64_t)
 //
-#define DIR_LOCK(dir_id)            \
-  int obj_idx = 0;                  \
-  _DIR_GUARD(dir_id, std::string()) \
+#define DIR_LOCK(dir_id)                     \
+  int obj_idx = 0;                           \
+  _DIR_GUARD(dir_id, std::string(), DirLock) \
 
-// Obtain the object lock.
+// Obtain the directory lock in shared mode.
+//
+// INPUT: directory id (int64_t)
+//
+#define DIR_LOCK_SHARED(dir_id)                    \
+  int obj_idx = 0;                                 \
+  _DIR_GUARD(dir_id, std::string(), SharedDirLock) \
+
+// Obtain the object lock for read-only access.
+//
+// INPUT: object id structure (struct OID)
+//
+// Only the parent directory lock is taken, in shared mode.
+//
+#define OBJ_LOCK_SHARED(obj_id) \
+  _DIR_GUARD(obj_id.dir_id, obj_id.obj_name, SharedDirLock)
+
+// Obtain the object lock for updates.
 //
 // INPUT: object id structure (struct OID)
 //
-// All object locks are currently represented by parent directory locks.
+// Object locks are represented by the lock of the parent directory
+// partition the object belongs to, taken under the parent directory
+// lock in shared mode. Updates to different partitions of
+// a directory may therefore proceed in parallel.
 //
-#define OBJ_LOCK(obj_id) _DIR_GUARD(obj_id.dir_id, obj_id.obj_name)
+#define OBJ_LOCK(obj_id)                                      \
+  _DIR_GUARD(obj_id.dir_id, obj_id.obj_name, SharedDirLock)   \
+  PartitionLock part_lock(&dir_guard, obj_idx);
 
 
 // Performs client-side path lookup entry renewal.
+// Like Access, this takes the object lock since leases are updated.
 //
 void IndexServer::Renew(LookupInfo& _return, const OID& obj_id) {
   MonitorHelper helper(oRenew, monitor_);
@@ -128,6 +205,59 @@ void IndexServer::Access(LookupInfo& _return, const OID& obj_id) {
   Lookup(obj_id, obj_idx, dir_guard, &_return);
 }
 
+// Resolves a run of path components with a single request. The first
+// component is named by ``obj_id'' and must belong to this server.
+// Each of the following ``names'' is looked up under the directory
+// resolved right before it, for as long as the entry belongs to a
+// partition held by this server. Resolution stops at the first component
+// that cannot be resolved locally, and the client continues from there.
+// Returns one lookup entry, with its lease, per resolved component.
+//
+void IndexServer::ResolvePrefix(std::vector<LookupInfo>& _return,
+        const OID& obj_id, const std::vector<std::string>& names) {
+  MonitorHelper helper(oResolvePrefix, monitor_);
+  LookupInfo info;
+  {
+    int obj_idx = 0;
+    OBJ_LOCK(obj_id);
+    Lookup(obj_id, obj_idx, dir_guard, &info);
+  }
+  _return.push_back(info);
+  OID oid = obj_id;
+  for (size_t i = 0; i < names.size(); ++i) {
+    oid.dir_id = info.id;
+    oid.path_depth++;
+    oid.obj_name = names[i];
+    if (!TryLookup(oid, &info)) {
+      break;
+    }
+    _return.push_back(info);
+  }
+}
+
+// Looks up a path component if it is held by this server.
+// Returns false if that cannot be done locally for any reason.
+//
+bool IndexServer::TryLookup(const OID& obj_id, LookupInfo* info) {
+  DirGuard::DirData dir_data = ctx_->FetchDir(obj_id.dir_id);
+  if (DirGuard::Empty(dir_data)) {
+    return false;
+  }
+  DirGuard dir_guard(dir_data);
+  SharedDirLock lock(&dir_guard);
+  int obj_idx = dir_guard.GetIndex(obj_id.obj_name);
+  if (dir_guard.ToServer(obj_idx) != ctx_->GetMyRank()) {
+    return false;
+  }
+  PartitionLock part_lock(&dir_guard, obj_idx);
+  try {
+    Lookup(obj_id, obj_idx, dir_guard, info);
+  } catch (apache::thrift::TException &tx) {
+    return false;
+  }
+  return true;
+}
+
 // Retrieves the attributes for a given file system object.
 //
 // REQUIRES: the specified name must map to an existing object.
@@ -135,9 +265,45 @@ void IndexServer::Access(LookupInfo& _return, const OID& obj_id) {
 void IndexServer::Getattr(StatInfo& _return,
         const OID& obj_id) {
   MonitorHelper helper(oGetattr, monitor_);
-  int obj_idx = 0;
-  OBJ_LOCK(obj_id);
-  MaybeThrowException(ctx_->Getattr_Unlocked(obj_id, obj_idx, &_return));
+  try {
+    if (FLAGS_optimistic_getattr && Getattr_Optimistic(obj_id, &_return)) {
+      return;
+    }
+    int obj_idx = 0;
+    OBJ_LOCK_SHARED(obj_id);
+    MaybeThrowException(ctx_->Getattr_Unlocked(obj_id, obj_idx, &_return));
+  } catch (FileNotFoundException &nf) {
+    nf.lease_due = TryGrantNegativeLease(obj_id);
+    throw;
+  }
+}
+
+// Attempts to serve a Getattr without taking the directory lock.
+// The partition is computed from the cached directory index, and the
+// result is only trusted if the index did not change during the read.
+// Returns false if the caller should retry with the directory lock,
+// which also takes care of redirecting clients with stale indices.
+//
+bool IndexServer::Getattr_Optimistic(const OID& obj_id, StatInfo* info) {
+  DirGuard::DirData dir_data = ctx_->FetchDir(obj_id.dir_id);
+  if (DirGuard::Empty(dir_data)) {
+    return false;
+  }
+  DirGuard dir_guard(dir_data);
+  uint64_t version;
+  if (!dir_guard.BeginOptimisticRead(&version)) {
+    return false;
+  }
+  int obj_idx = dir_guard.GetIndex(obj_id.obj_name);
+  if (dir_guard.ToServer(obj_idx) != ctx_->GetMyRank()) {
+    return false;
+  }
+  Status s = ctx_->Getattr_Unlocked(obj_id, obj_idx, info);
+  if (!dir_guard.ValidateOptimisticRead(version)) {
+    return false;
+  }
+  MaybeThrowException(s);
+  return true;
 }
 
 // Creates a new file under a given directory.
@@ -148,9 +314,11 @@ void IndexServer::Mknod(const OID& obj_id, i16 perm) {
   MonitorHelper helper(oMknod, monitor_);
   int obj_idx = 0;
   OBJ_LOCK(obj_id);
+  RevokeNegativeLease(obj_id, dir_guard);
 
   // TASK-I: link the new file
-  MaybeThrowException(ctx_->Mknod_Unlocked(obj_id, obj_idx, perm));
+  MaybeThrowException(ctx_->Mknod_Unlocked(obj_id, obj_idx, perm,
+          dir_guard.GetPartitionSize(obj_idx)));
 
   // TASK-II: increase directory size
   DLOG_ASSERT(dir_guard.HasPartitionData(obj_idx));
@@ -159,46 +327,81 @@ void IndexServer::Mknod(const OID& obj_id, i16 perm) {
   TriggerDirSplitting(obj_id.dir_id, obj_idx, dir_guard);
 }
 
-// Creates multiple files under a given directory
-// as an atomic operation with all-or-nothing semantics.
-//
-// REQUIRES: all specified file names must not collide with existing names.
+// Creates multiple files under a given directory with a single
+// directory lock acquisition and a single metadata write batch.
+// Each name is reported individually as either created, already existing,
+// or belonging to another server, in which case the current directory
+// partition map is returned so that the client may resend those names.
 //
-void IndexServer::Mknod_Bulk(const OIDS& obj_ids, i16 perm) {
-#if 1
-  OID obj_id;
-  obj_id.dir_id = obj_ids.dir_id;
-  obj_id.path_depth = obj_ids.path_depth;
-  std::vector<std::string>::const_iterator it;
-  for (it = obj_ids.obj_names.begin(); it != obj_ids.obj_names.end(); ++it) {
-    obj_id.obj_name = *it;
-    Mknod(obj_id, perm);
-  }
-#else
+void IndexServer::Mknod_Bulk(MknodBulkResult& _return,
+        const OIDS& obj_ids, i16 perm) {
   MonitorHelper helper(oMknod, monitor_);
   DIR_LOCK(obj_ids.dir_id);
-  std::set<int> idx_set;
+
+  // TASK-0: revoke negative leases on the new names. Since the directory
+  // lock may be released while waiting for a lease to expire, repeat
+  // until a full pass finds nothing to revoke.
   OID obj_id;
-  obj_id.dir_id = obj_ids.dir_id;
   obj_id.path_depth = obj_ids.path_depth;
+  obj_id.dir_id = obj_ids.dir_id;
+  obj_id.client_id = obj_ids.client_id;
+  bool revoked = true;
+  while (revoked) {
+    revoked = false;
+    for (size_t i = 0; i < obj_ids.obj_names.size(); ++i) {
+      obj_id.obj_name = obj_ids.obj_names[i];
+      revoked |= RevokeNegativeLease(obj_id, dir_guard);
+    }
+  }
 
-  std::vector<std::string>::const_iterator it = obj_ids.obj_names.begin();
-  for (; it != obj_ids.obj_names.end(); ++it) {
-    obj_id.obj_name = *it;
-    obj_idx = dir_guard.GetIndex(obj_id.obj_name);
-    MaybeThrowRedirectException(dir_guard, obj_idx, ctx_->GetMyRank());
-    MaybeThrowException(ctx_->Mknod_Unlocked(obj_id, obj_idx, perm));
+  // TASK-I: filter out names that are not ours
+  size_t num_names = obj_ids.obj_names.size();
+  _return.status.assign(num_names, MknodStatus::REDIRECTED);
+  NameList names;
+  std::vector<int16_t> idxs;
+  std::vector<size_t> positions;
+  for (size_t i = 0; i < num_names; ++i) {
+    obj_idx = dir_guard.GetIndex(obj_ids.obj_names[i]);
+    if (dir_guard.ToServer(obj_idx) == ctx_->GetMyRank()) {
+      idxs.push_back(obj_idx);
+      names.push_back(obj_ids.obj_names[i]);
+      positions.push_back(i);
+    }
+  }
+  if (positions.size() < num_names) {
+    dir_guard.PutDirIndex(&_return.dmap_data);
+  }
 
-    idx_set.insert(obj_idx);
-    DLOG_ASSERT(dir_guard.HasPartitionData(obj_idx));
-    dir_guard.InceaseAndGetPartitionSize(obj_idx, 1);
+  // TASK-II: link all new files
+  std::map<int16_t, int64_t> sizes;
+  for (size_t i = 0; i < idxs.size(); ++i) {
+    if (sizes.count(idxs[i]) == 0) {
+      sizes[idxs[i]] = dir_guard.GetPartitionSize(idxs[i]);
+    }
+  }
+  std::vector<bool> created;
+  MaybeThrowException(ctx_->Mknods_Unlocked(obj_ids.dir_id,
+          idxs, names, perm, sizes, &created));
+
+  // TASK-III: increase directory size
+  std::map<int, int> deltas;
+  for (size_t i = 0; i < positions.size(); ++i) {
+    if (created[i]) {
+      deltas[idxs[i]]++;
+      _return.status[positions[i]] = MknodStatus::CREATED;
+    } else {
+      _return.status[positions[i]] = MknodStatus::ALREADY_EXISTS;
+    }
+  }
+  std::map<int, int>::iterator it = deltas.begin();
+  for (; it != deltas.end(); ++it) {
+    DLOG_ASSERT(dir_guard.HasPartitionData(it->first));
+    dir_guard.InceaseAndGetPartitionSize(it->first, it->second);
   }
 
-  std::set<int>::iterator idx_it = idx_set.begin();
-  for (; idx_it != idx_set.end(); ++idx_it) {
-    TriggerDirSplitting(obj_ids.dir_id, *idx_it, dir_guard);
+  for (it = deltas.begin(); it != deltas.end(); ++it) {
+    TriggerDirSplitting(obj_ids.dir_id, it->first, dir_guard);
   }
-#endif
 }
 
 // Creates a new directory under a given parent directory.
@@ -213,20 +416,27 @@ void IndexServer::Mkdir(const OID& obj_id,
   MonitorHelper helper(oMkdir, monitor_);
   int obj_idx = 0;
   OBJ_LOCK(obj_id);
+  RevokeNegativeLease(obj_id, dir_guard);
 
   // TASK-I: allocate a new inode number
   int64_t new_inode = ctx_->NextInode();
 
-  // TASK-II: link the new directory
+  // TASK-II: link the new directory, recording its zeroth partition
+  // as pending if that partition is to be installed on another server
+  int home_srv = (U16INT(hint_server1)) % ctx_->GetNumServers();
+  bool remote_zeroth = (home_srv != ctx_->GetMyRank());
   MaybeThrowException(ctx_->Mkdir_Unlocked(obj_id, obj_idx,
-          perm, new_inode, hint_server1));
+          perm, new_inode, hint_server1,
+          dir_guard.GetPartitionSize(obj_idx), remote_zeroth));
 
   // TASK-III: install the zeroth partition
-  int home_srv = (U16INT(hint_server1)) % ctx_->GetNumServers();
-  if (home_srv == ctx_->GetMyRank()) {
+  if (!remote_zeroth) {
     CreateZeroth(new_inode, hint_server1);
+  } else if (FLAGS_async_zeroth) {
+    zeroth_thread_->AddZerothTask(home_srv, new_inode, hint_server1);
   } else {
     RPC_CreateZeroth(rpc_, home_srv, new_inode, hint_server1);
+    MaybeThrowException(ctx_->RemovePendingZeroth(new_inode));
   }
 
   // TASK-IV: increase the directory size
@@ -239,6 +449,17 @@ void IndexServer::Mkdir(const OID& obj_id,
 // Creates a new directory under a given parent directory
 // and immediately splits this new directory to all metadata servers.
 //
+// The new entry is linked first, with its zeroth partition recorded as
+// pending, so that nothing is installed for a request that is redirected
+// or finds the name taken. Partitions are then installed on all servers
+// in parallel without holding the parent directory lock. The zeroth
+// partition goes last, so that once clients can read the directory
+// index all partitions it refers to exist. Until then, clients wait
+// for the zeroth partition as they do for any other new directory.
+// Should any partition fail to install, the zeroth partition is
+// installed as that of a directory that is not split, and partitions
+// already installed elsewhere are simply never used.
+//
 // REQUIRES: hint servers must cover the entire virtual server space.
 // REQUIRES: the specified directory name must not collide with existing names.
 //
@@ -246,16 +467,27 @@ void IndexServer::Mkdir_Presplit(const OID& obj_id,
         i16 perm, i16 hint_server1, i16 hint_server2) {
   MonitorHelper helper(oMkdir, monitor_);
   int obj_idx = 0;
-  OBJ_LOCK(obj_id);
+  int64_t new_inode;
+  {
+    OBJ_LOCK(obj_id);
+    RevokeNegativeLease(obj_id, dir_guard);
 
-  // TASK-I: allocate a new inode number
-  int64_t new_inode = ctx_->NextInode();
+    // TASK-I: allocate a new inode number
+    new_inode = ctx_->NextInode();
 
-  // TASK-II: link the new directory
-  MaybeThrowException(ctx_->Mkdir_Unlocked(obj_id, obj_idx,
-          perm, new_inode, hint_server1));
+    // TASK-II: link the new directory with its zeroth partition pending
+    MaybeThrowException(ctx_->Mkdir_Unlocked(obj_id, obj_idx,
+            perm, new_inode, hint_server1,
+            dir_guard.GetPartitionSize(obj_idx), true));
+
+    // TASK-III: increase the directory size
+    DLOG_ASSERT(dir_guard.HasPartitionData(obj_idx));
+    dir_guard.InceaseAndGetPartitionSize(obj_idx, 1);
+
+    TriggerDirSplitting(obj_id.dir_id, obj_idx, dir_guard);
+  }
 
-  // TASK-III: initialize directory index
+  // TASK-IV: initialize directory index
   DirIndex* dir_idx = ctx_->NewDirIndex(new_inode, hint_server1);
   for (int i = 0; i < ctx_->GetNumServers(); ++i) {
     dir_idx->SetBit(i);
@@ -265,22 +497,46 @@ void IndexServer::Mkdir_Presplit(const OID& obj_id,
   std::string dmap_data(slice.data(), slice.size());
   delete dir_idx;
 
-  // TASK-IV: install all partitions
-  for (int i = 0; i < ctx_->GetNumServers(); ++i) {
+  // TASK-V: install all partitions but the zeroth one
+  Status s;
+  std::vector<int> srv_ids;
+  std::vector<int16_t> idxs;
+  for (int i = 1; i < ctx_->GetNumServers(); ++i) {
     int srv_id = DirIndex::MapIndexToServer(i,
             U16INT(hint_server1), ctx_->GetNumServers());
     if (srv_id == ctx_->GetMyRank()) {
       Local_CreatePartition(ctx_, new_inode, i, dmap_data);
     } else {
-      RPC_CreateParition(rpc_, srv_id, new_inode, i, dmap_data);
+      srv_ids.push_back(srv_id);
+      idxs.push_back(i);
     }
   }
+  if (!srv_ids.empty()) {
+    s = RPC_CreatePartitions(rpc_, new_inode, srv_ids, idxs, dmap_data);
+  }
 
-  // TASK-V: increase the directory size
-  DLOG_ASSERT(dir_guard.HasPartitionData(obj_idx));
-  dir_guard.InceaseAndGetPartitionSize(obj_idx, 1);
-
-  TriggerDirSplitting(obj_id.dir_id, obj_idx, dir_guard);
+  // TASK-VI: install the zeroth partition
+  int home_srv = (U16INT(hint_server1)) % ctx_->GetNumServers();
+  if (s.ok()) {
+    if (home_srv == ctx_->GetMyRank()) {
+      Local_CreatePartition(ctx_, new_inode, 0, dmap_data);
+    } else {
+      s = RPC_CreatePartitions(rpc_, new_inode,
+              std::vector<int>(1, home_srv), std::vector<int16_t>(1, 0),
+              dmap_data);
+    }
+    if (s.ok()) {
+      MaybeThrowException(ctx_->RemovePendingZeroth(new_inode));
+    }
+  }
+  if (!s.ok()) {
+    if (home_srv == ctx_->GetMyRank()) {
+      CreateZeroth(new_inode, hint_server1);
+      MaybeThrowException(ctx_->RemovePendingZeroth(new_inode));
+    } else {
+      zeroth_thread_->AddZerothTask(home_srv, new_inode, hint_server1, true);
+    }
+  }
 }
 
 // Changes the access permission of a given file system object.
@@ -341,6 +597,7 @@ void IndexServer::SetDirAttr(const OID& obj_id, i16 obj_idx,
     lease = lease_table_->New(obj_id, info);
   }
   LeaseGuard lease_guard(lease);
+  BlockingRegion blocking(LeaseTable::FetchLeaseDue(lease) != 0);
   WriteLock lock(lease, &dir_guard, ctx_->GetEnv());
   MaybeThrowException(ctx_->Setattr_Unlocked(obj_id, obj_idx, info));
   DLOG_ASSERT(lease->inode_no == info.id);
@@ -350,6 +607,19 @@ void IndexServer::SetDirAttr(const OID& obj_id, i16 obj_idx,
   DLOG_ASSERT(lease->zeroth_server == info.zeroth_server);
 }
 
+// Leases are tracked with the address requests come from rather than
+// the one claimed by clients, so that servers cannot be made to call
+// arbitrary hosts back. Requests not received through a reactor server,
+// whose sender is unknown, get leases that are waited out instead.
+//
+int64_t IndexServer::LeaseHolder(const OID& obj_id) {
+  uint32_t peer_ip;
+  if (revoker_ == NULL || !ReactorServer::GetPeerAddr(&peer_ip)) {
+    return -1;
+  }
+  return BindCallbackAddr(obj_id.client_id, peer_ip);
+}
+
 void IndexServer::Lookup(const OID& obj_id, i16 obj_idx,
         DirGuard& dir_guard, LookupInfo* info) {
   dir_guard.Lock_AssertHeld();
@@ -357,7 +627,13 @@ void IndexServer::Lookup(const OID& obj_id, i16 obj_idx,
   lease = lease_table_->Get(obj_id);
   if (lease == NULL) {
     StatInfo stat;
-    MaybeThrowException(ctx_->Getattr_Unlocked(obj_id, obj_idx, &stat));
+    Status s = ctx_->Getattr_Unlocked(obj_id, obj_idx, &stat);
+    if (s.IsNotFound()) {
+      FileNotFoundException nf;
+      nf.lease_due = GrantNegativeLease(obj_id, obj_idx, dir_guard);
+      throw nf;
+    }
+    MaybeThrowException(s);
     if (!S_ISDIR(stat.mode)) {
       throw DirectoryExpectedError();
     }
@@ -366,7 +642,7 @@ void IndexServer::Lookup(const OID& obj_id, i16 obj_idx,
   LeaseGuard lease_guard(lease);
   {
     // Automatically update lease due when disposed
-    ReadLock lock(lease, &dir_guard, ctx_->GetEnv());
+    ReadLock lock(lease, &dir_guard, ctx_->GetEnv(), LeaseHolder(obj_id));
     info->id = lease->inode_no;
     info->uid = lease->uid;
     info->gid = lease->gid;
@@ -377,6 +653,89 @@ void IndexServer::Lookup(const OID& obj_id, i16 obj_idx,
   info->lease_due = LeaseTable::FetchLeaseDue(lease);
 }
 
+// Grants a short lease on the absence of a given name so that clients
+// may cache the negative lookup result. Any later attempt to create
+// that name has to wait for the lease to expire.
+// Returns the lease due, or 0 if no lease is granted.
+//
+// REQUIRES: the specified name must not exist.
+//
+int64_t IndexServer::GrantNegativeLease(const OID& obj_id, i16 obj_idx,
+        DirGuard& dir_guard) {
+  dir_guard.Lock_AssertHeld();
+  if (FLAGS_negative_lease_time <= 0) {
+    return 0;
+  }
+  LeaseEntry* lease = NULL;
+  lease = neg_lease_table_->Get(obj_id);
+  if (lease == NULL) {
+    lease = neg_lease_table_->NewNegative(obj_id, FLAGS_negative_lease_time);
+    if (lease == NULL) {
+      return 0; // Too many negative leases outstanding
+    }
+  }
+  LeaseGuard lease_guard(lease);
+  {
+    // Automatically update lease due when disposed
+    ReadLock lock(lease, &dir_guard, ctx_->GetEnv(), LeaseHolder(obj_id));
+    // The lock may have been released while waiting for a writer,
+    // in which case the name may no longer be missing
+    StatInfo stat;
+    if (!ctx_->Getattr_Unlocked(obj_id, obj_idx, &stat).IsNotFound()) {
+      return 0;
+    }
+  }
+  // Set updated lease due
+  return LeaseTable::FetchLeaseDue(lease);
+}
+
+// Grants a negative lease for a given name if that name is held by
+// this server and is still missing. Returns 0 if no lease is granted.
+//
+int64_t IndexServer::TryGrantNegativeLease(const OID& obj_id) {
+  if (FLAGS_negative_lease_time <= 0) {
+    return 0;
+  }
+  DirGuard::DirData dir_data = ctx_->FetchDir(obj_id.dir_id);
+  if (DirGuard::Empty(dir_data)) {
+    return 0;
+  }
+  DirGuard dir_guard(dir_data);
+  SharedDirLock lock(&dir_guard);
+  int obj_idx = dir_guard.GetIndex(obj_id.obj_name);
+  if (dir_guard.ToServer(obj_idx) != ctx_->GetMyRank()) {
+    return 0;
+  }
+  PartitionLock part_lock(&dir_guard, obj_idx);
+  StatInfo stat;
+  if (!ctx_->Getattr_Unlocked(obj_id, obj_idx, &stat).IsNotFound()) {
+    return 0;
+  }
+  return GrantNegativeLease(obj_id, obj_idx, dir_guard);
+}
+
+// Waits out any negative lease granted on a name that is about to be
+// created, except the one held by the client creating it. Returns true
+// if such a lease was found, in which case the lock may have been
+// temporarily released.
+//
+bool IndexServer::RevokeNegativeLease(const OID& obj_id,
+        DirGuard& dir_guard) {
+  dir_guard.Lock_AssertHeld();
+  LeaseEntry* lease = NULL;
+  lease = neg_lease_table_->Get(obj_id);
+  if (lease == NULL) {
+    return false;
+  }
+  LeaseGuard lease_guard(lease);
+  {
+    BlockingRegion blocking(LeaseTable::FetchLeaseDue(lease) != 0);
+    WriteLock lock(lease, &dir_guard, ctx_->GetEnv(), LeaseHolder(obj_id));
+  }
+  neg_lease_table_->Evict(obj_id);
+  return true;
+}
+
 namespace {
 class ScannerGuard {
  public:
@@ -404,7 +763,7 @@ class ScannerGuard {
 void IndexServer::Readdir(EntryList& _return,
         i64 dir_id, i16 index) {
   MonitorHelper helper(oReaddir, monitor_);
-  DIR_LOCK(dir_id);
+  DIR_LOCK_SHARED(dir_id);
   DirScanner* ds = NULL;
   ds = ctx_->CreateDirScanner(dir_id, index, std::string());
   {
@@ -418,13 +777,81 @@ void IndexServer::Readdir(EntryList& _return,
   dir_guard.PutDirIndex(&_return.dmap_data);
 }
 
+// Scans a given directory partition one page at a time, starting from
+// the entry whose name hash equals or immediately follows the given hash.
+// At most ``max_entries'' entries are returned. If the partition holds
+// more entries, the hash of the next entry is returned as the end key
+// so that the client can resume from there with a new call.
+//
+// REQUIRES: the specified directory partition must exist.
+// REQUIRES: the specified directory id must map to an existing directory.
+//
+void IndexServer::ReaddirScan(ScanResult& _return,
+        i64 dir_id, i16 index,
+        const std::string& start_hash, i32 max_entries) {
+  MonitorHelper helper(oReaddir, monitor_);
+  DIR_LOCK_SHARED(dir_id);
+  int limit = max_entries > 0 ? max_entries : 1;
+  DirScanner* ds = NULL;
+  ds = ctx_->CreateDirScanner(dir_id, index, start_hash);
+  {
+    ScannerGuard scanner_guard(ds);
+    std::string name;
+    for (; ds->Valid() &&
+         static_cast<int>(_return.entries.size()) < limit; ds->Next()) {
+      ds->RetrieveEntryName(&name);
+      _return.entries.push_back(name);
+    }
+    _return.end_partition = index;
+    _return.more_entries = ds->Valid() ? 1 : 0;
+    if (_return.more_entries) {
+      ds->RetrieveEntryHash(&_return.end_key);
+    }
+  }
+  dir_guard.PutDirIndex(&_return.dmap_data);
+}
+
+// Same as ReaddirScan, but also returns the attributes of each entry,
+// which are decoded from the same scanner position as the entry name.
+//
+// REQUIRES: the specified directory partition must exist.
+// REQUIRES: the specified directory id must map to an existing directory.
+//
+void IndexServer::ReaddirPlus(ScanPlusResult& _return,
+        i64 dir_id, i16 index,
+        const std::string& start_hash, i32 max_entries) {
+  MonitorHelper helper(oReaddir, monitor_);
+  DIR_LOCK_SHARED(dir_id);
+  int limit = max_entries > 0 ? max_entries : 1;
+  DirScanner* ds = NULL;
+  ds = ctx_->CreateDirScanner(dir_id, index, start_hash);
+  {
+    ScannerGuard scanner_guard(ds);
+    std::string name;
+    StatInfo info;
+    for (; ds->Valid() &&
+         static_cast<int>(_return.names.size()) < limit; ds->Next()) {
+      ds->RetrieveEntryName(&name);
+      ds->RetrieveEntryStat(&info);
+      _return.names.push_back(name);
+      _return.entries.push_back(info);
+    }
+    _return.end_partition = index;
+    _return.more_entries = ds->Valid() ? 1 : 0;
+    if (_return.more_entries) {
+      ds->RetrieveEntryHash(&_return.end_key);
+    }
+  }
+  dir_guard.PutDirIndex(&_return.dmap_data);
+}
+
 // Retrieves the current directory partition map.
 //
 // REQUIRES: the specified directory id must map to an existing directory.
 //
 void IndexServer::ReadBitmap(std::string& _return, i64 dir_id) {
   MonitorHelper helper(oReadBitmap, monitor_);
-  DIR_LOCK(dir_id);
+  DIR_LOCK_SHARED(dir_id);
   dir_guard.PutDirIndex(&_return);
 }
 
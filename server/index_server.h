@@ -7,12 +7,19 @@
 
 #include "ipc/rpc.h"
 #include "common/leasectrl.h"
-#include "util/exec_srv.h"
 #include "server/fs_driver.h"
 #include "server/index_ctx.h"
+#include "server/split_thread.h"
+#include "server/zeroth_thread.h"
 
 namespace indexfs {
 
+DECLARE_bool(optimistic_getattr);
+DECLARE_int32(negative_lease_time);
+DECLARE_bool(async_zeroth);
+DECLARE_int32(lease_time);
+DECLARE_int32(min_lease_time);
+
 class IndexServer: virtual public MetadataIndexServiceIf {
  public:
 
@@ -26,10 +33,16 @@ class IndexServer: virtual public MetadataIndexServiceIf {
   void Getattr(StatInfo& _return, const OID& obj_id);
   void Renew(LookupInfo& _return, const OID& obj_id);
   void Access(LookupInfo& _return, const OID& obj_id);
+  void ResolvePrefix(std::vector<LookupInfo>& _return,
+      const OID& obj_id, const std::vector<std::string>& names);
   void Readdir(EntryList& _return, i64 dir_id, i16 index);
+  void ReaddirScan(ScanResult& _return, i64 dir_id, i16 index,
+      const std::string& start_hash, i32 max_entries);
+  void ReaddirPlus(ScanPlusResult& _return, i64 dir_id, i16 index,
+      const std::string& start_hash, i32 max_entries);
 
   void Mknod(const OID& obj_id, i16 perm);
-  void Mknod_Bulk(const OIDS& obj_ids, i16 perm);
+  void Mknod_Bulk(MknodBulkResult& _return, const OIDS& obj_ids, i16 perm);
   bool Chmod(const OID& obj_id, i16 perm);
   bool Chown(const OID& obj_id, i16 uid, i16 gid);
   void Mkdir_Presplit(const OID& obj_id, i16 perm,
@@ -44,20 +57,41 @@ class IndexServer: virtual public MetadataIndexServiceIf {
   void InsertSplit(i64 dir_id, i16 parent_index, i16 child_index,
       const std::string& path_split_files, const std::string& dmap_data,
       i64 min_seq, i64 max_seq, i64 num_entries);
+  void PreloadSplit(i64 dir_id, i16 child_index,
+      const std::string& path_split_files,
+      i64 min_seq, i64 max_seq, i64 num_entries);
+  void DiscardSplit(i64 dir_id, i16 child_index);
+
+  // Makes upcoming splits fail after their first online round,
+  // as if extracting or shipping entries had failed.
+  void TEST_SetSplitError(const Status& s) { test_split_error_ = s; }
 
  private:
-  Mutex mtx_;
   Monitor* monitor_;
   IndexContext* ctx_;
   RPC* rpc_;
   LeaseTable* lease_table_;
-  ExecService* exec_srv_;
+  LeaseTable* neg_lease_table_;
+  LeaseRevoker* revoker_;
+  SplitThreadPool* split_pool_;
+  ZerothThread* zeroth_thread_;
+  Status test_split_error_;
 
+  void ResumeZerothTasks();
   void Lookup(const OID& oid, i16 index, DirGuard& dir_guard,
       LookupInfo* info);
   void SetDirAttr(const OID& oid, i16 index, DirGuard& dir_guard,
       const StatInfo& info);
   void TriggerDirSplitting(i64 dir_id, i16 index, DirGuard& dir_guard);
+  bool Getattr_Optimistic(const OID& oid, StatInfo* info);
+  bool TryLookup(const OID& oid, LookupInfo* info);
+  int64_t GrantNegativeLease(const OID& oid, i16 index, DirGuard& dir_guard);
+  int64_t TryGrantNegativeLease(const OID& oid);
+  bool RevokeNegativeLease(const OID& oid, DirGuard& dir_guard);
+
+  // Returns the id leases granted to the sender of a request are tracked
+  // with, or -1 if these leases cannot be revoked before they expire.
+  int64_t LeaseHolder(const OID& oid);
 
   // No copying allowed
   IndexServer(const IndexServer&);
@@ -11,12 +11,18 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
+#include "ipc/callback.h"
 #include "metadb/metadb_io.h"
 #include "common/unit_test.h"
 #include "server/fs_driver.h"
 #include "server/index_ctx.h"
+#include "server/index_server.h"
 
 namespace indexfs { namespace test {
 
@@ -26,6 +32,8 @@ static const int kDepth = 16;
 static const int64_t kRtInodeNo = 0;
 static int run_id = 0;
 static const char* kRunPrefix = "/tmp/indexfs-test";
+static const int kNumSplitDirs = 8;
+static const int kNumSplitFiles = 1024;
 }
 
 class IndexFSTest {
@@ -33,13 +41,16 @@ class IndexFSTest {
 
   IndexFSTest() { run_id++; }
 
-  Status OpenContext();
+  Status OpenContext(DirIndexPolicy* policy = NULL);
 
   Status Mkdir(int64_t dir_id, const std::string& dir_name);
   Status Mknod(int64_t dir_id, const std::string& file_name);
   Status Getattr(int64_t dir_id, const std::string& obj_name);
   Status Setattr(int64_t dir_id, const std::string& obj_name);
 
+  int CountEntries(int64_t dir_id, int16_t index);
+  bool WaitForSplits(int64_t dir_id);
+
  protected:
   int64_t last_inode_;
   StatInfo last_stat_;
@@ -50,7 +61,7 @@ class IndexFSTest {
   IndexContext* index_ctx_;
 };
 
-Status IndexFSTest::OpenContext() {
+Status IndexFSTest::OpenContext(DirIndexPolicy* policy) {
   last_inode_ = kRtInodeNo;
   std::stringstream ss;
   ss << kRunPrefix << "-" << time(NULL);
@@ -65,6 +76,9 @@ Status IndexFSTest::OpenContext() {
   CreateDirectory(env_, options_->GetDBHomeDir());
   CreateDirectory(env_, options_->GetDBSplitDir());
   index_ctx_ = new IndexContext(env_, options_);
+  if (policy != NULL) {
+    index_ctx_->TEST_SetIndexPolicy(policy);
+  }
   return index_ctx_->Open();
 }
 
@@ -115,6 +129,88 @@ Status IndexFSTest::Setattr(int64_t dir_id,
   return index_ctx_->TEST_Setattr(obj_id, 0, last_stat_);
 }
 
+int IndexFSTest::CountEntries(int64_t dir_id, int16_t index) {
+  int num_entries = 0;
+  DirScanner* ds = index_ctx_->CreateDirScanner(dir_id, index, "");
+  for (; ds->Valid(); ds->Next()) {
+    num_entries++;
+  }
+  delete ds;
+  return num_entries;
+}
+
+bool IndexFSTest::WaitForSplits(int64_t dir_id) {
+  for (int i = 0; i < 1000; ++i) {
+    DirGuard::DirData dir_data = index_ctx_->FetchDir(dir_id);
+    if (DirGuard::Empty(dir_data)) {
+      return false;
+    }
+    DirGuard dir_guard(dir_data);
+    {
+      DirLock lock(&dir_guard);
+      if (!dir_guard.IsSplittingDisabled()) {
+        return true;
+      }
+    }
+    env_->SleepForMicroseconds(10 * 1000);
+  }
+  return false;
+}
+
+namespace {
+struct MknodWorker {
+  int64_t dir_id;
+  IndexServer* idx_srv;
+  int num_errors;
+};
+static
+void* RunMknodWorker(void* arg) {
+  MknodWorker* worker = reinterpret_cast<MknodWorker*>(arg);
+  char buf[64];
+  OID obj_id;
+  obj_id.dir_id = worker->dir_id;
+  obj_id.path_depth = 1;
+  for (int i = 0; i < kNumSplitFiles; ++i) {
+    snprintf(buf, 64, "file_%d", i);
+    obj_id.obj_name = buf;
+    try {
+      worker->idx_srv->Mknod(obj_id, 0);
+    } catch (apache::thrift::TException &tx) {
+      worker->num_errors++;
+    }
+  }
+  return NULL;
+}
+}
+
+namespace {
+static const int kNumStatOps = 20000;
+struct StatWorker {
+  int64_t dir_id;
+  IndexServer* idx_srv;
+  int num_errors;
+};
+static
+void* RunStatWorker(void* arg) {
+  StatWorker* worker = reinterpret_cast<StatWorker*>(arg);
+  char buf[64];
+  OID obj_id;
+  obj_id.dir_id = worker->dir_id;
+  obj_id.path_depth = 1;
+  StatInfo info;
+  for (int i = 0; i < kNumStatOps; ++i) {
+    snprintf(buf, 64, "file_%d", i % kBatchSize);
+    obj_id.obj_name = buf;
+    try {
+      worker->idx_srv->Getattr(info, obj_id);
+    } catch (apache::thrift::TException &tx) {
+      worker->num_errors++;
+    }
+  }
+  return NULL;
+}
+}
+
 // -------------------------------------------------------------
 // Test Cases
 // -------------------------------------------------------------
@@ -199,6 +295,308 @@ TEST(IndexFSTest, ReadDir) {
   ASSERT_EQ(num_names, names.size());
 }
 
+TEST(IndexFSTest, ReaddirScan) {
+  char buf[64];
+  ASSERT_OK(OpenContext());
+  const int64_t parent_id = last_inode_;
+  std::set<std::string> names;
+  for (int i = 0; i < kBatchSize; ++i) {
+    snprintf(buf, 64, "file_%d", i);
+    std::string name = buf;
+    ASSERT_OK(Mknod(parent_id, name));
+    names.insert(name);
+  }
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  std::set<std::string> results;
+  std::string start_hash;
+  int num_pages = 0;
+  while (true) {
+    ScanResult page;
+    idx_srv->ReaddirScan(page, parent_id, 0, start_hash, 10);
+    ASSERT_TRUE(page.entries.size() <= 10);
+    ASSERT_EQ(page.end_partition, 0);
+    num_pages++;
+    results.insert(page.entries.begin(), page.entries.end());
+    if (!page.more_entries) {
+      break;
+    }
+    ASSERT_TRUE(!page.end_key.empty());
+    start_hash = page.end_key;
+  }
+  ASSERT_TRUE(num_pages >= kBatchSize / 10);
+  ASSERT_TRUE(results == names);
+  delete idx_srv;
+  delete monitor;
+}
+
+TEST(IndexFSTest, ReaddirPlus) {
+  char buf[64];
+  ASSERT_OK(OpenContext());
+  const int64_t parent_id = last_inode_;
+  std::set<std::string> files;
+  std::set<std::string> dirs;
+  for (int i = 0; i < kBatchSize; ++i) {
+    snprintf(buf, 64, "entry_%d", i);
+    std::string name = buf;
+    if (i % 4 == 0) {
+      ASSERT_OK(Mkdir(parent_id, name));
+      dirs.insert(name);
+    } else {
+      ASSERT_OK(Mknod(parent_id, name));
+      files.insert(name);
+    }
+  }
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  std::set<std::string> file_results;
+  std::set<std::string> dir_results;
+  std::string start_hash;
+  while (true) {
+    ScanPlusResult page;
+    idx_srv->ReaddirPlus(page, parent_id, 0, start_hash, 10);
+    ASSERT_TRUE(page.names.size() <= 10);
+    ASSERT_EQ(page.names.size(), page.entries.size());
+    for (size_t i = 0; i < page.names.size(); ++i) {
+      if (S_ISDIR(page.entries[i].mode)) {
+        dir_results.insert(page.names[i]);
+      } else {
+        file_results.insert(page.names[i]);
+      }
+    }
+    if (!page.more_entries) {
+      break;
+    }
+    start_hash = page.end_key;
+  }
+  ASSERT_TRUE(file_results == files);
+  ASSERT_TRUE(dir_results == dirs);
+  delete idx_srv;
+  delete monitor;
+}
+
+TEST(IndexFSTest, ResolvePrefix) {
+  char buf[64];
+  ASSERT_OK(OpenContext());
+  OID obj_id;
+  obj_id.dir_id = last_inode_;
+  obj_id.path_depth = 1;
+  std::vector<int64_t> inodes;
+  std::vector<std::string> names;
+  for (int i = 0; i < kDepth; ++i) {
+    snprintf(buf, 64, "dir_%d", i);
+    ASSERT_OK(Mkdir(last_inode_, buf));
+    inodes.push_back(last_inode_);
+    if (i == 0) {
+      obj_id.obj_name = buf;
+    } else {
+      names.push_back(buf);
+    }
+  }
+  names.push_back("missing");
+  names.push_back("dir_x");
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  std::vector<LookupInfo> infos;
+  idx_srv->ResolvePrefix(infos, obj_id, names);
+  // Resolution stops right before the missing component
+  ASSERT_EQ(static_cast<int>(infos.size()), kDepth);
+  for (int i = 0; i < kDepth; ++i) {
+    ASSERT_EQ(infos[i].id, inodes[i]);
+    ASSERT_EQ(infos[i].zeroth_server, index_ctx_->GetMyRank());
+    ASSERT_TRUE(infos[i].lease_due > 0);
+  }
+  delete idx_srv;
+  delete monitor;
+}
+
+TEST(IndexFSTest, NegativeLease) {
+  ASSERT_OK(OpenContext());
+  OID obj_id;
+  obj_id.dir_id = last_inode_;
+  obj_id.path_depth = 1;
+  obj_id.obj_name = "missing";
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  const int32_t lease_time = FLAGS_negative_lease_time;
+  FLAGS_negative_lease_time = 0;
+  StatInfo info;
+  int64_t lease_due = -1;
+  try {
+    idx_srv->Getattr(info, obj_id);
+  } catch (FileNotFoundException &nf) {
+    lease_due = nf.lease_due;
+  }
+  ASSERT_EQ(lease_due, 0);
+  FLAGS_negative_lease_time = 200 * 1000;
+  lease_due = -1;
+  try {
+    idx_srv->Getattr(info, obj_id);
+  } catch (FileNotFoundException &nf) {
+    lease_due = nf.lease_due;
+  }
+  ASSERT_TRUE(lease_due > static_cast<int64_t>(env_->NowMicros()));
+  LookupInfo lookup_info;
+  int64_t lookup_lease_due = -1;
+  try {
+    idx_srv->Access(lookup_info, obj_id);
+  } catch (FileNotFoundException &nf) {
+    lookup_lease_due = nf.lease_due;
+  }
+  ASSERT_TRUE(lookup_lease_due >= lease_due);
+  // Creating the name has to wait for the negative lease to expire
+  idx_srv->Mknod(obj_id, 0644);
+  ASSERT_TRUE(static_cast<int64_t>(env_->NowMicros()) > lookup_lease_due);
+  idx_srv->Getattr(info, obj_id);
+  ASSERT_TRUE(S_ISREG(info.mode));
+  FLAGS_negative_lease_time = lease_time;
+  delete idx_srv;
+  delete monitor;
+}
+
+namespace {
+// Counts the leases revoked at a client
+class RevocationCounter: public RevocationHandler {
+ public:
+  RevocationCounter() : num_revoked(0), num_negative(0) { }
+  void Revoke(const OID& oid, bool is_negative) {
+    MutexLock lock(&mu);
+    num_revoked++;
+    if (is_negative) {
+      num_negative++;
+    }
+  }
+  Mutex mu;
+  int num_revoked;
+  int num_negative;
+};
+}
+
+TEST(IndexFSTest, LeaseRevocation) {
+  ASSERT_OK(OpenContext());
+  const int64_t parent_id = last_inode_;
+  ASSERT_OK(Mkdir(parent_id, "dir"));
+  FLAGS_lease_callback_ip = "127.0.0.1";
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  RevocationCounter counter;
+  CallbackListener listener(&counter);
+  ASSERT_OK(listener.Start());
+  // Requests are issued as if sent over a loopback connection
+  PeerAddrScope peer(INADDR_LOOPBACK);
+  OID obj_id;
+  obj_id.dir_id = parent_id;
+  obj_id.path_depth = 1;
+  obj_id.obj_name = "dir";
+  obj_id.client_id = listener.GetClientId();
+  LookupInfo info;
+  idx_srv->Access(info, obj_id);
+  ASSERT_TRUE(info.lease_due > static_cast<int64_t>(env_->NowMicros()));
+  // Updates recall leases instead of waiting for them to expire
+  idx_srv->Chmod(obj_id, S_IRWXU);
+  ASSERT_TRUE(static_cast<int64_t>(env_->NowMicros()) < info.lease_due);
+  ASSERT_EQ(counter.num_revoked, 1);
+  // Clients are called back at the address of their requests,
+  // whatever address they claim to listen at
+  int port = static_cast<int>(listener.GetClientId() & 0xffff);
+  obj_id.client_id = EncodeCallbackAddr("192.0.2.1", port);
+  idx_srv->Access(info, obj_id);
+  idx_srv->Chmod(obj_id, S_IRWXU);
+  ASSERT_TRUE(static_cast<int64_t>(env_->NowMicros()) < info.lease_due);
+  ASSERT_EQ(counter.num_revoked, 2);
+  obj_id.client_id = listener.GetClientId();
+  // Leases of clients that cannot be called back are waited out
+  obj_id.client_id = -1;
+  idx_srv->Access(info, obj_id);
+  idx_srv->Chmod(obj_id, S_IRWXU | S_IRWXG);
+  ASSERT_TRUE(static_cast<int64_t>(env_->NowMicros()) > info.lease_due);
+  ASSERT_EQ(counter.num_revoked, 2);
+  // Leases get shorter as updates become as frequent as lookups
+  idx_srv->Access(info, obj_id);
+  ASSERT_TRUE(info.lease_due <
+      static_cast<int64_t>(env_->NowMicros()) + FLAGS_lease_time);
+  // Negative leases are recalled as well
+  obj_id.obj_name = "missing";
+  obj_id.client_id = listener.GetClientId();
+  StatInfo stat;
+  int64_t lease_due = 0;
+  try {
+    idx_srv->Getattr(stat, obj_id);
+  } catch (FileNotFoundException &nf) {
+    lease_due = nf.lease_due;
+  }
+  ASSERT_TRUE(lease_due > static_cast<int64_t>(env_->NowMicros()));
+  OID creator_id = obj_id;
+  creator_id.client_id = -1;
+  idx_srv->Mknod(creator_id, 0644);
+  ASSERT_TRUE(static_cast<int64_t>(env_->NowMicros()) < lease_due);
+  ASSERT_EQ(counter.num_negative, 1);
+  // The negative lease of the creating client is neither recalled
+  // nor waited out
+  obj_id.obj_name = "missing_too";
+  try {
+    idx_srv->Getattr(stat, obj_id);
+  } catch (FileNotFoundException &nf) {
+    lease_due = nf.lease_due;
+  }
+  ASSERT_TRUE(lease_due > static_cast<int64_t>(env_->NowMicros()));
+  idx_srv->Mknod(obj_id, 0644);
+  ASSERT_TRUE(static_cast<int64_t>(env_->NowMicros()) < lease_due);
+  ASSERT_EQ(counter.num_negative, 1);
+  listener.Stop();
+  delete idx_srv;
+  delete monitor;
+}
+
+// Holders are called back all at once, and for
+// no longer than their leases would last.
+//
+TEST(IndexFSTest, ParallelRevocation) {
+  FLAGS_lease_callback_ip = "127.0.0.1";
+  const int timeout = FLAGS_lease_callback_timeout;
+  FLAGS_lease_callback_timeout = 1000 * 1000;
+  RevocationCounter counter;
+  CallbackListener listener(&counter);
+  ASSERT_OK(listener.Start());
+  // A client that accepts connections but never replies
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_TRUE(fd >= 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  ASSERT_EQ(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len), 0);
+  ASSERT_EQ(listen(fd, 16), 0);
+  ASSERT_EQ(getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len), 0);
+  std::vector<int64_t> holders;
+  for (int i = 0; i < 4; ++i) {
+    holders.push_back(EncodeCallbackAddr("127.0.0.1", ntohs(addr.sin_port)));
+  }
+  holders.push_back(listener.GetClientId());
+  CallbackRevoker revoker;
+  OID obj_id;
+  obj_id.dir_id = 0;
+  obj_id.path_depth = 1;
+  obj_id.obj_name = "file";
+  std::vector<int64_t> acked;
+  uint64_t start = env_->NowMicros();
+  revoker.Revoke(obj_id, false, holders, 50 * 1000, &acked);
+  uint64_t micros = env_->NowMicros() - start;
+  ASSERT_TRUE(micros < 500 * 1000);
+  ASSERT_EQ(acked.size(), 1);
+  ASSERT_EQ(acked[0], listener.GetClientId());
+  ASSERT_EQ(counter.num_revoked, 1);
+  // Connections are reused
+  acked.clear();
+  revoker.Revoke(obj_id, true, holders, 50 * 1000, &acked);
+  ASSERT_EQ(acked.size(), 1);
+  ASSERT_EQ(counter.num_negative, 1);
+  close(fd);
+  listener.Stop();
+  FLAGS_lease_callback_timeout = timeout;
+}
+
 TEST(IndexFSTest, BulkInsert) {
   char buf[64];
   ASSERT_OK(OpenContext());
@@ -255,6 +653,332 @@ TEST(IndexFSTest, BulkInsertExists) {
   delete dir_idx;
 }
 
+TEST(IndexFSTest, ParallelSplits) {
+  setenv("FS_DIR_SPLIT_THR", "128", 1);
+  // Use virtual servers so that a single server can split its directories
+  DirIndexPolicy* policy = DirIndexPolicy::TEST_NewPolicy(1, 64);
+  ASSERT_OK(OpenContext(policy));
+  const int64_t parent_id = last_inode_;
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  char buf[64];
+  MknodWorker workers[kNumSplitDirs];
+  pthread_t threads[kNumSplitDirs];
+  for (int i = 0; i < kNumSplitDirs; ++i) {
+    snprintf(buf, 64, "dir_%d", i);
+    ASSERT_OK(Mkdir(parent_id, buf));
+    workers[i].dir_id = last_inode_;
+    workers[i].idx_srv = idx_srv;
+    workers[i].num_errors = 0;
+  }
+  for (int i = 0; i < kNumSplitDirs; ++i) {
+    ASSERT_EQ(pthread_create(&threads[i],
+        NULL, RunMknodWorker, &workers[i]), 0);
+  }
+  for (int i = 0; i < kNumSplitDirs; ++i) {
+    ASSERT_EQ(pthread_join(threads[i], NULL), 0);
+    ASSERT_EQ(workers[i].num_errors, 0);
+  }
+  for (int i = 0; i < kNumSplitDirs; ++i) {
+    const int64_t dir_id = workers[i].dir_id;
+    ASSERT_TRUE(WaitForSplits(dir_id));
+    DirGuard::DirData dir_data = index_ctx_->FetchDir(dir_id);
+    ASSERT_TRUE(!DirGuard::Empty(dir_data));
+    DirGuard dir_guard(dir_data);
+    DirLock lock(&dir_guard);
+    ASSERT_EQ(dir_guard.GetTotalPartitionSize(), kNumSplitFiles);
+    int num_partitions = 0;
+    const DirIndex* dir_idx = dir_guard.FetchDirIndex();
+    for (int idx = 0; idx < (1 << dir_idx->FetchBitmapRadix()); ++idx) {
+      if (dir_idx->GetBit(idx)) {
+        num_partitions++;
+        ASSERT_TRUE(dir_guard.HasPartitionData(idx));
+        ASSERT_EQ(dir_guard.GetPartitionSize(idx), CountEntries(dir_id, idx));
+      }
+    }
+    ASSERT_TRUE(num_partitions > 1);
+  }
+  delete idx_srv;
+  delete monitor;
+  unsetenv("FS_DIR_SPLIT_THR");
+}
+
+// Partition sizes must be recovered from disk after a restart.
+//
+TEST(IndexFSTest, PartitionSizeRestart) {
+  setenv("FS_DIR_SPLIT_THR", "128", 1);
+  DirIndexPolicy* policy = DirIndexPolicy::TEST_NewPolicy(1, 64);
+  ASSERT_OK(OpenContext(policy));
+  const int64_t parent_id = last_inode_;
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  ASSERT_OK(Mkdir(parent_id, "dir"));
+  MknodWorker worker;
+  worker.dir_id = last_inode_;
+  worker.idx_srv = idx_srv;
+  worker.num_errors = 0;
+  RunMknodWorker(&worker);
+  ASSERT_EQ(worker.num_errors, 0);
+  ASSERT_TRUE(WaitForSplits(worker.dir_id));
+  delete idx_srv;
+  delete monitor;
+  delete index_ctx_;
+  index_ctx_ = new IndexContext(env_, options_);
+  index_ctx_->TEST_SetIndexPolicy(policy);
+  ASSERT_OK(index_ctx_->Open());
+  DirGuard::DirData dir_data = index_ctx_->FetchDir(worker.dir_id);
+  ASSERT_TRUE(!DirGuard::Empty(dir_data));
+  DirGuard dir_guard(dir_data);
+  DirLock lock(&dir_guard);
+  ASSERT_EQ(dir_guard.GetTotalPartitionSize(), kNumSplitFiles);
+  const DirIndex* dir_idx = dir_guard.FetchDirIndex();
+  for (int idx = 0; idx < (1 << dir_idx->FetchBitmapRadix()); ++idx) {
+    if (dir_idx->GetBit(idx)) {
+      ASSERT_TRUE(dir_guard.HasPartitionData(idx));
+      ASSERT_EQ(dir_guard.GetPartitionSize(idx), CountEntries(worker.dir_id, idx));
+    }
+  }
+  unsetenv("FS_DIR_SPLIT_THR");
+}
+
+// Failed splits must leave nothing behind in the new partition
+// and must not keep the directory from being split later.
+//
+TEST(IndexFSTest, SplitFailure) {
+  setenv("FS_DIR_SPLIT_THR", "128", 1);
+  DirIndexPolicy* policy = DirIndexPolicy::TEST_NewPolicy(1, 64);
+  ASSERT_OK(OpenContext(policy));
+  const int64_t parent_id = last_inode_;
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  idx_srv->TEST_SetSplitError(Status::IOError("Injected failure"));
+  ASSERT_OK(Mkdir(parent_id, "dir"));
+  MknodWorker worker;
+  worker.dir_id = last_inode_;
+  worker.idx_srv = idx_srv;
+  worker.num_errors = 0;
+  RunMknodWorker(&worker);
+  ASSERT_EQ(worker.num_errors, 0);
+  ASSERT_TRUE(WaitForSplits(worker.dir_id));
+  DirGuard::DirData dir_data = index_ctx_->FetchDir(worker.dir_id);
+  ASSERT_TRUE(!DirGuard::Empty(dir_data));
+  DirGuard dir_guard(dir_data);
+  {
+    DirLock lock(&dir_guard);
+    const DirIndex* dir_idx = dir_guard.FetchDirIndex();
+    ASSERT_EQ(dir_idx->FetchBitmapRadix(), 0);
+    ASSERT_EQ(dir_guard.GetPartitionSize(0), kNumSplitFiles);
+    ASSERT_EQ(CountEntries(worker.dir_id, 0), kNumSplitFiles);
+    ASSERT_EQ(CountEntries(worker.dir_id, dir_guard.NextIndex(0)), 0);
+  }
+  idx_srv->TEST_SetSplitError(Status::OK());
+  OID obj_id;
+  obj_id.dir_id = worker.dir_id;
+  obj_id.path_depth = 1;
+  obj_id.obj_name = "file_last";
+  idx_srv->Mknod(obj_id, 0);
+  ASSERT_TRUE(WaitForSplits(worker.dir_id));
+  {
+    DirLock lock(&dir_guard);
+    const DirIndex* dir_idx = dir_guard.FetchDirIndex();
+    ASSERT_TRUE(dir_idx->FetchBitmapRadix() > 0);
+    ASSERT_EQ(dir_guard.GetTotalPartitionSize(), kNumSplitFiles + 1);
+    for (int idx = 0; idx < (1 << dir_idx->FetchBitmapRadix()); ++idx) {
+      if (dir_idx->GetBit(idx)) {
+        ASSERT_EQ(dir_guard.GetPartitionSize(idx),
+                  CountEntries(worker.dir_id, idx));
+      }
+    }
+  }
+  delete idx_srv;
+  delete monitor;
+  unsetenv("FS_DIR_SPLIT_THR");
+}
+
+// Reports single-directory getattr throughput with an increasing
+// number of reader threads, with and without the optimistic read path.
+//
+TEST(IndexFSTest, GetattrThroughput) {
+  char buf[64];
+  ASSERT_OK(OpenContext());
+  const int64_t parent_id = last_inode_;
+  for (int i = 0; i < kBatchSize; ++i) {
+    snprintf(buf, 64, "file_%d", i);
+    ASSERT_OK(Mknod(parent_id, buf));
+  }
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  const bool optimistic = FLAGS_optimistic_getattr;
+  for (int mode = 0; mode < 2; ++mode) {
+    FLAGS_optimistic_getattr = (mode == 0);
+    for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+      StatWorker workers[8];
+      pthread_t threads[8];
+      uint64_t start = env_->NowMicros();
+      for (int i = 0; i < num_threads; ++i) {
+        workers[i].dir_id = parent_id;
+        workers[i].idx_srv = idx_srv;
+        workers[i].num_errors = 0;
+        ASSERT_EQ(pthread_create(&threads[i],
+            NULL, RunStatWorker, &workers[i]), 0);
+      }
+      for (int i = 0; i < num_threads; ++i) {
+        ASSERT_EQ(pthread_join(threads[i], NULL), 0);
+        ASSERT_EQ(workers[i].num_errors, 0);
+      }
+      uint64_t micros = env_->NowMicros() - start;
+      double ops = 1.0 * kNumStatOps * num_threads;
+      fprintf(stderr, "getattr (%s) %d threads: %.0f ops/s\n",
+              FLAGS_optimistic_getattr ? "optimistic" : "locked",
+              num_threads, ops * 1000 * 1000 / (micros > 0 ? micros : 1));
+    }
+  }
+  FLAGS_optimistic_getattr = optimistic;
+  delete idx_srv;
+  delete monitor;
+}
+
+// Servers never wait for a zeroth partition they have not been told
+// about; it is up to clients to retry until the partition shows up.
+//
+TEST(IndexFSTest, LateZeroth) {
+  ASSERT_OK(OpenContext());
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  const int64_t late_dir_id = 1 << 20;
+  std::string dmap_data;
+  bool unknown = false;
+  try {
+    idx_srv->ReadBitmap(dmap_data, late_dir_id);
+  } catch (UnrecognizedDirectoryError &ude) {
+    unknown = true;
+  }
+  ASSERT_TRUE(unknown);
+  idx_srv->CreateZeroth(late_dir_id, 0);
+  idx_srv->ReadBitmap(dmap_data, late_dir_id);
+  ASSERT_TRUE(!dmap_data.empty());
+  delete idx_srv;
+  delete monitor;
+}
+
+// Bulk creations report the outcome of each name, leaving names owned by
+// other servers for the client to resend along with the latest index.
+//
+TEST(IndexFSTest, MknodBulk) {
+  DirIndexPolicy* policy = DirIndexPolicy::TEST_NewPolicy(2, 2);
+  ASSERT_OK(OpenContext(policy));
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  DirIndex* dir_idx = policy->NewDirIndex(kRtInodeNo, 0);
+  dir_idx->SetBit(1);
+  idx_srv->UpdateBitmap(kRtInodeNo, dir_idx->ToSlice().ToString());
+  char buf[64];
+  OIDS obj_ids;
+  obj_ids.dir_id = kRtInodeNo;
+  obj_ids.path_depth = 1;
+  NameList local_names;
+  for (int i = 0; i < kBatchSize; ++i) {
+    snprintf(buf, 64, "file_%d", i);
+    obj_ids.obj_names.push_back(buf);
+    if (dir_idx->SelectServer(buf) == index_ctx_->GetMyRank()) {
+      local_names.push_back(buf);
+    }
+  }
+  ASSERT_TRUE(local_names.size() > 1);
+  ASSERT_TRUE(local_names.size() < obj_ids.obj_names.size());
+  OID obj_id;
+  obj_id.dir_id = kRtInodeNo;
+  obj_id.path_depth = 1;
+  obj_id.obj_name = local_names[0];
+  idx_srv->Mknod(obj_id, S_IRWXU);
+  obj_ids.obj_names.push_back(local_names[1]);
+  MknodBulkResult result;
+  idx_srv->Mknod_Bulk(result, obj_ids, S_IRUSR | S_IWUSR | S_IRGRP);
+  ASSERT_EQ(result.status.size(), obj_ids.obj_names.size());
+  for (int i = 0; i < kBatchSize; ++i) {
+    const std::string& name = obj_ids.obj_names[i];
+    if (dir_idx->SelectServer(name) != index_ctx_->GetMyRank()) {
+      ASSERT_EQ(result.status[i], MknodStatus::REDIRECTED);
+    } else if (name == local_names[0]) {
+      ASSERT_EQ(result.status[i], MknodStatus::ALREADY_EXISTS);
+    } else {
+      ASSERT_EQ(result.status[i], MknodStatus::CREATED);
+      StatInfo stat;
+      obj_id.obj_name = name;
+      idx_srv->Getattr(stat, obj_id);
+      ASSERT_EQ(stat.mode, S_IFREG | S_IRUSR | S_IWUSR | S_IRGRP);
+    }
+  }
+  // A name repeated within a batch is only created once
+  ASSERT_EQ(result.status.back(), MknodStatus::ALREADY_EXISTS);
+  ASSERT_TRUE(!result.dmap_data.empty());
+  DirIndex* srv_idx = policy->RecoverDirIndex(result.dmap_data);
+  ASSERT_TRUE(srv_idx->GetBit(1));
+  delete srv_idx;
+  ASSERT_EQ(CountEntries(kRtInodeNo, 0), static_cast<int>(local_names.size()));
+  ASSERT_EQ(CountEntries(kRtInodeNo, 1), 0);
+  // The index is only returned along with redirected names
+  result = MknodBulkResult();
+  obj_ids.obj_names.assign(1, "file_bulk");
+  while (dir_idx->SelectServer(obj_ids.obj_names[0]) !=
+         index_ctx_->GetMyRank()) {
+    obj_ids.obj_names[0] += "_";
+  }
+  idx_srv->Mknod_Bulk(result, obj_ids, S_IRUSR | S_IWUSR);
+  ASSERT_EQ(result.status.size(), 1);
+  ASSERT_EQ(result.status[0], MknodStatus::CREATED);
+  ASSERT_TRUE(result.dmap_data.empty());
+  delete dir_idx;
+  delete idx_srv;
+  delete monitor;
+}
+
+// Pre-split directories are usable as soon as their entry is visible.
+//
+TEST(IndexFSTest, PresplitMkdir) {
+  ASSERT_OK(OpenContext());
+  Monitor* monitor = CreateMonitorForServer(index_ctx_->GetMyRank());
+  IndexServer* idx_srv = new IndexServer(index_ctx_, monitor, NULL);
+  OID obj_id;
+  obj_id.dir_id = last_inode_;
+  obj_id.path_depth = 1;
+  obj_id.obj_name = "presplit";
+  idx_srv->Mkdir_Presplit(obj_id, S_IRWXU, 0, 0);
+  StatInfo stat;
+  idx_srv->Getattr(stat, obj_id);
+  ASSERT_TRUE(S_ISDIR(stat.mode));
+  OID file_id;
+  file_id.dir_id = stat.id;
+  file_id.path_depth = 2;
+  file_id.obj_name = "file";
+  idx_srv->Mknod(file_id, S_IRWXU);
+  std::vector<int64_t> dir_ids;
+  std::vector<int16_t> zeroth_servers;
+  ASSERT_OK(index_ctx_->ListPendingZeroths(&dir_ids, &zeroth_servers));
+  ASSERT_TRUE(dir_ids.empty());
+  bool exists = false;
+  try {
+    idx_srv->Mkdir_Presplit(obj_id, S_IRWXU, 0, 0);
+  } catch (FileAlreadyExistsException &fae) {
+    exists = true;
+  }
+  ASSERT_TRUE(exists);
+  // Nothing is installed for a name that is already taken
+  int64_t next_inode = index_ctx_->NextInode();
+  std::string dmap_data;
+  bool unknown = false;
+  try {
+    idx_srv->ReadBitmap(dmap_data, next_inode - 1);
+  } catch (UnrecognizedDirectoryError &ude) {
+    unknown = true;
+  }
+  ASSERT_TRUE(unknown);
+  ASSERT_OK(index_ctx_->ListPendingZeroths(&dir_ids, &zeroth_servers));
+  ASSERT_TRUE(dir_ids.empty());
+  delete idx_srv;
+  delete monitor;
+}
+
 } // namespace test
 } // namespace indexfs
 
@@ -2,104 +2,152 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common/logging.h"
+#include "server/fs_driver.h"
+#include "server/index_server.h"
 #include "server/split_thread.h"
 
 namespace indexfs {
 
+DEFINE_int32(split_threads, 2, "Max number of directory splits running concurrently per server");
+
+namespace {
+static void JoinThread(pthread_t tid) {
+  if (pthread_join(tid, NULL) != 0) {
+    perror("Fail to join thread!");
+    abort();
+  }
+}
 static pthread_t CreateThread(void*(*func)(void*), void* arg) {
   pthread_t tid;
-  if (pthread_create(&tid, NULL, func, arg) < 0) {
+  if (pthread_create(&tid, NULL, func, arg) != 0) {
     perror("Fail to create thread!");
     abort();
   }
   return tid;
 }
-
-static void JoinThread(pthread_t tid) {
-  if (pthread_join(tid, NULL) < 0) {
-    perror("Fail to join thread!");
-    abort();
-  }
 }
 
-void PthreadCall(const char* label, int result) {
-  if (result != 0) {
-    fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
-    exit(1);
-  }
+SplitThreadPool::SplitThreadPool(IndexServer* idx_srv,
+        Monitor* monitor, int num_threads) :
+        idx_srv_(idx_srv),
+        monitor_(monitor),
+        num_threads_(num_threads > 0 ? num_threads : 1),
+        cv_(&mu_),
+        started_(false),
+        done_(false),
+        next_seq_(0) {
+  DLOG_ASSERT(idx_srv_ != NULL);
 }
 
-SplitThread::SplitThread(Monitor* monitor) :
-              monitor_(monitor), thread_(0),
-              started_thread_(false), done_(false) {
-  server_ = new MetadataServer();
-  PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-  PthreadCall("cvar_init", pthread_cond_init(&signal_, NULL));
+SplitThreadPool::~SplitThreadPool() {
+  Shutdown();
 }
 
-SplitThread::~SplitThread() {
-  if (!done_) {
-    Stop();
+void SplitThreadPool::Start() {
+  MutexLock lock(&mu_);
+  if (!started_ && !done_) {
+    started_ = true;
+    for (int i = 0; i < num_threads_; ++i) {
+      threads_.push_back(CreateThread(&Run, this));
+    }
   }
-  delete server_;
 }
 
-void SplitThread::Start() {
-  thread_ = CreateThread(&Run, this);
+// Stops all worker threads once their current splits complete.
+// Splits still waiting in the queue are discarded.
+//
+void SplitThreadPool::Shutdown() {
+  {
+    MutexLock lock(&mu_);
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    cv_.SignalAll();
+  }
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    JoinThread(threads_[i]);
+  }
+  threads_.clear();
+  DLOG_IF(WARNING, !queue_.empty()) << "Discarding "
+          << queue_.size() << " pending directory splits";
 }
 
+int SplitThreadPool::QueueDepth() {
+  MutexLock lock(&mu_);
+  return static_cast<int>(queue_.size());
+}
 
-void SplitThread::AddSplitTask(int dir_id, int index) {
-  PthreadCall("lock", pthread_mutex_lock(&mu_));
-
-  // Start background thread if necessary
-  if (!started_thread_) {
-    Start();
+bool SplitThreadPool::AddSplitTask(int64_t dir_id,
+        int16_t index, int partition_size) {
+  MutexLock lock(&mu_);
+  if (done_) {
+    return false;
   }
-
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  bool wakeup = queue_.empty();
-
-  // Add to priority queue
-  queue_.push_back(SplitItem(dir_id, index));
-
-  if (wakeup)
-    PthreadCall("signal", pthread_cond_signal(&signal_));
-
-  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+  SplitKey key(dir_id, index);
+  if (pending_.count(key) != 0) {
+    return false;
+  }
+  SplitItem item;
+  item.dir_id = dir_id;
+  item.index = index;
+  item.partition_size = partition_size;
+  item.seq = next_seq_++;
+  item.submit_time = Env::Default()->NowMicros();
+  pending_.insert(key);
+  queue_.push(item);
+  if (monitor_ != NULL) {
+    monitor_->SetGauge(gSplitQueue, queue_.size());
+  }
+  cv_.Signal();
+  return true;
 }
 
-void SplitThread::ExecuteThread() {
-  started_thread_ = true;
-
-  while (!done_) {
-    // Wait until there is an item that is ready to run
-    PthreadCall("lock", pthread_mutex_lock(&mu_));
-    while (queue_.empty()) {
-      PthreadCall("wait", pthread_cond_wait(&signal_, &mu_));
+void SplitThreadPool::ExecuteThread() {
+  while (true) {
+    SplitItem item;
+    {
+      MutexLock lock(&mu_);
+      while (queue_.empty() && !done_) {
+        cv_.Wait();
+      }
+      if (done_) {
+        break;
+      }
+      item = queue_.top();
+      queue_.pop();
+      pending_.erase(SplitKey(item.dir_id, item.index));
+      if (monitor_ != NULL) {
+        monitor_->SetGauge(gSplitQueue, queue_.size());
+      }
+    }
+    if (monitor_ != NULL) {
+      uint64_t wait_time = Env::Default()->NowMicros() - item.submit_time;
+      monitor_->AddMetric(oSplitWait, static_cast<double>(wait_time));
+    }
+    try {
+      idx_srv_->DoSplit(item.dir_id, item.index);
+    } catch (IOError &io) {
+      LOG(ERROR) << "Fail to split directory [dir=" << item.dir_id << "]"
+              "[index=" << item.index << "]: " << io.message;
+    } catch (ServerInternalError &ie) {
+      LOG(ERROR) << "Fail to split directory [dir=" << item.dir_id << "]"
+              "[index=" << item.index << "]: " << ie.message;
+    } catch (apache::thrift::TException &tx) {
+      LOG(ERROR) << "Fail to split directory [dir=" << item.dir_id << "]"
+              "[index=" << item.index << "]: " << tx.what();
     }
-
-    int dir_id = queue_.front().dir_id;
-    int index = queue_.front().index;
-    queue_.pop_front();
-
-    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
-
-    DirHandle hdir = server_->FetchDir(dir_id);
-    server_->Split(dir_id, index, hdir);
   }
 }
 
-void* SplitThread::Run(void* arg) {
-  SplitThread* split = reinterpret_cast<SplitThread*>(arg);
-  split->ExecuteThread();
+void* SplitThreadPool::Run(void* arg) {
+  SplitThreadPool* pool = reinterpret_cast<SplitThreadPool*>(arg);
+  pool->ExecuteThread();
   return NULL;
 }
 
-void SplitThread::Stop() {
-  done_ = true;
-  JoinThread(thread_);
-}
-
 } // namespace indexfs
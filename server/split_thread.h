@@ -2,49 +2,92 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
-#ifndef SPLIT_THREAD_H_
-#define SPLIT_THREAD_H_
+#ifndef _INDEXFS_SERVER_SPLITTHREAD_H_
+#define _INDEXFS_SERVER_SPLITTHREAD_H_
 
-#include <deque>
+#include <set>
+#include <queue>
+#include <vector>
+#include <pthread.h>
+#include <gflags/gflags.h>
 
-#include "server/server.h"
+#include "common/common.h"
+#include "util/monitor.h"
 
 namespace indexfs {
 
-class SplitThread {
-public:
-  SplitThread(Monitor* monitor);
+DECLARE_int32(split_threads);
 
-  virtual ~SplitThread();
+class IndexServer;
+
+// A fixed-size pool of background threads executing directory splits
+// on behalf of an index server. Pending splits are served in order of
+// partition size, largest first, with ties broken by submission order.
+// A partition can only be queued once at any given time.
+//
+class SplitThreadPool {
+ public:
+
+  SplitThreadPool(IndexServer* idx_srv, Monitor* monitor, int num_threads);
+
+  virtual ~SplitThreadPool();
 
   void Start();
+  void Shutdown();
 
-  void AddSplitTask(int dir_id, int index);
+  // Queue a split for the specified directory partition.
+  // Returns false if that partition is already waiting to be split.
+  //
+  bool AddSplitTask(int64_t dir_id, int16_t index, int partition_size);
 
-  void Stop();
+  // Returns the number of splits waiting to be executed.
+  //
+  int QueueDepth();
 
-private:
-  static void* Run(void* arg);
+ private:
+
+  struct SplitItem {
+    int64_t dir_id;
+    int16_t index;
+    int partition_size;
+    uint64_t seq; // submission order
+    uint64_t submit_time; // in micros
+  };
+
+  struct SplitItemOrder {
+    bool operator()(const SplitItem& a, const SplitItem& b) const {
+      if (a.partition_size != b.partition_size) {
+        return a.partition_size < b.partition_size;
+      }
+      return a.seq > b.seq;
+    }
+  };
+
+  typedef std::pair<int64_t, int16_t> SplitKey;
+  typedef std::priority_queue<SplitItem,
+          std::vector<SplitItem>, SplitItemOrder> SplitQueue;
 
   void ExecuteThread();
+  static void* Run(void* arg);
 
-  MetadataServer* server_;
+  IndexServer* idx_srv_;
   Monitor* monitor_;
+  const int num_threads_;
+  std::vector<pthread_t> threads_;
 
-  pthread_mutex_t mu_;
-  pthread_cond_t signal_;
-  pthread_t thread_;
-  bool started_thread_;
+  Mutex mu_;
+  CondVar cv_;
+  bool started_;
   bool done_;
-
-  struct SplitItem {
-    SplitItem(int did, int dindex) : dir_id(did), index(dindex) {}
-    int dir_id, index;
-  };
-  typedef std::deque<SplitItem> SplitQueue;
+  uint64_t next_seq_;
   SplitQueue queue_;
+  std::set<SplitKey> pending_;
+
+  // No copying allowed
+  SplitThreadPool(const SplitThreadPool&);
+  SplitThreadPool& operator=(const SplitThreadPool&);
 };
 
 } // namespace indexfs
 
-#endif /* SPLIT_THREAD_H_ */
+#endif /* _INDEXFS_SERVER_SPLITTHREAD_H_ */
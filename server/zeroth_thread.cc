@@ -0,0 +1,181 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common/logging.h"
+#include "server/fs_driver.h"
+#include "server/zeroth_thread.h"
+
+namespace indexfs {
+
+DEFINE_int32(zeroth_batch_size, 256, "Max number of zeroth partitions installed per batch");
+
+namespace {
+// Delay (in micros) before retrying installations
+static const int kRetryDelay = 10 * 1000;
+static void JoinThread(pthread_t tid) {
+  if (pthread_join(tid, NULL) != 0) {
+    perror("Fail to join thread!");
+    abort();
+  }
+}
+static pthread_t CreateThread(void*(*func)(void*), void* arg) {
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, func, arg) != 0) {
+    perror("Fail to create thread!");
+    abort();
+  }
+  return tid;
+}
+}
+
+ZerothThread::ZerothThread(IndexContext* ctx, RPC* rpc, Monitor* monitor) :
+        ctx_(ctx),
+        rpc_(rpc),
+        monitor_(monitor),
+        cv_(&mu_),
+        started_(false),
+        done_(false) {
+}
+
+ZerothThread::~ZerothThread() {
+  Shutdown();
+}
+
+void ZerothThread::Start() {
+  MutexLock lock(&mu_);
+  if (!started_ && !done_) {
+    started_ = true;
+    thread_ = CreateThread(&Run, this);
+  }
+}
+
+// Stops the background thread after a last attempt to install all
+// partitions still waiting in the queue. Partitions still not installed
+// remain recorded as pending and are resumed after the next restart.
+//
+void ZerothThread::Shutdown() {
+  bool started;
+  {
+    MutexLock lock(&mu_);
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    started = started_;
+    cv_.SignalAll();
+  }
+  if (started) {
+    JoinThread(thread_);
+  }
+}
+
+int ZerothThread::QueueDepth() {
+  MutexLock lock(&mu_);
+  return static_cast<int>(queue_.size());
+}
+
+void ZerothThread::AddZerothTask(int srv_id,
+        int64_t dir_id, int16_t zeroth_server, bool resumed) {
+  DLOG_ASSERT(rpc_ != NULL);
+  ZerothItem item;
+  item.srv_id = srv_id;
+  item.dir_id = dir_id;
+  item.zeroth_server = zeroth_server;
+  item.num_retries = resumed ? 1 : 0;
+  MutexLock lock(&mu_);
+  queue_.push_back(item);
+  if (monitor_ != NULL) {
+    monitor_->SetGauge(gZerothQueue, queue_.size());
+  }
+  cv_.Signal();
+}
+
+// Removes the pending record of an installed partition.
+//
+void ZerothThread::Complete(const ZerothItem& item) {
+  if (ctx_ != NULL) {
+    Status s = ctx_->RemovePendingZeroth(item.dir_id);
+    LOG_IF(WARNING, !s.ok()) << "Fail to remove pending zeroth partition "
+            "[dir=" << item.dir_id << "]: " << s.ToString();
+  }
+}
+
+// Sends a batch of partitions. Partitions that may not have reached their
+// server are left in the batch for another attempt. Partitions failing
+// for other reasons are left pending until the next restart.
+//
+void ZerothThread::SendBatch(std::deque<ZerothItem>* batch) {
+  std::vector<int> srv_ids;
+  std::vector<int64_t> dir_ids;
+  std::vector<int16_t> zeroth_servers;
+  for (size_t i = 0; i < batch->size(); ++i) {
+    srv_ids.push_back((*batch)[i].srv_id);
+    dir_ids.push_back((*batch)[i].dir_id);
+    zeroth_servers.push_back((*batch)[i].zeroth_server);
+  }
+  std::vector<Status> results;
+  rpc_->MulticastZeroths(srv_ids, dir_ids, zeroth_servers, &results);
+  std::deque<ZerothItem> retries;
+  for (size_t i = 0; i < batch->size(); ++i) {
+    ZerothItem& item = (*batch)[i];
+    const Status& s = results[i];
+    // Installations may be retried after their first reply was lost
+    if (s.ok() || (s.IsAlreadyExists() && item.num_retries > 0)) {
+      Complete(item);
+      continue;
+    }
+    if (s.IsIOError()) {
+      item.num_retries++;
+      retries.push_back(item);
+    } else {
+      LOG(ERROR) << "Fail to install zeroth partition [dir=" << item.dir_id
+              << "][server=" << item.srv_id << "]: " << s.ToString();
+    }
+  }
+  batch->swap(retries);
+}
+
+void ZerothThread::ExecuteThread() {
+  std::deque<ZerothItem> batch;
+  while (true) {
+    bool done;
+    {
+      MutexLock lock(&mu_);
+      while (queue_.empty() && batch.empty() && !done_) {
+        cv_.Wait();
+      }
+      done = done_;
+      while (!queue_.empty() && (done ||
+             batch.size() < static_cast<size_t>(FLAGS_zeroth_batch_size))) {
+        batch.push_back(queue_.front());
+        queue_.pop_front();
+      }
+      if (monitor_ != NULL) {
+        monitor_->SetGauge(gZerothQueue, queue_.size());
+      }
+    }
+    if (!batch.empty()) {
+      SendBatch(&batch);
+      if (!batch.empty() && !done) {
+        Env::Default()->SleepForMicroseconds(kRetryDelay);
+      }
+    }
+    if (done) {
+      LOG_IF(WARNING, !batch.empty()) << "Leaving " << batch.size()
+              << " pending zeroth partitions to the next restart";
+      break;
+    }
+  }
+}
+
+void* ZerothThread::Run(void* arg) {
+  ZerothThread* thread = reinterpret_cast<ZerothThread*>(arg);
+  thread->ExecuteThread();
+  return NULL;
+}
+
+} // namespace indexfs
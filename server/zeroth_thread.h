@@ -0,0 +1,81 @@
+// Copyright (c) 2014 The IndexFS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef _INDEXFS_SERVER_ZEROTHTHREAD_H_
+#define _INDEXFS_SERVER_ZEROTHTHREAD_H_
+
+#include <deque>
+#include <pthread.h>
+#include <gflags/gflags.h>
+
+#include "ipc/rpc.h"
+#include "common/common.h"
+#include "util/monitor.h"
+#include "server/index_ctx.h"
+
+namespace indexfs {
+
+DECLARE_int32(zeroth_batch_size);
+
+// A background thread installing the zeroth partitions of new directories
+// on their home servers. Partitions queued while a batch is in flight are
+// sent together in the next batch, with requests to all servers pipelined.
+// Installations failing due to unreachable servers are retried until they
+// succeed. Queued partitions are expected to be recorded as pending in the
+// metadata DB, and their records are removed once they are installed.
+//
+class ZerothThread {
+ public:
+
+  ZerothThread(IndexContext* ctx, RPC* rpc, Monitor* monitor);
+
+  virtual ~ZerothThread();
+
+  void Start();
+  void Shutdown();
+
+  // Queue the zeroth partition of a new directory for installation
+  // on the specified server. Partitions resumed after a restart may
+  // have been installed before that restart.
+  //
+  void AddZerothTask(int srv_id, int64_t dir_id, int16_t zeroth_server,
+                     bool resumed = false);
+
+  // Returns the number of partitions waiting to be installed.
+  //
+  int QueueDepth();
+
+ private:
+
+  struct ZerothItem {
+    int srv_id;
+    int64_t dir_id;
+    int16_t zeroth_server;
+    int num_retries;
+  };
+
+  void ExecuteThread();
+  void SendBatch(std::deque<ZerothItem>* batch);
+  void Complete(const ZerothItem& item);
+  static void* Run(void* arg);
+
+  IndexContext* ctx_;
+  RPC* rpc_;
+  Monitor* monitor_;
+  pthread_t thread_;
+
+  Mutex mu_;
+  CondVar cv_;
+  bool started_;
+  bool done_;
+  std::deque<ZerothItem> queue_;
+
+  // No copying allowed
+  ZerothThread(const ZerothThread&);
+  ZerothThread& operator=(const ZerothThread&);
+};
+
+} // namespace indexfs
+
+#endif /* _INDEXFS_SERVER_ZEROTHTHREAD_H_ */
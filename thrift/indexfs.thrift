@@ -16,12 +16,17 @@ struct OID {
   1: required i16 path_depth
   2: required i64 dir_id
   3: required string obj_name
+  // Identifies the client to call back when leases granted on this
+  // object are revoked, or -1 if the client cannot be called back
+  4: i64 client_id = -1
 }
 
 struct OIDS {
   1: required i16 path_depth
   2: required i64 dir_id
   3: required list<string> obj_names
+  // Identifies the client creating these objects, see OID
+  4: i64 client_id = -1
 }
 
 struct StatInfo {
@@ -67,6 +72,18 @@ struct ScanPlusResult {
   6: required string dmap_data
 }
 
+// Per-name outcomes of a bulk file creation
+enum MknodStatus {
+  CREATED = 0,
+  ALREADY_EXISTS = 1,
+  REDIRECTED = 2
+}
+
+struct MknodBulkResult {
+  1: required list<i16> status
+  2: required string dmap_data
+}
+
 struct OpenResult {
   1: required bool is_embedded
   2: required string data
@@ -95,7 +112,8 @@ struct WriteResult {
 // ---------------------------------------------------------------
 
 exception FileNotFoundException {
-  // NO additional payload needed
+  // Lease (if any) under which clients may cache the absence of the name
+  1: required i64 lease_due
 }
 
 exception FileAlreadyExistsException {
@@ -171,6 +189,14 @@ LookupInfo Renew(1: OID obj_id)
           5: IOError io_error,
           6: ServerInternalError srv_error)
 
+list<LookupInfo> ResolvePrefix(1: OID obj_id, 2: list<string> names)
+  throws (1: UnrecognizedDirectoryError unknown_dir,
+          2: ServerRedirectionException srv_redirect,
+          3: FileNotFoundException not_found,
+          4: DirectoryExpectedError not_a_dir,
+          5: IOError io_error,
+          6: ServerInternalError srv_error)
+
 StatInfo Getattr(1: OID obj_id)
   throws (1: UnrecognizedDirectoryError unknown_dir,
           2: ServerRedirectionException srv_redirect,
@@ -185,12 +211,10 @@ void Mknod(1: OID obj_id, 2: i16 perm)
           4: IOError io_error,
           5: ServerInternalError srv_error)
 
-void Mknod_Bulk(1: OIDS obj_ids, 2: i16 perm)
+MknodBulkResult Mknod_Bulk(1: OIDS obj_ids, 2: i16 perm)
   throws (1: UnrecognizedDirectoryError unknown_dir,
-          2: ServerRedirectionException srv_redirect,
-          3: FileAlreadyExistsException file_exists,
-          4: IOError io_error,
-          5: ServerInternalError srv_error)
+          2: IOError io_error,
+          3: ServerInternalError srv_error)
 
 void Mkdir(1: OID obj_id, 2: i16 perm, 3: i16 hint_server1, 4: i16 hint_server2)
   throws (1: UnrecognizedDirectoryError unknown_dir,
@@ -231,6 +255,18 @@ EntryList Readdir(1: i64 dir_id, 2: i16 index)
           2: IOError io_error,
           3: ServerInternalError srv_error)
 
+ScanResult ReaddirScan(1: i64 dir_id, 2: i16 index,
+                       3: string start_hash, 4: i32 max_entries)
+  throws (1: UnrecognizedDirectoryError unknown_dir,
+          2: IOError io_error,
+          3: ServerInternalError srv_error)
+
+ScanPlusResult ReaddirPlus(1: i64 dir_id, 2: i16 index,
+                           3: string start_hash, 4: i32 max_entries)
+  throws (1: UnrecognizedDirectoryError unknown_dir,
+          2: IOError io_error,
+          3: ServerInternalError srv_error)
+
 string ReadBitmap(1: i64 dir_id)
   throws (1: UnrecognizedDirectoryError unknown_dir,
           2: IOError io_error,
@@ -249,4 +285,15 @@ void InsertSplit(1: i64 dir_id, 2: i16 parent_index, 3: i16 child_index,
           3: IOError io_error,
           4: ServerInternalError srv_error)
 
+void PreloadSplit(1: i64 dir_id, 2: i16 child_index,
+                  3: string path_split_files,
+                  4: i64 min_seq, 5: i64 max_seq, 6: i64 num_entries)
+  throws (1: IOError io_error,
+          2: ServerInternalError srv_error)
+
+void DiscardSplit(1: i64 dir_id, 2: i16 child_index)
+  throws (1: FileAlreadyExistsException file_exists,
+          2: IOError io_error,
+          3: ServerInternalError srv_error)
+
 }
@@ -8,6 +8,8 @@
 #include "leveldb/db.h"
 namespace indexfs {
 using leveldb::DB;
+using leveldb::Snapshot;
+using leveldb::PinnedValue;
 using leveldb::RepairDB;
 }
 #include "util/leveldb_io.h"
@@ -10,6 +10,8 @@ Monitor::~Monitor() {
   delete [] metric_cts_;
   delete [] metric_data_;
   delete [] metric_names_;
+  delete [] gauge_values_;
+  delete [] gauge_names_;
 }
 
 Monitor::Monitor(const char* (*metrics),
@@ -19,7 +21,10 @@ Monitor::Monitor(const char* (*metrics),
         server_id_(server_id),
         num_metrics_(num_metrics + 1),
         window_size_(window_size),
-        window_start_(0) {
+        window_start_(0),
+        num_gauges_(0),
+        gauge_values_(NULL),
+        gauge_names_(NULL) {
   metric_names_ = new std::string[num_metrics_];
   for (int i = 0; i < num_metrics; ++i) {
     metric_names_[i] = metrics[i];
@@ -30,6 +35,17 @@ Monitor::Monitor(const char* (*metrics),
   memset(metric_cts_, 0, sizeof(long) * num_metrics_);
 }
 
+void Monitor::RegisterGauges(const char* (*gauges), int num_gauges) {
+  DLOG_ASSERT(gauge_values_ == NULL);
+  num_gauges_ = num_gauges;
+  gauge_names_ = new std::string[num_gauges_];
+  for (int i = 0; i < num_gauges; ++i) {
+    gauge_names_[i] = gauges[i];
+  }
+  gauge_values_ = new long[num_gauges_];
+  memset(gauge_values_, 0, sizeof(long) * num_gauges_);
+}
+
 // Send to TSDB the current performance monitoring status,
 // which includes the total accumulating counts for each metric (file system
 // operation) measured so far,
@@ -54,6 +70,12 @@ void Monitor::GetCurrentStatus(std::stringstream *report) {
             << metric_data_[i].Average() << ' '
             << "rank=" << server_id_  << '\n';
   }
+  for (int i = 0; i < num_gauges_; ++i) {
+    *report << gauge_names_[i] << ' '
+            << now << ' '
+            << gauge_values_[i] << ' '
+            << "rank=" << server_id_  << '\n';
+  }
   // Resets all latency data if we reach the end of the current monitoring
   // window. For this to work nicely, the frequency of the monitoring
   // thread calling this method should be set to a value that can evenly
@@ -39,7 +39,15 @@ class Monitor {
   double TEST_GetMaxLatency(int metric_index) {
     return metric_data_[metric_index].Max();
   }
+  long TEST_GetGauge(int gauge_index) {
+    return gauge_values_[gauge_index];
+  }
+
+  // Register a set of gauges, such as queue depths, whose latest
+  // values will be reported along with the regular metrics.
+  void RegisterGauges(const char* (*gauges), int num_gauges);
 
+  void SetGauge(int gauge_index, long value);
   void AddMetric(int metric_index, double latency);
   void GetCurrentStatus(std::stringstream *report);
 
@@ -58,8 +66,19 @@ class Monitor {
   long* metric_cts_;
   Histogram* metric_data_;
   std::string* metric_names_;
+
+  int num_gauges_;
+  long* gauge_values_;
+  std::string* gauge_names_;
 };
 
+inline void Monitor::SetGauge(int gauge_index, long value) {
+  DLOG_ASSERT(gauge_index >= 0);
+  DLOG_ASSERT(gauge_index < num_gauges_);
+
+  gauge_values_[gauge_index] = value;
+}
+
 inline void Monitor::MaybeClearData(time_t now) {
   if (now - window_start_ >= window_size_) {
     for (int i = 0; i < num_metrics_; ++i) {
@@ -13,6 +13,10 @@ enum {
   op1, op2, kNumOps
 };
 static const char* kOpNames[kNumOps] = { "op_1", "op_2" };
+enum {
+  gauge1, kNumGauges
+};
+static const char* kGaugeNames[kNumGauges] = { "gauge_1" };
 struct MonitorTest {
   Monitor monitor_;
   MonitorTest() : monitor_(kOpNames, kNumOps, kRank, 0) { }
@@ -51,6 +55,18 @@ TEST(MonitorTest, Window) {
   ASSERT_EQ(200, monitor_.TEST_GetMaxLatency(op2));
 }
 
+TEST(MonitorTest, Gauges) {
+  monitor_.RegisterGauges(kGaugeNames, kNumGauges);
+  ASSERT_EQ(0, monitor_.TEST_GetGauge(gauge1));
+  monitor_.SetGauge(gauge1, 16);
+  monitor_.SetGauge(gauge1, 8);
+  ASSERT_EQ(8, monitor_.TEST_GetGauge(gauge1));
+  ASSERT_EQ(0, monitor_.TEST_GetTotalCount());
+  std::stringstream ss;
+  monitor_.GetCurrentStatus(&ss);
+  ASSERT_TRUE(ss.str().find("gauge_1") != std::string::npos);
+}
+
 TEST(MonitorTest, StatusReport) {
   monitor_.AddMetric(op1, 100);
   monitor_.AddMetric(op1, 200);